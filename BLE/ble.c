@@ -25,6 +25,7 @@
 #include "blepeer.h"
 #include "central.h"
 #include "gatt.h"
+#include "notificationdelegate.h"
 #include "tk_uuid.h"
 
 #define TAG "BLE"
@@ -305,6 +306,10 @@ void tk_ble_init(void) {
   ble_hs_cfg.sm_their_key_dist =
       BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
 
+  // Metrics
+  blecent_metrics_init();
+  tk_ble_notification_metrics_init();
+
   // Peer storage
   int rc = peer_init(MYNEWT_VAL(BLE_MAX_CONNECTIONS), 64, 64, 64);
   assert(rc == 0);
@@ -23,9 +23,18 @@
 #include "BLE/blepeer.h"
 #include "BLE/notificationdelegate.h"
 #include "BLE/tk_uuid.h"
+#include "diag/metrics.h"
 
 #define TAG "BLE Central"
 
+static tk_metric_t connections_metric = TK_METRIC_COUNTER(
+    "tk_ble_connections_total", "Connections established to sensor peers.");
+static tk_metric_t reconnects_metric =
+    TK_METRIC_COUNTER("tk_ble_reconnects_total",
+                      "Connections established after a disconnection.");
+static tk_metric_t disconnects_metric = TK_METRIC_COUNTER(
+    "tk_ble_disconnects_total", "Disconnections from sensor peers.");
+
 static int blecent_gap_event(struct ble_gap_event *event, void *arg);
 void ble_store_config_init(void);
 
@@ -145,6 +154,15 @@ static void blecent_on_disc_complete(const struct peer *peer, int status,
   blecent_subscribe(peer->conn_handle, NULL);
 }
 
+/**
+ * Registers the central's metrics.
+ */
+void blecent_metrics_init(void) {
+  tk_metrics_register(&connections_metric);
+  tk_metrics_register(&reconnects_metric);
+  tk_metrics_register(&disconnects_metric);
+}
+
 /**
  * Initiates the GAP general discovery procedure.
  */
@@ -300,6 +318,9 @@ static int blecent_gap_event(struct ble_gap_event *event, void *arg) {
     if (event->connect.status == 0) {
       /* Connection successfully established. */
       ESP_LOGI(TAG, "Connection established");
+      tk_metric_inc(&connections_metric);
+      if (disconnects_metric.value > 0)
+        tk_metric_inc(&reconnects_metric);
 
       rc = ble_gap_conn_find(event->connect.conn_handle, &desc);
       assert(rc == 0);
@@ -331,6 +352,7 @@ static int blecent_gap_event(struct ble_gap_event *event, void *arg) {
   case BLE_GAP_EVENT_DISCONNECT:
     /* Connection terminated. */
     ESP_LOGI(TAG, "disconnect; reason=%d", event->disconnect.reason);
+    tk_metric_inc(&disconnects_metric);
     print_conn_desc(&event->disconnect.conn);
 
     /* Forget about peer. */
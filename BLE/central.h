@@ -10,4 +10,5 @@
 
 #pragma once
 
+void blecent_metrics_init(void);
 void blecent_scan(void);
\ No newline at end of file
@@ -15,13 +15,18 @@
 #include "services/gatt/ble_svc_gatt.h"
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 
 #include "esp_ota_ops.h"
 #include "esp_system.h"
 
+#include "OTA/ota.h"
+#include "OTA/pull.h"
 #include "OTA/wifi.h"
 #include "OTA/server.h"
+#include "diag/trace.h"
 #include "model/datastore.h"
 #include "model/nvsettings.h"
 #include "tk_uuid.h"
@@ -31,6 +36,14 @@
 static int tk_gatt_access(uint16_t conn_handle, uint16_t attr_handle,
                           struct ble_gatt_access_ctxt *ctxt, void *arg);
 
+static uint16_t ota_progress_handle;
+
+// Trace dump being read over BLE, see the trace characteristic
+#define TK_GATT_TRACE_CHUNK 480
+static uint8_t *trace_dump = NULL;
+static size_t trace_dump_len = 0;
+static uint32_t trace_offset = 0;
+
 static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
     {
         /*** Service: Device information */
@@ -107,18 +120,35 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
                     /*** Characteristic: Update URL */
                     .uuid = &tk_id_common_ota_ch_update_url.u,
                     .access_cb = tk_gatt_access,
-                    .flags = BLE_GATT_CHR_F_READ,
+                    .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
                 },
                 {
                     /*** Characteristic: Update progress */
                     .uuid = &tk_id_common_ota_ch_progress.u,
                     .access_cb = tk_gatt_access,
+                    .val_handle = &ota_progress_handle,
                     .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
                 },
                 {
                     0, /* No more characteristics in this service. */
                 }},
     },
+    {
+        /*** Service: Diagnostics */
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &tk_id_common_diag.u,
+        .characteristics =
+            (struct ble_gatt_chr_def[]){
+                {
+                    /*** Characteristic: Trace dump */
+                    .uuid = &tk_id_common_diag_ch_trace.u,
+                    .access_cb = tk_gatt_access,
+                    .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+                },
+                {
+                    0, /* No more characteristics in this service. */
+                }},
+    },
     {
         0, /* No more services. */
     },
@@ -281,7 +311,85 @@ static int tk_gatt_access(uint16_t conn_handle, uint16_t attr_handle,
     return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
   }
 
-  
+  // Update URL, writing it starts the download
+  if (ble_uuid_cmp(uuid, &tk_id_common_ota_ch_update_url.u) == 0) {
+    switch (ctxt->op) {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+      rc = os_mbuf_append(ctxt->om, tk_ota_pull_url(),
+                          strlen(tk_ota_pull_url()));
+      return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:;
+
+      char url[TK_OTA_PULL_URL_LEN];
+      uint16_t len;
+      rc = tk_gatt_write(ctxt->om, 1, sizeof url - 1, url, &len);
+      if (rc != 0)
+        return rc;
+
+      return tk_ota_pull_start(url, len) == ESP_OK ? 0 : BLE_ATT_ERR_UNLIKELY;
+
+    default:
+      assert(0);
+      return BLE_ATT_ERR_UNLIKELY;
+    }
+  }
+
+  // Update progress: state, then percentage
+  if (ble_uuid_cmp(uuid, &tk_id_common_ota_ch_progress.u) == 0) {
+    assert(ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR);
+
+    tk_ota_progress_t progress = tk_ota_progress_get();
+    uint8_t value[2] = {progress.state, progress.percent};
+
+    rc = os_mbuf_append(ctxt->om, value, sizeof value);
+
+    return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+  }
+
+  // ---------- Diagnostics ----------
+
+  // Trace dump: write a little endian offset, read up to a chunk from there.
+  // Offset 0 takes a new dump, an offset past the end releases it.
+  if (ble_uuid_cmp(uuid, &tk_id_common_diag_ch_trace.u) == 0) {
+    switch (ctxt->op) {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+      if (trace_dump == NULL || trace_offset >= trace_dump_len)
+        return 0;
+
+      rc = os_mbuf_append(ctxt->om, trace_dump + trace_offset,
+                          MIN(trace_dump_len - trace_offset,
+                              TK_GATT_TRACE_CHUNK));
+      return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:;
+
+      uint8_t offset[4];
+      rc = tk_gatt_write(ctxt->om, sizeof offset, sizeof offset, offset, NULL);
+      if (rc != 0)
+        return rc;
+
+      trace_offset = offset[0] | offset[1] << 8 | offset[2] << 16 |
+                     (uint32_t)offset[3] << 24;
+
+      if (trace_offset == 0) {
+        free(trace_dump);
+        trace_dump = tk_trace_dump(&trace_dump_len);
+        if (trace_dump == NULL)
+          return BLE_ATT_ERR_INSUFFICIENT_RES;
+      } else if (trace_offset >= trace_dump_len) {
+        free(trace_dump);
+        trace_dump = NULL;
+      }
+
+      return 0;
+
+    default:
+      assert(0);
+      return BLE_ATT_ERR_UNLIKELY;
+    }
+  }
+
   // if (ble_uuid_cmp(uuid, &gatt_svr_chr_sec_test_static_uuid.u) == 0) {
   //   switch (ctxt->op) {
   //   case BLE_GATT_ACCESS_OP_READ_CHR:
@@ -333,6 +441,14 @@ void tk_gatt_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
   }
 }
 
+/**
+ * @brief Notifies the subscribed clients of the new progress.
+ *
+ */
+static void tk_gatt_ota_progress_changed(void) {
+  ble_gatts_chr_updated(ota_progress_handle);
+}
+
 /**
  * @brief Initializes the GATT server.
  *
@@ -360,5 +476,7 @@ int tk_gatt_init(void) {
     return rc;
   }
 
+  tk_ota_progress_set_listener(tk_gatt_ota_progress_changed);
+
   return 0;
 }
\ No newline at end of file
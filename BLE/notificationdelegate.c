@@ -9,13 +9,18 @@
  */
 
 #include "BLE/notificationdelegate.h"
-#include "model/datastore.h"
+#include "diag/metrics.h"
+#include "diag/tk_log.h"
+#include "diag/trace.h"
+#include "model/samples.h"
+#include "ui/refresh/refresh.h"
 
 #include <math.h>
 #include <sys/time.h>
 #include <time.h>
 
 #define TAG "GATT notification delegate"
+#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_BLE
 
 // Setting handle to -1 means that it's not subscribed yet.
 tk_ble_notification_identifier_t
@@ -28,6 +33,31 @@ tk_ble_notification_identifier_t
         {-1, &(tk_id_location.u), &(tk_id_location_ch_speed_kph.u)},
         {-1, &(tk_id_engine_temperature.u), &(tk_id_engine_temperature_ch_engine.u)}};
 
+// Notifications received, per characteristic
+static tk_metric_t notification_metrics[] = {
+    TK_METRIC_COUNTER_LABELED("tk_ble_notifications_total",
+                              "GATT notifications received.", "chr=\"rpm\""),
+    TK_METRIC_COUNTER_LABELED("tk_ble_notifications_total",
+                              "GATT notifications received.",
+                              "chr=\"speed_kph\""),
+    TK_METRIC_COUNTER_LABELED("tk_ble_notifications_total",
+                              "GATT notifications received.",
+                              "chr=\"gps_avail\""),
+    TK_METRIC_COUNTER_LABELED("tk_ble_notifications_total",
+                              "GATT notifications received.",
+                              "chr=\"engine_temp\""),
+    TK_METRIC_COUNTER_LABELED("tk_ble_notifications_total",
+                              "GATT notifications received.",
+                              "chr=\"other\"")};
+
+enum {
+  NOTIFICATION_METRIC_RPM,
+  NOTIFICATION_METRIC_SPEED_KPH,
+  NOTIFICATION_METRIC_GPS_AVAIL,
+  NOTIFICATION_METRIC_ENGINE_TEMP,
+  NOTIFICATION_METRIC_OTHER
+};
+
 void tk_ble_rpm_recv(struct os_mbuf *om);
 // void tk_ble_rpm_avail_recv(struct os_mbuf *om);
 void tk_ble_temperature_recv(struct os_mbuf *om);
@@ -52,10 +82,16 @@ static int tk_om_decode(struct os_mbuf *om, uint16_t min_len, uint16_t max_len,
   return 0;
 }
 
+void tk_ble_notification_metrics_init(void) {
+  for (int i = 0;
+       i < sizeof notification_metrics / sizeof notification_metrics[0]; i++)
+    tk_metrics_register(&notification_metrics[i]);
+}
+
 void tk_ble_handle_gatt_notification(uint16_t conn_handle, uint16_t attr_handle,
                                      struct os_mbuf *om) {
 
-  ESP_LOGV(TAG, "Handling conn %d, attr %d.", conn_handle, attr_handle);
+  TK_DLOGV(TAG, "Handling conn %d, attr %d.", conn_handle, attr_handle);
 
   // Find val_handle
   int i = -1;
@@ -72,45 +108,54 @@ void tk_ble_handle_gatt_notification(uint16_t conn_handle, uint16_t attr_handle,
 
   ble_uuid_t *chr_id = interesting_notifications[i].chr_id;
 
+  TK_TRACE_BEGIN(TK_TRACE_BLE_NOTIFY, i);
+
   // Dispatch
   if (ble_uuid_cmp(chr_id, &(tk_id_engine_rpm_ch_rpm.u)) == 0) {
+    tk_metric_inc(&notification_metrics[NOTIFICATION_METRIC_RPM]);
     tk_ble_rpm_recv(om);
   } else if (ble_uuid_cmp(chr_id, &(tk_id_location_ch_speed_kph.u)) == 0) {
+    tk_metric_inc(&notification_metrics[NOTIFICATION_METRIC_SPEED_KPH]);
     tk_ble_gps_speed_kph_recv(om);
   } else if (ble_uuid_cmp(chr_id, &(tk_id_location_ch_gps_avail.u)) == 0) {
+    tk_metric_inc(&notification_metrics[NOTIFICATION_METRIC_GPS_AVAIL]);
     tk_ble_gps_avail_recv(om, conn_handle);
   } else if (ble_uuid_cmp(chr_id, &(tk_id_engine_temperature_ch_engine.u)) == 0) {
+    tk_metric_inc(&notification_metrics[NOTIFICATION_METRIC_ENGINE_TEMP]);
     tk_ble_temperature_recv(om);
+  } else {
+    tk_metric_inc(&notification_metrics[NOTIFICATION_METRIC_OTHER]);
   }
+
+  TK_TRACE_END(TK_TRACE_BLE_NOTIFY, i);
 }
 
 void tk_ble_temperature_recv(struct os_mbuf *om) {
   float temp;
   tk_om_decode(om, sizeof temp, sizeof temp, &temp, NULL);
 
-  global_datastore.engine_data.temp_c = temp;
-  global_datastore.engine_data.temp_c_available = (temp != 0.0/0.0);
+  tk_model_push(TK_MODEL_SAMPLE_ENGINE_TEMP_C, temp);
 
-  ESP_LOGD(TAG, "Temerature received: %.2f.", temp);
+  TK_LOGD(TAG, "Temerature received: %.2f.", temp);
 }
 
 void tk_ble_rpm_recv(struct os_mbuf *om) {
+  // Sent as a double, the model keeps a float
   double rpm;
   tk_om_decode(om, sizeof rpm, sizeof rpm, &rpm, NULL);
 
-  global_datastore.engine_data.rpm_available = (rpm > 0.0);
-  global_datastore.engine_data.rpm = rpm;
+  tk_model_push(TK_MODEL_SAMPLE_ENGINE_RPM, (float)rpm);
 
-  ESP_LOGD(TAG, "RPM received: %.2f.", rpm);
+  TK_LOGD(TAG, "RPM received: %.2f.", rpm);
 }
 
 void tk_ble_gps_speed_kph_recv(struct os_mbuf *om) {
   double speed_kph;
   tk_om_decode(om, sizeof speed_kph, sizeof speed_kph, &speed_kph, NULL);
 
-  global_datastore.location_data.speed = speed_kph;
+  tk_model_push(TK_MODEL_SAMPLE_SPEED_KPH, (float)speed_kph);
 
-  ESP_LOGD(TAG, "Speed received: %.2f km/h.", speed_kph);
+  TK_LOGD(TAG, "Speed received: %.2f km/h.", speed_kph);
 }
 
 int time_received(uint16_t conn_handle, const struct ble_gatt_error *error,
@@ -137,6 +182,7 @@ int time_received(uint16_t conn_handle, const struct ble_gatt_error *error,
 
   setenv("TZ", "CET-1CEST-2,M3.5.0/02:00:00,M10.5.0/03:00:00", 1);
   tzset();
+  tk_refresh_request();
 
   ESP_LOGI(TAG, "Time set.");
 
@@ -144,12 +190,14 @@ int time_received(uint16_t conn_handle, const struct ble_gatt_error *error,
 }
 
 void tk_ble_gps_avail_recv(struct os_mbuf *om, int conn_handle) {
+  // The datastore lags behind, the edge is found here
+  static bool gps_was_avail = false;
+
   bool gps_avail;
   tk_om_decode(om, sizeof gps_avail, sizeof gps_avail, &gps_avail, NULL);
 
   // On rise, update date/time
-  if (gps_avail == true &&
-      global_datastore.gps_status != TK_GPS_STATUS_CONNECTED) {
+  if (gps_avail == true && !gps_was_avail) {
     ESP_LOGI(TAG, "Getting date/time from GPS device.");
 
     int rc =
@@ -161,9 +209,8 @@ void tk_ble_gps_avail_recv(struct os_mbuf *om, int conn_handle) {
     }
   }
 
-  global_datastore.location_data.speed_available = gps_avail;
-  global_datastore.gps_status =
-      gps_avail ? TK_GPS_STATUS_CONNECTED : TK_GPS_STATUS_CONNECTING;
+  gps_was_avail = gps_avail;
+  tk_model_push(TK_MODEL_SAMPLE_GPS_AVAILABLE, gps_avail);
 
-  ESP_LOGD(TAG, "GPS availability received: %d.", gps_avail);
+  TK_DLOGD(TAG, "GPS availability received: %d.", gps_avail);
 }
@@ -27,5 +27,6 @@ typedef struct {
 extern tk_ble_notification_identifier_t
     interesting_notifications[NUM_INTERESTING_NOTIFICATIONS];
 
+void tk_ble_notification_metrics_init(void);
 void tk_ble_handle_gatt_notification(uint16_t conn_handle, uint16_t attr_handle,
                                      struct os_mbuf *om);
@@ -71,6 +71,18 @@ static const ble_uuid128_t tk_id_common_ota_ch_progress =
     BLE_UUID128_INIT(0x05, 0x00, 0x24, 0x5d, 0x00, 0x13, 0xa1, 0x0a, 0x00, 0x24,
                      0x1f, 0x11, 0x12, 0x24, 0xaa, 0x5a);
 
+/* ----- Diagnostics service ----- */
+
+// 5AAA2412-111F-2400-0AA1-13005D250000
+static const ble_uuid128_t tk_id_common_diag =
+    BLE_UUID128_INIT(0x00, 0x00, 0x25, 0x5d, 0x00, 0x13, 0xa1, 0x0a, 0x00, 0x24,
+                     0x1f, 0x11, 0x12, 0x24, 0xaa, 0x5a);
+
+// 5AAA2412-111F-2400-0AA1-13005D250001
+static const ble_uuid128_t tk_id_common_diag_ch_trace =
+    BLE_UUID128_INIT(0x01, 0x00, 0x25, 0x5d, 0x00, 0x13, 0xa1, 0x0a, 0x00, 0x24,
+                     0x1f, 0x11, 0x12, 0x24, 0xaa, 0x5a);
+
 /* ----- Engine RPM service ----- */
 
 // 5AAA2412-111F-2400-0AA1-13025D240000
@@ -0,0 +1,196 @@
+/**
+ * @file assetpack.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Streaming, verified asset image writer.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "OTA/assetpack.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#define TAG "Asset update"
+
+// How long the GUI task may take to let go of the fonts
+#define TK_ASSETPACK_RELEASE_MS 2000
+
+#define TK_ASSETPACK_SECTOR 4096
+
+static esp_err_t tk_assetpack_fail(tk_assetpack_writer_t *writer,
+                                   esp_err_t err) {
+  tk_assetpack_abort(writer);
+  writer->error = err;
+  return err;
+}
+
+/**
+ * @brief Checks the header, then clears the way: fonts released, the
+ * partition erased as far as the image goes.
+ *
+ */
+static esp_err_t tk_assetpack_start(tk_assetpack_writer_t *writer) {
+  const tk_assets_header_t *header = &writer->header;
+
+  if (memcmp(header->magic, TK_ASSETS_MAGIC, sizeof header->magic) != 0 ||
+      header->format != TK_ASSETS_FORMAT) {
+    ESP_LOGE(TAG, "Not a format %d asset image.", TK_ASSETS_FORMAT);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if (header->length != writer->image_len) {
+    ESP_LOGE(TAG, "Image says %u bytes, %d are being sent.", header->length,
+             writer->image_len);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  esp_err_t err = tk_assets_release(TK_ASSETPACK_RELEASE_MS);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Fonts not released: %s.", esp_err_to_name(err));
+    return err;
+  }
+
+  size_t erase_len = (writer->image_len + TK_ASSETPACK_SECTOR - 1) &
+                     ~(TK_ASSETPACK_SECTOR - 1);
+  err = esp_partition_erase_range(writer->partition, 0, erase_len);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Erase failed: %s.", esp_err_to_name(err));
+    return err;
+  }
+
+  writer->started = true;
+  ESP_LOGI(TAG, "Writing image %.*s, %d bytes.", TK_ASSETS_VERSION_LEN,
+           header->version, writer->image_len);
+  return ESP_OK;
+}
+
+esp_err_t tk_assetpack_begin(tk_assetpack_writer_t *writer, size_t image_len) {
+  memset(writer, 0, sizeof(*writer));
+
+#if CONFIG_TK_ASSETS_PARTITION
+  writer->partition =
+      esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                               CONFIG_TK_ASSETS_PARTITION_LABEL);
+#endif
+  if (writer->partition == NULL) {
+    ESP_LOGE(TAG, "No asset partition.");
+    writer->error = ESP_ERR_NOT_SUPPORTED;
+    return writer->error;
+  }
+
+  if (image_len < sizeof(tk_assets_header_t) ||
+      image_len > writer->partition->size) {
+    ESP_LOGE(TAG, "Image is %d bytes, partition is %d bytes.", image_len,
+             writer->partition->size);
+    writer->error = ESP_ERR_INVALID_SIZE;
+    return writer->error;
+  }
+
+  writer->image_len = image_len;
+
+  mbedtls_sha256_init(&writer->sha);
+  mbedtls_sha256_starts_ret(&writer->sha, 0);
+
+  return ESP_OK;
+}
+
+esp_err_t tk_assetpack_write(tk_assetpack_writer_t *writer, const void *data,
+                             size_t len) {
+  const uint8_t *bytes = (const uint8_t *)data;
+
+  if (writer->error != ESP_OK)
+    return writer->error;
+
+  if (writer->received + len > writer->image_len) {
+    ESP_LOGE(TAG, "Received more data than the announced %d bytes.",
+             writer->image_len);
+    return tk_assetpack_fail(writer, ESP_ERR_INVALID_SIZE);
+  }
+
+  // The header is kept aside, written only at the end
+  size_t header_len = sizeof(writer->header);
+  if (writer->received < header_len) {
+    size_t n = header_len - writer->received;
+    if (n > len)
+      n = len;
+
+    memcpy((uint8_t *)&writer->header + writer->received, bytes, n);
+    writer->received += n;
+    bytes += n;
+    len -= n;
+
+    if (writer->received < header_len)
+      return ESP_OK;
+
+    esp_err_t err = tk_assetpack_start(writer);
+    if (err != ESP_OK)
+      return tk_assetpack_fail(writer, err);
+  }
+
+  if (len == 0)
+    return ESP_OK;
+
+  mbedtls_sha256_update_ret(&writer->sha, bytes, len);
+
+  esp_err_t err =
+      esp_partition_write(writer->partition, writer->received, bytes, len);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Write failed at %d: %s.", writer->received,
+             esp_err_to_name(err));
+    return tk_assetpack_fail(writer, err);
+  }
+
+  writer->received += len;
+  return ESP_OK;
+}
+
+esp_err_t tk_assetpack_finish(tk_assetpack_writer_t *writer) {
+  if (writer->error != ESP_OK)
+    return writer->error;
+
+  if (writer->received < writer->image_len) {
+    ESP_LOGE(TAG, "Image truncated: %d of %d bytes.", writer->received,
+             writer->image_len);
+    return tk_assetpack_fail(writer, ESP_ERR_INVALID_SIZE);
+  }
+
+  uint8_t digest[32];
+  mbedtls_sha256_finish_ret(&writer->sha, digest);
+  if (memcmp(digest, writer->header.sha256, sizeof digest) != 0) {
+    ESP_LOGE(TAG, "Image SHA-256 mismatch.");
+    return tk_assetpack_fail(writer, ESP_ERR_INVALID_CRC);
+  }
+
+  // Until here the partition holds no valid image
+  esp_err_t err = esp_partition_write(writer->partition, 0, &writer->header,
+                                      sizeof(writer->header));
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Header write failed: %s.", esp_err_to_name(err));
+    return tk_assetpack_fail(writer, err);
+  }
+
+  mbedtls_sha256_free(&writer->sha);
+  writer->started = false;
+
+  ESP_LOGI(TAG, "Image %.*s written, mapped at the next boot.",
+           TK_ASSETS_VERSION_LEN, writer->header.version);
+  return ESP_OK;
+}
+
+void tk_assetpack_abort(tk_assetpack_writer_t *writer) {
+  if (writer->started) {
+    ESP_LOGW(TAG, "Aborted after %d bytes, the partition has no image.",
+             writer->received);
+    writer->started = false;
+  }
+
+  mbedtls_sha256_free(&writer->sha);
+
+  if (writer->error == ESP_OK)
+    writer->error = ESP_ERR_INVALID_STATE;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file assetpack.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Streaming, verified asset image writer.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ * Writes an image made by tools/pack_assets.py to the asset partition. The
+ * header is checked as soon as it arrives; only then are the fonts released
+ * and the partition erased. The header is written last, once the hash has
+ * been checked, so an interrupted update leaves no image rather than a broken
+ * one, and the fonts fall back until the next complete update.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+
+#include "ui/assets/assets.h"
+
+typedef struct {
+  const esp_partition_t *partition;
+
+  size_t image_len;
+  size_t received;
+
+  // Held until the end, the body is written right away
+  tk_assets_header_t header;
+  bool started;
+
+  mbedtls_sha256_context sha;
+  esp_err_t error;
+} tk_assetpack_writer_t;
+
+/**
+ * @brief Prepares a writer. Nothing is touched until the header is verified.
+ *
+ * @param writer The writer.
+ * @param image_len The image length, which must be known.
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_SUPPORTED if the fonts are linked
+ * into the app, or an error if the image does not fit the partition.
+ */
+esp_err_t tk_assetpack_begin(tk_assetpack_writer_t *writer, size_t image_len);
+
+/**
+ * @brief Feeds a block of the image to the writer. Blocks until the GUI task
+ * has released the fonts, when the header completes.
+ *
+ * @param writer The writer.
+ * @param data The block.
+ * @param len The block length.
+ * @return esp_err_t ESP_OK, or the reason why the image was rejected.
+ */
+esp_err_t tk_assetpack_write(tk_assetpack_writer_t *writer, const void *data,
+                             size_t len);
+
+/**
+ * @brief Checks length and hash, then writes the header. The new image is
+ * mapped at the next boot.
+ *
+ * @param writer The writer.
+ * @return esp_err_t ESP_OK if the image is complete.
+ */
+esp_err_t tk_assetpack_finish(tk_assetpack_writer_t *writer);
+
+/**
+ * @brief Stops the transfer. If writing had started, the partition is left
+ * without an image.
+ *
+ * @param writer The writer.
+ */
+void tk_assetpack_abort(tk_assetpack_writer_t *writer);
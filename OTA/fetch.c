@@ -0,0 +1,163 @@
+/**
+ * @file fetch.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Resumable image download, independent of the HTTP client and of the
+ * flash.
+ * @version 0.1
+ * @date 2021-02-12
+ *
+ *
+ */
+
+#include "fetch.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+
+#define TAG "OTA fetch"
+
+/**
+ * @brief Moves the response body into the image until it ends.
+ *
+ * @param fetch The download.
+ * @param stats The progress, updated.
+ * @return esp_err_t ESP_OK when the whole image has been received.
+ */
+static esp_err_t tk_ota_fetch_stream(const tk_ota_fetch_t *fetch,
+                                     tk_ota_fetch_stats_t *stats) {
+  const tk_ota_transport_t *transport = &fetch->transport;
+  const tk_ota_fetch_image_t *image = &fetch->image;
+
+  for (;;) {
+    size_t capacity;
+    uint8_t *data = image->acquire(image->ctx, &capacity);
+    if (data == NULL)
+      return image->error(image->ctx);
+
+    size_t len = 0;
+    int read_len = 0;
+    while (len < capacity) {
+      read_len = transport->read(transport->ctx, data + len, capacity - len);
+      if (read_len <= 0)
+        break;
+      len += read_len;
+    }
+
+    stats->received += len;
+    image->submit(image->ctx, data, len);
+    if (fetch->progress != NULL)
+      fetch->progress(stats->received, stats->total);
+
+    if (read_len < 0)
+      return ESP_FAIL;
+
+    if (read_len == 0) {
+      // The body ended: complete, or the connection dropped
+      if (transport->complete(transport->ctx) &&
+          (stats->total == 0 || stats->received == stats->total))
+        return ESP_OK;
+
+      return ESP_FAIL;
+    }
+  }
+}
+
+uint32_t tk_ota_fetch_backoff_ms(int attempt) {
+  if (attempt <= 0)
+    return 0;
+
+  // Past 2^4 seconds the shift would only be capped
+  if (attempt > 5)
+    return TK_OTA_FETCH_MAX_BACKOFF_MS;
+
+  uint32_t backoff_ms = 1000u << (attempt - 1);
+  return backoff_ms < TK_OTA_FETCH_MAX_BACKOFF_MS ? backoff_ms
+                                                  : TK_OTA_FETCH_MAX_BACKOFF_MS;
+}
+
+esp_err_t tk_ota_fetch(const tk_ota_fetch_t *fetch,
+                       tk_ota_fetch_stats_t *stats) {
+  const tk_ota_transport_t *transport = &fetch->transport;
+  const tk_ota_fetch_image_t *image = &fetch->image;
+  tk_ota_fetch_stats_t local;
+  bool begun = false;
+  esp_err_t err = ESP_FAIL;
+
+  if (stats == NULL)
+    stats = &local;
+  memset(stats, 0, sizeof(*stats));
+
+  for (int attempt = 0; attempt <= fetch->retries; attempt++) {
+    if (attempt > 0) {
+      uint32_t backoff_ms = tk_ota_fetch_backoff_ms(attempt);
+      ESP_LOGW(TAG, "Attempt %d of %d in %d ms, from byte %d.", attempt + 1,
+               fetch->retries + 1, backoff_ms, stats->received);
+      fetch->delay(backoff_ms);
+    }
+
+    tk_ota_fetch_response_t response;
+    err = transport->open(transport->ctx, stats->received, &response);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Cannot connect: %s.", esp_err_to_name(err));
+      continue;
+    }
+
+    if (response.status == 206 && stats->received > 0 &&
+        response.range_start == (long)stats->received) {
+      ESP_LOGI(TAG, "Resuming from byte %d.", stats->received);
+      stats->resumes++;
+    } else if (response.status == 200) {
+      if (begun) {
+        // The server ignored the range, start over
+        ESP_LOGW(TAG, "Server cannot resume, restarting the image.");
+        image->abort(image->ctx);
+        begun = false;
+        stats->received = 0;
+        stats->restarts++;
+      }
+    } else {
+      ESP_LOGE(TAG, "Server answered %d.", response.status);
+      transport->close(transport->ctx);
+      err = ESP_FAIL;
+
+      // Client errors will not go away by retrying
+      if (response.status >= 400 && response.status < 500)
+        break;
+      continue;
+    }
+
+    if (!begun) {
+      stats->total =
+          response.content_length > 0 ? (size_t)response.content_length : 0;
+      err = image->begin(image->ctx, stats->total);
+      if (err != ESP_OK) {
+        transport->close(transport->ctx);
+        break;
+      }
+      begun = true;
+    }
+
+    err = tk_ota_fetch_stream(fetch, stats);
+    transport->close(transport->ctx);
+
+    // A rejected image is final, network errors are retried
+    esp_err_t image_err = image->error(image->ctx);
+    if (image_err != ESP_OK) {
+      err = image_err;
+      break;
+    }
+
+    if (err == ESP_OK)
+      break;
+  }
+
+  if (begun) {
+    if (err == ESP_OK)
+      err = image->finish(image->ctx);
+    else
+      image->abort(image->ctx);
+  }
+
+  return err;
+}
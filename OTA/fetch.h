@@ -0,0 +1,115 @@
+/**
+ * @file fetch.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Resumable image download, independent of the HTTP client and of the
+ * flash.
+ * @version 0.1
+ * @date 2021-02-12
+ *
+ * After a network error the download is retried with a growing delay, asking
+ * for the rest of the image with a range request. A server that answers the
+ * range with the whole image restarts it, a client error or a rejected image
+ * ends it.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Longest wait between two attempts
+#define TK_OTA_FETCH_MAX_BACKOFF_MS 16000
+
+typedef struct {
+  int status;
+
+  // Body length, negative if unknown
+  int content_length;
+
+  // First byte of a partial response, negative if there was no Content-Range
+  long range_start;
+} tk_ota_fetch_response_t;
+
+/**
+ * @brief One request at a time, over the same connection settings.
+ *
+ */
+typedef struct {
+  // Sends the request, from byte `from` if not 0, and reads the headers
+  esp_err_t (*open)(void *ctx, size_t from, tk_ota_fetch_response_t *response);
+
+  // Bytes read, 0 at the end of the body, negative on error
+  int (*read)(void *ctx, uint8_t *data, size_t len);
+
+  // Whether the whole body announced by the headers has been read
+  bool (*complete)(void *ctx);
+
+  void (*close)(void *ctx);
+  void *ctx;
+} tk_ota_transport_t;
+
+/**
+ * @brief Where the image goes, one buffer at a time.
+ *
+ */
+typedef struct {
+  // Prepares a new image, total is 0 if unknown
+  esp_err_t (*begin)(void *ctx, size_t total);
+
+  // A buffer to fill, NULL once the image has been rejected
+  uint8_t *(*acquire)(void *ctx, size_t *capacity);
+
+  // Hands back the last acquired buffer, even if empty
+  void (*submit)(void *ctx, uint8_t *data, size_t len);
+
+  // Why the image was rejected, ESP_OK if it was not
+  esp_err_t (*error)(void *ctx);
+
+  esp_err_t (*finish)(void *ctx);
+  void (*abort)(void *ctx);
+  void *ctx;
+} tk_ota_fetch_image_t;
+
+typedef struct {
+  tk_ota_transport_t transport;
+  tk_ota_fetch_image_t image;
+
+  // Attempts after the first
+  int retries;
+
+  void (*delay)(uint32_t ms);
+
+  // Optional, called after each buffer
+  void (*progress)(size_t received, size_t total);
+} tk_ota_fetch_t;
+
+typedef struct {
+  size_t received;
+  size_t total;
+
+  // Attempts that continued an image, and that started it over
+  int resumes;
+  int restarts;
+} tk_ota_fetch_stats_t;
+
+/**
+ * @brief The wait before an attempt.
+ *
+ * @param attempt The attempt, 1 for the first retry.
+ * @return uint32_t The wait, doubling from one second up to the maximum.
+ */
+uint32_t tk_ota_fetch_backoff_ms(int attempt);
+
+/**
+ * @brief Downloads the image and finishes it.
+ *
+ * @param fetch The transport, the image and the retry policy.
+ * @param stats What happened, can be NULL.
+ * @return esp_err_t ESP_OK if the image was received and finished.
+ */
+esp_err_t tk_ota_fetch(const tk_ota_fetch_t *fetch,
+                       tk_ota_fetch_stats_t *stats);
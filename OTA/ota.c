@@ -0,0 +1,378 @@
+/**
+ * @file ota.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Streaming, verified OTA image writer.
+ * @version 0.1
+ * @date 2020-11-27
+ *
+ *
+ */
+
+#include "ota.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_idf_version.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "freertos/task.h"
+
+#define TAG "OTA"
+
+/**
+ * @brief Erases the update partition, once the header has been verified.
+ *
+ * @param ctx The writer.
+ * @return esp_err_t The result of esp_ota_begin.
+ */
+static esp_err_t tk_ota_flash_begin(void *ctx) {
+  tk_ota_writer_t *writer = (tk_ota_writer_t *)ctx;
+  size_t image_len = writer->verifier.image_len;
+
+  esp_err_t err =
+      esp_ota_begin(writer->partition,
+                    image_len > 0 ? image_len : OTA_SIZE_UNKNOWN,
+                    &writer->handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Cannot begin OTA: %s.", esp_err_to_name(err));
+    return err;
+  }
+
+  writer->started = true;
+  return ESP_OK;
+}
+
+/**
+ * @brief Writes a verified block to flash.
+ *
+ * @param ctx The writer, already started.
+ * @param data The block.
+ * @param len The block length.
+ * @return esp_err_t The result of the flash write.
+ */
+static esp_err_t tk_ota_flash_write(void *ctx, const uint8_t *data,
+                                    size_t len) {
+  tk_ota_writer_t *writer = (tk_ota_writer_t *)ctx;
+
+  esp_err_t err = esp_ota_write(writer->handle, data, len);
+  if (err != ESP_OK)
+    ESP_LOGE(TAG, "Flash write error: %s.", esp_err_to_name(err));
+
+  return err;
+}
+
+/**
+ * @brief Records an error and aborts the flash write.
+ *
+ * @param writer The writer.
+ * @param err The error.
+ * @return esp_err_t The same error.
+ */
+static esp_err_t tk_ota_fail(tk_ota_writer_t *writer, esp_err_t err) {
+  tk_ota_writer_abort(writer);
+  writer->error = err;
+  return err;
+}
+
+/**
+ * @brief What the image must match, from the running app and the partition.
+ *
+ * @param writer The writer, with its partition.
+ * @param expect The expectations.
+ */
+static void tk_ota_expect_running(const tk_ota_writer_t *writer,
+                                  tk_ota_expect_t *expect) {
+  const esp_app_desc_t *running = esp_ota_get_app_description();
+
+  memset(expect, 0, sizeof(*expect));
+  expect->chip_id = CONFIG_IDF_FIRMWARE_CHIP_ID;
+  strlcpy(expect->project_name, running->project_name,
+          sizeof(expect->project_name));
+  strlcpy(expect->version, running->version, sizeof(expect->version));
+#if CONFIG_TK_OTA_ALLOW_SAME_VERSION
+  expect->allow_same_version = true;
+#endif
+  expect->capacity = writer->partition->size;
+
+  const esp_partition_t *invalid = esp_ota_get_last_invalid_partition();
+  esp_app_desc_t invalid_desc;
+  if (invalid != NULL &&
+      esp_ota_get_partition_description(invalid, &invalid_desc) == ESP_OK)
+    strlcpy(expect->rejected_version, invalid_desc.version,
+            sizeof(expect->rejected_version));
+}
+
+esp_err_t tk_ota_writer_begin(tk_ota_writer_t *writer, size_t image_len) {
+  memset(writer, 0, sizeof(*writer));
+
+  writer->partition = esp_ota_get_next_update_partition(NULL);
+  if (writer->partition == NULL) {
+    ESP_LOGE(TAG, "No update partition available.");
+    writer->error = ESP_ERR_NOT_FOUND;
+    return writer->error;
+  }
+
+  tk_ota_expect_t expect;
+  tk_ota_expect_running(writer, &expect);
+
+  const tk_ota_sink_t sink = {.begin = tk_ota_flash_begin,
+                              .write = tk_ota_flash_write,
+                              .ctx = writer};
+
+  writer->error =
+      tk_ota_verifier_begin(&writer->verifier, &expect, &sink, image_len);
+  return writer->error;
+}
+
+esp_err_t tk_ota_writer_write(tk_ota_writer_t *writer, const void *data,
+                              size_t len) {
+  if (writer->error != ESP_OK)
+    return writer->error;
+
+  esp_err_t err = tk_ota_verifier_write(&writer->verifier, data, len);
+  if (err != ESP_OK)
+    return tk_ota_fail(writer, err);
+
+  return ESP_OK;
+}
+
+esp_err_t tk_ota_writer_finish(tk_ota_writer_t *writer) {
+  esp_err_t err;
+
+  if (writer->error != ESP_OK)
+    return writer->error;
+
+  err = tk_ota_verifier_finish(&writer->verifier);
+  if (err != ESP_OK)
+    return tk_ota_fail(writer, err);
+
+  // Full validation of the segments happens here
+  writer->started = false;
+  err = esp_ota_end(writer->handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "OTA end error: %s.", esp_err_to_name(err));
+    writer->error = err;
+    return err;
+  }
+
+  err = esp_ota_set_boot_partition(writer->partition);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Cannot set boot partition: %s.", esp_err_to_name(err));
+    writer->error = err;
+    return err;
+  }
+
+  ESP_LOGI(TAG, "Next boot partition subtype %d at offset 0x%x.",
+           writer->partition->subtype, writer->partition->address);
+
+  return ESP_OK;
+}
+
+void tk_ota_writer_abort(tk_ota_writer_t *writer) {
+  if (writer->started) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+    esp_ota_abort(writer->handle);
+#else
+    // Releases the handle, the partial image fails validation
+    esp_ota_end(writer->handle);
+#endif
+    writer->started = false;
+    ESP_LOGW(TAG, "Flash write aborted after %d bytes.",
+             writer->verifier.received);
+  }
+
+  tk_ota_verifier_free(&writer->verifier);
+
+  if (writer->error == ESP_OK)
+    writer->error = ESP_ERR_INVALID_STATE;
+}
+
+/**
+ * @brief Writes the blocks to flash as they arrive, until the NULL block.
+ *
+ * @param arg The pipeline.
+ */
+static void tk_ota_pipeline_task(void *arg) {
+  tk_ota_pipeline_t *pipeline = (tk_ota_pipeline_t *)arg;
+  tk_ota_block_t *block;
+
+  for (;;) {
+    xQueueReceive(pipeline->full_queue, &block, portMAX_DELAY);
+    if (block == NULL)
+      break;
+
+    // After an error the blocks are only recycled
+    if (pipeline->error == ESP_OK && block->len > 0) {
+      esp_err_t err =
+          tk_ota_writer_write(&pipeline->writer, block->data, block->len);
+      if (err != ESP_OK)
+        pipeline->error = err;
+    }
+
+    xQueueSend(pipeline->free_queue, &block, portMAX_DELAY);
+  }
+
+  xSemaphoreGive(pipeline->done);
+  vTaskDelete(NULL);
+}
+
+static void tk_ota_pipeline_release(tk_ota_pipeline_t *pipeline) {
+  if (pipeline->free_queue != NULL)
+    vQueueDelete(pipeline->free_queue);
+  if (pipeline->full_queue != NULL)
+    vQueueDelete(pipeline->full_queue);
+  if (pipeline->done != NULL)
+    vSemaphoreDelete(pipeline->done);
+  free(pipeline->storage);
+
+  pipeline->free_queue = NULL;
+  pipeline->full_queue = NULL;
+  pipeline->done = NULL;
+  pipeline->storage = NULL;
+}
+
+/**
+ * @brief Stops the flash task once it has written what it was given.
+ *
+ */
+static void tk_ota_pipeline_drain(tk_ota_pipeline_t *pipeline) {
+  tk_ota_block_t *end = NULL;
+  xQueueSend(pipeline->full_queue, &end, portMAX_DELAY);
+  xSemaphoreTake(pipeline->done, portMAX_DELAY);
+}
+
+esp_err_t tk_ota_pipeline_begin(tk_ota_pipeline_t *pipeline,
+                                size_t image_len) {
+  esp_err_t err = tk_ota_writer_begin(&pipeline->writer, image_len);
+  pipeline->error = err;
+  pipeline->storage = NULL;
+  pipeline->free_queue = NULL;
+  pipeline->full_queue = NULL;
+  pipeline->done = NULL;
+
+  if (err != ESP_OK)
+    return err;
+
+  pipeline->storage =
+      malloc(TK_OTA_PIPELINE_BLOCKS * TK_OTA_PIPELINE_BLOCK_LEN);
+  pipeline->free_queue =
+      xQueueCreate(TK_OTA_PIPELINE_BLOCKS, sizeof(tk_ota_block_t *));
+
+  // One more slot than the blocks, for the end marker
+  pipeline->full_queue =
+      xQueueCreate(TK_OTA_PIPELINE_BLOCKS + 1, sizeof(tk_ota_block_t *));
+  pipeline->done = xSemaphoreCreateBinary();
+
+  if (pipeline->storage == NULL || pipeline->free_queue == NULL ||
+      pipeline->full_queue == NULL || pipeline->done == NULL) {
+    ESP_LOGE(TAG, "Cannot allocate the write pipeline.");
+    tk_ota_pipeline_release(pipeline);
+    pipeline->error = ESP_ERR_NO_MEM;
+    return pipeline->error;
+  }
+
+  for (int i = 0; i < TK_OTA_PIPELINE_BLOCKS; i++) {
+    tk_ota_block_t *block = &pipeline->blocks[i];
+    block->data = pipeline->storage + i * TK_OTA_PIPELINE_BLOCK_LEN;
+    block->len = 0;
+    xQueueSend(pipeline->free_queue, &block, 0);
+  }
+
+  if (xTaskCreate(tk_ota_pipeline_task, "ota_flash", 4096, pipeline,
+                  uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+    ESP_LOGE(TAG, "Cannot start the flash task.");
+    tk_ota_pipeline_release(pipeline);
+    pipeline->error = ESP_ERR_NO_MEM;
+    return pipeline->error;
+  }
+
+  return ESP_OK;
+}
+
+tk_ota_block_t *tk_ota_pipeline_acquire(tk_ota_pipeline_t *pipeline) {
+  tk_ota_block_t *block;
+
+  if (pipeline->error != ESP_OK)
+    return NULL;
+
+  xQueueReceive(pipeline->free_queue, &block, portMAX_DELAY);
+  block->len = 0;
+
+  // The write that just completed may have failed
+  if (pipeline->error != ESP_OK) {
+    xQueueSend(pipeline->free_queue, &block, 0);
+    return NULL;
+  }
+
+  return block;
+}
+
+void tk_ota_pipeline_submit(tk_ota_pipeline_t *pipeline,
+                            tk_ota_block_t *block) {
+  xQueueSend(pipeline->full_queue, &block, portMAX_DELAY);
+}
+
+esp_err_t tk_ota_pipeline_finish(tk_ota_pipeline_t *pipeline) {
+  esp_err_t err = pipeline->error;
+
+  if (pipeline->done == NULL)
+    return err;
+
+  tk_ota_pipeline_drain(pipeline);
+  tk_ota_pipeline_release(pipeline);
+
+  err = pipeline->error;
+  if (err == ESP_OK)
+    err = tk_ota_writer_finish(&pipeline->writer);
+
+  pipeline->error = err;
+  return err;
+}
+
+void tk_ota_pipeline_abort(tk_ota_pipeline_t *pipeline) {
+  if (pipeline->done != NULL) {
+    // Nothing useful is written from now on
+    if (pipeline->error == ESP_OK)
+      pipeline->error = ESP_ERR_INVALID_STATE;
+
+    tk_ota_pipeline_drain(pipeline);
+    tk_ota_pipeline_release(pipeline);
+  }
+
+  tk_ota_writer_abort(&pipeline->writer);
+}
+
+static portMUX_TYPE progress_mux = portMUX_INITIALIZER_UNLOCKED;
+static tk_ota_progress_t progress = {.state = TK_OTA_STATE_IDLE};
+static void (*progress_listener)(void) = NULL;
+
+void tk_ota_progress_update(tk_ota_state_t state, size_t received,
+                            size_t total) {
+  uint8_t percent = 0;
+  if (state == TK_OTA_STATE_DONE)
+    percent = 100;
+  else if (total > 0)
+    percent = (uint8_t)((uint64_t)received * 100 / total);
+
+  portENTER_CRITICAL(&progress_mux);
+  bool changed = progress.state != state || progress.percent != percent;
+  progress.state = state;
+  progress.percent = percent;
+  portEXIT_CRITICAL(&progress_mux);
+
+  if (changed && progress_listener != NULL)
+    progress_listener();
+}
+
+tk_ota_progress_t tk_ota_progress_get(void) {
+  portENTER_CRITICAL(&progress_mux);
+  tk_ota_progress_t current = progress;
+  portEXIT_CRITICAL(&progress_mux);
+
+  return current;
+}
+
+void tk_ota_progress_set_listener(void (*listener)(void)) {
+  progress_listener = listener;
+}
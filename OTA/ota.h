@@ -0,0 +1,184 @@
+/**
+ * @file ota.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Streaming, verified OTA image writer.
+ * @version 0.1
+ * @date 2020-11-27
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "verify.h"
+
+// Blocks in flight between the network and the flash writer
+#define TK_OTA_PIPELINE_BLOCKS 3
+#define TK_OTA_PIPELINE_BLOCK_LEN 4096
+
+/**
+ * @brief A single OTA transfer. The image is verified while it streams, see
+ * verify.h, and the flash is erased only once its header has been accepted.
+ *
+ */
+typedef struct {
+  const esp_partition_t *partition;
+  esp_ota_handle_t handle;
+  bool started;
+
+  tk_ota_verifier_t verifier;
+
+  esp_err_t error;
+} tk_ota_writer_t;
+
+/**
+ * @brief Prepares a writer for a new image. Nothing is erased until the header
+ * has been verified.
+ *
+ * @param writer The writer.
+ * @param image_len The expected image length, 0 if unknown.
+ * @return esp_err_t ESP_OK, or an error if no update partition fits the image.
+ */
+esp_err_t tk_ota_writer_begin(tk_ota_writer_t *writer, size_t image_len);
+
+/**
+ * @brief Feeds a block of the image to the writer.
+ *
+ * @param writer The writer.
+ * @param data The block.
+ * @param len The block length.
+ * @return esp_err_t ESP_OK, or the reason why the image was rejected. On error
+ * the flash write has already been aborted.
+ */
+esp_err_t tk_ota_writer_write(tk_ota_writer_t *writer, const void *data,
+                              size_t len);
+
+/**
+ * @brief Checks length and hash, finalizes the image and selects it for the
+ * next boot.
+ *
+ * @param writer The writer.
+ * @return esp_err_t ESP_OK if the new image will be booted.
+ */
+esp_err_t tk_ota_writer_finish(tk_ota_writer_t *writer);
+
+/**
+ * @brief Aborts the transfer and releases the OTA handle.
+ *
+ * @param writer The writer.
+ */
+void tk_ota_writer_abort(tk_ota_writer_t *writer);
+
+/**
+ * @brief A buffer moving through the pipeline.
+ *
+ */
+typedef struct {
+  uint8_t *data;
+  size_t len;
+} tk_ota_block_t;
+
+/**
+ * @brief A writer fed by its own task, so that receiving the next block
+ * overlaps with erasing and writing the previous one.
+ *
+ */
+typedef struct {
+  tk_ota_writer_t writer;
+
+  uint8_t *storage;
+  tk_ota_block_t blocks[TK_OTA_PIPELINE_BLOCKS];
+
+  // Empty blocks for the producer, filled blocks for the flash task
+  QueueHandle_t free_queue;
+  QueueHandle_t full_queue;
+  SemaphoreHandle_t done;
+
+  volatile esp_err_t error;
+} tk_ota_pipeline_t;
+
+/**
+ * @brief Starts the flash task and a new image.
+ *
+ * @param pipeline The pipeline.
+ * @param image_len The expected image length, 0 if unknown.
+ * @return esp_err_t ESP_OK, or the reason why the image cannot be written.
+ */
+esp_err_t tk_ota_pipeline_begin(tk_ota_pipeline_t *pipeline, size_t image_len);
+
+/**
+ * @brief Waits for an empty block to fill.
+ *
+ * @param pipeline The pipeline.
+ * @return tk_ota_block_t* The block, or NULL if the image was rejected.
+ */
+tk_ota_block_t *tk_ota_pipeline_acquire(tk_ota_pipeline_t *pipeline);
+
+/**
+ * @brief Hands a filled block to the flash task. Blocks that are acquired must
+ * always be submitted, even empty.
+ *
+ * @param pipeline The pipeline.
+ * @param block The block, with its length set.
+ */
+void tk_ota_pipeline_submit(tk_ota_pipeline_t *pipeline, tk_ota_block_t *block);
+
+/**
+ * @brief Waits for the pending blocks, then verifies and selects the image.
+ * The pipeline is released in any case.
+ *
+ * @param pipeline The pipeline.
+ * @return esp_err_t ESP_OK if the new image will be booted.
+ */
+esp_err_t tk_ota_pipeline_finish(tk_ota_pipeline_t *pipeline);
+
+/**
+ * @brief Drops the pending blocks, aborts the image and releases the pipeline.
+ *
+ * @param pipeline The pipeline.
+ */
+void tk_ota_pipeline_abort(tk_ota_pipeline_t *pipeline);
+
+typedef enum {
+  TK_OTA_STATE_IDLE,
+  TK_OTA_STATE_CONNECTING,
+  TK_OTA_STATE_DOWNLOADING,
+  TK_OTA_STATE_DONE,
+  TK_OTA_STATE_FAILED
+} tk_ota_state_t;
+
+/**
+ * @brief Progress of the current update, whatever its source.
+ *
+ */
+typedef struct {
+  tk_ota_state_t state;
+  uint8_t percent;
+} tk_ota_progress_t;
+
+/**
+ * @brief Updates the progress and tells the listener about visible changes.
+ *
+ * @param state The new state.
+ * @param received Bytes received so far.
+ * @param total Image length, 0 if unknown.
+ */
+void tk_ota_progress_update(tk_ota_state_t state, size_t received, size_t total);
+
+tk_ota_progress_t tk_ota_progress_get(void);
+
+/**
+ * @brief Sets the function called when the progress changes.
+ *
+ * @param listener The listener, called from the updating task.
+ */
+void tk_ota_progress_set_listener(void (*listener)(void));
@@ -0,0 +1,256 @@
+/**
+ * @file pull.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief OTA download from a URL.
+ * @version 0.1
+ * @date 2021-02-12
+ *
+ *
+ */
+
+#include "OTA/pull.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "OTA/fetch.h"
+#include "OTA/ota.h"
+#include "OTA/wifi.h"
+#include "diag/metrics.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "model/datastore.h"
+#include "model/nvsettings.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#if CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+#include "esp_crt_bundle.h"
+#endif
+
+#define TAG "OTA pull"
+
+static char pull_url[TK_OTA_PULL_URL_LEN] = "";
+static bool pull_running = false;
+static portMUX_TYPE pull_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static tk_metric_t pull_bytes_metric = TK_METRIC_COUNTER(
+    "tk_ota_pull_bytes_total", "OTA image bytes downloaded.");
+static tk_metric_t pull_resumes_metric = TK_METRIC_COUNTER(
+    "tk_ota_pull_resumes_total", "OTA downloads resumed after an error.");
+
+/**
+ * @brief The pipeline, and the block being filled.
+ *
+ */
+typedef struct {
+  tk_ota_pipeline_t pipeline;
+  tk_ota_block_t *block;
+} tk_ota_pull_image_t;
+
+static esp_err_t tk_ota_pull_open(void *ctx, size_t from,
+                                  tk_ota_fetch_response_t *response) {
+  esp_http_client_handle_t client = (esp_http_client_handle_t)ctx;
+
+  if (from > 0) {
+    char range[32];
+    snprintf(range, sizeof range, "bytes=%u-", from);
+    esp_http_client_set_header(client, "Range", range);
+  } else {
+    esp_http_client_delete_header(client, "Range");
+  }
+
+  esp_err_t err = esp_http_client_open(client, 0);
+  if (err != ESP_OK)
+    return err;
+
+  response->content_length = esp_http_client_fetch_headers(client);
+  response->status = esp_http_client_get_status_code(client);
+  response->range_start = -1;
+
+  char *content_range = NULL;
+  unsigned start;
+  if (esp_http_client_get_header(client, "Content-Range", &content_range) ==
+          ESP_OK &&
+      content_range != NULL &&
+      sscanf(content_range, "bytes %u-", &start) == 1)
+    response->range_start = start;
+
+  return ESP_OK;
+}
+
+static int tk_ota_pull_read(void *ctx, uint8_t *data, size_t len) {
+  return esp_http_client_read((esp_http_client_handle_t)ctx, (char *)data,
+                              len);
+}
+
+static bool tk_ota_pull_complete(void *ctx) {
+  return esp_http_client_is_complete_data_received(
+      (esp_http_client_handle_t)ctx);
+}
+
+static void tk_ota_pull_close(void *ctx) {
+  esp_http_client_close((esp_http_client_handle_t)ctx);
+}
+
+static esp_err_t tk_ota_pull_begin(void *ctx, size_t total) {
+  tk_ota_pull_image_t *image = (tk_ota_pull_image_t *)ctx;
+  return tk_ota_pipeline_begin(&image->pipeline, total);
+}
+
+static uint8_t *tk_ota_pull_acquire(void *ctx, size_t *capacity) {
+  tk_ota_pull_image_t *image = (tk_ota_pull_image_t *)ctx;
+
+  image->block = tk_ota_pipeline_acquire(&image->pipeline);
+  if (image->block == NULL)
+    return NULL;
+
+  *capacity = TK_OTA_PIPELINE_BLOCK_LEN;
+  return image->block->data;
+}
+
+static void tk_ota_pull_submit(void *ctx, uint8_t *data, size_t len) {
+  tk_ota_pull_image_t *image = (tk_ota_pull_image_t *)ctx;
+
+  image->block->len = len;
+  tk_metric_add(&pull_bytes_metric, len);
+  tk_ota_pipeline_submit(&image->pipeline, image->block);
+  image->block = NULL;
+}
+
+static esp_err_t tk_ota_pull_error(void *ctx) {
+  return ((tk_ota_pull_image_t *)ctx)->pipeline.error;
+}
+
+static esp_err_t tk_ota_pull_finish(void *ctx) {
+  return tk_ota_pipeline_finish(&((tk_ota_pull_image_t *)ctx)->pipeline);
+}
+
+static void tk_ota_pull_abort(void *ctx) {
+  tk_ota_pipeline_abort(&((tk_ota_pull_image_t *)ctx)->pipeline);
+}
+
+static void tk_ota_pull_delay(uint32_t ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+
+static void tk_ota_pull_progress(size_t received, size_t total) {
+  tk_ota_progress_update(TK_OTA_STATE_DOWNLOADING, received, total);
+}
+
+/**
+ * @brief Downloads and flashes the image, resuming with a range request after
+ * network errors.
+ *
+ * @param url The image URL.
+ * @return esp_err_t ESP_OK if the image is verified and selected for boot.
+ */
+static esp_err_t tk_ota_pull_download(const char *url) {
+  tk_ota_pull_image_t image = {.block = NULL};
+
+  esp_http_client_config_t config = {
+      .url = url,
+      .timeout_ms = 10000,
+#if CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+      .crt_bundle_attach = esp_crt_bundle_attach,
+#endif
+  };
+
+  esp_http_client_handle_t client = esp_http_client_init(&config);
+  if (client == NULL) {
+    ESP_LOGE(TAG, "Invalid URL.");
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  const tk_ota_fetch_t fetch = {
+      .transport = {.open = tk_ota_pull_open,
+                    .read = tk_ota_pull_read,
+                    .complete = tk_ota_pull_complete,
+                    .close = tk_ota_pull_close,
+                    .ctx = client},
+      .image = {.begin = tk_ota_pull_begin,
+                .acquire = tk_ota_pull_acquire,
+                .submit = tk_ota_pull_submit,
+                .error = tk_ota_pull_error,
+                .finish = tk_ota_pull_finish,
+                .abort = tk_ota_pull_abort,
+                .ctx = &image},
+      .retries = CONFIG_TK_OTA_PULL_RETRIES,
+      .delay = tk_ota_pull_delay,
+      .progress = tk_ota_pull_progress,
+  };
+
+  tk_ota_fetch_stats_t stats;
+  esp_err_t err = tk_ota_fetch(&fetch, &stats);
+  esp_http_client_cleanup(client);
+
+  tk_metric_add(&pull_resumes_metric, stats.resumes + stats.restarts);
+
+  return err;
+}
+
+static void tk_ota_pull_task(void *arg) {
+  tk_ota_progress_update(TK_OTA_STATE_CONNECTING, 0, 0);
+  nv_flush();
+
+  esp_err_t err = wifi_connect_sta(
+      global_datastore.wifi_settings.sta_ssid,
+      global_datastore.wifi_settings.sta_password,
+      pdMS_TO_TICKS(CONFIG_TK_OTA_STA_TIMEOUT_MS));
+
+  if (err == ESP_OK) {
+    ESP_LOGI(TAG, "Downloading %s.", pull_url);
+    err = tk_ota_pull_download(pull_url);
+    wifi_disconnect_sta();
+  }
+
+  if (err == ESP_OK) {
+    tk_ota_progress_update(TK_OTA_STATE_DONE, 0, 0);
+    ESP_LOGI(TAG, "Rebooting after update.");
+    vTaskDelay(2000 / portTICK_PERIOD_MS);
+
+    esp_restart();
+  }
+
+  ESP_LOGE(TAG, "Update failed: %s.", esp_err_to_name(err));
+  tk_ota_progress_update(TK_OTA_STATE_FAILED, 0, 0);
+
+  portENTER_CRITICAL(&pull_mux);
+  pull_running = false;
+  portEXIT_CRITICAL(&pull_mux);
+
+  vTaskDelete(NULL);
+}
+
+esp_err_t tk_ota_pull_start(const char *url, size_t len) {
+  if (len == 0 || len >= sizeof pull_url)
+    return ESP_ERR_INVALID_SIZE;
+
+  portENTER_CRITICAL(&pull_mux);
+  bool busy = pull_running;
+  if (!busy) {
+    memcpy(pull_url, url, len);
+    pull_url[len] = '\0';
+    pull_running = true;
+  }
+  portEXIT_CRITICAL(&pull_mux);
+
+  if (busy) {
+    ESP_LOGW(TAG, "A download is already running.");
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  tk_metrics_register(&pull_bytes_metric);
+  tk_metrics_register(&pull_resumes_metric);
+
+  if (xTaskCreate(tk_ota_pull_task, "ota_pull", 8192, NULL, 5, NULL) !=
+      pdPASS) {
+    portENTER_CRITICAL(&pull_mux);
+    pull_running = false;
+    portEXIT_CRITICAL(&pull_mux);
+    return ESP_ERR_NO_MEM;
+  }
+
+  return ESP_OK;
+}
+
+const char *tk_ota_pull_url(void) { return pull_url; }
@@ -0,0 +1,35 @@
+/**
+ * @file pull.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief OTA download from a URL.
+ * @version 0.1
+ * @date 2021-02-12
+ *
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#define TK_OTA_PULL_URL_LEN 256
+
+/**
+ * @brief Starts downloading and flashing the image at a URL, over the
+ * configured station network. The device reboots into the new image when it
+ * is verified.
+ *
+ * @param url The image URL, not necessarily terminated.
+ * @param len The URL length.
+ * @return esp_err_t ESP_OK if the download started.
+ */
+esp_err_t tk_ota_pull_start(const char *url, size_t len);
+
+/**
+ * @brief The last requested URL, empty if none.
+ *
+ * @return const char* The URL.
+ */
+const char *tk_ota_pull_url(void);
@@ -19,11 +19,32 @@
 #include <string.h>
 #include <sys/param.h>
 
+#include "OTA/assetpack.h"
+#include "OTA/ota.h"
+#include "OTA/telemetry.h"
+#include "diag/metrics.h"
+#include "diag/profiler.h"
+#include "diag/trace.h"
+#include "model/nvsettings.h"
+#include "ui/assets/assets.h"
+#include "esp_timer.h"
+
 #define TAG "OTA server"
 
+// Consecutive socket timeouts tolerated during an upload
+#define OTA_RECV_RETRIES 5
+
 httpd_handle_t OTA_server = NULL;
 int8_t flash_status = 0;
 
+static tk_metric_t ota_bytes_metric =
+    TK_METRIC_COUNTER("tk_ota_bytes_total", "OTA image bytes received.");
+static tk_metric_t ota_failures_metric =
+    TK_METRIC_COUNTER("tk_ota_failures_total", "Rejected or failed OTA uploads.");
+static tk_metric_t ota_throughput_metric =
+    TK_METRIC_GAUGE("tk_ota_throughput_bytes_per_second",
+                    "Throughput of the last OTA upload.");
+
 EventGroupHandle_t reboot_event_group;
 const int REBOOT_BIT = BIT0;
 
@@ -58,86 +79,132 @@ void systemRebootTask(void *parameter) {
   }
 }
 
+/**
+ * @brief Fills a block from the request, retrying on timeouts.
+ *
+ * @return int The bytes read, or the socket error.
+ */
+static int OTA_receive_block(httpd_req_t *req, tk_ota_block_t *block,
+                             int remaining) {
+  int timeouts = 0;
+  int wanted = MIN(remaining, TK_OTA_PIPELINE_BLOCK_LEN);
+
+  while (block->len < wanted) {
+    /* Read the data for the request */
+    int recv_len = httpd_req_recv(req, (char *)block->data + block->len,
+                                  wanted - block->len);
+
+    if (recv_len == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts <= OTA_RECV_RETRIES) {
+      ESP_LOGW(TAG, "Socket timeout.");
+      /* Retry receiving if timeout occurred */
+      continue;
+    }
+
+    if (recv_len <= 0)
+      return recv_len;
+
+    timeouts = 0;
+    block->len += recv_len;
+  }
+
+  return block->len;
+}
+
 /* Receive .Bin file */
 esp_err_t OTA_update_post_handler(httpd_req_t *req) {
-  esp_ota_handle_t ota_handle;
+  tk_ota_pipeline_t pipeline;
 
-  char ota_buff[1024];
   int content_length = req->content_len;
-  ESP_LOGI(TAG, "OTA buffer at %p.", ota_buff);
   ESP_LOGI(TAG, "Content length: %d.", content_length);
   int content_received = 0;
-  int recv_len = 0;
-  bool is_req_body_started = false;
-  const esp_partition_t *update_partition =
-      esp_ota_get_next_update_partition(NULL);
+  int64_t start_us = esp_timer_get_time();
 
   // Unsucessful Flashing
   flash_status = -1;
 
-  do {
-    /* Read the data for the request */
-    recv_len = httpd_req_recv(req, ota_buff, 1024);
-    if (recv_len < 0) {
-      if (recv_len == HTTPD_SOCK_ERR_TIMEOUT) {
-        ESP_LOGW(TAG, "Socket timeout.");
-        /* Retry receiving if timeout occurred */
-        continue;
-      }
-      ESP_LOGE(TAG, "OTA error. Data received: %d.", recv_len);
+  // Nothing pending should be lost if the update goes wrong
+  nv_flush();
+
+  esp_err_t err = tk_ota_pipeline_begin(&pipeline, content_length);
+  if (err != ESP_OK) {
+    // Only the size is the client's fault
+    if (err == ESP_ERR_INVALID_SIZE)
+      httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                          "Image does not fit the update partition.");
+    else if (err == ESP_ERR_NOT_FOUND)
+      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                          "No update partition.");
+    else if (err == ESP_ERR_NO_MEM)
+      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                          "Out of memory.");
+    else
+      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                          esp_err_to_name(err));
+    tk_metric_inc(&ota_failures_metric);
+    tk_ota_progress_update(TK_OTA_STATE_FAILED, 0, content_length);
+    return ESP_FAIL;
+  }
+
+  while (content_received < content_length) {
+    tk_ota_block_t *block = tk_ota_pipeline_acquire(&pipeline);
+    if (block == NULL) {
+      // Rejected early, no need to receive the rest
+      tk_ota_pipeline_abort(&pipeline);
+      httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                          "Image rejected, see device log.");
+      tk_metric_inc(&ota_failures_metric);
+      tk_ota_progress_update(TK_OTA_STATE_FAILED, content_received,
+                             content_length);
       return ESP_FAIL;
     }
 
-    // ESP_LOGI(TAG, "Received len = %d.", recv_len);
-    // for (int j = 0; j < recv_len; j++) {
-    //   printf("%c", ota_buff[j]);
-    // }
-    // printf("\n");
-
-    if (recv_len > 0) {
-      if (!is_req_body_started) {
-        ESP_ERROR_CHECK(
-            esp_ota_begin(update_partition, content_length, &ota_handle));
-        ESP_LOGI(TAG, "Writing first block. Start = %p, len = %x.", ota_buff,
-                 recv_len);
-        esp_ota_write(ota_handle, ota_buff, recv_len);
-        content_received += recv_len;
-        is_req_body_started = true;
-      } else {
-        ESP_LOGI(TAG, "Writing block. Start = %p, len = %x.", ota_buff,
-                 recv_len);
-        esp_ota_write(ota_handle, ota_buff, recv_len);
-        content_received += recv_len;
-      }
-    } else if (recv_len < 0) {
-      ESP_LOGE(TAG, "Error: recv data error!");
+    int recv_len =
+        OTA_receive_block(req, block, content_length - content_received);
+    if (recv_len <= 0) {
+      // Connection closed or failed: the image is truncated
+      ESP_LOGE(TAG, "OTA error after %d bytes. Data received: %d.",
+               content_received, recv_len);
+      tk_ota_pipeline_submit(&pipeline, block);
+      tk_ota_pipeline_abort(&pipeline);
+      tk_metric_inc(&ota_failures_metric);
+      tk_ota_progress_update(TK_OTA_STATE_FAILED, content_received,
+                             content_length);
+      return ESP_FAIL;
     }
-  } while (recv_len > 0 && content_received < content_length);
 
-  // End response
-  // httpd_resp_send_chunk(req, NULL, 0);
-  esp_err_t err = esp_ota_end(ota_handle);
-  if (err == ESP_OK) {
-    // Lets update the partition
-    if (esp_ota_set_boot_partition(update_partition) == ESP_OK) {
-      const esp_partition_t *boot_partition = esp_ota_get_boot_partition();
-
-      // Webpage will request status when complete
-      // This is to let it know it was successful
-      flash_status = 1;
-
-      ESP_LOGI(TAG, "Next boot partition subtype %d at offset 0x%x.",
-               boot_partition->subtype, boot_partition->address);
-      ESP_LOGI(TAG, "Please Restart System...");
-      xEventGroupSetBits(reboot_event_group, REBOOT_BIT);
-    } else {
-      ESP_LOGE(TAG, "Flash error!");
-    }
+    tk_metric_add(&ota_bytes_metric, recv_len);
+    tk_ota_pipeline_submit(&pipeline, block);
 
-  } else {
-    ESP_LOGE(TAG, "OTA end error: %s.", esp_err_to_name(err));
+    content_received += recv_len;
+    tk_ota_progress_update(TK_OTA_STATE_DOWNLOADING, content_received,
+                           content_length);
   }
 
+  if (tk_ota_pipeline_finish(&pipeline) != ESP_OK) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                        "Image verification failed.");
+    tk_metric_inc(&ota_failures_metric);
+    tk_ota_progress_update(TK_OTA_STATE_FAILED, content_received,
+                           content_length);
+    return ESP_FAIL;
+  }
+
+  int64_t elapsed_us = esp_timer_get_time() - start_us;
+  if (elapsed_us > 0)
+    tk_metric_set(&ota_throughput_metric,
+                  (int32_t)((int64_t)content_received * 1000000 / elapsed_us));
+
+  tk_ota_progress_update(TK_OTA_STATE_DONE, content_received, content_length);
+
+  // Webpage will request status when complete
+  // This is to let it know it was successful
+  flash_status = 1;
+
+  httpd_resp_sendstr(req, "OK");
+
+  ESP_LOGI(TAG, "Please Restart System...");
+  xEventGroupSetBits(reboot_event_group, REBOOT_BIT);
+
   return ESP_OK;
 }
 
@@ -146,6 +213,193 @@ httpd_uri_t OTA_update = {.uri = "/update",
                           .handler = OTA_update_post_handler,
                           .user_ctx = NULL};
 
+/* Receive an asset image, from tools/pack_assets.py */
+esp_err_t assets_update_post_handler(httpd_req_t *req) {
+  tk_assetpack_writer_t writer;
+  tk_ota_block_t block;
+
+  int content_length = req->content_len;
+  ESP_LOGI(TAG, "Asset image length: %d.", content_length);
+  int content_received = 0;
+
+  // A restart follows this one too
+  nv_flush();
+
+  esp_err_t err = tk_assetpack_begin(&writer, content_length);
+  if (err != ESP_OK) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                        err == ESP_ERR_NOT_SUPPORTED
+                            ? "No asset partition, the fonts are built in."
+                            : "Image does not fit the asset partition.");
+    tk_ota_progress_update(TK_OTA_STATE_FAILED, 0, content_length);
+    return ESP_FAIL;
+  }
+
+  block.data = malloc(TK_OTA_PIPELINE_BLOCK_LEN);
+  if (block.data == NULL) {
+    tk_assetpack_abort(&writer);
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory.");
+    return ESP_FAIL;
+  }
+
+  while (content_received < content_length) {
+    block.len = 0;
+    int recv_len =
+        OTA_receive_block(req, &block, content_length - content_received);
+    if (recv_len <= 0) {
+      ESP_LOGE(TAG, "Asset update error after %d bytes. Data received: %d.",
+               content_received, recv_len);
+      err = ESP_FAIL;
+      break;
+    }
+
+    tk_metric_add(&ota_bytes_metric, recv_len);
+    err = tk_assetpack_write(&writer, block.data, recv_len);
+    if (err != ESP_OK)
+      break;
+
+    content_received += recv_len;
+    tk_ota_progress_update(TK_OTA_STATE_DOWNLOADING, content_received,
+                           content_length);
+  }
+
+  free(block.data);
+
+  if (err == ESP_OK)
+    err = tk_assetpack_finish(&writer);
+  else
+    tk_assetpack_abort(&writer);
+
+  if (err != ESP_OK) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                        "Image rejected, see device log.");
+    tk_metric_inc(&ota_failures_metric);
+    tk_ota_progress_update(TK_OTA_STATE_FAILED, content_received,
+                           content_length);
+    return ESP_FAIL;
+  }
+
+  tk_ota_progress_update(TK_OTA_STATE_DONE, content_received, content_length);
+  httpd_resp_sendstr(req, "OK");
+
+  // The fonts were let go of, the new image is mapped at boot
+  xEventGroupSetBits(reboot_event_group, REBOOT_BIT);
+
+  return ESP_OK;
+}
+
+httpd_uri_t assets_update = {.uri = "/update_assets",
+                             .method = HTTP_POST,
+                             .handler = assets_update_post_handler,
+                             .user_ctx = NULL};
+
+/* Version of the mapped asset image */
+esp_err_t assets_get_handler(httpd_req_t *req) {
+  const char *version = tk_assets_version();
+
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_sendstr_chunk(req, version != NULL ? version : "none");
+  httpd_resp_sendstr_chunk(req, "\n");
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+httpd_uri_t assets_uri = {.uri = "/assets",
+                          .method = HTTP_GET,
+                          .handler = assets_get_handler,
+                          .user_ctx = NULL};
+
+static void metrics_emit(const char *text, size_t len, void *ctx) {
+  httpd_resp_send_chunk((httpd_req_t *)ctx, text, len);
+}
+
+/* Runtime counters in the Prometheus text format */
+esp_err_t metrics_get_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  tk_metrics_render(metrics_emit, req);
+
+  // End response
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+httpd_uri_t metrics_uri = {.uri = "/metrics",
+                           .method = HTTP_GET,
+                           .handler = metrics_get_handler,
+                           .user_ctx = NULL};
+
+/* Event trace dump, for tools/trace2perfetto.py */
+esp_err_t trace_get_handler(httpd_req_t *req) {
+  size_t len;
+  uint8_t *dump = tk_trace_dump(&len);
+
+  if (dump == NULL) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                        "Tracing is disabled or out of memory");
+    return ESP_FAIL;
+  }
+
+  httpd_resp_set_type(req, "application/octet-stream");
+  esp_err_t err = httpd_resp_send(req, (const char *)dump, len);
+  free(dump);
+
+  return err;
+}
+
+httpd_uri_t trace_uri = {.uri = "/trace",
+                         .method = HTTP_GET,
+                         .handler = trace_get_handler,
+                         .user_ctx = NULL};
+
+/* Sampling profiler: ?action=start[&hz=N], stop or clear, else the dump for
+ * tools/profile_report.py */
+esp_err_t profile_get_handler(httpd_req_t *req) {
+  char query[48];
+  char action[8] = "";
+  char hz[8] = "0";
+
+  if (httpd_req_get_url_query_str(req, query, sizeof query) == ESP_OK) {
+    httpd_query_key_value(query, "action", action, sizeof action);
+    httpd_query_key_value(query, "hz", hz, sizeof hz);
+  }
+
+  if (strcmp(action, "start") == 0) {
+    esp_err_t err = tk_prof_start(strtoul(hz, NULL, 10));
+    if (err != ESP_OK) {
+      httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, esp_err_to_name(err));
+      return ESP_FAIL;
+    }
+    return httpd_resp_sendstr(req, "Profiler started\n");
+  } else if (strcmp(action, "stop") == 0) {
+    tk_prof_stop();
+    return httpd_resp_sendstr(req, "Profiler stopped\n");
+  } else if (strcmp(action, "clear") == 0) {
+    tk_prof_clear();
+    return httpd_resp_sendstr(req, "Profiler cleared\n");
+  } else if (action[0] != '\0') {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown action");
+    return ESP_FAIL;
+  }
+
+  size_t len;
+  uint8_t *dump = tk_prof_dump(&len);
+
+  if (dump == NULL) {
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND,
+                        "No samples, or out of memory");
+    return ESP_FAIL;
+  }
+
+  httpd_resp_set_type(req, "application/octet-stream");
+  esp_err_t err = httpd_resp_send(req, (const char *)dump, len);
+  free(dump);
+
+  return err;
+}
+
+httpd_uri_t profile_uri = {.uri = "/profile",
+                           .method = HTTP_GET,
+                           .handler = profile_get_handler,
+                           .user_ctx = NULL};
+
 httpd_handle_t start_OTA_webserver(void) {
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 
@@ -155,6 +409,11 @@ httpd_handle_t start_OTA_webserver(void) {
   // Lets bump up the stack size (default was 4096)
   config.stack_size = 8192;
 
+#if CONFIG_TK_TELEMETRY
+  // Telemetry clients are forgotten when their socket closes
+  config.close_fn = tk_telemetry_on_close;
+#endif
+
   // Start the httpd server
   ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
 
@@ -162,6 +421,20 @@ httpd_handle_t start_OTA_webserver(void) {
     // Set URI handlers
     ESP_LOGI(TAG, "Registering URI handlers.");
     httpd_register_uri_handler(OTA_server, &OTA_update);
+    httpd_register_uri_handler(OTA_server, &assets_update);
+    httpd_register_uri_handler(OTA_server, &assets_uri);
+    httpd_register_uri_handler(OTA_server, &metrics_uri);
+    httpd_register_uri_handler(OTA_server, &trace_uri);
+    httpd_register_uri_handler(OTA_server, &profile_uri);
+
+    tk_metrics_register(&ota_bytes_metric);
+    tk_metrics_register(&ota_failures_metric);
+    tk_metrics_register(&ota_throughput_metric);
+
+#if CONFIG_TK_TELEMETRY
+    tk_telemetry_start(OTA_server);
+#endif
+
     return OTA_server;
   }
 
@@ -170,6 +443,10 @@ httpd_handle_t start_OTA_webserver(void) {
 }
 
 void stop_OTA_webserver(httpd_handle_t server) {
+#if CONFIG_TK_TELEMETRY
+  tk_telemetry_stop();
+#endif
+
   // Stop the httpd server
   httpd_stop(server);
 }
@@ -0,0 +1,511 @@
+/**
+ * @file telemetry.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Live datastore telemetry over WebSocket.
+ * @version 0.1
+ * @date 2021-02-10
+ *
+ *
+ */
+
+#include "OTA/telemetry.h"
+
+#if CONFIG_TK_TELEMETRY
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "diag/metrics.h"
+#include "diag/trace.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "model/datastore.h"
+
+#define TAG "Telemetry"
+
+// Worst case size of a frame with every field in it
+#define TK_TELEMETRY_FRAME_MAX 512
+
+typedef enum {
+  TK_TELEMETRY_FLOAT,
+  // int32_t in 1e-7 units
+  TK_TELEMETRY_E7,
+  TK_TELEMETRY_ENUM
+} tk_telemetry_field_type_t;
+
+/**
+ * @brief A datastore field published to the clients.
+ *
+ */
+typedef struct {
+  const char *key;
+  tk_telemetry_field_type_t type;
+  const void *value;
+
+  // NULL if the field is always available
+  const bool *available;
+
+  // Decimals sent, changes below the last one are not deltas
+  uint8_t decimals;
+} tk_telemetry_field_t;
+
+#define TK_ENGINE(field) (&global_datastore.engine_data.field)
+#define TK_LOCATION(field) (&global_datastore.location_data.field)
+
+static const tk_telemetry_field_t fields[] = {
+    {"rpm", TK_TELEMETRY_FLOAT, TK_ENGINE(rpm), TK_ENGINE(rpm_available), 0},
+    {"temp_c", TK_TELEMETRY_FLOAT, TK_ENGINE(temp_c),
+     TK_ENGINE(temp_c_available), 1},
+    {"lat", TK_TELEMETRY_E7, TK_LOCATION(lat_e7), TK_LOCATION(lat_available),
+     6},
+    {"lon", TK_TELEMETRY_E7, TK_LOCATION(lon_e7), TK_LOCATION(lon_available),
+     6},
+    {"alt", TK_TELEMETRY_FLOAT, TK_LOCATION(altitude),
+     TK_LOCATION(altitude_available), 1},
+    {"speed", TK_TELEMETRY_FLOAT, TK_LOCATION(speed),
+     TK_LOCATION(speed_available), 1},
+    {"gps_heading", TK_TELEMETRY_FLOAT, TK_LOCATION(gps_heading),
+     TK_LOCATION(gps_heading_available), 1},
+    {"heading", TK_TELEMETRY_FLOAT, TK_LOCATION(heading),
+     TK_LOCATION(heading_available), 1},
+    {"gps", TK_TELEMETRY_ENUM, &global_datastore.gps_status, NULL, 0},
+    {"warning", TK_TELEMETRY_ENUM, &global_datastore.warning_level, NULL, 0},
+};
+
+#define TK_TELEMETRY_FIELDS (sizeof fields / sizeof fields[0])
+
+// Sentinel for a field that is not available
+#define TK_TELEMETRY_UNAVAILABLE INT64_MIN
+
+/**
+ * @brief An encoded frame, shared by all the clients it is sent to and freed
+ * by the last one.
+ *
+ */
+typedef struct {
+  int refs;
+  size_t len;
+  char data[];
+} tk_telemetry_frame_t;
+
+typedef struct {
+  int fd;
+  bool active;
+
+  // A send is queued or running, the client gets nothing else until it ends
+  bool in_flight;
+
+  // The client missed a delta and needs a full frame
+  bool resync;
+
+  tk_telemetry_frame_t *frame;
+} tk_telemetry_client_t;
+
+static httpd_handle_t telemetry_server = NULL;
+static esp_timer_handle_t telemetry_timer = NULL;
+static portMUX_TYPE telemetry_mux = portMUX_INITIALIZER_UNLOCKED;
+static tk_telemetry_client_t clients[CONFIG_TK_TELEMETRY_MAX_CLIENTS];
+
+// Last published state, in sent units
+static int64_t last_values[TK_TELEMETRY_FIELDS];
+static uint32_t sequence = 0;
+
+static tk_metric_t telemetry_frames_metric = TK_METRIC_COUNTER(
+    "tk_telemetry_frames_total", "Telemetry frames sent to clients.");
+static tk_metric_t telemetry_skipped_metric =
+    TK_METRIC_COUNTER("tk_telemetry_skipped_total",
+                      "Telemetry frames skipped for a busy client.");
+static tk_metric_t telemetry_clients_metric = TK_METRIC_GAUGE(
+    "tk_telemetry_clients", "Connected telemetry clients.");
+
+static void tk_telemetry_frame_release(tk_telemetry_frame_t *frame) {
+  if (__atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    free(frame);
+}
+
+/**
+ * @brief Reads a field, scaled to an integer in the units it is sent with.
+ *
+ */
+static int64_t tk_telemetry_field_read(const tk_telemetry_field_t *field) {
+  static const int32_t scale[] = {1, 10, 100, 1000, 10000, 100000, 1000000,
+                                  10000000};
+
+  if (field->available != NULL && !*field->available)
+    return TK_TELEMETRY_UNAVAILABLE;
+
+  switch (field->type) {
+  case TK_TELEMETRY_FLOAT:
+    return llroundf(*(const float *)field->value * scale[field->decimals]);
+  case TK_TELEMETRY_E7: {
+    // Rounded to the decimals sent, half away from zero
+    int32_t value = *(const int32_t *)field->value;
+    int32_t div = scale[7 - field->decimals];
+    return (value + (value < 0 ? -div / 2 : div / 2)) / div;
+  }
+  case TK_TELEMETRY_ENUM:
+  default:
+    return *(const int *)field->value;
+  }
+}
+
+/**
+ * @brief Appends a field to a frame being encoded.
+ *
+ * @return int The characters written, negative if the frame is full.
+ */
+static int tk_telemetry_field_encode(char *out, size_t size,
+                                     const tk_telemetry_field_t *field,
+                                     int64_t value, bool first) {
+  const char *sep = first ? "" : ",";
+
+  if (value == TK_TELEMETRY_UNAVAILABLE)
+    return snprintf(out, size, "%s\"%s\":null", sep, field->key);
+
+  if (field->decimals == 0)
+    return snprintf(out, size, "%s\"%s\":%lld", sep, field->key, value);
+
+  // Integer arithmetic keeps the output identical to the compared values
+  int64_t scale = 1;
+  for (int i = 0; i < field->decimals; i++)
+    scale *= 10;
+
+  int64_t magnitude = llabs(value);
+  return snprintf(out, size, "%s\"%s\":%s%lld.%0*lld", sep, field->key,
+                  value < 0 ? "-" : "", magnitude / scale, field->decimals,
+                  magnitude % scale);
+}
+
+/**
+ * @brief Encodes a frame with the fields that changed, or with all of them.
+ *
+ * @param values The current values.
+ * @param seq The sequence number.
+ * @param full True for a full frame.
+ * @return tk_telemetry_frame_t* The frame with one reference, or NULL if there
+ * is nothing to send.
+ */
+static tk_telemetry_frame_t *tk_telemetry_encode(const int64_t *values,
+                                                 uint32_t seq, bool full) {
+  tk_telemetry_frame_t *frame =
+      malloc(sizeof(tk_telemetry_frame_t) + TK_TELEMETRY_FRAME_MAX);
+  if (frame == NULL) {
+    ESP_LOGE(TAG, "Cannot allocate a frame.");
+    return NULL;
+  }
+
+  char *out = frame->data;
+  size_t left = TK_TELEMETRY_FRAME_MAX;
+  bool first = true;
+  int len = snprintf(out, left, "{\"seq\":%u,\"t\":%lld,\"full\":%s,\"d\":{",
+                     seq, esp_timer_get_time() / 1000,
+                     full ? "true" : "false");
+
+  for (int i = 0; i < TK_TELEMETRY_FIELDS && len >= 0 && len < left; i++) {
+    out += len;
+    left -= len;
+    len = 0;
+
+    if (!full && values[i] == last_values[i])
+      continue;
+
+    len = tk_telemetry_field_encode(out, left, &fields[i], values[i], first);
+    first = false;
+  }
+
+  if (len >= 0 && len < left) {
+    out += len;
+    left -= len;
+    len = snprintf(out, left, "}}");
+  }
+
+  if (len < 0 || len >= left) {
+    ESP_LOGE(TAG, "Frame does not fit in %d bytes.", TK_TELEMETRY_FRAME_MAX);
+    free(frame);
+    return NULL;
+  }
+
+  if (first && !full) {
+    free(frame);
+    return NULL;
+  }
+
+  frame->len = out + len - frame->data;
+  frame->refs = 1;
+  return frame;
+}
+
+/**
+ * @brief Sends a client its frame, runs in the server task.
+ *
+ * @param arg The client.
+ */
+static void tk_telemetry_send_work(void *arg) {
+  tk_telemetry_client_t *client = (tk_telemetry_client_t *)arg;
+
+  // Whoever takes the frame from the slot releases it
+  portENTER_CRITICAL(&telemetry_mux);
+  tk_telemetry_frame_t *frame = client->frame;
+  client->frame = NULL;
+  portEXIT_CRITICAL(&telemetry_mux);
+
+  if (frame != NULL) {
+    httpd_ws_frame_t ws_frame = {.final = true,
+                                 .type = HTTPD_WS_TYPE_TEXT,
+                                 .payload = (uint8_t *)frame->data,
+                                 .len = frame->len};
+
+    esp_err_t err = ESP_FAIL;
+    if (httpd_ws_get_fd_info(telemetry_server, client->fd) ==
+        HTTPD_WS_CLIENT_WEBSOCKET)
+      err = httpd_ws_send_frame_async(telemetry_server, client->fd, &ws_frame);
+
+    if (err == ESP_OK)
+      tk_metric_inc(&telemetry_frames_metric);
+    else
+      ESP_LOGW(TAG, "Send to socket %d failed: %s.", client->fd,
+               esp_err_to_name(err));
+
+    tk_telemetry_frame_release(frame);
+  }
+
+  portENTER_CRITICAL(&telemetry_mux);
+  client->in_flight = false;
+  portEXIT_CRITICAL(&telemetry_mux);
+}
+
+/**
+ * @brief Queues a frame for a client, if it is not still busy with the last
+ * one.
+ *
+ */
+static void tk_telemetry_offer(tk_telemetry_client_t *client,
+                               tk_telemetry_frame_t *frame, bool full) {
+  bool queue = false;
+
+  portENTER_CRITICAL(&telemetry_mux);
+  if (client->active) {
+    if (client->in_flight) {
+      // Backpressure: drop it, the client will need a full frame
+      client->resync = true;
+    } else {
+      client->in_flight = true;
+      client->resync &= !full;
+      client->frame = frame;
+      queue = true;
+    }
+  }
+  portEXIT_CRITICAL(&telemetry_mux);
+
+  if (!queue) {
+    tk_metric_inc(&telemetry_skipped_metric);
+    return;
+  }
+
+  __atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+  if (httpd_queue_work(telemetry_server, tk_telemetry_send_work, client) !=
+      ESP_OK) {
+    portENTER_CRITICAL(&telemetry_mux);
+    client->frame = NULL;
+    client->in_flight = false;
+    client->resync = true;
+    portEXIT_CRITICAL(&telemetry_mux);
+    tk_telemetry_frame_release(frame);
+  }
+}
+
+/**
+ * @brief Publishes the datastore. The delta and, when someone needs it, the
+ * full frame are encoded once and shared by every client.
+ *
+ */
+static void tk_telemetry_tick(void *arg) {
+  int64_t values[TK_TELEMETRY_FIELDS];
+  bool need_full = false;
+  bool any = false;
+
+  for (int i = 0; i < CONFIG_TK_TELEMETRY_MAX_CLIENTS; i++) {
+    if (clients[i].active) {
+      any = true;
+      need_full |= clients[i].resync;
+    }
+  }
+
+  if (!any)
+    return;
+
+  TK_TRACE_BEGIN(TK_TRACE_TELEMETRY, need_full);
+
+  for (int i = 0; i < TK_TELEMETRY_FIELDS; i++)
+    values[i] = tk_telemetry_field_read(&fields[i]);
+
+  // Sequence numbers count deltas, a full frame shares the one of its tick
+  tk_telemetry_frame_t *delta = tk_telemetry_encode(values, sequence + 1, false);
+  if (delta != NULL)
+    sequence++;
+
+  tk_telemetry_frame_t *full =
+      need_full ? tk_telemetry_encode(values, sequence, true) : NULL;
+
+  if (delta == NULL && full == NULL) {
+    TK_TRACE_END(TK_TRACE_TELEMETRY, 0);
+    return;
+  }
+
+  memcpy(last_values, values, sizeof last_values);
+
+  for (int i = 0; i < CONFIG_TK_TELEMETRY_MAX_CLIENTS; i++) {
+    tk_telemetry_client_t *client = &clients[i];
+    if (!client->active)
+      continue;
+
+    // A client waiting for a full frame must not get a delta first
+    if (client->resync) {
+      if (full != NULL)
+        tk_telemetry_offer(client, full, true);
+    } else if (delta != NULL) {
+      tk_telemetry_offer(client, delta, false);
+    }
+  }
+
+  if (delta != NULL)
+    tk_telemetry_frame_release(delta);
+  if (full != NULL)
+    tk_telemetry_frame_release(full);
+
+  TK_TRACE_END(TK_TRACE_TELEMETRY, sequence);
+}
+
+static void tk_telemetry_update_clients_metric(void) {
+  int32_t count = 0;
+  for (int i = 0; i < CONFIG_TK_TELEMETRY_MAX_CLIENTS; i++)
+    count += clients[i].active;
+  tk_metric_set(&telemetry_clients_metric, count);
+}
+
+/* WebSocket handshake and incoming frames */
+static esp_err_t telemetry_ws_handler(httpd_req_t *req) {
+  if (req->method == HTTP_GET) {
+    int fd = httpd_req_to_sockfd(req);
+    bool added = false;
+
+    portENTER_CRITICAL(&telemetry_mux);
+    for (int i = 0; i < CONFIG_TK_TELEMETRY_MAX_CLIENTS && !added; i++) {
+      // A slot with a send still queued cannot be reused yet
+      if (!clients[i].active && !clients[i].in_flight) {
+        clients[i].fd = fd;
+        clients[i].active = true;
+        clients[i].resync = true;
+        added = true;
+      }
+    }
+    portEXIT_CRITICAL(&telemetry_mux);
+
+    if (!added) {
+      ESP_LOGW(TAG, "Too many clients, refusing socket %d.", fd);
+      return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Client connected on socket %d.", fd);
+    tk_telemetry_update_clients_metric();
+    return ESP_OK;
+  }
+
+  // Any text from a client asks for a full frame
+  uint8_t payload[16];
+  httpd_ws_frame_t frame = {.payload = payload};
+  esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+  if (err != ESP_OK)
+    return err;
+
+  if (frame.len > sizeof payload)
+    return ESP_FAIL;
+
+  err = httpd_ws_recv_frame(req, &frame, sizeof payload);
+  if (err != ESP_OK)
+    return err;
+
+  int fd = httpd_req_to_sockfd(req);
+  portENTER_CRITICAL(&telemetry_mux);
+  for (int i = 0; i < CONFIG_TK_TELEMETRY_MAX_CLIENTS; i++) {
+    if (clients[i].active && clients[i].fd == fd)
+      clients[i].resync = true;
+  }
+  portEXIT_CRITICAL(&telemetry_mux);
+
+  return ESP_OK;
+}
+
+static httpd_uri_t telemetry_uri = {.uri = "/telemetry",
+                                    .method = HTTP_GET,
+                                    .handler = telemetry_ws_handler,
+                                    .user_ctx = NULL,
+                                    .is_websocket = true};
+
+void tk_telemetry_on_close(httpd_handle_t server, int sockfd) {
+  bool removed = false;
+
+  portENTER_CRITICAL(&telemetry_mux);
+  for (int i = 0; i < CONFIG_TK_TELEMETRY_MAX_CLIENTS; i++) {
+    if (clients[i].active && clients[i].fd == sockfd) {
+      clients[i].active = false;
+      removed = true;
+    }
+  }
+  portEXIT_CRITICAL(&telemetry_mux);
+
+  if (removed) {
+    ESP_LOGI(TAG, "Client on socket %d disconnected.", sockfd);
+    tk_telemetry_update_clients_metric();
+  }
+
+  // Setting a close hook makes closing the socket our job
+  close(sockfd);
+}
+
+void tk_telemetry_start(httpd_handle_t server) {
+  telemetry_server = server;
+  httpd_register_uri_handler(server, &telemetry_uri);
+
+  tk_metrics_register(&telemetry_frames_metric);
+  tk_metrics_register(&telemetry_skipped_metric);
+  tk_metrics_register(&telemetry_clients_metric);
+
+  if (telemetry_timer == NULL) {
+    const esp_timer_create_args_t timer_args = {
+        .callback = tk_telemetry_tick, .name = "telemetry"};
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &telemetry_timer));
+  }
+
+  ESP_ERROR_CHECK(esp_timer_start_periodic(
+      telemetry_timer, 1000000 / CONFIG_TK_TELEMETRY_MAX_RATE_HZ));
+
+  ESP_LOGI(TAG, "Publishing at up to %d Hz.", CONFIG_TK_TELEMETRY_MAX_RATE_HZ);
+}
+
+void tk_telemetry_stop(void) {
+  if (telemetry_timer != NULL)
+    esp_timer_stop(telemetry_timer);
+
+  // Queued sends may never run once the server stops, take their frames back
+  for (int i = 0; i < CONFIG_TK_TELEMETRY_MAX_CLIENTS; i++) {
+    portENTER_CRITICAL(&telemetry_mux);
+    tk_telemetry_frame_t *frame = clients[i].frame;
+    clients[i].frame = NULL;
+    clients[i].active = false;
+    clients[i].in_flight = false;
+    portEXIT_CRITICAL(&telemetry_mux);
+
+    if (frame != NULL)
+      tk_telemetry_frame_release(frame);
+  }
+
+  tk_telemetry_update_clients_metric();
+  telemetry_server = NULL;
+}
+
+#endif
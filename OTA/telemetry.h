@@ -0,0 +1,35 @@
+/**
+ * @file telemetry.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Live datastore telemetry over WebSocket.
+ * @version 0.1
+ * @date 2021-02-10
+ *
+ *
+ */
+
+#pragma once
+
+#include <esp_http_server.h>
+
+/**
+ * @brief Registers the /telemetry WebSocket endpoint and starts publishing.
+ *
+ * @param server The running web server.
+ */
+void tk_telemetry_start(httpd_handle_t server);
+
+/**
+ * @brief Stops publishing and forgets every client. Call before stopping the
+ * web server.
+ *
+ */
+void tk_telemetry_stop(void);
+
+/**
+ * @brief Socket close hook, to be set as the server's close_fn.
+ *
+ * @param server The web server.
+ * @param sockfd The socket being closed.
+ */
+void tk_telemetry_on_close(httpd_handle_t server, int sockfd);
@@ -0,0 +1,239 @@
+/**
+ * @file verify.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Checks an app image while it streams, independently of the flash.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "verify.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+
+#define TAG "OTA"
+
+/**
+ * @brief Checks the image header and the app description as soon as they are
+ * available, before anything is passed on.
+ *
+ * @param verifier The verifier, with a complete header buffer.
+ * @return esp_err_t ESP_OK if the image can be written.
+ */
+static esp_err_t tk_ota_verify_header(tk_ota_verifier_t *verifier) {
+  const tk_ota_expect_t *expect = &verifier->expect;
+  const esp_image_header_t *header =
+      (const esp_image_header_t *)verifier->header;
+  const esp_app_desc_t *desc =
+      (const esp_app_desc_t *)(verifier->header + sizeof(esp_image_header_t) +
+                               sizeof(esp_image_segment_header_t));
+
+  if (header->magic != ESP_IMAGE_HEADER_MAGIC) {
+    ESP_LOGE(TAG, "Invalid image magic 0x%02x.", header->magic);
+    return ESP_ERR_IMAGE_INVALID;
+  }
+
+  if (header->chip_id != expect->chip_id) {
+    ESP_LOGE(TAG, "Image is built for chip %d, this is chip %d.",
+             header->chip_id, expect->chip_id);
+    return ESP_ERR_IMAGE_INVALID;
+  }
+
+  if (header->segment_count == 0 ||
+      header->segment_count > ESP_IMAGE_MAX_SEGMENTS) {
+    ESP_LOGE(TAG, "Invalid segment count %d.", header->segment_count);
+    return ESP_ERR_IMAGE_INVALID;
+  }
+
+  if (desc->magic_word != ESP_APP_DESC_MAGIC_WORD) {
+    ESP_LOGE(TAG, "Image has no app description.");
+    return ESP_ERR_IMAGE_INVALID;
+  }
+
+  if (strncmp(desc->project_name, expect->project_name,
+              sizeof(desc->project_name)) != 0) {
+    ESP_LOGE(TAG, "Image is for project \"%.32s\", not \"%.32s\".",
+             desc->project_name, expect->project_name);
+    return ESP_ERR_IMAGE_INVALID;
+  }
+
+  // Refuse the version that already failed to boot
+  if (expect->rejected_version[0] != '\0' &&
+      strncmp(desc->version, expect->rejected_version,
+              sizeof(desc->version)) == 0) {
+    ESP_LOGE(TAG, "Version %.32s was previously rolled back.", desc->version);
+    return ESP_ERR_OTA_VALIDATE_FAILED;
+  }
+
+  if (!expect->allow_same_version &&
+      strncmp(desc->version, expect->version, sizeof(desc->version)) == 0) {
+    ESP_LOGE(TAG, "Version %.32s is already running.", desc->version);
+    return ESP_ERR_OTA_VALIDATE_FAILED;
+  }
+
+  verifier->hash_appended = header->hash_appended == 1;
+
+  ESP_LOGI(TAG, "Image header verified: %.32s %.32s, %d segments%s.",
+           desc->project_name, desc->version, header->segment_count,
+           verifier->hash_appended ? ", SHA-256 appended" : "");
+
+  return ESP_OK;
+}
+
+/**
+ * @brief Hashes a block, holding back the last bytes of the stream as they
+ * could be the appended hash.
+ *
+ * @param verifier The verifier.
+ * @param data The block.
+ * @param len The block length.
+ */
+static void tk_ota_hash_update(tk_ota_verifier_t *verifier,
+                               const uint8_t *data, size_t len) {
+  if (!verifier->hash_appended) {
+    mbedtls_sha256_update_ret(&verifier->sha, data, len);
+    return;
+  }
+
+  size_t total = verifier->tail_len + len;
+  if (total <= TK_OTA_HASH_LEN) {
+    memcpy(verifier->tail + verifier->tail_len, data, len);
+    verifier->tail_len = total;
+    return;
+  }
+
+  // Everything but the last TK_OTA_HASH_LEN bytes can be hashed now
+  size_t hashable = total - TK_OTA_HASH_LEN;
+  size_t from_tail =
+      hashable < verifier->tail_len ? hashable : verifier->tail_len;
+  size_t from_data = hashable - from_tail;
+
+  mbedtls_sha256_update_ret(&verifier->sha, verifier->tail, from_tail);
+  mbedtls_sha256_update_ret(&verifier->sha, data, from_data);
+
+  // New tail: what is left of the old one, then the end of this block
+  size_t tail_left = verifier->tail_len - from_tail;
+  memmove(verifier->tail, verifier->tail + from_tail, tail_left);
+  memcpy(verifier->tail + tail_left, data + from_data, len - from_data);
+  verifier->tail_len = TK_OTA_HASH_LEN;
+}
+
+/**
+ * @brief Hashes a block and passes it on.
+ *
+ */
+static esp_err_t tk_ota_pass(tk_ota_verifier_t *verifier, const uint8_t *data,
+                             size_t len) {
+  tk_ota_hash_update(verifier, data, len);
+  return verifier->sink.write(verifier->sink.ctx, data, len);
+}
+
+esp_err_t tk_ota_verifier_begin(tk_ota_verifier_t *verifier,
+                                const tk_ota_expect_t *expect,
+                                const tk_ota_sink_t *sink, size_t image_len) {
+  memset(verifier, 0, sizeof(*verifier));
+  verifier->expect = *expect;
+  verifier->sink = *sink;
+
+  if (image_len > expect->capacity) {
+    ESP_LOGE(TAG, "Image is %d bytes, partition is %d bytes.", image_len,
+             expect->capacity);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  verifier->image_len = image_len;
+
+  mbedtls_sha256_init(&verifier->sha);
+  mbedtls_sha256_starts_ret(&verifier->sha, 0);
+
+  return ESP_OK;
+}
+
+esp_err_t tk_ota_verifier_write(tk_ota_verifier_t *verifier, const void *data,
+                                size_t len) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  esp_err_t err;
+
+  if (verifier->image_len > 0 &&
+      verifier->received + len > verifier->image_len) {
+    ESP_LOGE(TAG, "Received more data than the announced %d bytes.",
+             verifier->image_len);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  if (verifier->received + len > verifier->expect.capacity) {
+    ESP_LOGE(TAG, "Image does not fit in the update partition.");
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  verifier->received += len;
+
+  // Fill the header first
+  if (!verifier->verified) {
+    size_t needed = TK_OTA_HEADER_LEN - verifier->header_len;
+    size_t copy = len < needed ? len : needed;
+    memcpy(verifier->header + verifier->header_len, bytes, copy);
+    verifier->header_len += copy;
+    bytes += copy;
+    len -= copy;
+
+    if (verifier->header_len < TK_OTA_HEADER_LEN)
+      return ESP_OK;
+
+    err = tk_ota_verify_header(verifier);
+    if (err != ESP_OK)
+      return err;
+
+    // The header is fine, erasing is now worth it
+    err = verifier->sink.begin(verifier->sink.ctx);
+    if (err != ESP_OK)
+      return err;
+    verifier->verified = true;
+
+    err = tk_ota_pass(verifier, verifier->header, verifier->header_len);
+    if (err != ESP_OK)
+      return err;
+  }
+
+  if (len == 0)
+    return ESP_OK;
+
+  return tk_ota_pass(verifier, bytes, len);
+}
+
+esp_err_t tk_ota_verifier_finish(tk_ota_verifier_t *verifier) {
+  esp_err_t err = ESP_OK;
+
+  if (!verifier->verified) {
+    ESP_LOGE(TAG, "Image truncated inside the header (%d bytes).",
+             verifier->received);
+    err = ESP_ERR_IMAGE_INVALID;
+  } else if (verifier->image_len > 0 &&
+             verifier->received < verifier->image_len) {
+    ESP_LOGE(TAG, "Image truncated: %d of %d bytes.", verifier->received,
+             verifier->image_len);
+    err = ESP_ERR_INVALID_SIZE;
+  } else if (verifier->hash_appended) {
+    uint8_t digest[TK_OTA_HASH_LEN];
+    mbedtls_sha256_finish_ret(&verifier->sha, digest);
+
+    if (verifier->tail_len != TK_OTA_HASH_LEN ||
+        memcmp(digest, verifier->tail, TK_OTA_HASH_LEN) != 0) {
+      ESP_LOGE(TAG, "Image SHA-256 mismatch.");
+      err = ESP_ERR_IMAGE_INVALID;
+    } else {
+      ESP_LOGI(TAG, "Image SHA-256 verified.");
+    }
+  }
+
+  tk_ota_verifier_free(verifier);
+  return err;
+}
+
+void tk_ota_verifier_free(tk_ota_verifier_t *verifier) {
+  mbedtls_sha256_free(&verifier->sha);
+}
@@ -0,0 +1,121 @@
+/**
+ * @file verify.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Checks an app image while it streams, independently of the flash.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ * The image header, chip and version are checked as soon as enough bytes have
+ * arrived, before anything reaches the sink, and the SHA-256 is computed over
+ * what is passed on. Everything the checks depend on is in tk_ota_expect_t,
+ * so test/host runs the same code over images built in memory.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_app_format.h"
+#include "esp_err.h"
+#include "esp_image_format.h"
+#include "mbedtls/sha256.h"
+
+// Bytes needed before the image header and the app description can be checked
+#define TK_OTA_HEADER_LEN                                                      \
+  (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) +           \
+   sizeof(esp_app_desc_t))
+
+#define TK_OTA_HASH_LEN 32
+
+/**
+ * @brief What an image must match, from the running app.
+ *
+ */
+typedef struct {
+  uint16_t chip_id;
+  char project_name[32];
+  char version[32];
+
+  // The version that failed to boot, empty if none did
+  char rejected_version[32];
+  bool allow_same_version;
+
+  // Room for the image
+  size_t capacity;
+} tk_ota_expect_t;
+
+/**
+ * @brief Where the verified image goes.
+ *
+ */
+typedef struct {
+  // Called once, when the header has been verified, before the first write
+  esp_err_t (*begin)(void *ctx);
+  esp_err_t (*write)(void *ctx, const uint8_t *data, size_t len);
+  void *ctx;
+} tk_ota_sink_t;
+
+typedef struct {
+  tk_ota_expect_t expect;
+  tk_ota_sink_t sink;
+
+  // Total image length, 0 if unknown
+  size_t image_len;
+  size_t received;
+
+  // Held until it is verified, then passed on first
+  uint8_t header[TK_OTA_HEADER_LEN];
+  size_t header_len;
+  bool verified;
+
+  // The trailing bytes are held back, they could be the appended hash
+  mbedtls_sha256_context sha;
+  bool hash_appended;
+  uint8_t tail[TK_OTA_HASH_LEN];
+  size_t tail_len;
+} tk_ota_verifier_t;
+
+/**
+ * @brief Prepares a verifier for a new image.
+ *
+ * @param verifier The verifier.
+ * @param expect What the image must match, copied.
+ * @param sink Where the image goes, copied.
+ * @param image_len The expected image length, 0 if unknown.
+ * @return esp_err_t ESP_OK, or ESP_ERR_INVALID_SIZE if the image cannot fit.
+ */
+esp_err_t tk_ota_verifier_begin(tk_ota_verifier_t *verifier,
+                                const tk_ota_expect_t *expect,
+                                const tk_ota_sink_t *sink, size_t image_len);
+
+/**
+ * @brief Checks a block and passes it to the sink, once the header is
+ * verified.
+ *
+ * @param verifier The verifier.
+ * @param data The block.
+ * @param len The block length.
+ * @return esp_err_t ESP_OK, the reason why the image was rejected, or the
+ * error of the sink.
+ */
+esp_err_t tk_ota_verifier_write(tk_ota_verifier_t *verifier, const void *data,
+                                size_t len);
+
+/**
+ * @brief Checks the length and the appended hash, once the stream has ended.
+ * The verifier is released in any case.
+ *
+ * @param verifier The verifier.
+ * @return esp_err_t ESP_OK if the image is complete and intact.
+ */
+esp_err_t tk_ota_verifier_finish(tk_ota_verifier_t *verifier);
+
+/**
+ * @brief Releases a verifier that will not be finished.
+ *
+ * @param verifier The verifier.
+ */
+void tk_ota_verifier_free(tk_ota_verifier_t *verifier);
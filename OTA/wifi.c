@@ -9,9 +9,13 @@
  */
 
 #include "OTA/server.h"
+#include "diag/metrics.h"
 #include "esp_event.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include <esp_log.h>
 #include <mdns.h>
 #include <stdio.h>
@@ -19,6 +23,7 @@
 #include <string.h>
 
 #include "model/datastore.h"
+#include "ui/refresh/refresh.h"
 #include "ota.h"
 #include "wifi.h"
 
@@ -32,6 +37,24 @@ const int AP_CLIENT_DISCONNECTED_BIT = BIT1;
 const int WIFI_STA_CONNECTED_BIT = BIT0;
 const int WIFI_STA_DISCONNECTED_BIT = BIT1;
 
+// Serializes start, stop and the web server handling in the event handler
+static SemaphoreHandle_t wifi_mutex = NULL;
+static StaticSemaphore_t wifi_mutex_buffer;
+
+// One-time initialisation, kept across start/stop cycles
+static bool wifi_initialized = false;
+static bool wifi_sta_active = false;
+static httpd_handle_t *wifi_server = NULL;
+
+static int64_t wifi_start_us = 0;
+
+static tk_metric_t wifi_bringup_metric =
+    TK_METRIC_GAUGE("tk_wifi_ap_bringup_ms",
+                    "Time from the enable request to the soft AP running.");
+static tk_metric_t wifi_released_metric =
+    TK_METRIC_GAUGE("tk_wifi_heap_released_bytes",
+                    "Heap returned by the last soft AP shutdown.");
+
 static char *rand_string(char *str, size_t size) {
   const char charset[] =
       "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
@@ -45,6 +68,32 @@ static char *rand_string(char *str, size_t size) {
   return str;
 }
 
+static void wifi_lock(void) { xSemaphoreTake(wifi_mutex, portMAX_DELAY); }
+
+static void wifi_unlock(void) { xSemaphoreGive(wifi_mutex); }
+
+/**
+ * @brief Starts the web server, unless the access point is going down.
+ *
+ * @param server The server handle.
+ */
+static void wifi_server_start(httpd_handle_t *server) {
+  wifi_lock();
+  if (*server == NULL && global_datastore.wifi_settings.ap_enable) {
+    *server = start_OTA_webserver();
+  }
+  wifi_unlock();
+}
+
+static void wifi_server_stop(httpd_handle_t *server) {
+  wifi_lock();
+  if (*server) {
+    stop_OTA_webserver(*server);
+    *server = NULL;
+  }
+  wifi_unlock();
+}
+
 static esp_err_t event_handler(void *ctx, system_event_t *event) {
   httpd_handle_t *server = (httpd_handle_t *)ctx;
 
@@ -69,13 +118,10 @@ static esp_err_t event_handler(void *ctx, system_event_t *event) {
   case SYSTEM_EVENT_STA_DISCONNECTED: /**< ESP32 station disconnected from AP */
     ESP_LOGI(TAG, "SYSTEM_EVENT_STA_DISCONNECTED\r");
     esp_wifi_connect();
-    xEventGroupClearBits(wifi_event_group, WIFI_STA_DISCONNECTED_BIT);
+    xEventGroupClearBits(wifi_event_group, WIFI_STA_CONNECTED_BIT);
     ESP_LOGI(TAG, "retry to connect to the AP\r");
     /* Stop the web server */
-    if (*server) {
-      stop_OTA_webserver(*server);
-      *server = NULL;
-    }
+    wifi_server_stop(server);
     break;
 
   case SYSTEM_EVENT_STA_AUTHMODE_CHANGE:
@@ -87,9 +133,7 @@ static esp_err_t event_handler(void *ctx, system_event_t *event) {
              ip4addr_ntoa(&event->event_info.got_ip.ip_info.ip));
     xEventGroupSetBits(wifi_event_group, WIFI_STA_CONNECTED_BIT);
     /* Start the web server */
-    if (*server == NULL) {
-      *server = start_OTA_webserver();
-    }
+    wifi_server_start(server);
     break;
 
   case SYSTEM_EVENT_STA_LOST_IP:
@@ -109,6 +153,12 @@ static esp_err_t event_handler(void *ctx, system_event_t *event) {
     break; /**< ESP32 station wps pin code in enrollee mode */
   case SYSTEM_EVENT_AP_START:
     ESP_LOGI(TAG, "SYSTEM_EVENT_AP_START\r");
+    if (wifi_start_us != 0) {
+      int32_t bringup_ms = (esp_timer_get_time() - wifi_start_us) / 1000;
+      tk_metric_set(&wifi_bringup_metric, bringup_ms);
+      ESP_LOGI(TAG, "SoftAP up in %d ms.", bringup_ms);
+      wifi_start_us = 0;
+    }
     break; /**< ESP32 soft-AP start */
   case SYSTEM_EVENT_AP_STOP:
     ESP_LOGI(TAG, "SYSTEM_EVENT_AP_STOP\r");
@@ -122,9 +172,7 @@ static esp_err_t event_handler(void *ctx, system_event_t *event) {
              event->event_info.sta_connected.aid);
     xEventGroupSetBits(wifi_event_group, AP_CLIENT_CONNECTED_BIT);
     /* Start the web server */
-    if (*server == NULL) {
-      *server = start_OTA_webserver();
-    }
+    wifi_server_start(server);
     break;
 
   case SYSTEM_EVENT_AP_STADISCONNECTED: /**< a station disconnected from ESP32
@@ -135,10 +183,7 @@ static esp_err_t event_handler(void *ctx, system_event_t *event) {
              event->event_info.sta_disconnected.aid);
     xEventGroupSetBits(wifi_event_group, AP_CLIENT_DISCONNECTED_BIT);
     /* Stop the web server */
-    if (*server) {
-      stop_OTA_webserver(*server);
-      *server = NULL;
-    }
+    wifi_server_stop(server);
     break;
 
   case SYSTEM_EVENT_AP_PROBEREQRECVED:
@@ -176,9 +221,6 @@ static esp_err_t event_handler(void *ctx, system_event_t *event) {
 
 void start_dhcp_server(void) {
 
-  // initialize the tcp stack
-  tcpip_adapter_init();
-
   // stop DHCP server
   ESP_ERROR_CHECK(tcpip_adapter_dhcps_stop(TCPIP_ADAPTER_IF_AP));
 
@@ -207,21 +249,49 @@ void start_mdns() {
   mdns_service_add(NULL, "_http", "_tcp", 80, NULL, 0);
 }
 
-void wifi_init_softap(void *arg) {
+/**
+ * @brief TCP/IP stack, event loop and AP addressing. These can only be set up
+ * once and survive the radio being stopped.
+ *
+ * @param arg The web server handle, passed to the event handler.
+ */
+static void wifi_init_once(void *arg) {
+  if (wifi_initialized)
+    return;
 
   // Random seed
   time_t t;
   srand((unsigned)time(&t));
 
-  ESP_LOGI(TAG, "Starting SoftAP for OTA.");
-
-  start_dhcp_server();
-
   wifi_event_group = xEventGroupCreate();
+  wifi_server = (httpd_handle_t *)arg;
 
   tcpip_adapter_init();
+  start_dhcp_server();
   ESP_ERROR_CHECK(esp_event_loop_init(event_handler, arg));
 
+  tk_metrics_register(&wifi_bringup_metric);
+  tk_metrics_register(&wifi_released_metric);
+
+  wifi_initialized = true;
+}
+
+void wifi_init(void) {
+  wifi_mutex = xSemaphoreCreateMutexStatic(&wifi_mutex_buffer);
+}
+
+void wifi_init_softap(void *arg) {
+  wifi_lock();
+
+  if (global_datastore.wifi_settings.ap_enable || wifi_sta_active) {
+    wifi_unlock();
+    return;
+  }
+
+  ESP_LOGI(TAG, "Starting SoftAP for OTA.");
+  wifi_start_us = esp_timer_get_time();
+
+  wifi_init_once(arg);
   start_mdns();
 
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
@@ -265,16 +335,107 @@ void wifi_init_softap(void *arg) {
   ESP_ERROR_CHECK(esp_wifi_set_max_tx_power(8));
 
   global_datastore.wifi_settings.ap_enable = true;
+  tk_refresh_request();
+
+  wifi_unlock();
 
-  ESP_LOGI(TAG, "SoftAP started.");
+  ESP_LOGI(TAG, "SoftAP starting.");
 }
 
 void wifi_stop_softap(void *arg) {
-  ESP_LOGW(TAG, "Stopping OTA AP is not supported.");
-  // ESP_ERROR_CHECK(esp_wifi_stop());
-  // ESP_ERROR_CHECK(esp_wifi_deinit());
+  wifi_lock();
+
+  if (!global_datastore.wifi_settings.ap_enable) {
+    wifi_unlock();
+    return;
+  }
+
+  uint32_t heap_before = esp_get_free_heap_size();
+
+  // Late station events must not bring the server back
+  global_datastore.wifi_settings.ap_enable = false;
+  wifi_start_us = 0;
+  tk_refresh_request();
+
+  if (wifi_server != NULL && *wifi_server != NULL) {
+    stop_OTA_webserver(*wifi_server);
+    *wifi_server = NULL;
+  }
+
+  // Releases the driver buffers and the Wi-Fi task
+  ESP_ERROR_CHECK(esp_wifi_stop());
+  ESP_ERROR_CHECK(esp_wifi_deinit());
+  mdns_free();
+
+  wifi_unlock();
+
+  int32_t released = (int32_t)esp_get_free_heap_size() - (int32_t)heap_before;
+  tk_metric_set(&wifi_released_metric, released);
+
+  ESP_LOGI(TAG, "SoftAP stopped, %d bytes of heap released.", released);
+}
+
+esp_err_t wifi_connect_sta(const char *ssid, const char *password,
+                           TickType_t timeout) {
+  wifi_lock();
+
+  if (global_datastore.wifi_settings.ap_enable || wifi_sta_active) {
+    wifi_unlock();
+    ESP_LOGE(TAG, "Wi-Fi is already in use.");
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  ESP_LOGI(TAG, "Connecting to \"%s\".", ssid);
+
+  wifi_init_once(&OTA_server);
+  xEventGroupClearBits(wifi_event_group, WIFI_STA_CONNECTED_BIT);
+
+  wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+  ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+  ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+  ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+
+  wifi_config_t sta_config = {0};
+  strncpy((char *)sta_config.sta.ssid, ssid, sizeof(sta_config.sta.ssid));
+  strncpy((char *)sta_config.sta.password, password,
+          sizeof(sta_config.sta.password));
+
+  ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
+
+  // The event handler connects on start and reconnects on every drop
+  ESP_ERROR_CHECK(esp_wifi_start());
+  wifi_sta_active = true;
+
+  wifi_unlock();
+
+  EventBits_t bits = xEventGroupWaitBits(
+      wifi_event_group, WIFI_STA_CONNECTED_BIT, pdFALSE, pdFALSE, timeout);
+
+  if ((bits & WIFI_STA_CONNECTED_BIT) == 0) {
+    ESP_LOGE(TAG, "No connection to \"%s\".", ssid);
+    wifi_disconnect_sta();
+    return ESP_ERR_TIMEOUT;
+  }
+
+  return ESP_OK;
+}
+
+void wifi_disconnect_sta(void) {
+  wifi_lock();
+
+  if (!wifi_sta_active) {
+    wifi_unlock();
+    return;
+  }
+
+  wifi_sta_active = false;
+
+  esp_wifi_disconnect();
+  ESP_ERROR_CHECK(esp_wifi_stop());
+  ESP_ERROR_CHECK(esp_wifi_deinit());
+  xEventGroupClearBits(wifi_event_group, WIFI_STA_CONNECTED_BIT);
 
-  // global_datastore.wifi_settings.ap_enable = false;
+  wifi_unlock();
 
-  // ESP_LOGI(TAG, "SoftAP stopped.");
+  ESP_LOGI(TAG, "Station stopped.");
 }
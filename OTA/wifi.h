@@ -8,5 +8,48 @@
  * 
  */
 
+#pragma once
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+/**
+ * @brief Creates the lock the other functions share. Once at boot, before any
+ * of them.
+ *
+ */
+void wifi_init(void);
+
+/**
+ * @brief Starts the OTA access point. The network stack and the event loop are
+ * initialized on the first call only.
+ *
+ * @param arg Pointer to the web server handle.
+ */
 void wifi_init_softap(void *arg);
-void wifi_stop_softap(void *arg);
\ No newline at end of file
+
+/**
+ * @brief Stops the OTA access point and the web server, and releases the Wi-Fi
+ * driver.
+ *
+ * @param arg Unused.
+ */
+void wifi_stop_softap(void *arg);
+
+/**
+ * @brief Joins a network as a station, with the access point stopped.
+ *
+ * @param ssid The network name.
+ * @param password The network password.
+ * @param timeout How long to wait for an IP address.
+ * @return esp_err_t ESP_OK once connected. Dropped connections are retried
+ * until wifi_disconnect_sta.
+ */
+esp_err_t wifi_connect_sta(const char *ssid, const char *password,
+                           TickType_t timeout);
+
+/**
+ * @brief Leaves the station network and releases the Wi-Fi driver.
+ *
+ */
+void wifi_disconnect_sta(void);
@@ -0,0 +1,353 @@
+/**
+ * @file bench.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Microbenchmarks, run from the console by name.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "diag/bench.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "lvgl/lvgl.h"
+#include "ui/assets/assets.h"
+#include "ui/fonts/glyph_cache.h"
+#include "ui/styles/tk_theme.h"
+#include "ui/widgets/tk_gauge.h"
+
+#include "esp_timer.h"
+#include "xtensa/hal.h"
+
+#define TK_BENCH_NOW() xthal_get_ccount()
+#define TK_BENCH_UNIT "cycles"
+#else
+#include <time.h>
+
+static uint32_t tk_bench_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+#define TK_BENCH_NOW() tk_bench_ns()
+#define TK_BENCH_UNIT "ns"
+#endif
+
+static void tk_bench_add(tk_bench_result_t *out, const char *name,
+                         const char *unit, uint64_t total_x10) {
+  if (out->count == TK_BENCH_VALUES)
+    return;
+
+  out->values[out->count].name = name;
+  out->values[out->count].unit = unit;
+  out->values[out->count].value_x10 = total_x10 / out->runs;
+  out->count++;
+}
+
+// -------------------- FLOAT --------------------
+
+// Inputs, read through volatile so nothing is folded at compile time
+static volatile float inputs[] = {0.6f, 0.35f, 17.3f, 1840.f, 86.5f, 0.42f};
+
+/**
+ * @brief One refresh worth of model and display conversions, in type T.
+ *
+ */
+#define TK_FLOAT_BENCH_KERNEL(T, name)                                         \
+  static int32_t __attribute__((noinline)) name(uint32_t i) {                 \
+    T level = (T)inputs[0], light = (T)inputs[1] + (T)(i & 7) / 100;           \
+    T speed = (T)inputs[2], rpm = (T)inputs[3], temp = (T)inputs[4];           \
+    T slider = (T)inputs[5];                                                   \
+    int32_t acc = 0;                                                           \
+                                                                               \
+    /* exp_roll_avg and brightness_write */                                    \
+    level -= level / 10;                                                       \
+    level += light / 10;                                                       \
+    acc += 20 + (int32_t)(level * (T)(1023 - 20));                             \
+                                                                               \
+    /* Speed arc and label */                                                  \
+    if (speed > (T)2.5)                                                        \
+      acc += (int32_t)(speed * 10);                                            \
+    acc += (int32_t)(speed * 10 + (T)0.5);                                     \
+                                                                               \
+    /* RPM arc */                                                              \
+    acc += (int32_t)rpm;                                                       \
+                                                                               \
+    /* Temperature in Fahrenheit, in tenths */                                 \
+    acc += (int32_t)(((temp * ((T)9 / 5)) + 32) * 10 + (T)0.5);                \
+                                                                               \
+    /* Menu slider, value to position and back */                              \
+    T perc = (slider - 0) / (1 - 0);                                           \
+    int32_t steps = (int32_t)(perc * 400);                                     \
+    acc += (int32_t)(((T)steps / 400 * (1 - 0) + 0) * 1000);                   \
+                                                                               \
+    return acc;                                                                \
+  }
+
+TK_FLOAT_BENCH_KERNEL(double, tk_bench_double)
+TK_FLOAT_BENCH_KERNEL(float, tk_bench_float)
+
+/**
+ * @brief The refresh path math in double and in float.
+ *
+ */
+static void tk_bench_types(uint32_t runs, tk_bench_result_t *out) {
+  volatile int32_t sink = 0;
+
+  uint32_t start = TK_BENCH_NOW();
+  for (uint32_t i = 0; i < runs; i++)
+    sink += tk_bench_double(i);
+  uint32_t double_time = TK_BENCH_NOW() - start;
+
+  start = TK_BENCH_NOW();
+  for (uint32_t i = 0; i < runs; i++)
+    sink += tk_bench_float(i);
+  uint32_t float_time = TK_BENCH_NOW() - start;
+
+  (void)sink;
+  tk_bench_add(out, "double", TK_BENCH_UNIT, (uint64_t)double_time * 10);
+  tk_bench_add(out, "float", TK_BENCH_UNIT, (uint64_t)float_time * 10);
+}
+
+#ifdef ESP_PLATFORM
+
+/**
+ * @brief Puts a scratch screen up, for the cases that draw alone.
+ *
+ */
+static lv_obj_t *tk_bench_screen(void) {
+  lv_obj_t *screen = lv_obj_create(NULL, NULL);
+  lv_scr_load(screen);
+  return screen;
+}
+
+static void tk_bench_screen_done(lv_obj_t *previous, lv_obj_t *screen) {
+  lv_scr_load(previous);
+  lv_obj_del(screen);
+}
+
+// -------------------- GAUGE --------------------
+
+/**
+ * @brief Steps a widget through jumps of varying size both ways, as sparse
+ * samples give, one synchronous frame each.
+ *
+ */
+static int64_t tk_bench_widget(lv_obj_t *widget, bool gauge, uint32_t runs) {
+  int64_t start = esp_timer_get_time();
+
+  for (uint32_t i = 1; i <= runs; i++) {
+    int16_t value = (i * 37) % 101;
+    if (gauge)
+      tk_gauge_set_value(widget, value);
+    else
+      lv_arc_set_value(widget, value);
+    lv_refr_now(NULL);
+  }
+
+  return esp_timer_get_time() - start;
+}
+
+/**
+ * @brief A value change on lv_arc and on tk_gauge, alone with the main view's
+ * geometry. The flush is the same for the same area, the difference is the
+ * drawing.
+ *
+ */
+static void tk_bench_gauge(uint32_t runs, tk_bench_result_t *out) {
+  lv_obj_t *previous = lv_scr_act();
+  lv_obj_t *screen = tk_bench_screen();
+
+  lv_obj_t *arc = lv_arc_create(screen, NULL);
+  lv_arc_set_bg_angles(arc, 60, 300);
+  lv_arc_set_angles(arc, 60, 300);
+  lv_arc_set_rotation(arc, 90);
+  lv_arc_set_range(arc, 0, 100);
+  lv_obj_set_size(arc, 200, 200);
+  lv_obj_set_style_local_pad_all(arc, LV_ARC_PART_BG, LV_STATE_DEFAULT, 0);
+  lv_obj_align(arc, NULL, LV_ALIGN_CENTER, 0, 0);
+
+  lv_obj_t *gauge = tk_gauge_create(screen);
+  tk_gauge_set_angles(gauge, 150, 240);
+  tk_gauge_set_range(gauge, 0, 100);
+  lv_obj_set_size(gauge, 200, 200);
+  lv_obj_set_style_local_pad_all(gauge, TK_GAUGE_PART_BG, LV_STATE_DEFAULT, 0);
+  lv_obj_align(gauge, NULL, LV_ALIGN_CENTER, 0, 0);
+
+  // Full frames first, and the mask rendered, outside the measure
+  lv_obj_set_hidden(gauge, true);
+  lv_refr_now(NULL);
+  tk_bench_add(out, "lv_arc", "us", tk_bench_widget(arc, false, runs) * 10);
+
+  lv_obj_set_hidden(arc, true);
+  lv_obj_set_hidden(gauge, false);
+  lv_refr_now(NULL);
+  tk_bench_add(out, "tk_gauge", "us", tk_bench_widget(gauge, true, runs) * 10);
+
+  tk_bench_screen_done(previous, screen);
+}
+
+// -------------------- GLYPH --------------------
+
+/**
+ * @brief Counts on a label with every digit changing, as an RPM readout does,
+ * one synchronous frame per number.
+ *
+ */
+static int64_t tk_bench_label(lv_obj_t *label, uint32_t runs) {
+  int64_t start = esp_timer_get_time();
+
+  for (uint32_t i = 1; i <= runs; i++) {
+    lv_label_set_text_fmt(label, "%u", (i * 1237) % 10000);
+    lv_refr_now(NULL);
+  }
+
+  return esp_timer_get_time() - start;
+}
+
+/**
+ * @brief A readout change in the title font, compressed and cached.
+ *
+ */
+static void tk_bench_glyph(uint32_t runs, tk_bench_result_t *out) {
+  lv_obj_t *previous = lv_scr_act();
+  lv_obj_t *screen = tk_bench_screen();
+
+  lv_obj_t *label = lv_label_create(screen, NULL);
+  lv_label_set_align(label, LV_LABEL_ALIGN_CENTER);
+  lv_label_set_long_mode(label, LV_LABEL_LONG_CROP);
+  lv_obj_set_width(label, 120);
+  lv_obj_align(label, NULL, LV_ALIGN_CENTER, 0, 0);
+
+  lv_obj_set_style_local_text_font(label, LV_LABEL_PART_MAIN, LV_STATE_DEFAULT,
+                                   tk_font(TK_FONT_TITLE));
+  lv_refr_now(NULL);
+  tk_bench_add(out, "compressed", "us", tk_bench_label(label, runs) * 10);
+
+  tk_glyph_cache_stats_t before, after;
+  lv_obj_set_style_local_text_font(
+      label, LV_LABEL_PART_MAIN, LV_STATE_DEFAULT,
+      tk_glyph_cache_wrap(tk_font(TK_FONT_TITLE), TK_GLYPH_CACHE_NUMERIC));
+  lv_refr_now(NULL);
+  tk_glyph_cache_get_stats(&before);
+  tk_bench_add(out, "cached", "us", tk_bench_label(label, runs) * 10);
+  tk_glyph_cache_get_stats(&after);
+
+  // A share of the lookups, not a time: scaled up by the runs it is divided by
+  uint32_t hits = after.hits - before.hits;
+  uint32_t lookups = hits + after.misses - before.misses;
+  tk_bench_add(out, "hits", "%",
+               lookups > 0 ? (uint64_t)hits * 1000 * runs / lookups : 0);
+
+  tk_bench_screen_done(previous, screen);
+}
+
+// -------------------- THEME --------------------
+
+typedef enum {
+  TK_BENCH_SWAP,
+  TK_BENCH_SWITCH,
+  TK_BENCH_RESTYLE,
+  TK_BENCH_REDRAW,
+} tk_bench_theme_kind_t;
+
+/**
+ * @brief Switches back and forth from the mode shown, on the view shown. The
+ * restyle kind also restyles every object, as when the styles were rebuilt;
+ * the redraw kind only invalidates the screen.
+ *
+ */
+static int64_t tk_bench_switches(tk_bench_theme_kind_t kind, uint32_t runs) {
+  bool light = tk_theme_is_light();
+  int64_t start = esp_timer_get_time();
+
+  for (uint32_t i = 0; i < runs; i++) {
+    if (kind == TK_BENCH_REDRAW) {
+      lv_obj_invalidate(lv_scr_act());
+    } else {
+      light = !light;
+      tk_theme_set(light);
+    }
+
+    if (kind == TK_BENCH_RESTYLE)
+      lv_obj_report_style_mod(NULL);
+
+    if (kind != TK_BENCH_SWAP)
+      lv_refr_now(NULL);
+  }
+
+  return esp_timer_get_time() - start;
+}
+
+/**
+ * @brief A theme switch alone, then with the frame drawn after it.
+ *
+ */
+static void tk_bench_theme(uint32_t runs, tk_bench_result_t *out) {
+  bool light = tk_theme_is_light();
+
+  // Nothing pending from before is drawn by the first switch
+  lv_refr_now(NULL);
+
+  tk_bench_add(out, "swap", "us", tk_bench_switches(TK_BENCH_SWAP, runs) * 10);
+  tk_theme_set(light);
+  lv_refr_now(NULL);
+
+  tk_bench_add(out, "switch", "us",
+               tk_bench_switches(TK_BENCH_SWITCH, runs) * 10);
+  tk_bench_add(out, "restyle", "us",
+               tk_bench_switches(TK_BENCH_RESTYLE, runs) * 10);
+  tk_bench_add(out, "redraw", "us",
+               tk_bench_switches(TK_BENCH_REDRAW, runs) * 10);
+
+  tk_theme_set(light);
+  lv_refr_now(NULL);
+}
+
+#endif
+
+const tk_bench_case_t tk_bench_cases[] = {
+    {.name = "float",
+     .run_name = "refreshes",
+     .default_runs = 1000,
+     .run = tk_bench_types},
+#ifdef ESP_PLATFORM
+    {.name = "gauge",
+     .run_name = "value changes",
+     .default_runs = 100,
+     .gui = true,
+     .run = tk_bench_gauge},
+    {.name = "glyph",
+     .run_name = "readout changes",
+     .default_runs = 100,
+     .gui = true,
+     .run = tk_bench_glyph},
+    {.name = "theme",
+     .run_name = "switches",
+     .default_runs = 20,
+     .gui = true,
+     .run = tk_bench_theme},
+#endif
+    {0},
+};
+
+const tk_bench_case_t *tk_bench_find(const char *name) {
+  for (const tk_bench_case_t *bench = tk_bench_cases; bench->name != NULL;
+       bench++)
+    if (strcmp(bench->name, name) == 0)
+      return bench;
+
+  return NULL;
+}
+
+void tk_bench_run(const tk_bench_case_t *bench, uint32_t runs,
+                  tk_bench_result_t *out) {
+  memset(out, 0, sizeof *out);
+  out->runs = runs > 0 ? runs : bench->default_runs;
+  bench->run(out->runs, out);
+}
@@ -0,0 +1,68 @@
+/**
+ * @file bench.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Microbenchmarks, run from the console by name.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ * Each case runs a small kernel a number of times and reports one or more
+ * averages per run. The GUI cases take over the screen or the theme, and
+ * count synchronous frames, flush included, so they run on the GUI task.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TK_BENCH_VALUES 4
+
+typedef struct {
+  uint32_t runs;
+  uint8_t count;
+
+  struct {
+    const char *name;
+    const char *unit;
+
+    // Per run, in tenths
+    uint32_t value_x10;
+  } values[TK_BENCH_VALUES];
+} tk_bench_result_t;
+
+typedef struct {
+  const char *name;
+
+  // What a run is, and how many by default
+  const char *run_name;
+  uint32_t default_runs;
+
+  // Whether the case must run on the GUI task
+  bool gui;
+
+  void (*run)(uint32_t runs, tk_bench_result_t *out);
+} tk_bench_case_t;
+
+/**
+ * @brief The cases, terminated by one without a name.
+ *
+ */
+extern const tk_bench_case_t tk_bench_cases[];
+
+/**
+ * @brief A case by name.
+ *
+ * @return const tk_bench_case_t* The case, or NULL if there is none.
+ */
+const tk_bench_case_t *tk_bench_find(const char *name);
+
+/**
+ * @brief Runs a case, from the GUI task if the case says so.
+ *
+ * @param bench The case.
+ * @param runs Runs, 0 for the case's default.
+ * @param out The results.
+ */
+void tk_bench_run(const tk_bench_case_t *bench, uint32_t runs,
+                  tk_bench_result_t *out);
@@ -0,0 +1,79 @@
+/**
+ * @file boot.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Boot timeline recorder.
+ * @version 0.1
+ * @date 2021-02-15
+ *
+ *
+ */
+
+#include "diag/boot.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TAG "Boot"
+
+#define TK_BOOT_MAX_MARKS 32
+
+typedef struct {
+  const char *phase;
+
+  // Copied, the task may be gone by the summary
+  char task[configMAX_TASK_NAME_LEN];
+  int64_t time_us;
+  int core;
+} tk_boot_mark_t;
+
+static portMUX_TYPE boot_mux = portMUX_INITIALIZER_UNLOCKED;
+static tk_boot_mark_t marks[TK_BOOT_MAX_MARKS];
+static int marks_count = 0;
+
+void tk_boot_mark(const char *phase) {
+  int64_t now = esp_timer_get_time();
+  const char *task = pcTaskGetTaskName(NULL);
+
+  portENTER_CRITICAL(&boot_mux);
+  if (marks_count < TK_BOOT_MAX_MARKS) {
+    tk_boot_mark_t *mark = &marks[marks_count++];
+    mark->phase = phase;
+    strlcpy(mark->task, task, sizeof(mark->task));
+    mark->time_us = now;
+    mark->core = xPortGetCoreID();
+  }
+  portEXIT_CRITICAL(&boot_mux);
+}
+
+void tk_boot_summary(void) {
+  tk_boot_mark_t copy[TK_BOOT_MAX_MARKS];
+  int count;
+
+  portENTER_CRITICAL(&boot_mux);
+  count = marks_count;
+  memcpy(copy, marks, count * sizeof(tk_boot_mark_t));
+  portEXIT_CRITICAL(&boot_mux);
+
+  ESP_LOGI(TAG, "%9s %9s  %-4s %-12s %s", "t (ms)", "step (ms)", "core",
+           "task", "phase");
+
+  for (int i = 0; i < count; i++) {
+    // Step from the previous mark of the same task
+    int64_t previous_us = 0;
+    for (int j = i - 1; j >= 0; j--) {
+      if (strcmp(copy[j].task, copy[i].task) == 0) {
+        previous_us = copy[j].time_us;
+        break;
+      }
+    }
+
+    ESP_LOGI(TAG, "%9.1f %9.1f  %-4d %-12s %s", copy[i].time_us / 1000.0,
+             (copy[i].time_us - previous_us) / 1000.0, copy[i].core,
+             copy[i].task, copy[i].phase);
+  }
+}
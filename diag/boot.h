@@ -0,0 +1,26 @@
+/**
+ * @file boot.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Boot timeline recorder.
+ * @version 0.1
+ * @date 2021-02-15
+ *
+ *
+ */
+
+#pragma once
+
+/**
+ * @brief Records the end of a boot phase, with the time, core and task. Can be
+ * called from any task; marks past the capacity are dropped.
+ *
+ * @param phase What has just completed, a string literal.
+ */
+void tk_boot_mark(const char *phase);
+
+/**
+ * @brief Logs every mark, with the time since boot and since the previous
+ * mark of the same task.
+ *
+ */
+void tk_boot_summary(void);
@@ -0,0 +1,495 @@
+/**
+ * @file console.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Diagnostic commands on the serial console.
+ * @version 0.1
+ * @date 2021-02-17
+ *
+ *
+ */
+
+#include "diag/console.h"
+
+#if CONFIG_TK_CONSOLE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag/bench.h"
+#include "diag/framestats.h"
+#include "diag/metrics.h"
+#include "diag/profiler.h"
+#include "diag/sampler.h"
+#include "diag/trace.h"
+#include "hmi/ESP32/power.h"
+#include "model/nvsettings.h"
+#include "ui/jobs/jobs.h"
+#include "ui/overlay/dev_overlay.h"
+
+#include "driver/uart.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_vfs_dev.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "linenoise/linenoise.h"
+#include "mbedtls/base64.h"
+
+#define TAG "Console"
+
+static void tk_console_emit(const char *text, size_t len, void *ctx) {
+  (void)ctx;
+  fwrite(text, 1, len, stdout);
+}
+
+/**
+ * @brief Prints the last sample as a table.
+ *
+ */
+static void tk_console_print_sample(void) {
+  tk_sample_t *sample = malloc(sizeof *sample);
+  if (sample == NULL)
+    return;
+
+  tk_sampler_get(sample);
+  if (sample->seq == 0) {
+    printf("No sample yet.\n");
+    free(sample);
+    return;
+  }
+
+  printf("Sample %u, %lld ms since boot\n", sample->seq,
+         sample->time_us / 1000);
+  printf("Heap: %u free, %u minimum, %u largest block\n", sample->heap_free,
+         sample->heap_min_free, sample->heap_largest_block);
+  printf("LVGL: %u of %u free, %u max used, %u%% fragmented\n",
+         sample->lv_mem_free, sample->lv_mem_total, sample->lv_mem_max_used,
+         sample->lv_mem_frag_pct);
+
+  printf("\n%-16s %4s %7s %10s\n", "Task", "Core", "CPU", "Stack free");
+  for (int i = 0; i < sample->tasks_count; i++) {
+    tk_sampler_task_t *task = &sample->tasks[i];
+    char core[4] = "-";
+    char cpu[8] = "-";
+
+    if (task->core >= 0)
+      snprintf(core, sizeof core, "%d", task->core);
+    if (task->cpu_permille >= 0)
+      snprintf(cpu, sizeof cpu, "%d.%d%%", task->cpu_permille / 10,
+               task->cpu_permille % 10);
+
+    printf("%-16s %4s %7s %10u\n", task->name, core, cpu,
+           task->stack_free_min);
+  }
+
+  free(sample);
+}
+
+/**
+ * @brief `metrics [prom]`: the last sample, or every metric in the Prometheus
+ * format with `prom`.
+ *
+ */
+static int tk_console_metrics(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "prom") == 0) {
+    tk_metrics_render(tk_console_emit, NULL);
+  } else if (argc > 1) {
+    printf("Usage: metrics [prom]\n");
+    return 1;
+  } else {
+    tk_console_print_sample();
+  }
+
+  fflush(stdout);
+  return 0;
+}
+
+/**
+ * @brief Shows or hides the developer overlay, on the GUI task.
+ *
+ */
+static void tk_console_overlay_job(void *payload) {
+  (void)payload;
+
+  tk_dev_overlay_toggle();
+}
+
+/**
+ * @brief `frames [log on|off|overlay]`: the last second of display frames, one
+ * log line per second, or the developer overlay.
+ *
+ */
+static int tk_console_frames(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[1], "log") == 0) {
+    tk_frame_stats_set_logging(strcmp(argv[2], "on") == 0);
+    return 0;
+  } else if (argc == 2 && strcmp(argv[1], "overlay") == 0) {
+    if (!tk_ui_post(tk_console_overlay_job, NULL, 0)) {
+      printf("The GUI task is busy.\n");
+      return 1;
+    }
+    return 0;
+  } else if (argc > 1) {
+    printf("Usage: frames [log on|off|overlay]\n");
+    return 1;
+  }
+
+  tk_frame_stats_t stats;
+  tk_frame_stats_get(&stats);
+  if (stats.seq == 0) {
+    printf("No frames yet.\n");
+    return 0;
+  }
+
+  printf("%u frames in %u ms, %u.%u fps\n", stats.frames, stats.window_ms,
+         stats.fps_x10 / 10, stats.fps_x10 % 10);
+  printf("Render: %u us average, %u us max\n", stats.render_avg_us,
+         stats.render_max_us);
+  printf("Flush: %u us average, %u us max\n", stats.flush_avg_us,
+         stats.flush_max_us);
+  printf("Areas: %u.%u average, %u max\n", stats.areas_avg_x10 / 10,
+         stats.areas_avg_x10 % 10, stats.areas_max);
+  printf("Pixels: %u invalidated, %u flushed per frame, of %u\n",
+         stats.invalidated_px_avg, stats.flushed_px_avg, stats.screen_px);
+  printf("Logging every second is %s.\n",
+         tk_frame_stats_logging() ? "on" : "off");
+  return 0;
+}
+
+/**
+ * @brief Prints a binary dump in base64 between markers, for the host tools to
+ * find in a serial log.
+ *
+ * @param name The name in the markers.
+ */
+static void tk_console_print_dump(const char *name, const uint8_t *dump,
+                                  size_t len) {
+  // 72 bytes, 96 characters per line
+  printf("---- tk %s begin ----\n", name);
+  for (size_t i = 0; i < len; i += 72) {
+    unsigned char line[97];
+    size_t out_len;
+    mbedtls_base64_encode(line, sizeof line, &out_len, dump + i,
+                          len - i < 72 ? len - i : 72);
+    printf("%.*s\n", out_len, line);
+  }
+  printf("---- tk %s end ----\n", name);
+  fflush(stdout);
+}
+
+/**
+ * @brief `trace [clear]`: the trace dump for tools/trace2perfetto.py, or drops
+ * every record.
+ *
+ */
+static int tk_console_trace(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "clear") == 0) {
+    tk_trace_clear();
+    return 0;
+  } else if (argc > 1) {
+    printf("Usage: trace [clear]\n");
+    return 1;
+  }
+
+  size_t len;
+  uint8_t *dump = tk_trace_dump(&len);
+  if (dump == NULL) {
+    printf("Tracing is disabled or out of memory.\n");
+    return 1;
+  }
+
+  tk_console_print_dump("trace", dump, len);
+  free(dump);
+  return 0;
+}
+
+/**
+ * @brief `prof [start [hz] | stop | dump | clear]`: controls the sampling
+ * profiler, dumps it for tools/profile_report.py, or prints its state.
+ *
+ */
+static int tk_console_prof(int argc, char **argv) {
+  if (argc == 1) {
+    printf("Profiler %s, %u samples taken.\n",
+           tk_prof_running() ? "running" : "stopped", tk_prof_samples());
+    return 0;
+  }
+
+  if (strcmp(argv[1], "start") == 0) {
+    uint32_t hz = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+    esp_err_t err = tk_prof_start(hz);
+    if (err != ESP_OK) {
+      printf("Cannot start: %s.\n", esp_err_to_name(err));
+      return 1;
+    }
+  } else if (strcmp(argv[1], "stop") == 0) {
+    tk_prof_stop();
+  } else if (strcmp(argv[1], "clear") == 0) {
+    tk_prof_clear();
+  } else if (strcmp(argv[1], "dump") == 0) {
+    size_t len;
+    uint8_t *dump = tk_prof_dump(&len);
+    if (dump == NULL) {
+      printf("No samples, or out of memory.\n");
+      return 1;
+    }
+
+    tk_console_print_dump("profile", dump, len);
+    free(dump);
+  } else {
+    printf("Usage: prof [start [hz] | stop | dump | clear]\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+static void tk_console_print_bench(const tk_bench_case_t *bench,
+                                   const tk_bench_result_t *result) {
+  printf("%s, %u %s, per run:", bench->name, result->runs, bench->run_name);
+  for (int i = 0; i < result->count; i++)
+    printf("%s %s %u.%u %s", i > 0 ? "," : "", result->values[i].name,
+           result->values[i].value_x10 / 10, result->values[i].value_x10 % 10,
+           result->values[i].unit);
+  printf("\n");
+}
+
+typedef struct {
+  const tk_bench_case_t *bench;
+  uint32_t runs;
+} tk_console_bench_t;
+
+/**
+ * @brief Runs a GUI case on the GUI task and prints it from there.
+ *
+ */
+static void tk_console_bench_job(void *payload) {
+  tk_console_bench_t *request = payload;
+  tk_bench_result_t result;
+
+  tk_bench_run(request->bench, request->runs, &result);
+  tk_console_print_bench(request->bench, &result);
+}
+
+/**
+ * @brief `bench <case> [runs]`: runs a case of diag/bench.c. Without a case,
+ * lists them.
+ *
+ */
+static int tk_console_bench(int argc, char **argv) {
+  const tk_bench_case_t *bench = argc > 1 ? tk_bench_find(argv[1]) : NULL;
+  if (bench == NULL) {
+    printf("Usage: bench <case> [runs], cases:");
+    for (bench = tk_bench_cases; bench->name != NULL; bench++)
+      printf(" %s", bench->name);
+    printf("\n");
+    return argc > 1;
+  }
+
+  tk_console_bench_t request = {
+      .bench = bench, .runs = argc > 2 ? strtoul(argv[2], NULL, 10) : 0};
+
+  if (bench->gui) {
+    if (!tk_ui_post(tk_console_bench_job, &request, sizeof request)) {
+      printf("The GUI task is busy.\n");
+      return 1;
+    }
+    return 0;
+  }
+
+  tk_bench_result_t result;
+  tk_bench_run(bench, request.runs, &result);
+  tk_console_print_bench(bench, &result);
+  return 0;
+}
+
+/**
+ * @brief `power`: the governor mode, the time spent in each since boot and
+ * the wake latency. With PM profiling, the power management locks and modes.
+ *
+ */
+static int tk_console_power(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  tk_power_stats_t stats;
+  tk_power_get_stats(&stats);
+
+  // Shares in percent, of the time since the governor started
+  uint64_t total_ms = stats.active_ms + stats.idle_ms;
+  if (total_ms == 0)
+    total_ms = 1;
+  uint32_t active_pct = stats.active_ms * 100ULL / total_ms;
+  uint32_t idle_pct = stats.idle_ms * 100ULL / total_ms;
+  uint32_t dimmed_pct = stats.dimmed_ms * 100ULL / total_ms;
+
+  printf("%s, backlight %s\n", stats.active ? "Active" : "Idle",
+         stats.dimmed ? "dimmed" : "on");
+  printf("Active %u s (%u%%), idle %u s (%u%%), dimmed %u s (%u%%)\n",
+         stats.active_ms / 1000, active_pct, stats.idle_ms / 1000, idle_pct,
+         stats.dimmed_ms / 1000, dimmed_pct);
+  printf("%u wakes from idle, %u answered by a frame, %u ms on average\n",
+         stats.wakes, stats.wake_frames, stats.wake_frame_avg_ms);
+
+#if CONFIG_PM_PROFILING
+  printf("\n");
+  esp_pm_dump_locks(stdout);
+#endif
+
+  fflush(stdout);
+  return 0;
+}
+
+typedef struct {
+  tk_setting_id_t id;
+  const char *text;
+  SemaphoreHandle_t done;
+  esp_err_t *err;
+} tk_console_set_t;
+
+static void tk_console_set_job(void *payload) {
+  tk_console_set_t *request = payload;
+
+  *request->err = nv_set_text(request->id, request->text);
+  xSemaphoreGive(request->done);
+}
+
+/**
+ * @brief `set <key> <value>`: changes a setting as the menus do, on the GUI
+ * task, and saves it. Without arguments, lists the keys.
+ *
+ */
+static int tk_console_set(int argc, char **argv) {
+  if (argc != 3) {
+    printf("Settings:");
+    for (int i = 0; i < TK_SETTING_COUNT; i++)
+      printf(" %s", nv_key(i));
+    printf("\n");
+    return argc == 1 ? 0 : 1;
+  }
+
+  tk_setting_id_t id = nv_find(argv[1]);
+  if (id == TK_SETTING_COUNT) {
+    printf("No setting %s.\n", argv[1]);
+    return 1;
+  }
+
+  esp_err_t err = ESP_FAIL;
+  tk_console_set_t request = {
+      .id = id, .text = argv[2], .done = xSemaphoreCreateBinary(), .err = &err};
+  if (request.done == NULL)
+    return 1;
+
+  if (!tk_ui_post(tk_console_set_job, &request, sizeof request)) {
+    vSemaphoreDelete(request.done);
+    printf("The GUI task is busy.\n");
+    return 1;
+  }
+
+  // The job reads the arguments and writes the result: wait for it
+  xSemaphoreTake(request.done, portMAX_DELAY);
+  vSemaphoreDelete(request.done);
+
+  if (err != ESP_OK) {
+    printf("%s not set: %s.\n", argv[1], esp_err_to_name(err));
+    return 1;
+  }
+
+  return 0;
+}
+
+static const esp_console_cmd_t tk_console_commands[] = {
+    {.command = "metrics",
+     .help = "Tasks, heap and LVGL memory from the last sample; "
+             "'metrics prom' dumps every metric.",
+     .func = tk_console_metrics},
+    {.command = "frames",
+     .help = "Display frame rate, render and flush times and invalidated "
+             "areas over the last second; 'frames log on|off' logs them, "
+             "'frames overlay' toggles the developer overlay.",
+     .func = tk_console_frames},
+    {.command = "trace",
+     .help = "Dumps the event trace for tools/trace2perfetto.py; "
+             "'trace clear' drops it.",
+     .func = tk_console_trace},
+    {.command = "prof",
+     .help = "Sampling profiler: 'prof start [hz]', 'prof stop', 'prof dump' "
+             "for tools/profile_report.py, 'prof clear' frees it.",
+     .func = tk_console_prof},
+    {.command = "bench",
+     .help = "Microbenchmarks, 'bench <case> [runs]': float, the refresh "
+             "path math in double and in float; gauge, a value change on "
+             "lv_arc and on tk_gauge; glyph, a readout change with and "
+             "without the glyph cache; theme, a theme switch and the frame "
+             "after it.",
+     .func = tk_console_bench},
+    {.command = "power",
+     .help = "Time spent active, idle and dimmed, and the time from a wake "
+             "to its first frame; with CONFIG_PM_PROFILING, the power "
+             "management locks and the time in each power mode.",
+     .func = tk_console_power},
+    {.command = "set",
+     .help = "Changes a setting and saves it, 'set <key> <value>'; switches "
+             "take 0 or 1, on or off. 'set' lists the keys.",
+     .func = tk_console_set},
+};
+
+static void tk_console_task(void *arg) {
+  (void)arg;
+
+  // Plain line input if the terminal does not answer escape sequences
+  if (linenoiseProbe() != 0)
+    linenoiseSetDumbMode(1);
+
+  while (true) {
+    char *line = linenoise("tk> ");
+    if (line == NULL)
+      continue;
+
+    if (strlen(line) > 0) {
+      linenoiseHistoryAdd(line);
+
+      int ret;
+      esp_err_t err = esp_console_run(line, &ret);
+      if (err == ESP_ERR_NOT_FOUND)
+        printf("Unknown command, try 'help'.\n");
+      else if (err == ESP_OK && ret != 0)
+        printf("Command returned %d.\n", ret);
+    }
+
+    linenoiseFree(line);
+  }
+}
+
+void tk_console_start(void) {
+  setvbuf(stdin, NULL, _IONBF, 0);
+  esp_vfs_dev_uart_set_rx_line_endings(ESP_LINE_ENDINGS_CR);
+  esp_vfs_dev_uart_set_tx_line_endings(ESP_LINE_ENDINGS_CRLF);
+
+  ESP_ERROR_CHECK(
+      uart_driver_install(CONFIG_ESP_CONSOLE_UART_NUM, 256, 0, 0, NULL, 0));
+  esp_vfs_dev_uart_use_driver(CONFIG_ESP_CONSOLE_UART_NUM);
+
+  esp_console_config_t config = {.max_cmdline_args = 8,
+                                 .max_cmdline_length = 128};
+  ESP_ERROR_CHECK(esp_console_init(&config));
+  linenoiseSetMultiLine(1);
+  linenoiseHistorySetMaxLen(10);
+
+  esp_console_register_help_command();
+  for (int i = 0;
+       i < sizeof tk_console_commands / sizeof tk_console_commands[0]; i++)
+    ESP_ERROR_CHECK(esp_console_cmd_register(&tk_console_commands[i]));
+
+  xTaskCreate(tk_console_task, "console", 4096, NULL, 2, NULL);
+  ESP_LOGI(TAG, "Console started.");
+}
+
+#else
+
+void tk_console_start(void) {}
+
+#endif
@@ -0,0 +1,18 @@
+/**
+ * @file console.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Diagnostic commands on the serial console.
+ * @version 0.1
+ * @date 2021-02-17
+ *
+ *
+ */
+
+#pragma once
+
+/**
+ * @brief Takes over the console UART for line input, registers the commands
+ * and starts the console task. Does nothing unless CONFIG_TK_CONSOLE is set.
+ *
+ */
+void tk_console_start(void);
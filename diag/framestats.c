@@ -0,0 +1,219 @@
+/**
+ * @file framestats.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Per-frame render, flush and invalidation statistics of the display.
+ * @version 0.1
+ * @date 2021-02-21
+ *
+ *
+ */
+
+#include "diag/framestats.h"
+
+#include <string.h>
+
+#include "diag/metrics.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#define TAG "Frames"
+
+#define TK_FRAME_WINDOW_US 1000000
+
+static tk_metric_t render_metric = TK_METRIC_HISTOGRAM(
+    "tk_frame_render_ms", "Time spent drawing a frame.", 1, 2, 5, 10, 20, 40,
+    80);
+
+static tk_metric_t flush_metric =
+    TK_METRIC_HISTOGRAM("tk_frame_flush_ms",
+                        "Time spent sending a frame to the display.", 1, 2, 5,
+                        10, 20, 40, 80);
+
+static tk_metric_t areas_metric =
+    TK_METRIC_HISTOGRAM("tk_frame_invalidated_areas",
+                        "Invalidated areas per frame, before joining.", 1, 2, 4,
+                        8, 16, 32);
+
+static tk_metric_t invalidated_metric = TK_METRIC_HISTOGRAM(
+    "tk_frame_invalidated_percent",
+    "Invalidated share of the screen per frame, before joining.", 1, 5, 10, 25,
+    50, 100);
+
+static tk_metric_t fps_metric = TK_METRIC_GAUGE(
+    "tk_frames_per_second", "Frames drawn over the last second.");
+
+static tk_metric_t frames_metric =
+    TK_METRIC_COUNTER("tk_frames_total", "Frames drawn since boot.");
+
+static lv_disp_t *stats_disp = NULL;
+static void (*flush_orig)(lv_disp_drv_t *drv, const lv_area_t *area,
+                          lv_color_t *color_p) = NULL;
+
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static tk_frame_stats_t last_window;
+#if CONFIG_TK_FRAME_STATS_LOG
+static bool logging = true;
+#else
+static bool logging = false;
+#endif
+
+// The frame being drawn, only touched by the GUI task
+static uint32_t frame_flush_us;
+static uint32_t frame_flushed_px;
+
+// The window being accumulated
+static struct {
+  int64_t start_us;
+  uint32_t frames;
+  uint64_t render_us;
+  uint32_t render_max_us;
+  uint64_t flush_us;
+  uint32_t flush_max_us;
+  uint32_t areas;
+  uint32_t areas_max;
+  uint64_t invalidated_px;
+  uint64_t flushed_px;
+} window;
+
+/**
+ * @brief Flushes and waits for the end of the transfer, to time it.
+ *
+ * The display is single buffered: lvgl waits for each part to be sent before
+ * drawing the next one anyway, so waiting here only holds the GUI task for the
+ * last part of a frame.
+ */
+static void tk_frame_flush(lv_disp_drv_t *drv, const lv_area_t *area,
+                           lv_color_t *color_p) {
+  int64_t start = esp_timer_get_time();
+
+  frame_flushed_px += lv_area_get_size(area);
+  flush_orig(drv, area, color_p);
+
+  while (drv->buffer->flushing) {
+  }
+
+  frame_flush_us += esp_timer_get_time() - start;
+}
+
+/**
+ * @brief Closes the window, publishes it and starts the next one.
+ *
+ */
+static void tk_frame_window_close(int64_t now) {
+  tk_frame_stats_t stats = {.seq = last_window.seq + 1,
+                            .window_ms = (now - window.start_us) / 1000,
+                            .frames = window.frames,
+                            .render_max_us = window.render_max_us,
+                            .flush_max_us = window.flush_max_us,
+                            .areas_max = window.areas_max,
+                            .screen_px = lv_disp_get_hor_res(stats_disp) *
+                                         lv_disp_get_ver_res(stats_disp)};
+
+  stats.fps_x10 = (uint64_t)window.frames * 10000000 / (now - window.start_us);
+
+  if (window.frames > 0) {
+    stats.render_avg_us = window.render_us / window.frames;
+    stats.flush_avg_us = window.flush_us / window.frames;
+    stats.areas_avg_x10 = window.areas * 10 / window.frames;
+    stats.invalidated_px_avg = window.invalidated_px / window.frames;
+    stats.flushed_px_avg = window.flushed_px / window.frames;
+  }
+
+  portENTER_CRITICAL(&stats_mux);
+  memcpy(&last_window, &stats, sizeof stats);
+  portEXIT_CRITICAL(&stats_mux);
+
+  tk_metric_set(&fps_metric, (stats.fps_x10 + 5) / 10);
+
+  if (logging && stats.frames > 0)
+    ESP_LOGI(TAG,
+             "%u.%u fps, render %u/%u us, flush %u/%u us, %u.%u areas, "
+             "%u%% invalidated, %u%% flushed (avg/max per frame).",
+             stats.fps_x10 / 10, stats.fps_x10 % 10, stats.render_avg_us,
+             stats.render_max_us, stats.flush_avg_us, stats.flush_max_us,
+             stats.areas_avg_x10 / 10, stats.areas_avg_x10 % 10,
+             stats.invalidated_px_avg * 100 / stats.screen_px,
+             stats.flushed_px_avg * 100 / stats.screen_px);
+
+  memset(&window, 0, sizeof window);
+  window.start_us = now;
+}
+
+/**
+ * @brief Replaces the refresh task of the display, around lvgl's own.
+ *
+ */
+static void tk_frame_refr_task(lv_task_t *task) {
+  // Counted before lvgl joins and clears them
+  uint32_t areas = stats_disp->inv_p;
+  uint32_t invalidated_px = 0;
+  for (uint32_t i = 0; i < areas; i++)
+    invalidated_px += lv_area_get_size(&stats_disp->inv_areas[i]);
+
+  frame_flush_us = 0;
+  frame_flushed_px = 0;
+
+  int64_t start = esp_timer_get_time();
+  _lv_disp_refr_task(task);
+  int64_t now = esp_timer_get_time();
+
+  if (areas > 0) {
+    uint32_t frame_us = now - start;
+    uint32_t render_us =
+        frame_us > frame_flush_us ? frame_us - frame_flush_us : 0;
+    uint32_t screen_px =
+        lv_disp_get_hor_res(stats_disp) * lv_disp_get_ver_res(stats_disp);
+    uint32_t invalidated_pct = (uint64_t)invalidated_px * 100 / screen_px;
+
+    tk_metric_inc(&frames_metric);
+    tk_metric_observe(&render_metric, render_us / 1000);
+    tk_metric_observe(&flush_metric, frame_flush_us / 1000);
+    tk_metric_observe(&areas_metric, areas);
+    tk_metric_observe(&invalidated_metric,
+                      invalidated_pct > 100 ? 100 : invalidated_pct);
+
+    window.frames++;
+    window.render_us += render_us;
+    window.flush_us += frame_flush_us;
+    window.areas += areas;
+    window.invalidated_px += invalidated_px;
+    window.flushed_px += frame_flushed_px;
+    if (render_us > window.render_max_us)
+      window.render_max_us = render_us;
+    if (frame_flush_us > window.flush_max_us)
+      window.flush_max_us = frame_flush_us;
+    if (areas > window.areas_max)
+      window.areas_max = areas;
+  }
+
+  if (now - window.start_us >= TK_FRAME_WINDOW_US)
+    tk_frame_window_close(now);
+}
+
+void tk_frame_stats_init(lv_disp_t *disp) {
+  tk_metrics_register(&render_metric);
+  tk_metrics_register(&flush_metric);
+  tk_metrics_register(&areas_metric);
+  tk_metrics_register(&invalidated_metric);
+  tk_metrics_register(&fps_metric);
+  tk_metrics_register(&frames_metric);
+
+  stats_disp = disp;
+  flush_orig = disp->driver.flush_cb;
+  disp->driver.flush_cb = tk_frame_flush;
+
+  window.start_us = esp_timer_get_time();
+  lv_task_set_cb(disp->refr_task, tk_frame_refr_task);
+}
+
+void tk_frame_stats_get(tk_frame_stats_t *out) {
+  portENTER_CRITICAL(&stats_mux);
+  memcpy(out, &last_window, sizeof *out);
+  portEXIT_CRITICAL(&stats_mux);
+}
+
+void tk_frame_stats_set_logging(bool enabled) { logging = enabled; }
+
+bool tk_frame_stats_logging(void) { return logging; }
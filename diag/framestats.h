@@ -0,0 +1,87 @@
+/**
+ * @file framestats.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Per-frame render, flush and invalidation statistics of the display.
+ * @version 0.1
+ * @date 2021-02-21
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+/**
+ * @brief Averages and maxima over one window of about a second.
+ *
+ */
+typedef struct {
+  /**
+   * @brief Incremented on every window, 0 before the first one.
+   *
+   */
+  uint32_t seq;
+  uint32_t window_ms;
+
+  uint16_t frames;
+  uint16_t fps_x10;
+
+  uint32_t render_avg_us;
+  uint32_t render_max_us;
+  uint32_t flush_avg_us;
+  uint32_t flush_max_us;
+
+  /**
+   * @brief Invalidated areas per frame, before lvgl joins them, in tenths.
+   *
+   */
+  uint16_t areas_avg_x10;
+  uint16_t areas_max;
+
+  /**
+   * @brief Invalidated pixels per frame, overlaps counted twice.
+   *
+   */
+  uint32_t invalidated_px_avg;
+
+  /**
+   * @brief Pixels rendered and flushed per frame.
+   *
+   */
+  uint32_t flushed_px_avg;
+
+  uint32_t screen_px;
+} tk_frame_stats_t;
+
+/**
+ * @brief Wraps the refresh task and the flush callback of a registered display
+ * and registers the frame metrics. Call it from the GUI task, after the
+ * display is registered.
+ *
+ * @param disp The display.
+ */
+void tk_frame_stats_init(lv_disp_t *disp);
+
+/**
+ * @brief Copies the last complete window. Can be called from any task.
+ *
+ * @param out Where to copy it.
+ */
+void tk_frame_stats_get(tk_frame_stats_t *out);
+
+/**
+ * @brief Enables or disables one log line per window.
+ *
+ * @param enabled Whether to log.
+ */
+void tk_frame_stats_set_logging(bool enabled);
+
+/**
+ * @brief Whether a log line is printed per window.
+ *
+ */
+bool tk_frame_stats_logging(void);
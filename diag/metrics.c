@@ -0,0 +1,221 @@
+/**
+ * @file metrics.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Lightweight runtime metrics registry.
+ * @version 0.1
+ * @date 2021-02-08
+ *
+ *
+ */
+
+#include "diag/metrics.h"
+#include "diag/sampler.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TAG "Metrics"
+
+// Upper bound for the per-task statistics
+#define TK_METRICS_MAX_TASKS 24
+
+static portMUX_TYPE metrics_mux = portMUX_INITIALIZER_UNLOCKED;
+static tk_metric_t *metrics_head = NULL;
+static tk_metric_t *metrics_tail = NULL;
+
+void tk_metrics_register(tk_metric_t *metric) {
+  portENTER_CRITICAL(&metrics_mux);
+  if (!metric->registered) {
+    metric->registered = true;
+    metric->next = NULL;
+    if (metrics_tail == NULL)
+      metrics_head = metric;
+    else
+      metrics_tail->next = metric;
+    metrics_tail = metric;
+  }
+  portEXIT_CRITICAL(&metrics_mux);
+}
+
+void tk_metric_observe(tk_metric_t *metric, int32_t value) {
+  uint8_t i = 0;
+  while (i < metric->bounds_count && value > metric->bounds[i])
+    i++;
+
+  portENTER_CRITICAL_SAFE(&metrics_mux);
+  metric->buckets[i]++;
+  metric->sum += value;
+  metric->count++;
+  portEXIT_CRITICAL_SAFE(&metrics_mux);
+}
+
+/**
+ * @brief Formats a line and sends it to the output callback.
+ *
+ */
+static void tk_metrics_printf(tk_metrics_emit_t emit, void *ctx,
+                              const char *format, ...) {
+  char line[160];
+  va_list args;
+
+  va_start(args, format);
+  int len = vsnprintf(line, sizeof line, format, args);
+  va_end(args);
+
+  if (len < 0)
+    return;
+  if (len >= sizeof line)
+    len = sizeof line - 1;
+
+  emit(line, len, ctx);
+}
+
+static void tk_metrics_header(tk_metrics_emit_t emit, void *ctx,
+                              const char *name, const char *help,
+                              const char *type) {
+  tk_metrics_printf(emit, ctx, "# HELP %s %s\n# TYPE %s %s\n", name, help,
+                    name, type);
+}
+
+static void tk_metrics_render_histogram(tk_metrics_emit_t emit, void *ctx,
+                                        tk_metric_t *metric) {
+  uint32_t buckets[metric->bounds_count + 1];
+  int64_t sum;
+  uint32_t count;
+
+  // Consistent snapshot
+  portENTER_CRITICAL(&metrics_mux);
+  memcpy(buckets, (const void *)metric->buckets, sizeof buckets);
+  sum = metric->sum;
+  count = metric->count;
+  portEXIT_CRITICAL(&metrics_mux);
+
+  const char *labels = metric->labels != NULL ? metric->labels : "";
+  const char *sep = metric->labels != NULL ? "," : "";
+
+  uint32_t cumulative = 0;
+  for (int i = 0; i <= metric->bounds_count; i++) {
+    cumulative += buckets[i];
+    if (i < metric->bounds_count)
+      tk_metrics_printf(emit, ctx, "%s_bucket{%s%sle=\"%d\"} %u\n",
+                        metric->name, labels, sep, metric->bounds[i],
+                        cumulative);
+    else
+      tk_metrics_printf(emit, ctx, "%s_bucket{%s%sle=\"+Inf\"} %u\n",
+                        metric->name, labels, sep, cumulative);
+  }
+
+  if (metric->labels != NULL) {
+    tk_metrics_printf(emit, ctx, "%s_sum{%s} %lld\n%s_count{%s} %u\n",
+                      metric->name, labels, sum, metric->name, labels, count);
+  } else {
+    tk_metrics_printf(emit, ctx, "%s_sum %lld\n%s_count %u\n", metric->name,
+                      sum, metric->name, count);
+  }
+}
+
+/**
+ * @brief Heap and per-task statistics, sampled at render time.
+ *
+ */
+static void tk_metrics_render_system(tk_metrics_emit_t emit, void *ctx) {
+  tk_metrics_header(emit, ctx, "tk_heap_free_bytes", "Free heap.", "gauge");
+  tk_metrics_printf(emit, ctx, "tk_heap_free_bytes %u\n",
+                    esp_get_free_heap_size());
+
+  tk_metrics_header(emit, ctx, "tk_heap_min_free_bytes",
+                    "Lowest free heap since boot.", "gauge");
+  tk_metrics_printf(emit, ctx, "tk_heap_min_free_bytes %u\n",
+                    esp_get_minimum_free_heap_size());
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+  static TaskStatus_t tasks[TK_METRICS_MAX_TASKS];
+  uint32_t total_runtime = 0;
+  UBaseType_t count =
+      uxTaskGetSystemState(tasks, TK_METRICS_MAX_TASKS, &total_runtime);
+
+  tk_metrics_header(emit, ctx, "tk_task_stack_free_min_bytes",
+                    "Stack high-water mark per task.", "gauge");
+  for (UBaseType_t i = 0; i < count; i++) {
+    tk_metrics_printf(emit, ctx,
+                      "tk_task_stack_free_min_bytes{task=\"%s\"} %u\n",
+                      tasks[i].pcTaskName, tasks[i].usStackHighWaterMark);
+  }
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+  // Run time counters are per core, the share is relative to one core
+  tk_metrics_header(emit, ctx, "tk_task_runtime_total",
+                    "Run time counter per task.", "counter");
+  for (UBaseType_t i = 0; i < count; i++) {
+    tk_metrics_printf(emit, ctx, "tk_task_runtime_total{task=\"%s\"} %u\n",
+                      tasks[i].pcTaskName, tasks[i].ulRunTimeCounter);
+  }
+
+  tk_metrics_header(emit, ctx, "tk_task_cpu_share_permille",
+                    "CPU share per task since boot.", "gauge");
+  for (UBaseType_t i = 0; i < count; i++) {
+    uint32_t share =
+        total_runtime > 0
+            ? (uint32_t)((uint64_t)tasks[i].ulRunTimeCounter * 1000 /
+                         total_runtime)
+            : 0;
+    tk_metrics_printf(emit, ctx,
+                      "tk_task_cpu_share_permille{task=\"%s\"} %u\n",
+                      tasks[i].pcTaskName, share);
+  }
+#endif
+#endif
+
+  // Recent CPU share, from the sampler
+  tk_sample_t *sample = malloc(sizeof *sample);
+  if (sample == NULL)
+    return;
+
+  tk_sampler_get(sample);
+  tk_metrics_header(emit, ctx, "tk_task_cpu_recent_permille",
+                    "CPU share per task over the last sample interval.",
+                    "gauge");
+  for (int i = 0; i < sample->tasks_count; i++) {
+    if (sample->tasks[i].cpu_permille < 0)
+      continue;
+    tk_metrics_printf(emit, ctx,
+                      "tk_task_cpu_recent_permille{task=\"%s\"} %d\n",
+                      sample->tasks[i].name, sample->tasks[i].cpu_permille);
+  }
+
+  free(sample);
+}
+
+void tk_metrics_render(tk_metrics_emit_t emit, void *ctx) {
+  const char *last_name = NULL;
+
+  tk_metrics_render_system(emit, ctx);
+
+  for (tk_metric_t *metric = metrics_head; metric != NULL;
+       metric = metric->next) {
+
+    // One header per metric family
+    if (last_name == NULL || strcmp(last_name, metric->name) != 0) {
+      tk_metrics_header(emit, ctx, metric->name, metric->help,
+                        metric->type == TK_METRIC_COUNTER ? "counter"
+                        : metric->type == TK_METRIC_GAUGE ? "gauge"
+                                                          : "histogram");
+      last_name = metric->name;
+    }
+
+    if (metric->type == TK_METRIC_HISTOGRAM) {
+      tk_metrics_render_histogram(emit, ctx, metric);
+    } else if (metric->labels != NULL) {
+      tk_metrics_printf(emit, ctx, "%s{%s} %d\n", metric->name, metric->labels,
+                        metric->value);
+    } else {
+      tk_metrics_printf(emit, ctx, "%s %d\n", metric->name, metric->value);
+    }
+  }
+}
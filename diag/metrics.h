@@ -0,0 +1,137 @@
+/**
+ * @file metrics.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Lightweight runtime metrics registry.
+ * @version 0.1
+ * @date 2021-02-08
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+  TK_METRIC_COUNTER,
+  TK_METRIC_GAUGE,
+  TK_METRIC_HISTOGRAM
+} tk_metric_type_t;
+
+/**
+ * @brief A metric. Define it statically with one of the TK_METRIC_* macros,
+ * register it once and update it from any task.
+ *
+ */
+typedef struct tk_metric {
+  const char *name;
+  const char *help;
+
+  /**
+   * @brief Optional label set, such as `chr="rpm"`. Metrics sharing a name
+   * should be registered one after the other.
+   *
+   */
+  const char *labels;
+
+  tk_metric_type_t type;
+
+  /**
+   * @brief Counter or gauge value.
+   *
+   */
+  volatile int32_t value;
+
+  /**
+   * @brief Histogram upper bounds (ascending) and bucket counts. The last
+   * bucket, past the last bound, is +Inf.
+   *
+   */
+  const int32_t *bounds;
+  uint8_t bounds_count;
+  volatile uint32_t *buckets;
+  volatile int64_t sum;
+  volatile uint32_t count;
+
+  bool registered;
+  struct tk_metric *next;
+} tk_metric_t;
+
+#define TK_METRIC_COUNTER(_name, _help)                                        \
+  { .name = _name, .help = _help, .type = TK_METRIC_COUNTER }
+
+#define TK_METRIC_COUNTER_LABELED(_name, _help, _labels)                       \
+  { .name = _name, .help = _help, .labels = _labels, .type = TK_METRIC_COUNTER }
+
+#define TK_METRIC_GAUGE(_name, _help)                                          \
+  { .name = _name, .help = _help, .type = TK_METRIC_GAUGE }
+
+#define TK_METRIC_HISTOGRAM(_name, _help, ...)                                 \
+  {                                                                            \
+    .name = _name, .help = _help, .type = TK_METRIC_HISTOGRAM,                 \
+    .bounds = (const int32_t[]){__VA_ARGS__},                                  \
+    .bounds_count = sizeof((int32_t[]){__VA_ARGS__}) / sizeof(int32_t),        \
+    .buckets = (uint32_t[sizeof((int32_t[]){__VA_ARGS__}) / sizeof(int32_t) + \
+                         1]){0},                                               \
+  }
+
+/**
+ * @brief Receives the text exposition, one piece at a time.
+ *
+ */
+typedef void (*tk_metrics_emit_t)(const char *text, size_t len, void *ctx);
+
+/**
+ * @brief Adds a metric to the registry. Registering twice is harmless.
+ *
+ * @param metric The metric.
+ */
+void tk_metrics_register(tk_metric_t *metric);
+
+/**
+ * @brief Adds an amount to a counter or a gauge.
+ *
+ * @param metric The metric.
+ * @param amount The amount.
+ */
+static inline void tk_metric_add(tk_metric_t *metric, int32_t amount) {
+  __atomic_fetch_add(&metric->value, amount, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Increments a counter.
+ *
+ * @param metric The metric.
+ */
+static inline void tk_metric_inc(tk_metric_t *metric) {
+  tk_metric_add(metric, 1);
+}
+
+/**
+ * @brief Sets a gauge.
+ *
+ * @param metric The metric.
+ * @param value The new value.
+ */
+static inline void tk_metric_set(tk_metric_t *metric, int32_t value) {
+  __atomic_store_n(&metric->value, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Records a sample in a histogram.
+ *
+ * @param metric The metric.
+ * @param value The sample.
+ */
+void tk_metric_observe(tk_metric_t *metric, int32_t value);
+
+/**
+ * @brief Writes every registered metric, plus heap and task statistics, in the
+ * Prometheus text exposition format.
+ *
+ * @param emit The output callback.
+ * @param ctx Passed to the callback.
+ */
+void tk_metrics_render(tk_metrics_emit_t emit, void *ctx);
@@ -0,0 +1,359 @@
+/**
+ * @file profiler.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Sampling CPU profiler, driven by a hardware timer interrupt per core.
+ * @version 0.1
+ * @date 2021-02-20
+ *
+ *
+ */
+
+#include "diag/profiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#define TAG "Profiler"
+
+#if CONFIG_TK_PROF
+
+#include <sys/lock.h>
+
+#include "driver/timer.h"
+#include "esp_debug_helpers.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/xtensa_context.h"
+
+#if !CONFIG_FREERTOS_UNICORE
+#include "esp_ipc.h"
+#endif
+
+#define TK_PROF_MAGIC 0x46504b54 // "TKPF"
+#define TK_PROF_VERSION 1
+#define TK_PROF_MAX_TASKS 24
+// Timer n of the group samples core n
+#define TK_PROF_GROUP TIMER_GROUP_1
+#define TK_PROF_HZ_MIN 10
+#define TK_PROF_HZ_MAX 10000
+
+typedef struct {
+  uint32_t task;
+  uint8_t core;
+  uint8_t depth;
+  uint16_t reserved;
+
+  // The interrupted PC, then the return addresses as found on the stack
+  uint32_t pc[CONFIG_TK_PROF_DEPTH];
+} tk_prof_sample_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t sample_size;
+  uint8_t cores;
+  uint8_t depth;
+  uint8_t tasks;
+  uint8_t task_name_len;
+  uint32_t hz;
+  uint32_t count;
+  uint32_t total;
+  uint64_t now_us;
+} tk_prof_header_t;
+
+static tk_prof_sample_t *samples = NULL;
+
+// Samples taken, the slot is head modulo the ring size
+static volatile uint32_t head = 0;
+static volatile bool sampling = false;
+static bool running = false;
+static bool timers_ready[portNUM_PROCESSORS];
+static uint32_t rate = 0;
+
+// Start, stop, dump and clear come from the console and the web server
+static _lock_t prof_lock;
+
+typedef struct {
+  timer_idx_t timer;
+  esp_err_t err;
+} tk_prof_timer_call_t;
+
+/**
+ * @brief The timer interrupt, on the core it samples.
+ *
+ * Runs at level 1, so the interrupted context is always a task: the port saves
+ * its registers, window spilled, at the top of its stack and stores that in
+ * the first word of the TCB. Code running with interrupts disabled is seen at
+ * the point where they are enabled again.
+ */
+static void IRAM_ATTR tk_prof_isr(void *arg) {
+  timer_idx_t timer = (timer_idx_t)(intptr_t)arg;
+
+  timer_group_clr_intr_status_in_isr(TK_PROF_GROUP, timer);
+  timer_group_enable_alarm_in_isr(TK_PROF_GROUP, timer);
+
+  if (!sampling)
+    return;
+
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  if (task == NULL)
+    return;
+
+  uint32_t slot = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+  tk_prof_sample_t *sample = &samples[slot % CONFIG_TK_PROF_SAMPLES];
+
+  XtExcFrame *frame = *(XtExcFrame **)task;
+  esp_backtrace_frame_t bt = {
+      .pc = frame->pc, .sp = frame->a1, .next_pc = frame->a0};
+
+  sample->task = (uint32_t)task;
+  sample->core = xPortGetCoreID();
+  sample->pc[0] = bt.pc;
+
+  uint8_t depth = 1;
+  while (depth < CONFIG_TK_PROF_DEPTH && bt.next_pc != 0 &&
+         esp_backtrace_get_next_frame(&bt))
+    sample->pc[depth++] = bt.pc;
+
+  sample->depth = depth;
+}
+
+/**
+ * @brief Sets up the timer of the calling core, its interrupt is allocated
+ * there.
+ *
+ */
+static void tk_prof_timer_init(void *arg) {
+  tk_prof_timer_call_t *call = arg;
+  timer_idx_t timer = call->timer;
+
+  // 1 MHz ticks
+  timer_config_t config = {.divider = 80,
+                           .counter_dir = TIMER_COUNT_UP,
+                           .counter_en = TIMER_PAUSE,
+                           .alarm_en = TIMER_ALARM_EN,
+                           .auto_reload = TIMER_AUTORELOAD_EN,
+                           .intr_type = TIMER_INTR_LEVEL};
+
+  call->err = timer_init(TK_PROF_GROUP, timer, &config);
+  if (call->err == ESP_OK)
+    call->err = timer_enable_intr(TK_PROF_GROUP, timer);
+  if (call->err == ESP_OK)
+    call->err = timer_isr_register(TK_PROF_GROUP, timer, tk_prof_isr,
+                                   (void *)(intptr_t)timer,
+                                   ESP_INTR_FLAG_LEVEL1 | ESP_INTR_FLAG_IRAM,
+                                   NULL);
+}
+
+/**
+ * @brief Sets up the timers not set up yet, each on its core. A core that
+ * failed is tried again on the next start.
+ *
+ */
+static esp_err_t tk_prof_timers_init(void) {
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    if (timers_ready[core])
+      continue;
+
+    tk_prof_timer_call_t call = {.timer = core, .err = ESP_FAIL};
+#if !CONFIG_FREERTOS_UNICORE
+    // If the call cannot be made, the error stays ESP_FAIL
+    if (core != xPortGetCoreID())
+      esp_ipc_call_blocking(core, tk_prof_timer_init, &call);
+    else
+#endif
+      tk_prof_timer_init(&call);
+
+    if (call.err != ESP_OK) {
+      ESP_LOGE(TAG, "Timer of core %d not set up: %s.", core,
+               esp_err_to_name(call.err));
+      return call.err;
+    }
+
+    timers_ready[core] = true;
+  }
+
+  return ESP_OK;
+}
+
+/**
+ * @brief Pauses sampling and lets an interrupt already past the check finish.
+ *
+ */
+static void tk_prof_pause(void) {
+  sampling = false;
+  vTaskDelay(1);
+}
+
+/**
+ * @brief Pauses the timers, with the lock held.
+ *
+ */
+static void tk_prof_halt(void) {
+  if (!running)
+    return;
+
+  for (int core = 0; core < portNUM_PROCESSORS; core++)
+    timer_pause(TK_PROF_GROUP, core);
+  tk_prof_pause();
+  running = false;
+}
+
+esp_err_t tk_prof_start(uint32_t hz) {
+  if (hz == 0)
+    hz = CONFIG_TK_PROF_HZ;
+  if (hz < TK_PROF_HZ_MIN || hz > TK_PROF_HZ_MAX)
+    return ESP_ERR_INVALID_ARG;
+
+  _lock_acquire(&prof_lock);
+
+  if (samples == NULL) {
+    // Internal memory, the interrupt also fires with the flash cache off
+    samples = heap_caps_malloc(CONFIG_TK_PROF_SAMPLES * sizeof *samples,
+                               MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (samples == NULL) {
+      _lock_release(&prof_lock);
+      ESP_LOGE(TAG, "No memory for %u samples.", CONFIG_TK_PROF_SAMPLES);
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  esp_err_t err = tk_prof_timers_init();
+  if (err != ESP_OK) {
+    _lock_release(&prof_lock);
+    return err;
+  }
+
+  tk_prof_halt();
+  head = 0;
+  rate = hz;
+
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    timer_set_counter_value(TK_PROF_GROUP, core, 0);
+    timer_set_alarm_value(TK_PROF_GROUP, core, 1000000 / hz);
+  }
+
+  sampling = true;
+  for (int core = 0; core < portNUM_PROCESSORS; core++)
+    timer_start(TK_PROF_GROUP, core);
+  running = true;
+
+  _lock_release(&prof_lock);
+
+  ESP_LOGI(TAG, "Sampling at %u Hz per core.", hz);
+  return ESP_OK;
+}
+
+void tk_prof_stop(void) {
+  _lock_acquire(&prof_lock);
+  tk_prof_halt();
+  _lock_release(&prof_lock);
+}
+
+bool tk_prof_running(void) { return running; }
+
+uint32_t tk_prof_samples(void) { return head; }
+
+uint8_t *tk_prof_dump(size_t *len) {
+  _lock_acquire(&prof_lock);
+
+  if (samples == NULL || head == 0) {
+    _lock_release(&prof_lock);
+    return NULL;
+  }
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+  static TaskStatus_t statuses[TK_PROF_MAX_TASKS];
+  UBaseType_t tasks = uxTaskGetSystemState(statuses, TK_PROF_MAX_TASKS, NULL);
+#else
+  UBaseType_t tasks = 0;
+#endif
+
+  tk_prof_pause();
+
+  uint32_t total = head;
+  uint32_t count =
+      total < CONFIG_TK_PROF_SAMPLES ? total : CONFIG_TK_PROF_SAMPLES;
+
+  size_t size = sizeof(tk_prof_header_t) +
+                tasks * (4 + configMAX_TASK_NAME_LEN) +
+                count * sizeof(tk_prof_sample_t);
+
+  uint8_t *dump = malloc(size);
+  if (dump == NULL) {
+    sampling = running;
+    _lock_release(&prof_lock);
+    ESP_LOGE(TAG, "No memory for a %u byte dump.", size);
+    return NULL;
+  }
+
+  tk_prof_header_t header = {.magic = TK_PROF_MAGIC,
+                             .version = TK_PROF_VERSION,
+                             .sample_size = sizeof(tk_prof_sample_t),
+                             .cores = portNUM_PROCESSORS,
+                             .depth = CONFIG_TK_PROF_DEPTH,
+                             .tasks = tasks,
+                             .task_name_len = configMAX_TASK_NAME_LEN,
+                             .hz = rate,
+                             .count = count,
+                             .total = total,
+                             .now_us = esp_timer_get_time()};
+  uint8_t *p = dump;
+  memcpy(p, &header, sizeof header);
+  p += sizeof header;
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+  for (UBaseType_t i = 0; i < tasks; i++) {
+    uint32_t handle = (uint32_t)statuses[i].xHandle;
+    memcpy(p, &handle, 4);
+    p += 4;
+    strncpy((char *)p, statuses[i].pcTaskName, configMAX_TASK_NAME_LEN);
+    p += configMAX_TASK_NAME_LEN;
+  }
+#endif
+
+  for (uint32_t i = total - count; i != total; i++) {
+    memcpy(p, &samples[i % CONFIG_TK_PROF_SAMPLES], sizeof(tk_prof_sample_t));
+    p += sizeof(tk_prof_sample_t);
+  }
+
+  sampling = running;
+  _lock_release(&prof_lock);
+
+  *len = p - dump;
+  return dump;
+}
+
+void tk_prof_clear(void) {
+  _lock_acquire(&prof_lock);
+
+  tk_prof_halt();
+  free(samples);
+  samples = NULL;
+  head = 0;
+
+  _lock_release(&prof_lock);
+}
+
+#else
+
+esp_err_t tk_prof_start(uint32_t hz) { return ESP_ERR_NOT_SUPPORTED; }
+
+void tk_prof_stop(void) {}
+
+bool tk_prof_running(void) { return false; }
+
+uint32_t tk_prof_samples(void) { return 0; }
+
+uint8_t *tk_prof_dump(size_t *len) {
+  *len = 0;
+  return NULL;
+}
+
+void tk_prof_clear(void) {}
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * @file profiler.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Sampling CPU profiler, driven by a hardware timer interrupt per core.
+ * @version 0.1
+ * @date 2021-02-20
+ *
+ * Each interrupt records the running task, the interrupted PC and a few return
+ * addresses in a ring, so a dump holds the last CONFIG_TK_PROF_SAMPLES
+ * samples. Nothing is allocated and no interrupt fires until the first start.
+ * Symbolize a dump with tools/profile_report.py.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief Drops the previous samples and starts sampling. Call it from a task;
+ * start, stop, dump and clear may come from several.
+ *
+ * @param hz Samples per second on each core, 0 for CONFIG_TK_PROF_HZ.
+ * @return esp_err_t ESP_ERR_NOT_SUPPORTED if the profiler is disabled,
+ * ESP_ERR_INVALID_ARG for a rate out of range, ESP_ERR_NO_MEM if the ring
+ * cannot be allocated, or the error of a timer that could not be set up.
+ */
+esp_err_t tk_prof_start(uint32_t hz);
+
+/**
+ * @brief Stops sampling, keeping the samples for a dump.
+ *
+ */
+void tk_prof_stop(void);
+
+/**
+ * @brief Whether the timers are running.
+ *
+ */
+bool tk_prof_running(void);
+
+/**
+ * @brief Samples taken since the last start, including those already
+ * overwritten in the ring.
+ *
+ */
+uint32_t tk_prof_samples(void);
+
+/**
+ * @brief Serializes the ring, oldest sample first, with the task names.
+ * Sampling pauses while copying. The format is described in
+ * tools/profile_report.py.
+ *
+ * @param len Where to store the dump length.
+ * @return uint8_t* The dump, to be freed, or NULL if there are no samples or
+ * no memory.
+ */
+uint8_t *tk_prof_dump(size_t *len);
+
+/**
+ * @brief Stops sampling and frees the ring.
+ *
+ */
+void tk_prof_clear(void);
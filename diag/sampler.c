@@ -0,0 +1,156 @@
+/**
+ * @file sampler.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Low-rate system sampler: tasks, heap and LVGL memory.
+ * @version 0.1
+ * @date 2021-02-17
+ *
+ *
+ */
+
+#include "diag/sampler.h"
+
+#include <string.h>
+
+#include "diag/metrics.h"
+#include "diag/trace.h"
+
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#define TAG "Sampler"
+
+static portMUX_TYPE sampler_mux = portMUX_INITIALIZER_UNLOCKED;
+static tk_sample_t last_sample;
+
+static tk_metric_t heap_largest_block_metric =
+    TK_METRIC_GAUGE("tk_heap_largest_free_block_bytes",
+                    "Largest allocatable block at the last sample.");
+
+static tk_metric_t lv_mem_free_metric =
+    TK_METRIC_GAUGE("tk_lv_mem_free_bytes", "Free LVGL heap.");
+
+static tk_metric_t lv_mem_max_used_metric = TK_METRIC_GAUGE(
+    "tk_lv_mem_max_used_bytes", "Highest LVGL heap usage since boot.");
+
+static tk_metric_t lv_mem_frag_metric =
+    TK_METRIC_GAUGE("tk_lv_mem_frag_percent", "LVGL heap fragmentation.");
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+// Counters from the previous sample, to compute the recent CPU share
+static TaskStatus_t statuses[TK_SAMPLER_MAX_TASKS];
+static struct {
+  TaskHandle_t handle;
+  uint32_t runtime;
+} previous[TK_SAMPLER_MAX_TASKS];
+static UBaseType_t previous_count = 0;
+static uint32_t previous_total = 0;
+
+/**
+ * @brief Fills the task table of a sample.
+ *
+ */
+static void tk_sampler_tasks(tk_sample_t *sample) {
+  uint32_t total = 0;
+  UBaseType_t count =
+      uxTaskGetSystemState(statuses, TK_SAMPLER_MAX_TASKS, &total);
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+  uint32_t elapsed = total - previous_total;
+#endif
+
+  for (UBaseType_t i = 0; i < count; i++) {
+    tk_sampler_task_t *task = &sample->tasks[i];
+
+    strlcpy(task->name, statuses[i].pcTaskName, sizeof task->name);
+    task->stack_free_min = statuses[i].usStackHighWaterMark;
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+    task->core = statuses[i].xCoreID == tskNO_AFFINITY ? -1
+                                                       : statuses[i].xCoreID;
+#else
+    task->core = -1;
+#endif
+    task->cpu_permille = -1;
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    for (UBaseType_t j = 0; j < previous_count && elapsed > 0; j++) {
+      if (previous[j].handle == statuses[i].xHandle) {
+        uint32_t delta = statuses[i].ulRunTimeCounter - previous[j].runtime;
+        task->cpu_permille = (uint64_t)delta * 1000 / elapsed;
+        break;
+      }
+    }
+#endif
+  }
+
+  for (UBaseType_t i = 0; i < count; i++) {
+    previous[i].handle = statuses[i].xHandle;
+    previous[i].runtime = statuses[i].ulRunTimeCounter;
+  }
+  previous_count = count;
+  previous_total = total;
+
+  sample->tasks_count = count;
+}
+#endif
+
+/**
+ * @brief Takes a sample, as an lvgl task.
+ *
+ */
+static void tk_sampler_task(lv_task_t *task) {
+  (void)task;
+
+  // Built off to the side, the lock only covers the copy
+  static tk_sample_t sample;
+
+  TK_TRACE_BEGIN(TK_TRACE_SAMPLER, 0);
+
+  sample.time_us = esp_timer_get_time();
+  sample.heap_free = esp_get_free_heap_size();
+  sample.heap_min_free = esp_get_minimum_free_heap_size();
+  sample.heap_largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+  lv_mem_monitor_t mon;
+  lv_mem_monitor(&mon);
+  sample.lv_mem_total = mon.total_size;
+  sample.lv_mem_free = mon.free_size;
+  sample.lv_mem_max_used = mon.max_used;
+  sample.lv_mem_frag_pct = mon.frag_pct;
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+  tk_sampler_tasks(&sample);
+#else
+  sample.tasks_count = 0;
+#endif
+
+  sample.seq++;
+
+  portENTER_CRITICAL(&sampler_mux);
+  memcpy(&last_sample, &sample, sizeof sample);
+  portEXIT_CRITICAL(&sampler_mux);
+  TK_TRACE_END(TK_TRACE_SAMPLER, sample.tasks_count);
+
+  tk_metric_set(&heap_largest_block_metric, sample.heap_largest_block);
+  tk_metric_set(&lv_mem_free_metric, sample.lv_mem_free);
+  tk_metric_set(&lv_mem_max_used_metric, sample.lv_mem_max_used);
+  tk_metric_set(&lv_mem_frag_metric, sample.lv_mem_frag_pct);
+}
+
+void tk_sampler_init(void) {
+  tk_metrics_register(&heap_largest_block_metric);
+  tk_metrics_register(&lv_mem_free_metric);
+  tk_metrics_register(&lv_mem_max_used_metric);
+  tk_metrics_register(&lv_mem_frag_metric);
+
+  // First sample on the next handler run rather than a period from now
+  lv_task_t *task = lv_task_create(tk_sampler_task, CONFIG_TK_METRICS_SAMPLE_MS,
+                                   LV_TASK_PRIO_LOWEST, NULL);
+  lv_task_ready(task);
+}
+
+void tk_sampler_get(tk_sample_t *out) {
+  portENTER_CRITICAL(&sampler_mux);
+  memcpy(out, &last_sample, sizeof *out);
+  portEXIT_CRITICAL(&sampler_mux);
+}
@@ -0,0 +1,83 @@
+/**
+ * @file sampler.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Low-rate system sampler: tasks, heap and LVGL memory.
+ * @version 0.1
+ * @date 2021-02-17
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lvgl/lvgl.h"
+
+#define TK_SAMPLER_MAX_TASKS 24
+
+/**
+ * @brief One task, as seen by the last sample.
+ *
+ */
+typedef struct {
+  char name[configMAX_TASK_NAME_LEN];
+
+  /**
+   * @brief Share of one core over the last interval, -1 if run time stats
+   * are disabled or the task is new.
+   *
+   */
+  int16_t cpu_permille;
+
+  uint32_t stack_free_min;
+
+  /**
+   * @brief Pinned core, -1 if not pinned or unknown.
+   *
+   */
+  int8_t core;
+} tk_sampler_task_t;
+
+/**
+ * @brief A consistent snapshot of the system.
+ *
+ */
+typedef struct {
+  /**
+   * @brief Incremented on every sample, 0 before the first one.
+   *
+   */
+  uint32_t seq;
+  int64_t time_us;
+
+  uint32_t heap_free;
+  uint32_t heap_min_free;
+  uint32_t heap_largest_block;
+
+  uint32_t lv_mem_total;
+  uint32_t lv_mem_free;
+  uint32_t lv_mem_max_used;
+  uint8_t lv_mem_frag_pct;
+
+  uint8_t tasks_count;
+  tk_sampler_task_t tasks[TK_SAMPLER_MAX_TASKS];
+} tk_sample_t;
+
+/**
+ * @brief Registers the sampler gauges and starts sampling every
+ * CONFIG_TK_METRICS_SAMPLE_MS. Must be called from the GUI task, since the
+ * LVGL memory monitor is not thread safe.
+ *
+ */
+void tk_sampler_init(void);
+
+/**
+ * @brief Copies the last sample. Can be called from any task.
+ *
+ * @param out Where to copy it.
+ */
+void tk_sampler_get(tk_sample_t *out);
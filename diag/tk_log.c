@@ -0,0 +1,126 @@
+/**
+ * @file tk_log.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Deferred log printer.
+ * @version 0.1
+ * @date 2021-02-19
+ *
+ *
+ */
+
+#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_DEFAULT
+#include "diag/tk_log.h"
+
+#include <stdio.h>
+
+#include "diag/metrics.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#define TAG "Log"
+
+#if CONFIG_TK_LOG_DEFERRED
+
+#define TK_LOG_LINE_LEN 160
+
+typedef struct {
+  uint32_t time_ms;
+  const char *tag;
+  const char *format;
+  uint8_t level;
+  uint8_t nargs;
+  uint32_t args[TK_DLOG_MAX_ARGS];
+} tk_log_record_t;
+
+static QueueHandle_t log_queue = NULL;
+
+static tk_metric_t log_dropped_metric =
+    TK_METRIC_COUNTER("tk_log_deferred_dropped_total",
+                      "Deferred log lines dropped on a full queue.");
+
+void IRAM_ATTR tk_log_defer(esp_log_level_t level, const char *tag,
+                            const char *format, uint8_t nargs,
+                            const uint32_t *args) {
+  tk_log_record_t record = {.time_ms = esp_log_timestamp(),
+                            .tag = tag,
+                            .format = format,
+                            .level = level,
+                            .nargs = nargs};
+
+  for (uint8_t i = 0; i < nargs; i++)
+    record.args[i] = args[i];
+
+  BaseType_t sent = pdFALSE;
+
+  if (log_queue != NULL) {
+    if (xPortInIsrContext()) {
+      BaseType_t woken = pdFALSE;
+      sent = xQueueSendFromISR(log_queue, &record, &woken);
+      if (woken) {
+        portYIELD_FROM_ISR();
+      }
+    } else {
+      sent = xQueueSend(log_queue, &record, 0);
+    }
+  }
+
+  if (sent != pdTRUE)
+    tk_metric_inc(&log_dropped_metric);
+}
+
+static const char level_letters[] = {'N', 'E', 'W', 'I', 'D', 'V'};
+
+/**
+ * @brief Formats and prints the queued lines, at the lowest priority.
+ *
+ */
+static void tk_log_printer(void *pvParameter) {
+  (void)pvParameter;
+
+  tk_log_record_t record;
+  char line[TK_LOG_LINE_LEN];
+
+  while (1) {
+    if (xQueueReceive(log_queue, &record, portMAX_DELAY) != pdTRUE)
+      continue;
+
+    // Missing arguments read as zero, the format decides how many are used
+    for (uint8_t i = record.nargs; i < TK_DLOG_MAX_ARGS; i++)
+      record.args[i] = 0;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+    snprintf(line, sizeof line, record.format, record.args[0], record.args[1],
+             record.args[2], record.args[3]);
+#pragma GCC diagnostic pop
+
+    esp_log_write(record.level, record.tag, "%c (%u) %s: %s\n",
+                  level_letters[record.level], record.time_ms, record.tag,
+                  line);
+  }
+}
+
+void tk_log_init(void) {
+  if (log_queue != NULL)
+    return;
+
+  tk_metrics_register(&log_dropped_metric);
+
+  log_queue =
+      xQueueCreate(CONFIG_TK_LOG_DEFERRED_DEPTH, sizeof(tk_log_record_t));
+  if (log_queue == NULL) {
+    ESP_LOGE(TAG, "No memory for the deferred log queue.");
+    return;
+  }
+
+  xTaskCreate(tk_log_printer, "log_printer", 3072, NULL, 1, NULL);
+}
+
+#else
+
+void tk_log_init(void) {}
+
+#endif
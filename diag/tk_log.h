@@ -0,0 +1,103 @@
+/**
+ * @file tk_log.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Logging with per-module compile-time levels and a deferred mode.
+ * @version 0.1
+ * @date 2021-02-19
+ *
+ * A module defines its level before using the macros, for example
+ * `#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_UI`. Calls above it compile to
+ * nothing; the arguments are still type checked.
+ *
+ * The TK_DLOGx variants do not format or print: they queue the format, the
+ * tag and up to four integer arguments for a low priority printer task. They
+ * are safe in ISRs and never block. The format and any %s argument must be
+ * string literals, since they are read later; floating point arguments are
+ * refused at compile time.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_log.h"
+
+#define TK_LOG(level, tag, format, ...)                                        \
+  do {                                                                         \
+    if ((level) <= TK_LOG_LEVEL)                                               \
+      ESP_LOG_LEVEL(level, tag, format, ##__VA_ARGS__);                        \
+  } while (0)
+
+#define TK_LOGE(tag, format, ...)                                              \
+  TK_LOG(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define TK_LOGW(tag, format, ...)                                              \
+  TK_LOG(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define TK_LOGI(tag, format, ...)                                              \
+  TK_LOG(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define TK_LOGD(tag, format, ...)                                              \
+  TK_LOG(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define TK_LOGV(tag, format, ...)                                              \
+  TK_LOG(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#define TK_DLOG_MAX_ARGS 4
+
+// One integer argument, a negative array size for floating point ones
+#define TK_DLOG_ARG(a)                                                         \
+  ((uint32_t)(uintptr_t)(a) +                                                  \
+   0 * sizeof(char[__builtin_classify_type(a) == 8 ? -1 : 1]))
+
+#define TK_DLOG_ARGS_0()
+#define TK_DLOG_ARGS_1(a) TK_DLOG_ARG(a)
+#define TK_DLOG_ARGS_2(a, b) TK_DLOG_ARG(a), TK_DLOG_ARG(b)
+#define TK_DLOG_ARGS_3(a, b, c) TK_DLOG_ARG(a), TK_DLOG_ARG(b), TK_DLOG_ARG(c)
+#define TK_DLOG_ARGS_4(a, b, c, d)                                             \
+  TK_DLOG_ARG(a), TK_DLOG_ARG(b), TK_DLOG_ARG(c), TK_DLOG_ARG(d)
+
+#define TK_DLOG_PICK(_0, _1, _2, _3, _4, name, ...) name
+#define TK_DLOG_ARGS(...)                                                      \
+  TK_DLOG_PICK(_0, ##__VA_ARGS__, TK_DLOG_ARGS_4, TK_DLOG_ARGS_3,              \
+               TK_DLOG_ARGS_2, TK_DLOG_ARGS_1, TK_DLOG_ARGS_0)(__VA_ARGS__)
+#define TK_DLOG_NARGS(...) TK_DLOG_PICK(_0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+
+#if CONFIG_TK_LOG_DEFERRED
+
+/**
+ * @brief Queues a log line for the printer task. Use the TK_DLOGx macros.
+ *
+ */
+void tk_log_defer(esp_log_level_t level, const char *tag, const char *format,
+                  uint8_t nargs, const uint32_t *args);
+
+#define TK_DLOG(level, tag, format, ...)                                       \
+  do {                                                                         \
+    if ((level) <= TK_LOG_LEVEL)                                               \
+      tk_log_defer(level, tag, format, TK_DLOG_NARGS(__VA_ARGS__),             \
+                   (const uint32_t[TK_DLOG_MAX_ARGS]){                         \
+                       TK_DLOG_ARGS(__VA_ARGS__)});                            \
+  } while (0)
+
+#else
+
+// Printed right away
+#define TK_DLOG(level, tag, format, ...)                                       \
+  TK_LOG(level, tag, format, ##__VA_ARGS__)
+
+#endif
+
+#define TK_DLOGE(tag, format, ...)                                             \
+  TK_DLOG(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define TK_DLOGW(tag, format, ...)                                             \
+  TK_DLOG(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define TK_DLOGI(tag, format, ...)                                             \
+  TK_DLOG(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define TK_DLOGD(tag, format, ...)                                             \
+  TK_DLOG(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define TK_DLOGV(tag, format, ...)                                             \
+  TK_DLOG(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+/**
+ * @brief Starts the deferred log printer. Lines queued before are dropped.
+ *
+ */
+void tk_log_init(void);
@@ -0,0 +1,197 @@
+/**
+ * @file trace.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Binary event trace, cheap enough for the hot paths and ISRs.
+ * @version 0.1
+ * @date 2021-02-18
+ *
+ *
+ */
+
+#include "diag/trace.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TAG "Trace"
+
+#if CONFIG_TK_TRACE
+
+#define TK_TRACE_MAGIC 0x52544b54 // "TKTR"
+#define TK_TRACE_VERSION 1
+#define TK_TRACE_MAX_TASKS 24
+#define TK_TRACE_FLAG_ISR 0x01
+
+_Static_assert((CONFIG_TK_TRACE_RECORDS & (CONFIG_TK_TRACE_RECORDS - 1)) == 0,
+               "CONFIG_TK_TRACE_RECORDS must be a power of two");
+
+typedef struct {
+  uint32_t time_us;
+  uint16_t event;
+  uint8_t type;
+  uint8_t flags;
+  uint32_t task;
+  uint32_t arg;
+} tk_trace_entry_t;
+
+typedef struct {
+  // Total records written, the slot is head modulo the size
+  volatile uint32_t head;
+  tk_trace_entry_t entries[CONFIG_TK_TRACE_RECORDS];
+} tk_trace_ring_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t entry_size;
+  uint8_t cores;
+  uint8_t events;
+  uint8_t tasks;
+  uint8_t task_name_len;
+  uint32_t ring_size;
+  uint64_t now_us;
+} tk_trace_header_t;
+
+#define TK_TRACE_EVENT_NAME(id, name) name,
+
+static const char *const event_names[TK_TRACE_EVENT_COUNT] = {
+    TK_TRACE_EVENTS(TK_TRACE_EVENT_NAME)};
+
+static tk_trace_ring_t rings[portNUM_PROCESSORS];
+static volatile bool recording = true;
+
+void IRAM_ATTR tk_trace_record(tk_trace_event_t event, tk_trace_type_t type,
+                               uint32_t arg) {
+  if (!recording)
+    return;
+
+  bool isr = xPortInIsrContext();
+
+  // A task moved to the other core in between still gets a slot of its own,
+  // the increment is atomic across cores
+  tk_trace_ring_t *ring = &rings[xPortGetCoreID()];
+  uint32_t slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+  tk_trace_entry_t *entry =
+      &ring->entries[slot & (CONFIG_TK_TRACE_RECORDS - 1)];
+
+  entry->time_us = (uint32_t)esp_timer_get_time();
+  entry->event = event;
+  entry->type = type;
+  entry->flags = isr ? TK_TRACE_FLAG_ISR : 0;
+  entry->task = isr ? 0 : (uint32_t)xTaskGetCurrentTaskHandle();
+  entry->arg = arg;
+}
+
+/**
+ * @brief Stops recording and lets the writers already past the check finish.
+ *
+ */
+static void tk_trace_pause(void) {
+  recording = false;
+  vTaskDelay(1);
+}
+
+uint8_t *tk_trace_dump(size_t *len) {
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+  static TaskStatus_t statuses[TK_TRACE_MAX_TASKS];
+  UBaseType_t tasks = uxTaskGetSystemState(statuses, TK_TRACE_MAX_TASKS, NULL);
+#else
+  UBaseType_t tasks = 0;
+#endif
+
+  size_t names_len = 0;
+  for (int i = 0; i < TK_TRACE_EVENT_COUNT; i++)
+    names_len += 1 + strlen(event_names[i]);
+
+  size_t size = sizeof(tk_trace_header_t) + names_len +
+                tasks * (4 + configMAX_TASK_NAME_LEN) +
+                portNUM_PROCESSORS * (4 + sizeof rings[0].entries);
+
+  uint8_t *dump = malloc(size);
+  if (dump == NULL) {
+    ESP_LOGE(TAG, "No memory for a %u byte dump.", size);
+    return NULL;
+  }
+
+  tk_trace_pause();
+
+  tk_trace_header_t header = {.magic = TK_TRACE_MAGIC,
+                              .version = TK_TRACE_VERSION,
+                              .entry_size = sizeof(tk_trace_entry_t),
+                              .cores = portNUM_PROCESSORS,
+                              .events = TK_TRACE_EVENT_COUNT,
+                              .tasks = tasks,
+                              .task_name_len = configMAX_TASK_NAME_LEN,
+                              .ring_size = CONFIG_TK_TRACE_RECORDS,
+                              .now_us = esp_timer_get_time()};
+  uint8_t *p = dump;
+  memcpy(p, &header, sizeof header);
+  p += sizeof header;
+
+  // Event names, length prefixed, in id order
+  for (int i = 0; i < TK_TRACE_EVENT_COUNT; i++) {
+    uint8_t name_len = strlen(event_names[i]);
+    *p++ = name_len;
+    memcpy(p, event_names[i], name_len);
+    p += name_len;
+  }
+
+  // Task names by handle, so the tool can label the tracks
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+  for (UBaseType_t i = 0; i < tasks; i++) {
+    uint32_t handle = (uint32_t)statuses[i].xHandle;
+    memcpy(p, &handle, 4);
+    p += 4;
+    strncpy((char *)p, statuses[i].pcTaskName, configMAX_TASK_NAME_LEN);
+    p += configMAX_TASK_NAME_LEN;
+  }
+#endif
+
+  // Each ring oldest first, with its record count
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    tk_trace_ring_t *ring = &rings[core];
+    uint32_t head = ring->head;
+    uint32_t count =
+        head < CONFIG_TK_TRACE_RECORDS ? head : CONFIG_TK_TRACE_RECORDS;
+
+    memcpy(p, &count, 4);
+    p += 4;
+
+    for (uint32_t i = head - count; i != head; i++) {
+      memcpy(p, &ring->entries[i & (CONFIG_TK_TRACE_RECORDS - 1)],
+             sizeof(tk_trace_entry_t));
+      p += sizeof(tk_trace_entry_t);
+    }
+  }
+
+  recording = true;
+
+  *len = p - dump;
+  return dump;
+}
+
+void tk_trace_clear(void) {
+  tk_trace_pause();
+
+  for (int core = 0; core < portNUM_PROCESSORS; core++)
+    rings[core].head = 0;
+
+  recording = true;
+}
+
+#else
+
+uint8_t *tk_trace_dump(size_t *len) {
+  *len = 0;
+  return NULL;
+}
+
+void tk_trace_clear(void) {}
+
+#endif
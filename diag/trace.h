@@ -0,0 +1,94 @@
+/**
+ * @file trace.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Binary event trace, cheap enough for the hot paths and ISRs.
+ * @version 0.1
+ * @date 2021-02-18
+ *
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Every trace event, with the name shown by tools/trace2perfetto.py.
+ * Append only, the ids are in the dumps.
+ *
+ */
+#define TK_TRACE_EVENTS(X)                                                     \
+  X(TK_TRACE_UI_JOBS, "ui jobs")                                               \
+  X(TK_TRACE_GUI_HANDLER, "lv_task_handler")                                   \
+  X(TK_TRACE_GUI_SLEEP, "gui sleep")                                           \
+  X(TK_TRACE_REFRESH, "refresh")                                               \
+  X(TK_TRACE_FRAME, "frame")                                                   \
+  X(TK_TRACE_BLE_NOTIFY, "ble notify")                                         \
+  X(TK_TRACE_ENCODER_ISR, "encoder isr")                                       \
+  X(TK_TRACE_ENCODER_SAMPLE, "encoder sample")                                 \
+  X(TK_TRACE_BUTTON_ISR, "button isr")                                         \
+  X(TK_TRACE_BUTTON_SAMPLE, "button sample")                                   \
+  X(TK_TRACE_NV_COMMIT, "nv commit")                                           \
+  X(TK_TRACE_TELEMETRY, "telemetry tick")                                      \
+  X(TK_TRACE_SAMPLER, "sampler")
+
+#define TK_TRACE_EVENT_ENUM(id, name) id,
+
+typedef enum {
+  TK_TRACE_EVENTS(TK_TRACE_EVENT_ENUM) TK_TRACE_EVENT_COUNT
+} tk_trace_event_t;
+
+typedef enum {
+  TK_TRACE_TYPE_BEGIN,
+  TK_TRACE_TYPE_END,
+  TK_TRACE_TYPE_INSTANT,
+  TK_TRACE_TYPE_COUNTER
+} tk_trace_type_t;
+
+#if CONFIG_TK_TRACE
+
+/**
+ * @brief Appends a record to the ring of the calling core. Lock free, safe in
+ * ISRs.
+ *
+ * @param event The event.
+ * @param type Begin, end, instant or counter.
+ * @param arg Free argument, the value for counters.
+ */
+void tk_trace_record(tk_trace_event_t event, tk_trace_type_t type,
+                     uint32_t arg);
+
+#define TK_TRACE_BEGIN(event, arg)                                             \
+  tk_trace_record(event, TK_TRACE_TYPE_BEGIN, (uint32_t)(arg))
+#define TK_TRACE_END(event, arg)                                               \
+  tk_trace_record(event, TK_TRACE_TYPE_END, (uint32_t)(arg))
+#define TK_TRACE_INSTANT(event, arg)                                           \
+  tk_trace_record(event, TK_TRACE_TYPE_INSTANT, (uint32_t)(arg))
+#define TK_TRACE_COUNTER(event, value)                                         \
+  tk_trace_record(event, TK_TRACE_TYPE_COUNTER, (uint32_t)(value))
+
+#else
+
+#define TK_TRACE_BEGIN(event, arg) ((void)0)
+#define TK_TRACE_END(event, arg) ((void)0)
+#define TK_TRACE_INSTANT(event, arg) ((void)0)
+#define TK_TRACE_COUNTER(event, value) ((void)0)
+
+#endif
+
+/**
+ * @brief Pauses recording and serializes the rings, the event names and the
+ * task names. The format is described in tools/trace2perfetto.py.
+ *
+ * @param len Where to store the dump length.
+ * @return uint8_t* The dump, to be freed, or NULL if tracing is disabled or
+ * out of memory.
+ */
+uint8_t *tk_trace_dump(size_t *len);
+
+/**
+ * @brief Drops every record.
+ *
+ */
+void tk_trace_clear(void);
@@ -10,31 +10,34 @@
 
 #include <stdbool.h>
 
-#include "ui/styles/tk_style.h"
+#include "ui/styles/tk_theme.h"
 #include "ui/views.h"
 
 #include "lvgl/lvgl.h"
-#include "lvgl/src/lv_themes/lv_theme_material.h"
 
 #include "hmi/ESP32/brightness.h"
+#include "model/datastore.h"
 #include "driver/ledc.h"
 #include "driver/adc.h"
 #include "soc/adc_channel.h"
 #include "esp_err.h"
-#include "esp_log.h"
+#include "esp_sleep.h"
+#include "diag/tk_log.h"
 
 #define TAG "Brightness"
+#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_HMI
 
 ledc_channel_config_t ledc_channel;
 static tk_brightness_settings_t *settings_int;
 static bool dark_theme = true;
+static bool backlight_dimmed = false;
 
 /**
  * @brief Writes the brightness value to the backlight.
  * 
  * @param value Brightness value (0-1).
  */
-void brightness_write(double value)
+void brightness_write(float value)
 {
     // TODO: Implement fade
     // Constrain input
@@ -43,29 +46,48 @@ void brightness_write(double value)
     if (value > 1)
         value = 1;
 
+#if CONFIG_TK_POWER_DIM_S > 0
+    if (backlight_dimmed)
+        value *= CONFIG_TK_POWER_DIM_PERCENT / 100.0f;
+#endif
+
     // Get duty cycle
-    unsigned int duty_cycle = BRIGHTNESS_MIN + (value * (double)(BRIGHTNESS_MAX - BRIGHTNESS_MIN));
+    unsigned int duty_cycle = BRIGHTNESS_MIN + (value * (float)(BRIGHTNESS_MAX - BRIGHTNESS_MIN));
 
     ESP_ERROR_CHECK(ledc_set_fade_time_and_start(ledc_channel.speed_mode, ledc_channel.channel, duty_cycle, 100, LEDC_FADE_NO_WAIT));
 }
 
 /**
- * @brief Initializes the brightness manager.
+ * @brief Sets up the backlight PWM and turns it fully on. Safe to call more
+ * than once.
  * 
- * @param settings Initial settings.
  */
-void hmi_brightness_init(tk_brightness_settings_t *settings)
+void hmi_backlight_init(void)
 {
-    // Save the pointer for internal editing
-    settings_int = settings;
+    static bool initialized = false;
+
+    if (initialized)
+        return;
 
     // Set up the PWM driver
+#if CONFIG_TK_POWER_LIGHT_SLEEP
+    // The APB clock stops in light sleep, this one keeps the backlight on
+    ESP_ERROR_CHECK(esp_sleep_pd_config(ESP_PD_DOMAIN_RTC8M, ESP_PD_OPTION_ON));
+
+    ledc_timer_config_t ledc_timer = {
+        .duty_resolution = LEDC_TIMER_10_BIT,
+        .freq_hz = 7500,
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .timer_num = LEDC_TIMER_0,
+        .clk_cfg = LEDC_USE_RTC8M_CLK};
+#else
     ledc_timer_config_t ledc_timer = {
         .duty_resolution = LEDC_TIMER_10_BIT,
         .freq_hz = 8000,
         .speed_mode = LEDC_LOW_SPEED_MODE,
         .timer_num = LEDC_TIMER_0,
         .clk_cfg = LEDC_AUTO_CLK};
+#endif
 
     ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
 
@@ -81,6 +103,37 @@ void hmi_brightness_init(tk_brightness_settings_t *settings)
     ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
     ESP_ERROR_CHECK(ledc_fade_func_install(0));
 
+    brightness_write(1);
+    initialized = true;
+}
+
+/**
+ * @brief Dims the backlight, or brings it back to the set brightness.
+ * 
+ * @param dim true to dim.
+ */
+void hmi_backlight_dim(bool dim)
+{
+    if (dim == backlight_dimmed)
+        return;
+
+    backlight_dimmed = dim;
+    brightness_write(settings_int != NULL ? settings_int->level : 1);
+}
+
+/**
+ * @brief Initializes the brightness manager.
+ * 
+ * @param settings Initial settings.
+ */
+void hmi_brightness_init(tk_brightness_settings_t *settings)
+{
+    // Save the pointer for internal editing
+    settings_int = settings;
+
+    // Normally already on for the splash
+    hmi_backlight_init();
+
     // Set up LDR switcher
     gpio_config_t switcher_gpio = {
         .mode = GPIO_MODE_OUTPUT_OD,
@@ -107,9 +160,9 @@ void hmi_brightness_init(tk_brightness_settings_t *settings)
  * 
  * @param avg The old average.
  * @param new_sample The new sample.
- * @return double The new average.
+ * @return float The new average.
  */
-double exp_roll_avg(double avg, double new_sample)
+float exp_roll_avg(float avg, float new_sample)
 {
 
     avg -= avg / 10;
@@ -127,22 +180,8 @@ void switch_theme(bool light)
 {
     dark_theme = !light;
 
-    // Set theme
-    if (light)
-    {
-        lv_theme_material_init(tk_get_primary_color(true), tk_get_secondary_color(true),
-                               LV_THEME_MATERIAL_FLAG_LIGHT,
-                               &nunito_bold_12, &nunito_bold_16, &nunito_bold_24, &nunito_bold_36);
-    }
-    else
-    {
-        lv_theme_material_init(tk_get_primary_color(false), tk_get_secondary_color(false),
-                               LV_THEME_MATERIAL_FLAG_DARK,
-                               &nunito_bold_12, &nunito_bold_16, &nunito_bold_24, &nunito_bold_36);
-    }
-
-    // Generate styles
-    tk_styles_init(light);
+    // Prebuilt at the first call, a swap after that
+    tk_theme_set(light);
 }
 
 /**
@@ -167,12 +206,12 @@ void brightness_task(lv_task_t *task)
             reading = LIGHT_DARK;
         if (reading < LIGHT_BRIGHT)
             reading = LIGHT_BRIGHT;
-        double environment_darkness = (double)(reading - LIGHT_BRIGHT) / (double)(LIGHT_DARK - LIGHT_BRIGHT);
-        double environment_light = 1.0 - environment_darkness;
+        float environment_darkness = (float)(reading - LIGHT_BRIGHT) / (float)(LIGHT_DARK - LIGHT_BRIGHT);
+        float environment_light = 1.0f - environment_darkness;
 
         // Update struct
         settings_int->level = exp_roll_avg(settings_int->level, environment_light);
-        ESP_LOGD(TAG, "Reading = %d. Relative brightness = %.4f, average %.4f.", reading, environment_light, settings_int->level);
+        TK_LOGD(TAG, "Reading = %d. Relative brightness = %.4f, average %.4f.", reading, environment_light, settings_int->level);
 
         // Set display to correct value
         brightness_write(settings_int->level);
@@ -183,6 +222,14 @@ void brightness_task(lv_task_t *task)
         brightness_write(settings_int->level);
     }
 
+    // Fixed theme
+    if (!global_datastore.theme_settings.automatic)
+    {
+        if (global_datastore.theme_settings.light == dark_theme)
+            switch_theme(global_datastore.theme_settings.light);
+        return;
+    }
+
     // Update theme (with hysteresis)
     if (settings_int->level > THEME_THRESHOLD_HIGH && dark_theme)
     {
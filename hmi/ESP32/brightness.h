@@ -17,8 +17,23 @@
 #define BRIGHTNESS_MAX  1023
 #define LIGHT_DARK      4095
 #define LIGHT_BRIGHT    1800
-#define THEME_THRESHOLD_LOW     0.10
-#define THEME_THRESHOLD_HIGH    0.15
+#define THEME_THRESHOLD_LOW     0.10f
+#define THEME_THRESHOLD_HIGH    0.15f
+
+/**
+ * @brief Sets up the backlight PWM and turns it fully on. Safe to call more
+ * than once.
+ * 
+ */
+void hmi_backlight_init(void);
+
+/**
+ * @brief Dims the backlight, or brings it back to the set brightness. The
+ * brightness task keeps the level it writes dimmed meanwhile.
+ * 
+ * @param dim true to dim.
+ */
+void hmi_backlight_dim(bool dim);
 
 /**
  * @brief Initializes the brightness manager.
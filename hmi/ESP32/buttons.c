@@ -8,17 +8,23 @@
  * 
  */
 
-#include "esp_log.h"
+#include "diag/tk_log.h"
 #include "esp_timer.h"
 
 #include "buttons.h"
+#include "diag/trace.h"
+#include "tkos.h"
 
 #define TAG "Buttons"
+#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_HMI
 
 static volatile uint64_t hmi_button_last_micros = 0;
 static volatile int16_t hmi_button_last = -1;
 int hmi_button_isr_id = -1;
 
+// Set while the pins wake the chip from light sleep instead of interrupting
+static volatile bool hmi_buttons_wake_armed = false;
+
 esp_timer_handle_t hmi_buttons_delayer;
 
 /**
@@ -31,7 +37,7 @@ void hmi_buttons_sample(void *arg)
     int id = *(int *)arg;
     int pin;
 
-    ESP_LOGD(TAG, "Sampling button %d.", id);
+    TK_DLOGD(TAG, "Sampling button %d.", id);
 
     // Associate id to pin
     switch (id)
@@ -47,18 +53,21 @@ void hmi_buttons_sample(void *arg)
         break;
     }
 
+    TK_TRACE_INSTANT(TK_TRACE_BUTTON_SAMPLE, id);
+
     // Some time after the interrupt we should see if it was a press or a release
     if (gpio_get_level(pin))
     {
-        ESP_LOGD(TAG, "Button %d was pressed.", id);
+        TK_DLOGD(TAG, "Button %d was pressed.", id);
         hmi_button_last = id;
     }
     else
     {
-        ESP_LOGD(TAG, "Button %d was being released.", id);
+        TK_DLOGD(TAG, "Button %d was being released.", id);
         hmi_button_last = -1;
     }
 
+    tk_gui_wake_input();
 }
 
 /**
@@ -69,6 +78,7 @@ void hmi_buttons_sample(void *arg)
 static void IRAM_ATTR hmi_buttons_isr(void *arg)
 {
     hmi_button_isr_id = (int)arg;
+    TK_TRACE_INSTANT(TK_TRACE_BUTTON_ISR, hmi_button_isr_id);
     if (esp_timer_get_time() - hmi_button_last_micros > HMI_BUTTON_DEB_US)
         // Delay reading
         ESP_ERROR_CHECK(esp_timer_start_once(hmi_buttons_delayer, HMI_BUTTON_DEL_US));
@@ -105,6 +115,74 @@ void hmi_buttons_init()
     ESP_LOGI(TAG, "Buttons initialized.");
 }
 
+/**
+ * @brief Makes a press wake the chip from light sleep. Edges are not seen
+ * without the APB clock, so the interrupts give way to a level wakeup until
+ * the press is polled or the wakeup disarmed.
+ * 
+ */
+void hmi_buttons_wake_arm(void)
+{
+    gpio_intr_disable(HMI_BUTTON_PIN_LEFT);
+    gpio_intr_disable(HMI_BUTTON_PIN_RIGHT);
+    gpio_wakeup_enable(HMI_BUTTON_PIN_LEFT, GPIO_INTR_HIGH_LEVEL);
+    gpio_wakeup_enable(HMI_BUTTON_PIN_RIGHT, GPIO_INTR_HIGH_LEVEL);
+
+    __atomic_store_n(&hmi_buttons_wake_armed, true, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Gives the pins back to the edge interrupts.
+ * 
+ */
+static void hmi_buttons_wake_restore(void)
+{
+    gpio_wakeup_disable(HMI_BUTTON_PIN_LEFT);
+    gpio_wakeup_disable(HMI_BUTTON_PIN_RIGHT);
+    gpio_set_intr_type(HMI_BUTTON_PIN_LEFT, GPIO_INTR_ANYEDGE);
+    gpio_set_intr_type(HMI_BUTTON_PIN_RIGHT, GPIO_INTR_ANYEDGE);
+    gpio_intr_enable(HMI_BUTTON_PIN_LEFT);
+    gpio_intr_enable(HMI_BUTTON_PIN_RIGHT);
+}
+
+/**
+ * @brief Disarms the wakeup if a button is pressed, and samples the press as
+ * the ISR would have. Called from the idle task.
+ * 
+ */
+void hmi_buttons_wake_poll(void)
+{
+    if (!__atomic_load_n(&hmi_buttons_wake_armed, __ATOMIC_ACQUIRE))
+        return;
+
+    int id;
+    if (gpio_get_level(HMI_BUTTON_PIN_LEFT))
+        id = HMI_BUTTON_ID_LEFT;
+    else if (gpio_get_level(HMI_BUTTON_PIN_RIGHT))
+        id = HMI_BUTTON_ID_RIGHT;
+    else
+        return;
+
+    if (!__atomic_exchange_n(&hmi_buttons_wake_armed, false, __ATOMIC_ACQ_REL))
+        return;
+
+    hmi_buttons_wake_restore();
+
+    hmi_button_isr_id = id;
+    hmi_button_last_micros = esp_timer_get_time();
+    esp_timer_start_once(hmi_buttons_delayer, HMI_BUTTON_DEL_US);
+}
+
+/**
+ * @brief Gives the pins back to the edge interrupts, if armed.
+ * 
+ */
+void hmi_buttons_wake_disarm(void)
+{
+    if (__atomic_exchange_n(&hmi_buttons_wake_armed, false, __ATOMIC_ACQ_REL))
+        hmi_buttons_wake_restore();
+}
+
 /**
  * @brief The callback function for interfacing this driver with lvgl.
  * 
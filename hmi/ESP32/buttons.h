@@ -31,6 +31,26 @@
  */
 void hmi_buttons_init();
 
+/**
+ * @brief Makes a press wake the chip from light sleep, until it is polled or
+ * the wakeup disarmed. The buttons do not interrupt meanwhile.
+ * 
+ */
+void hmi_buttons_wake_arm(void);
+
+/**
+ * @brief Disarms the wakeup if a button is pressed, and samples the press as
+ * the ISR would have. Called from the idle task.
+ * 
+ */
+void hmi_buttons_wake_poll(void);
+
+/**
+ * @brief Gives the pins back to the edge interrupts, if armed.
+ * 
+ */
+void hmi_buttons_wake_disarm(void);
+
 /**
  * @brief The callback function for interfacing this driver with lvgl.
  * 
@@ -8,16 +8,22 @@
  * 
  */
 
-#include "esp_log.h"
+#include "diag/tk_log.h"
 #include "esp_timer.h"
 
 #include "encoder.h"
+#include "diag/trace.h"
+#include "tkos.h"
 
 #define TAG "Encoder"
+#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_HMI
 
 static volatile int64_t hmi_encoder_last_micros = 0;
 static volatile int16_t hmi_encoder_delta = 0;
 
+// Level of line A when the wakeup was armed, -1 when not armed
+static volatile int hmi_encoder_wake_rest = -1;
+
 esp_timer_handle_t hmi_encoder_delayer;
 
 
@@ -36,6 +42,9 @@ void hmi_encoder_sample()
 
     // Update delta
     hmi_encoder_delta += (2 * input) - 1;
+    TK_TRACE_INSTANT(TK_TRACE_ENCODER_SAMPLE, input);
+
+    tk_gui_wake_input();
 }
 
 /**
@@ -45,6 +54,8 @@ void hmi_encoder_sample()
  */
 static void IRAM_ATTR hmi_encoder_isr(void *arg)
 {
+    TK_TRACE_INSTANT(TK_TRACE_ENCODER_ISR, 0);
+
     // Keep only the first edge and ignore next until DEB_US has passed (since the last edge)
     if (esp_timer_get_time() - hmi_encoder_last_micros > HMI_ENCODER_DEB_US)
     {
@@ -94,6 +105,65 @@ void hmi_encoder_init()
     ESP_LOGI(TAG, "Encoder initialized.");
 }
 
+/**
+ * @brief Makes a step wake the chip from light sleep: line A rests at either
+ * level, so the wakeup is on the other one.
+ * 
+ */
+void hmi_encoder_wake_arm(void)
+{
+    int rest = gpio_get_level(HMI_ENCODER_PIN_A);
+
+    gpio_intr_disable(HMI_ENCODER_PIN_A);
+    gpio_wakeup_enable(HMI_ENCODER_PIN_A, rest ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+
+    __atomic_store_n(&hmi_encoder_wake_rest, rest, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Gives line A back to the edge interrupt.
+ * 
+ */
+static void hmi_encoder_wake_restore(void)
+{
+    gpio_wakeup_disable(HMI_ENCODER_PIN_A);
+    gpio_set_intr_type(HMI_ENCODER_PIN_A, GPIO_INTR_POSEDGE);
+    gpio_intr_enable(HMI_ENCODER_PIN_A);
+}
+
+/**
+ * @brief Disarms the wakeup if line A moved, and samples the step if it was a
+ * rising edge, as the ISR would have. Called from the idle task.
+ * 
+ */
+void hmi_encoder_wake_poll(void)
+{
+    int rest = __atomic_load_n(&hmi_encoder_wake_rest, __ATOMIC_ACQUIRE);
+    if (rest < 0 || gpio_get_level(HMI_ENCODER_PIN_A) == rest)
+        return;
+
+    if (__atomic_exchange_n(&hmi_encoder_wake_rest, -1, __ATOMIC_ACQ_REL) < 0)
+        return;
+
+    hmi_encoder_wake_restore();
+
+    if (rest == 0)
+    {
+        hmi_encoder_last_micros = esp_timer_get_time();
+        esp_timer_start_once(hmi_encoder_delayer, HMI_ENCODER_DEL_US);
+    }
+}
+
+/**
+ * @brief Gives line A back to the edge interrupt, if armed.
+ * 
+ */
+void hmi_encoder_wake_disarm(void)
+{
+    if (__atomic_exchange_n(&hmi_encoder_wake_rest, -1, __ATOMIC_ACQ_REL) >= 0)
+        hmi_encoder_wake_restore();
+}
+
 /**
  * @brief The callback function for interfacing this driver with lvgl.
  * 
@@ -106,7 +176,7 @@ bool hmi_encoder_read(lv_indev_drv_t *drv, lv_indev_data_t *data)
 {
     data->enc_diff = hmi_encoder_moves();
     if (data->enc_diff != 0) {
-        ESP_LOGD(TAG, "Encoder delta: %d.", data->enc_diff);
+        TK_DLOGD(TAG, "Encoder delta: %d.", data->enc_diff);
         data->key = data->enc_diff < 0 ? LV_KEY_LEFT : LV_KEY_RIGHT;
     }
 
@@ -26,6 +26,26 @@
  */
 void hmi_encoder_init();
 
+/**
+ * @brief Makes a step wake the chip from light sleep, until it is polled or
+ * the wakeup disarmed. The encoder does not interrupt meanwhile.
+ * 
+ */
+void hmi_encoder_wake_arm(void);
+
+/**
+ * @brief Disarms the wakeup if line A moved, and samples the step as the ISR
+ * would have. Called from the idle task.
+ * 
+ */
+void hmi_encoder_wake_poll(void);
+
+/**
+ * @brief Gives line A back to the edge interrupt, if armed.
+ * 
+ */
+void hmi_encoder_wake_disarm(void);
+
 /**
  * @brief The callback function for interfacing this driver with lvgl.
  * 
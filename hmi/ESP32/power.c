@@ -0,0 +1,271 @@
+/**
+ * @file power.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Refresh rate governor and idle power mode.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "hmi/ESP32/power.h"
+
+#include "diag/metrics.h"
+#include "hmi/ESP32/brightness.h"
+#include "hmi/ESP32/buttons.h"
+#include "hmi/ESP32/encoder.h"
+#include "model/datastore.h"
+#include "model/samples.h"
+#include "ui/refresh/refresh.h"
+
+#include "freertos/FreeRTOS.h"
+#include "esp_freertos_hooks.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "soc/rtc.h"
+
+#define TAG "Power"
+
+#define TK_POWER_DIM_MS (CONFIG_TK_POWER_DIM_S * 1000)
+
+static tk_metric_t active_metric = TK_METRIC_COUNTER(
+    "tk_power_active_ms_total", "Time spent active, at the full UI rate.");
+static tk_metric_t idle_metric = TK_METRIC_COUNTER(
+    "tk_power_idle_ms_total", "Time spent idle, at the reduced UI rate.");
+static tk_metric_t dimmed_metric = TK_METRIC_COUNTER(
+    "tk_power_dimmed_ms_total", "Time spent with the backlight dimmed.");
+static tk_metric_t wakes_metric = TK_METRIC_COUNTER(
+    "tk_power_wakes_total", "Inputs that ended an idle period.");
+static tk_metric_t wake_frame_metric = TK_METRIC_HISTOGRAM(
+    "tk_power_wake_frame_ms",
+    "Time from an input that ended an idle period to the frame answering it.",
+    5, 10, 20, 40, 80, 160);
+
+typedef struct {
+  lv_task_t *task;
+  uint32_t active_period;
+  uint32_t idle_period;
+} tk_power_task_t;
+
+static tk_power_task_t tasks[TK_POWER_TASKS];
+
+static bool active = true;
+static bool dimmed = false;
+
+// esp_timer milliseconds, the clock the samples are stamped with
+static uint32_t last_input_ms = 0;
+static uint32_t last_account_ms = 0;
+
+static bool wake_pending = false;
+static int64_t wake_start_us = 0;
+
+#if CONFIG_PM_ENABLE
+// Held while the GUI task runs, and while active
+static esp_pm_lock_handle_t awake_lock = NULL;
+static esp_pm_lock_handle_t active_lock = NULL;
+#endif
+
+#if CONFIG_TK_POWER_LIGHT_SLEEP
+/**
+ * @brief Runs in the idle tasks, which are the first to run after a light
+ * sleep: an input that woke the chip is sampled from here.
+ *
+ * @return true The core can wait for an interrupt.
+ */
+static bool tk_power_idle_hook(void) {
+  hmi_buttons_wake_poll();
+  hmi_encoder_wake_poll();
+  return true;
+}
+#endif
+
+/**
+ * @brief Adds the time since the last call to the mode counters.
+ *
+ */
+static void tk_power_account(uint32_t now_ms) {
+  uint32_t elapsed = now_ms - last_account_ms;
+  last_account_ms = now_ms;
+
+  tk_metric_add(active ? &active_metric : &idle_metric, elapsed);
+  if (dimmed)
+    tk_metric_add(&dimmed_metric, elapsed);
+}
+
+static void tk_power_set_active(bool value) {
+  active = value;
+
+  tk_refresh_set_min_ms(active ? TK_REFRESH_MIN_MS
+                               : CONFIG_TK_POWER_IDLE_REFRESH_MS);
+
+  for (int i = 0; i < TK_POWER_TASKS; i++) {
+    if (tasks[i].task != NULL)
+      lv_task_set_period(tasks[i].task, active ? tasks[i].active_period
+                                               : tasks[i].idle_period);
+  }
+
+#if CONFIG_PM_ENABLE
+  if (active)
+    esp_pm_lock_acquire(active_lock);
+#endif
+
+#if CONFIG_TK_POWER_LIGHT_SLEEP
+  if (active) {
+    hmi_buttons_wake_disarm();
+    hmi_encoder_wake_disarm();
+  } else {
+    hmi_buttons_wake_arm();
+    hmi_encoder_wake_arm();
+  }
+#endif
+
+#if CONFIG_PM_ENABLE
+  if (!active)
+    esp_pm_lock_release(active_lock);
+#endif
+
+  ESP_LOGD(TAG, "%s.", active ? "Active" : "Idle");
+}
+
+void tk_power_init(void) {
+  tk_metrics_register(&active_metric);
+  tk_metrics_register(&idle_metric);
+  tk_metrics_register(&dimmed_metric);
+  tk_metrics_register(&wakes_metric);
+  tk_metrics_register(&wake_frame_metric);
+
+  last_input_ms = esp_timer_get_time() / 1000;
+  last_account_ms = last_input_ms;
+
+#if CONFIG_PM_ENABLE
+  ESP_ERROR_CHECK(
+      esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "tk_gui", &awake_lock));
+  ESP_ERROR_CHECK(
+      esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "tk_active", &active_lock));
+  esp_pm_lock_acquire(awake_lock);
+  esp_pm_lock_acquire(active_lock);
+
+  // The lowest clock is the crystal's, the APB clock follows it
+  esp_pm_config_esp32_t config = {
+      .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+      .min_freq_mhz = (int)rtc_clk_xtal_freq_get(),
+#if CONFIG_TK_POWER_LIGHT_SLEEP
+      .light_sleep_enable = true,
+#endif
+  };
+
+  esp_err_t err = esp_pm_configure(&config);
+  if (err != ESP_OK)
+    ESP_LOGW(TAG, "Power management not configured: %s.",
+             esp_err_to_name(err));
+#endif
+
+#if CONFIG_TK_POWER_LIGHT_SLEEP
+  ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+  for (int core = 0; core < portNUM_PROCESSORS; core++)
+    ESP_ERROR_CHECK(
+        esp_register_freertos_idle_hook_for_cpu(tk_power_idle_hook, core));
+#endif
+
+  ESP_LOGI(TAG, "Idle after %d ms, dimmed after %d s with the engine off.",
+           CONFIG_TK_POWER_IDLE_MS, CONFIG_TK_POWER_DIM_S);
+}
+
+void tk_power_add_task(lv_task_t *task, uint32_t idle_period) {
+  for (int i = 0; i < TK_POWER_TASKS; i++) {
+    if (tasks[i].task == NULL) {
+      tasks[i] = (tk_power_task_t){.task = task,
+                                   .active_period = task->period,
+                                   .idle_period = idle_period};
+      if (!active)
+        lv_task_set_period(task, idle_period);
+      return;
+    }
+  }
+
+  ESP_LOGW(TAG, "No free slot, the task keeps its period.");
+}
+
+void tk_power_input(int64_t time_us) {
+  last_input_ms = esp_timer_get_time() / 1000;
+
+  if (!active && !wake_pending) {
+    wake_pending = true;
+    wake_start_us = time_us;
+    tk_metric_inc(&wakes_metric);
+  }
+}
+
+uint32_t tk_power_service(void) {
+  uint32_t now_ms = esp_timer_get_time() / 1000;
+  tk_power_account(now_ms);
+
+  uint32_t since_input = now_ms - last_input_ms;
+  uint32_t since_change = now_ms - tk_model_last_change_ms();
+  uint32_t since_activity =
+      since_input < since_change ? since_input : since_change;
+
+  bool now_active = since_activity < CONFIG_TK_POWER_IDLE_MS;
+  if (now_active != active)
+    tk_power_set_active(now_active);
+
+  uint32_t next = LV_NO_TASK_READY;
+  if (active)
+    next = CONFIG_TK_POWER_IDLE_MS - since_activity;
+
+#if CONFIG_TK_POWER_DIM_S > 0
+  // A running engine is reported with every sample, which wakes the task
+  bool engine_off = !global_datastore.engine_data.rpm_available;
+  bool now_dimmed = engine_off && since_input >= TK_POWER_DIM_MS;
+  if (now_dimmed != dimmed) {
+    dimmed = now_dimmed;
+    hmi_backlight_dim(dimmed);
+    ESP_LOGI(TAG, "Backlight %s.", dimmed ? "dimmed" : "restored");
+  }
+
+  if (engine_off && !dimmed && TK_POWER_DIM_MS - since_input < next)
+    next = TK_POWER_DIM_MS - since_input;
+#endif
+
+  return next;
+}
+
+void tk_power_sleep(bool frame_due) {
+  // The input changed nothing on screen, there is no frame to wait for
+  if (!frame_due)
+    wake_pending = false;
+
+#if CONFIG_PM_ENABLE
+  esp_pm_lock_release(awake_lock);
+#endif
+}
+
+void tk_power_wake(void) {
+#if CONFIG_PM_ENABLE
+  esp_pm_lock_acquire(awake_lock);
+#endif
+}
+
+void tk_power_frame(void) {
+  if (!wake_pending)
+    return;
+
+  wake_pending = false;
+  tk_metric_observe(&wake_frame_metric,
+                    (esp_timer_get_time() - wake_start_us) / 1000);
+}
+
+void tk_power_get_stats(tk_power_stats_t *out) {
+  out->active = active;
+  out->dimmed = dimmed;
+  out->active_ms = active_metric.value;
+  out->idle_ms = idle_metric.value;
+  out->dimmed_ms = dimmed_metric.value;
+  out->wakes = wakes_metric.value;
+  out->wake_frames = wake_frame_metric.count;
+  out->wake_frame_avg_ms =
+      out->wake_frames > 0 ? wake_frame_metric.sum / out->wake_frames : 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file power.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Refresh rate governor and idle power mode.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ * The UI is active while the user is interacting or a sample brings a new
+ * value: refreshes run at up to 50 Hz and the governed lvgl tasks at their
+ * own period. After TK_POWER_IDLE_MS without either it is idle: refreshes
+ * are spaced by TK_POWER_IDLE_REFRESH_MS, the governed tasks slow down and,
+ * with power management on, the CPU clock drops whenever the GUI task waits,
+ * and the chip light sleeps between frames if that is enabled too. With the
+ * engine off the backlight is dimmed after TK_POWER_DIM_S without input.
+ *
+ * Current draw cannot be read from here: tk_power_*_ms_total give the time
+ * spent in each mode, to weigh the currents measured on the bench with.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+/**
+ * @brief lvgl tasks governed at most.
+ *
+ */
+#define TK_POWER_TASKS 4
+
+typedef struct {
+  bool active;
+  bool dimmed;
+
+  // Since boot
+  uint32_t active_ms;
+  uint32_t idle_ms;
+  uint32_t dimmed_ms;
+
+  // Inputs that ended an idle period, and their average time to a frame
+  uint32_t wakes;
+  uint32_t wake_frames;
+  uint32_t wake_frame_avg_ms;
+} tk_power_stats_t;
+
+/**
+ * @brief Configures power management and starts active. GUI task only, once
+ * the input devices are up.
+ *
+ */
+void tk_power_init(void);
+
+/**
+ * @brief Slows an lvgl task down while idle. GUI task only.
+ *
+ * @param task The task, at its active period.
+ * @param idle_period Its period while idle, in milliseconds.
+ */
+void tk_power_add_task(lv_task_t *task, uint32_t idle_period);
+
+/**
+ * @brief Notes an input. GUI task only, as it handles the input.
+ *
+ * @param time_us When the input arrived, from esp_timer_get_time.
+ */
+void tk_power_input(int64_t time_us);
+
+/**
+ * @brief Switches between active and idle, and dims or brightens the
+ * backlight, as due. GUI task only, every loop.
+ *
+ * @return uint32_t Milliseconds until the next change could be due,
+ * LV_NO_TASK_READY if none is.
+ */
+uint32_t tk_power_service(void);
+
+/**
+ * @brief Called by the GUI task before it waits.
+ *
+ * @param frame_due Whether something is invalidated and not drawn yet.
+ */
+void tk_power_sleep(bool frame_due);
+
+/**
+ * @brief Called by the GUI task when it wakes up.
+ *
+ */
+void tk_power_wake(void);
+
+/**
+ * @brief Called after every frame, for the wake latency.
+ *
+ */
+void tk_power_frame(void);
+
+/**
+ * @brief The mode and the time spent in each since boot.
+ *
+ * @param out The statistics.
+ */
+void tk_power_get_stats(tk_power_stats_t *out);
@@ -14,5 +14,5 @@
 
 typedef struct {
     bool automatic;
-    double level;
+    float level;
 } tk_brightness_settings_t;
\ No newline at end of file
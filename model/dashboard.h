@@ -0,0 +1,27 @@
+/**
+ * @file dashboard.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Dashboard settings model.
+ * @version 0.1
+ * @date 2021-02-14
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+  /**
+   * @brief Full scale of the speed arc, in km/h.
+   *
+   */
+  int32_t speed_max;
+
+  /**
+   * @brief Full scale of the RPM arc.
+   *
+   */
+  int32_t rpm_max;
+} tk_dashboard_settings_t;
@@ -13,8 +13,10 @@
 #include <stdbool.h>
 
 #include "model/brightness.h"
+#include "model/dashboard.h"
 #include "model/engine.h"
 #include "model/location.h"
+#include "model/theme.h"
 #include "model/tool.h"
 #include "model/units.h"
 #include "model/vehnet.h"
@@ -24,9 +26,11 @@
 typedef struct {
   bool bluetooth_connected;
   tk_brightness_settings_t brightness_settings;
+  tk_dashboard_settings_t dashboard_settings;
   tk_engine_data_t engine_data;
   tk_location_data_t location_data;
   tk_gps_status_t gps_status;
+  tk_theme_settings_t theme_settings;
   tk_tool_connection_t tool_connection;
   tk_unit_settings_t unit_settings;
   tk_vehnet_status_t vehnet_status;
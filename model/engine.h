@@ -22,7 +22,7 @@ typedef struct {
      * @brief The engine's RPM.
      * 
      */
-    double rpm;
+    float rpm;
     bool rpm_available;
 
     /**
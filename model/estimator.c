@@ -0,0 +1,75 @@
+/**
+ * @file estimator.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Value of a sparse sampled signal at any time, for smooth gauges.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "model/estimator.h"
+
+void tk_estimator_add(tk_estimator_t *estimator, float value,
+                      uint32_t time_ms) {
+  if (!estimator->valid) {
+    estimator->valid = true;
+    estimator->value = value;
+    estimator->rate = 0;
+    estimator->time_ms = time_ms;
+    estimator->offset = 0;
+    return;
+  }
+
+  // Where the gauge is now, so it does not jump
+  float shown = tk_estimator_get(estimator, time_ms);
+  uint32_t interval = time_ms - estimator->time_ms;
+
+  if (interval > 0 && interval <= TK_ESTIMATOR_STALE_MS)
+    estimator->rate = (value - estimator->value) / interval;
+  else
+    estimator->rate = 0;
+
+  estimator->value = value;
+  estimator->time_ms = time_ms;
+  estimator->offset = shown - value;
+}
+
+float tk_estimator_get(const tk_estimator_t *estimator, uint32_t now_ms) {
+  if (!estimator->valid)
+    return 0;
+
+  // Samples are stamped by another task, now can be a little behind
+  int32_t age = now_ms - estimator->time_ms;
+  if (age < 0)
+    age = 0;
+
+  float estimate = estimator->value +
+                   estimator->rate * (age < TK_ESTIMATOR_HORIZON_MS
+                                          ? age
+                                          : TK_ESTIMATOR_HORIZON_MS);
+
+  if (age < TK_ESTIMATOR_BLEND_MS)
+    estimate += estimator->offset * (TK_ESTIMATOR_BLEND_MS - age) /
+                TK_ESTIMATOR_BLEND_MS;
+
+  return estimate;
+}
+
+bool tk_estimator_settled(const tk_estimator_t *estimator, uint32_t now_ms) {
+  if (!estimator->valid)
+    return true;
+
+  int32_t age = now_ms - estimator->time_ms;
+  if (age < 0)
+    age = 0;
+
+  if (age < TK_ESTIMATOR_BLEND_MS && estimator->offset != 0)
+    return false;
+
+  return age >= TK_ESTIMATOR_HORIZON_MS || estimator->rate == 0;
+}
+
+void tk_estimator_reset(tk_estimator_t *estimator) {
+  estimator->valid = false;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file estimator.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Value of a sparse sampled signal at any time, for smooth gauges.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ * Between samples the value follows the slope of the last two, for at most
+ * TK_ESTIMATOR_HORIZON_MS, then holds. A new sample does not make it jump:
+ * the gap from the estimate shown at that moment fades out over
+ * TK_ESTIMATOR_BLEND_MS. Estimates start from the receive time of the sample,
+ * so a gauge is never behind the data.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief How far past the last sample the slope is followed.
+ *
+ */
+#define TK_ESTIMATOR_HORIZON_MS 300
+
+/**
+ * @brief How long the gap to a new sample takes to close.
+ *
+ */
+#define TK_ESTIMATOR_BLEND_MS 100
+
+/**
+ * @brief Samples further apart than this give no slope.
+ *
+ */
+#define TK_ESTIMATOR_STALE_MS 1000
+
+typedef struct {
+  bool valid;
+
+  // The last sample and the slope that led to it, per millisecond
+  float value;
+  float rate;
+  uint32_t time_ms;
+
+  // Estimate minus sample when it arrived, fading to 0
+  float offset;
+} tk_estimator_t;
+
+/**
+ * @brief Adds a sample.
+ *
+ * @param estimator The estimator.
+ * @param value The sample.
+ * @param time_ms When it was received.
+ */
+void tk_estimator_add(tk_estimator_t *estimator, float value,
+                      uint32_t time_ms);
+
+/**
+ * @brief The estimate at a time, at or after the last sample.
+ *
+ * @param estimator The estimator.
+ * @param now_ms The time.
+ * @return float The estimate, 0 before the first sample.
+ */
+float tk_estimator_get(const tk_estimator_t *estimator, uint32_t now_ms);
+
+/**
+ * @brief Whether the estimate stays the same from now until the next sample.
+ *
+ */
+bool tk_estimator_settled(const tk_estimator_t *estimator, uint32_t now_ms);
+
+/**
+ * @brief Forgets the samples, the next one is shown as it is.
+ *
+ */
+void tk_estimator_reset(tk_estimator_t *estimator);
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 /**
  * @brief A struct for representing data related to the current location.
@@ -19,45 +20,45 @@
 typedef struct {
 
     /**
-     * @brief The latitude in degrees.
+     * @brief The latitude in 1e-7 degrees, as float would lose meters.
      * 
      */
-    double lat;
+    int32_t lat_e7;
     bool lat_available;
 
     /**
-     * @brief The longitude in degrees.
+     * @brief The longitude in 1e-7 degrees.
      * 
      */
-    double lon;
+    int32_t lon_e7;
     bool lon_available;
 
     /**
      * @brief The altitude in meters over sea level.
      * 
      */
-    double altitude;
+    float altitude;
     bool altitude_available;
 
     /**
      * @brief The speed in km/h.
      * 
      */
-    double speed;
+    float speed;
     bool speed_available;
 
     /**
      * @brief The heading calculated by the GPS, in degrees.
      * 
      */
-    double gps_heading;
+    float gps_heading;
     bool gps_heading_available;
 
     /**
      * @brief The heading from the compass, in degrees and referenced to the geographic north.
      * 
      */
-    double heading;
+    float heading;
     bool heading_available;
 
 
@@ -10,16 +10,460 @@
 
 #include "nvsettings.h"
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp32/rom/crc.h"
 #include "esp_log.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "nvs_flash.h"
 
 #include "datastore.h"
+#include "diag/metrics.h"
+#include "diag/trace.h"
+#include "hmi/ESP32/brightness.h"
+#include "ui/jobs/jobs.h"
+#include "ui/refresh/refresh.h"
 
 #define TAG "NV Settings"
 
+// All the settings are stored in one blob
+#define NV_BLOB_KEY "settings"
+#define NV_BLOB_MAGIC 0x544b5354 // "TKST"
+#define NV_BLOB_VERSION 2
+#define NV_BLOB_MAX 512
+
+typedef enum {
+  NV_TYPE_BOOL,
+  NV_TYPE_INT32,
+  NV_TYPE_FLOAT,
+  NV_TYPE_STRING
+} nv_type_t;
+
+/**
+ * @brief A row of the settings registry.
+ *
+ */
+typedef struct {
+  const char *key;
+  nv_type_t type;
+
+  // The datastore field, and its size in the blob
+  void *binding;
+  size_t size;
+
+  union {
+    bool b;
+    int32_t i;
+    float f;
+    const char *s;
+  } def;
+
+  // Valid range for numbers
+  float min;
+  float max;
+
+  // Optional, called after the value has changed
+  void (*apply)(tk_setting_id_t id);
+} nv_setting_t;
+
+/**
+ * @brief Stored blob header, followed by the values in registry order.
+ *
+ */
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t length;
+  uint32_t crc;
+} nv_blob_header_t;
+
+#define NV_BOOL(_key, _field, _def)                                            \
+  {                                                                            \
+    .key = _key, .type = NV_TYPE_BOOL, .binding = &(_field),                   \
+    .size = sizeof(bool), .def.b = _def, .min = 0, .max = 1                    \
+  }
+
+#define NV_BOOL_APPLY(_key, _field, _def, _apply)                              \
+  {                                                                            \
+    .key = _key, .type = NV_TYPE_BOOL, .binding = &(_field),                   \
+    .size = sizeof(bool), .def.b = _def, .min = 0, .max = 1, .apply = _apply   \
+  }
+
+#define NV_INT32(_key, _field, _def, _min, _max)                               \
+  {                                                                            \
+    .key = _key, .type = NV_TYPE_INT32, .binding = &(_field),                  \
+    .size = sizeof(int32_t), .def.i = _def, .min = _min, .max = _max           \
+  }
+
+#define NV_FLOAT(_key, _field, _def, _min, _max)                               \
+  {                                                                            \
+    .key = _key, .type = NV_TYPE_FLOAT, .binding = &(_field),                  \
+    .size = sizeof(float), .def.f = _def, .min = _min, .max = _max             \
+  }
+
+#define NV_STRING(_key, _field, _def)                                          \
+  {                                                                            \
+    .key = _key, .type = NV_TYPE_STRING, .binding = (_field),                  \
+    .size = sizeof(_field), .def.s = _def                                      \
+  }
+
+// -------------------- APPLY --------------------
+
+/**
+ * @brief Shows a fixed theme at once. The automatic one follows the light
+ * sensor, from the brightness task.
+ *
+ */
+static void nv_apply_theme(tk_setting_id_t id) {
+  if (!global_datastore.theme_settings.automatic)
+    switch_theme(global_datastore.theme_settings.light);
+}
+
+// The brightness is written by its task at every run, and the dashboard maxima
+// by the views at the refresh that follows every change
+
+#define DS global_datastore
+
+// -------------------- REGISTRY --------------------
+static const nv_setting_t nv_settings[TK_SETTING_COUNT] = {
+    [TK_SETTING_BRIGHTNESS_AUTO] =
+        NV_BOOL("bri_auto", DS.brightness_settings.automatic, true),
+    [TK_SETTING_BRIGHTNESS_LEVEL] =
+        NV_FLOAT("bri_level", DS.brightness_settings.level, 1, 0, 1),
+    [TK_SETTING_UNITS_CELSIUS] =
+        NV_BOOL("celsius", DS.unit_settings.celsius, true),
+    [TK_SETTING_UNITS_CLOCK_24H] =
+        NV_BOOL("clock_24h", DS.unit_settings.clock_24h, true),
+    [TK_SETTING_THEME_AUTO] = NV_BOOL_APPLY(
+        "theme_auto", DS.theme_settings.automatic, true, nv_apply_theme),
+    [TK_SETTING_THEME_LIGHT] = NV_BOOL_APPLY(
+        "theme_light", DS.theme_settings.light, false, nv_apply_theme),
+    [TK_SETTING_DASHBOARD_SPEED_MAX] = NV_INT32(
+        "speed_max", DS.dashboard_settings.speed_max, 100, 10, 400),
+    [TK_SETTING_DASHBOARD_RPM_MAX] =
+        NV_INT32("rpm_max", DS.dashboard_settings.rpm_max, 2500, 500, 10000),
+    [TK_SETTING_WIFI_STA_SSID] = NV_STRING(
+        "sta_ssid", DS.wifi_settings.sta_ssid, CONFIG_TK_OTA_STA_SSID),
+    [TK_SETTING_WIFI_STA_PASSWORD] =
+        NV_STRING("sta_password", DS.wifi_settings.sta_password,
+                  CONFIG_TK_OTA_STA_PASSWORD),
+};
+
+#undef DS
+
+_Static_assert(TK_SETTING_COUNT <= 32, "The dirty mask holds 32 settings.");
+
+// Every setting, without shifting past the mask width
+#define NV_DIRTY_ALL ((uint32_t)((1ULL << TK_SETTING_COUNT) - 1))
+
 nvs_handle_t nv_handle;
 
-void nv_get_units();
+// Held only to copy values and the dirty mask, never across NVS calls: the GUI
+// task takes it at every change
+static SemaphoreHandle_t nv_mutex = NULL;
+
+// Orders the writes, for the writer task and the shutdown handler
+static SemaphoreHandle_t nv_write_mutex = NULL;
+static TaskHandle_t nv_writer_task_handle = NULL;
+
+// Settings changed in RAM and not yet written
+static uint32_t nv_dirty = 0;
+
+// The values to write, copied from the datastore by the GUI task, which owns it
+static uint8_t nv_values[NV_BLOB_MAX - sizeof(nv_blob_header_t)];
+
+// Set once the stored settings are in the datastore, nothing is written before
+static bool nv_ready = false;
+
+// Pre-blob keys, erased once the blob is committed
+static bool nv_legacy_keys = false;
+
+// Read into by the services task, then applied from by the GUI task
+static uint8_t nv_blob[NV_BLOB_MAX];
+
+static tk_metric_t nv_changes_metric =
+    TK_METRIC_COUNTER("tk_nv_changes_total", "Settings changes requested.");
+static tk_metric_t nv_commits_metric =
+    TK_METRIC_COUNTER("tk_nv_commits_total", "Settings batches committed.");
+
+// -------------------- VALUES --------------------
+
+/**
+ * @brief Where a setting is in the blob payload.
+ *
+ */
+static size_t nv_offset(tk_setting_id_t id) {
+  size_t offset = 0;
+  for (tk_setting_id_t i = 0; i < id; i++)
+    offset += nv_settings[i].size;
+
+  return offset;
+}
+
+/**
+ * @brief Stores the default, in the datastore field or in the payload, where
+ * numbers may be unaligned.
+ *
+ */
+static void nv_default(const nv_setting_t *setting, void *value) {
+  switch (setting->type) {
+  case NV_TYPE_BOOL:
+    *(bool *)value = setting->def.b;
+    break;
+  case NV_TYPE_INT32:
+    memcpy(value, &setting->def.i, sizeof(int32_t));
+    break;
+  case NV_TYPE_FLOAT:
+    memcpy(value, &setting->def.f, sizeof(float));
+    break;
+  case NV_TYPE_STRING:
+    strlcpy((char *)value, setting->def.s, setting->size);
+    break;
+  }
+}
+
+/**
+ * @brief Checks a value, in the datastore field or in the payload, where
+ * numbers may be unaligned.
+ *
+ * @param setting The setting.
+ * @param value The value.
+ * @param clamp Whether numbers out of range are clamped, or rejected.
+ * @return true The value is valid, possibly after clamping.
+ */
+static bool nv_validate(const nv_setting_t *setting, void *value,
+                        bool clamp) {
+  int32_t i;
+  float f;
+
+  switch (setting->type) {
+  case NV_TYPE_BOOL:
+    // Anything but 0 or 1 comes from a corrupted blob
+    return *(uint8_t *)value <= 1;
+
+  case NV_TYPE_STRING:
+    ((char *)value)[setting->size - 1] = '\0';
+    return true;
+
+  case NV_TYPE_INT32:
+    memcpy(&i, value, sizeof i);
+    f = i;
+    break;
+
+  case NV_TYPE_FLOAT:
+  default:
+    memcpy(&f, value, sizeof f);
+    if (isnan(f))
+      return false;
+    break;
+  }
+
+  if (f >= setting->min && f <= setting->max)
+    return true;
+
+  if (!clamp)
+    return false;
+
+  f = f < setting->min ? setting->min : setting->max;
+  i = f;
+  if (setting->type == NV_TYPE_INT32)
+    memcpy(value, &i, sizeof i);
+  else
+    memcpy(value, &f, sizeof f);
+
+  return true;
+}
+
+// -------------------- WRITER --------------------
+
+/**
+ * @brief Copies settings from the datastore for the next batch and wakes the
+ * writer. GUI task only.
+ *
+ * @param mask One bit per setting.
+ */
+static void nv_mark_dirty(uint32_t mask) {
+  xSemaphoreTake(nv_mutex, portMAX_DELAY);
+
+  size_t offset = 0;
+  for (int i = 0; i < TK_SETTING_COUNT; i++) {
+    if (mask & BIT(i))
+      memcpy(nv_values + offset, nv_settings[i].binding, nv_settings[i].size);
+    offset += nv_settings[i].size;
+  }
+
+  nv_dirty |= mask;
+  xSemaphoreGive(nv_mutex);
+
+  tk_metric_inc(&nv_changes_metric);
+  xTaskNotifyGive(nv_writer_task_handle);
+}
+
+/**
+ * @brief Serializes the copied values into a blob. Called with the mutex held.
+ *
+ * @param blob The buffer, NV_BLOB_MAX bytes.
+ * @return size_t The blob length.
+ */
+static size_t nv_blob_build(uint8_t *blob) {
+  nv_blob_header_t *header = (nv_blob_header_t *)blob;
+  uint8_t *payload = blob + sizeof(nv_blob_header_t);
+  size_t length = 0;
+
+  for (int i = 0; i < TK_SETTING_COUNT; i++)
+    length += nv_settings[i].size;
+  memcpy(payload, nv_values, length);
+
+  header->magic = NV_BLOB_MAGIC;
+  header->version = NV_BLOB_VERSION;
+  header->length = length;
+  header->crc = crc32_le(0, payload, length);
+
+  return sizeof(nv_blob_header_t) + length;
+}
+
+void nv_flush() {
+  if (nv_mutex == NULL)
+    return;
+
+  // Word-aligned, for the header
+  uint32_t blob_words[NV_BLOB_MAX / sizeof(uint32_t)];
+  uint8_t *blob = (uint8_t *)blob_words;
+
+  xSemaphoreTake(nv_write_mutex, portMAX_DELAY);
+  xSemaphoreTake(nv_mutex, portMAX_DELAY);
+
+  // Kept for when the stored settings are in, not to overwrite them
+  if (!nv_ready || nv_dirty == 0) {
+    xSemaphoreGive(nv_mutex);
+    xSemaphoreGive(nv_write_mutex);
+    return;
+  }
+
+  uint32_t dirty = nv_dirty;
+  nv_dirty = 0;
+  size_t blob_len = nv_blob_build(blob);
+
+  xSemaphoreGive(nv_mutex);
+
+  TK_TRACE_BEGIN(TK_TRACE_NV_COMMIT, dirty);
+  esp_err_t err = nvs_set_blob(nv_handle, NV_BLOB_KEY, blob, blob_len);
+  if (err == ESP_OK)
+    err = nvs_commit(nv_handle);
+  TK_TRACE_END(TK_TRACE_NV_COMMIT, err);
+
+  if (err != ESP_OK) {
+    // Retried with the next batch
+    ESP_LOGE(TAG, "Settings write failed: %s.", esp_err_to_name(err));
+    xSemaphoreTake(nv_mutex, portMAX_DELAY);
+    nv_dirty |= dirty;
+    xSemaphoreGive(nv_mutex);
+  } else {
+    tk_metric_inc(&nv_commits_metric);
+
+    if (nv_legacy_keys) {
+      nvs_erase_key(nv_handle, "bri_auto");
+      nvs_erase_key(nv_handle, "bri_level");
+      nvs_commit(nv_handle);
+      nv_legacy_keys = false;
+    }
+  }
+
+  xSemaphoreGive(nv_write_mutex);
+
+  if (err == ESP_OK)
+    ESP_LOGI(TAG, "Settings committed (changed mask 0x%x).", dirty);
+}
+
+/**
+ * @brief Waits for the changes to stop, then writes them in one batch.
+ *
+ */
+static void nv_writer_task(void *arg) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    // Every change restarts the quiet period, up to a maximum delay
+    TickType_t first = xTaskGetTickCount();
+    while (xTaskGetTickCount() - first <
+               pdMS_TO_TICKS(CONFIG_TK_NV_MAX_DELAY_MS) &&
+           ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_TK_NV_QUIET_MS)) > 0)
+      ;
+
+    nv_flush();
+  }
+}
+
+// -------------------- MIGRATIONS --------------------
+
+/**
+ * @brief Version 0: one NVS key per setting, before the blob.
+ *
+ */
+static void nv_migrate_from_keys(uint8_t *payload) {
+  int8_t automatic;
+  int32_t level;
+
+  if (nvs_get_i8(nv_handle, "bri_auto", &automatic) == ESP_OK) {
+    bool value = automatic != 0;
+    memcpy(payload + nv_offset(TK_SETTING_BRIGHTNESS_AUTO), &value,
+           sizeof value);
+    nv_legacy_keys = true;
+  }
+
+  if (nvs_get_i32(nv_handle, "bri_level", &level) == ESP_OK) {
+    float value = level / 1000000.0f;
+    memcpy(payload + nv_offset(TK_SETTING_BRIGHTNESS_LEVEL), &value,
+           sizeof value);
+    nv_legacy_keys = true;
+  }
+
+  if (nv_legacy_keys)
+    ESP_LOGI(TAG, "Migrated the settings from individual keys.");
+}
+
+/**
+ * @brief Version 1: the brightness level was a double. Narrowed in place, the
+ * settings after it move back.
+ *
+ */
+static size_t nv_migrate_level_to_float(uint8_t *payload, size_t len) {
+  size_t offset = nv_offset(TK_SETTING_BRIGHTNESS_LEVEL);
+
+  double level;
+  float narrowed;
+  if (offset + sizeof level > len)
+    return len;
+
+  memcpy(&level, payload + offset, sizeof level);
+  narrowed = level;
+  memcpy(payload + offset, &narrowed, sizeof narrowed);
+  memmove(payload + offset + sizeof narrowed, payload + offset + sizeof level,
+          len - offset - sizeof level);
+
+  return len - (sizeof level - sizeof narrowed);
+}
+
+/**
+ * @brief Upgrades from each version to the next. Settings appended to the
+ * registry need no migration, they start from their default.
+ *
+ */
+static const struct {
+  // Rewrites the stored values to the next layout, before they are read
+  size_t (*payload)(uint8_t *payload, size_t len);
+
+  // Moves values kept outside the blob into it, after it is read
+  void (*outside)(uint8_t *payload);
+} nv_migrations[NV_BLOB_VERSION] = {
+    [0] = {.outside = nv_migrate_from_keys},
+    [1] = {.payload = nv_migrate_level_to_float},
+};
 
 // -------------------- GENERAL FUNCTIONS --------------------
 void nv_init() {
@@ -39,87 +483,212 @@ void nv_init() {
     ESP_LOGE(TAG, "Failed to initialize NVS for peripheral settings.");
     ESP_ERROR_CHECK(err);
   }
+
+  // Pending changes are written before any restart
+  esp_register_shutdown_handler(nv_flush);
+
+  tk_metrics_register(&nv_changes_metric);
+  tk_metrics_register(&nv_commits_metric);
 }
 
-void nv_load_settings() {
-  ESP_LOGI(TAG, "Loading all non-volatile peripheral settings.");
+void nv_load_defaults() {
+  for (int i = 0; i < TK_SETTING_COUNT; i++)
+    nv_default(&nv_settings[i], nv_settings[i].binding);
 
-  // Brightness
-  global_datastore.brightness_settings.automatic = nv_get_brightness_auto();
-  global_datastore.brightness_settings.level = nv_get_brightness_man_level();
+  // The UI may change settings from now on, they are written once loaded
+  if (nv_mutex == NULL) {
+    nv_mutex = xSemaphoreCreateMutex();
+    nv_write_mutex = xSemaphoreCreateMutex();
+    xTaskCreate(nv_writer_task, "nv_writer", 3072, NULL, 1,
+                &nv_writer_task_handle);
+  }
 }
 
-void nv_load_apply_settings() {
-  ESP_LOGI(TAG, "Loading and applying all non-volatile peripheral settings.");
-  nv_load_settings();
+/**
+ * @brief Moves the loaded values from the payload into the datastore, on the
+ * GUI task. A setting changed there before keeps its new value.
+ *
+ * @param payload Whether to rewrite the blob, as a bool.
+ */
+static void nv_load_job(void *payload) {
+  bool rewrite = *(bool *)payload;
+  const uint8_t *values = nv_blob + sizeof(nv_blob_header_t);
 
-  // Brightness
-  // Nothing to apply
+  xSemaphoreTake(nv_mutex, portMAX_DELAY);
 
-  // Units
-  nv_get_units();
-}
+  uint32_t changed = nv_dirty;
+  size_t offset = 0;
+  for (int i = 0; i < TK_SETTING_COUNT; i++) {
+    if (!(changed & BIT(i))) {
+      memcpy(nv_settings[i].binding, values + offset, nv_settings[i].size);
+      memcpy(nv_values + offset, values + offset, nv_settings[i].size);
+    }
+    offset += nv_settings[i].size;
+  }
 
-// -------------------- SETTINGS --------------------
+  nv_ready = true;
+  xSemaphoreGive(nv_mutex);
 
-// Units
-void nv_get_units() {
-  global_datastore.unit_settings.celsius = true;
-  global_datastore.unit_settings.clock_24h = true;
+  for (int i = 0; i < TK_SETTING_COUNT; i++) {
+    if (nv_settings[i].apply != NULL)
+      nv_settings[i].apply(i);
+  }
+
+  tk_refresh_request();
+
+  // Rewrite anything that is not stored exactly as the registry says, and
+  // write what changed in the meantime
+  if (rewrite)
+    nv_mark_dirty(NV_DIRTY_ALL);
+  else if (changed != 0)
+    xTaskNotifyGive(nv_writer_task_handle);
 
-  // TODO
+  ESP_LOGI(TAG, "Settings applied.");
 }
 
-// Automatic brightness
-void nv_set_brightness_auto(bool automatic) {
-  ESP_LOGI(TAG, "Writing and applying automatic brightness setting to %d.", automatic);
-  global_datastore.brightness_settings.automatic = automatic;
+void nv_load_apply_settings() {
+  ESP_LOGI(TAG, "Loading all non-volatile peripheral settings.");
 
-  // Save
-  esp_err_t err = nvs_set_i8(nv_handle, "bri_auto", (int8_t)automatic);
+  const nv_blob_header_t *header = (const nv_blob_header_t *)nv_blob;
+  uint8_t *payload = nv_blob + sizeof(nv_blob_header_t);
+  size_t blob_len = sizeof nv_blob;
+  size_t payload_len = 0;
+  int version = 0;
 
-  // Apply
-  // Not needed
-}
+  // One read for everything. Nothing else uses the buffer until the job runs.
+  esp_err_t err = nvs_get_blob(nv_handle, NV_BLOB_KEY, nv_blob, &blob_len);
 
-bool nv_get_brightness_auto() {
+  if (err == ESP_OK && blob_len >= sizeof(nv_blob_header_t) &&
+      header->magic == NV_BLOB_MAGIC &&
+      header->length <= blob_len - sizeof(nv_blob_header_t) &&
+      header->crc == crc32_le(0, payload, header->length)) {
+    version = header->version;
+    payload_len = header->length;
+  } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+    ESP_LOGE(TAG, "Settings blob unreadable (%s), using defaults.",
+             esp_err_to_name(err));
+  }
 
-  int8_t automatic = 1;
-  esp_err_t err = nvs_get_i8(nv_handle, "bri_auto", &automatic);
-  assert(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND);
-  if (err == ESP_ERR_NOT_FOUND) {
-    ESP_LOGW(TAG,
-             "Automatic brightness key not found. Returning default value of 1.");
+  for (int v = version; v < NV_BLOB_VERSION; v++) {
+    if (nv_migrations[v].payload != NULL)
+      payload_len = nv_migrations[v].payload(payload, payload_len);
   }
 
-  ESP_LOGI(TAG, "Automatic brightness setting read from NVS: %d.", automatic);
+  // The registry is append-only: the stored values are a prefix of it
+  size_t offset = 0;
+  for (int i = 0; i < TK_SETTING_COUNT; i++) {
+    if (offset + nv_settings[i].size > payload_len)
+      nv_default(&nv_settings[i], payload + offset);
+
+    offset += nv_settings[i].size;
+  }
+
+  for (int v = version; v < NV_BLOB_VERSION; v++) {
+    if (nv_migrations[v].outside != NULL)
+      nv_migrations[v].outside(payload);
+  }
 
-  return (bool)automatic;
+  bool invalid = false;
+  offset = 0;
+  for (int i = 0; i < TK_SETTING_COUNT; i++) {
+    if (!nv_validate(&nv_settings[i], payload + offset, false)) {
+      ESP_LOGW(TAG, "Invalid value for %s, using the default.",
+               nv_settings[i].key);
+      nv_default(&nv_settings[i], payload + offset);
+      invalid = true;
+    }
+
+    offset += nv_settings[i].size;
+  }
+
+  ESP_LOGI(TAG, "Settings loaded: blob version %d, %d of %d bytes.", version,
+           payload_len, offset);
+
+  // The datastore is the GUI task's: the values are moved in from there
+  bool rewrite =
+      version != NV_BLOB_VERSION || payload_len != offset || invalid;
+  while (!tk_ui_post(nv_load_job, &rewrite, sizeof rewrite))
+    vTaskDelay(pdMS_TO_TICKS(10));
+}
+
+// -------------------- SETTINGS --------------------
+
+void nv_setting_changed(tk_setting_id_t id) {
+  const nv_setting_t *setting = &nv_settings[id];
+
+  nv_validate(setting, setting->binding, true);
+  ESP_LOGD(TAG, "Setting %s changed.", setting->key);
+
+  if (setting->apply != NULL)
+    setting->apply(id);
+  tk_refresh_request();
+
+  // Save, batched by the writer task
+  nv_mark_dirty(BIT(id));
 }
 
-// Manual brightness level
-void nv_set_brightness_man_level(double level) {
-  ESP_LOGI(TAG, "Writing and applying manual brightness level setting to %.2f.", level);
-  global_datastore.brightness_settings.level = level;
+esp_err_t nv_set(tk_setting_id_t id, const void *value) {
+  const nv_setting_t *setting = &nv_settings[id];
+  uint8_t previous[setting->size];
 
-  // Save
-  esp_err_t err = nvs_set_i32(nv_handle, "bri_level", (int32_t)(level * 1000000));
+  memcpy(previous, setting->binding, setting->size);
 
-  // Apply
-  // Not needed
+  if (setting->type == NV_TYPE_STRING)
+    strlcpy((char *)setting->binding, (const char *)value, setting->size);
+  else
+    memcpy(setting->binding, value, setting->size);
+
+  if (!nv_validate(setting, setting->binding, false)) {
+    memcpy(setting->binding, previous, setting->size);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  nv_setting_changed(id);
+  return ESP_OK;
+}
+
+tk_setting_id_t nv_find(const char *key) {
+  for (int i = 0; i < TK_SETTING_COUNT; i++)
+    if (strcmp(nv_settings[i].key, key) == 0)
+      return i;
+
+  return TK_SETTING_COUNT;
 }
 
-double nv_get_brightness_man_level() {
+const char *nv_key(tk_setting_id_t id) { return nv_settings[id].key; }
 
-  int32_t level = 1000000;
-  esp_err_t err = nvs_get_i32(nv_handle, "bri_level", &level);
-  assert(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND);
-  if (err == ESP_ERR_NOT_FOUND) {
-    ESP_LOGW(TAG,
-             "Manual brightness level key not found. Returning default value of 1.");
+esp_err_t nv_set_text(tk_setting_id_t id, const char *text) {
+  const nv_setting_t *setting = &nv_settings[id];
+  char *end = NULL;
+
+  switch (setting->type) {
+  case NV_TYPE_BOOL: {
+    bool value = strcmp(text, "1") == 0 || strcmp(text, "on") == 0 ||
+                 strcmp(text, "true") == 0;
+    if (!value && strcmp(text, "0") != 0 && strcmp(text, "off") != 0 &&
+        strcmp(text, "false") != 0)
+      return ESP_ERR_INVALID_ARG;
+    return nv_set(id, &value);
   }
 
-  ESP_LOGI(TAG, "Manual brightness level setting read from NVS: %.2f.", (double)level/1000000.0);
+  case NV_TYPE_INT32: {
+    int32_t value = strtol(text, &end, 10);
+    if (end == text || *end != '\0')
+      return ESP_ERR_INVALID_ARG;
+    return nv_set(id, &value);
+  }
 
-  return (double)level/1000000.0;
+  case NV_TYPE_FLOAT: {
+    float value = strtof(text, &end);
+    if (end == text || *end != '\0')
+      return ESP_ERR_INVALID_ARG;
+    return nv_set(id, &value);
+  }
+
+  case NV_TYPE_STRING:
+  default:
+    if (strlen(text) >= setting->size)
+      return ESP_ERR_INVALID_SIZE;
+    return nv_set(id, text);
+  }
 }
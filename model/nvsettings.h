@@ -12,13 +12,103 @@
 
 #include <stdbool.h>
 
+#include "esp_err.h"
+
+/**
+ * @brief The persisted settings. Each one is described by a row of the
+ * registry in nvsettings.c and bound to a datastore field.
+ *
+ * Only append to this list: the stored blob follows its order.
+ *
+ */
+typedef enum {
+  TK_SETTING_BRIGHTNESS_AUTO,
+  TK_SETTING_BRIGHTNESS_LEVEL,
+  TK_SETTING_UNITS_CELSIUS,
+  TK_SETTING_UNITS_CLOCK_24H,
+  TK_SETTING_THEME_AUTO,
+  TK_SETTING_THEME_LIGHT,
+  TK_SETTING_DASHBOARD_SPEED_MAX,
+  TK_SETTING_DASHBOARD_RPM_MAX,
+  TK_SETTING_WIFI_STA_SSID,
+  TK_SETTING_WIFI_STA_PASSWORD,
+  TK_SETTING_COUNT
+} tk_setting_id_t;
+
+/**
+ * @brief Opens the settings namespace. Any task, after nv_load_defaults.
+ *
+ */
 void nv_init();
-void nv_load_settings();
+
+/**
+ * @brief Sets every setting to its default, in RAM only, and starts the
+ * writer. GUI task, before anything can change a setting: the UI can start
+ * before the stored settings are loaded.
+ *
+ */
+void nv_load_defaults();
+
+/**
+ * @brief Reads the stored settings, then moves them into the datastore and
+ * applies them with a job on the GUI task. Any task, after nv_init. Nothing is
+ * written before that job, and settings changed before it keep their value.
+ *
+ */
 void nv_load_apply_settings();
 
+/**
+ * @brief Writes and commits the pending changes now. Setters only mark their
+ * setting, the writer task commits after a quiet period; call this before
+ * anything that may lose RAM state, such as an OTA update.
+ *
+ */
+void nv_flush();
+
 // SETTINGS
-void nv_set_brightness_auto(bool automatic);
-bool nv_get_brightness_auto();
 
-void nv_set_brightness_man_level(double level);
-double nv_get_brightness_man_level();
+/**
+ * @brief Validates a setting whose datastore field has just been changed in
+ * place (by a menu binding, for example), applies it and schedules the write.
+ * GUI task only.
+ *
+ * @param id The setting.
+ */
+void nv_setting_changed(tk_setting_id_t id);
+
+/**
+ * @brief Stores a new value in the setting's datastore field, then behaves
+ * like nv_setting_changed. GUI task only.
+ *
+ * @param id The setting.
+ * @param value The value, of the field's type. Strings are terminated.
+ * @return esp_err_t ESP_OK, or ESP_ERR_INVALID_ARG if the value is out of
+ * range.
+ */
+esp_err_t nv_set(tk_setting_id_t id, const void *value);
+
+/**
+ * @brief Stores a value given as text, as typed on the console, then behaves
+ * like nv_set. GUI task only.
+ *
+ * @param id The setting.
+ * @param text 0, 1, on, off, true or false for switches, a number, or the
+ * string itself.
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG if the text is not a value of
+ * the setting or out of range, or ESP_ERR_INVALID_SIZE for a string too long.
+ */
+esp_err_t nv_set_text(tk_setting_id_t id, const char *text);
+
+/**
+ * @brief The setting with a key.
+ *
+ * @param key The key, as stored.
+ * @return tk_setting_id_t The setting, TK_SETTING_COUNT if there is none.
+ */
+tk_setting_id_t nv_find(const char *key);
+
+/**
+ * @brief The key a setting is stored with.
+ *
+ */
+const char *nv_key(tk_setting_id_t id);
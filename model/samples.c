@@ -0,0 +1,170 @@
+/**
+ * @file samples.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Timestamped samples from the Bluetooth host to the model.
+ * @version 0.1
+ * @date 2021-02-23
+ *
+ *
+ */
+
+#include "model/samples.h"
+
+#include <math.h>
+
+#include "diag/metrics.h"
+#include "model/datastore.h"
+#include "model/estimator.h"
+#include "tkos.h"
+#include "ui/refresh/refresh.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "Model samples"
+
+_Static_assert((TK_MODEL_SAMPLES_LEN & (TK_MODEL_SAMPLES_LEN - 1)) == 0,
+               "TK_MODEL_SAMPLES_LEN must be a power of two.");
+
+#define TK_MODEL_SAMPLES_MASK (TK_MODEL_SAMPLES_LEN - 1)
+
+static tk_metric_t samples_metric = TK_METRIC_COUNTER(
+    "tk_model_samples_total", "Samples applied to the datastore.");
+
+static tk_metric_t dropped_metric = TK_METRIC_COUNTER(
+    "tk_model_samples_dropped_total", "Samples dropped, the queue was full.");
+
+static tk_metric_t batch_metric =
+    TK_METRIC_HISTOGRAM("tk_model_batch_samples",
+                        "Samples applied together.", 1, 2, 4, 8, 16, 32, 64);
+
+static tk_metric_t age_metric =
+    TK_METRIC_HISTOGRAM("tk_model_sample_age_ms",
+                        "Time from receiving a sample to applying it.", 1, 5,
+                        10, 50, 100, 500);
+
+// Single producer and single consumer: each index is written by one side
+static tk_model_sample_t samples[TK_MODEL_SAMPLES_LEN];
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+
+// Per kind, flags have none in use
+static tk_estimator_t estimators[TK_MODEL_SAMPLE_KIND_COUNT];
+
+// A repeated value is not a change, for the power governor
+static float last_values[TK_MODEL_SAMPLE_KIND_COUNT];
+static uint32_t last_change_ms = 0;
+
+void tk_model_samples_init(void) {
+  tk_metrics_register(&samples_metric);
+  tk_metrics_register(&dropped_metric);
+  tk_metrics_register(&batch_metric);
+  tk_metrics_register(&age_metric);
+}
+
+bool tk_model_push(tk_model_sample_kind_t kind, float value) {
+  uint32_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+
+  if (pos - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) == TK_MODEL_SAMPLES_LEN) {
+    tk_metric_inc(&dropped_metric);
+    return false;
+  }
+
+  tk_model_sample_t *sample = &samples[pos & TK_MODEL_SAMPLES_MASK];
+  sample->time_ms = esp_timer_get_time() / 1000;
+  sample->kind = kind;
+  sample->value = value;
+  __atomic_store_n(&head, pos + 1, __ATOMIC_RELEASE);
+
+  tk_gui_wake();
+  return true;
+}
+
+/**
+ * @brief Writes one sample to the datastore.
+ *
+ */
+static void tk_model_apply(const tk_model_sample_t *sample) {
+  switch (sample->kind) {
+  case TK_MODEL_SAMPLE_ENGINE_RPM:
+    global_datastore.engine_data.rpm = sample->value;
+    break;
+  case TK_MODEL_SAMPLE_ENGINE_TEMP_C:
+    global_datastore.engine_data.temp_c = sample->value;
+    break;
+  case TK_MODEL_SAMPLE_SPEED_KPH:
+    global_datastore.location_data.speed = sample->value;
+    break;
+  case TK_MODEL_SAMPLE_GPS_AVAILABLE:
+    // A fix after a loss is shown as it is, not ramped from the old speed
+    if (sample->value == 0)
+      tk_estimator_reset(&estimators[TK_MODEL_SAMPLE_SPEED_KPH]);
+
+    global_datastore.location_data.speed_available = sample->value != 0;
+    global_datastore.gps_status = sample->value != 0
+                                      ? TK_GPS_STATUS_CONNECTED
+                                      : TK_GPS_STATUS_CONNECTING;
+    break;
+  default:
+    ESP_LOGW(TAG, "Unknown sample kind %d.", sample->kind);
+    return;
+  }
+
+  float *last = &last_values[sample->kind];
+  if (sample->value != *last && !(isnan(sample->value) && isnan(*last))) {
+    *last = sample->value;
+    last_change_ms = sample->time_ms;
+  }
+
+  // Not a number would stay in the slope, the next value starts over
+  if (isnan(sample->value))
+    tk_estimator_reset(&estimators[sample->kind]);
+  else if (sample->kind != TK_MODEL_SAMPLE_GPS_AVAILABLE)
+    tk_estimator_add(&estimators[sample->kind], sample->value,
+                     sample->time_ms);
+}
+
+/**
+ * @brief Updates what follows from the latest values, once per batch.
+ *
+ */
+static void tk_model_derive(void) {
+  tk_engine_data_t *engine = &global_datastore.engine_data;
+
+  engine->rpm_available = engine->rpm > 0.0f;
+  engine->temp_c_available = !isnan(engine->temp_c);
+}
+
+uint32_t tk_model_update(void) {
+  uint32_t start = tail;
+  uint32_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+  uint32_t count = end - start;
+
+  if (count == 0)
+    return 0;
+
+  uint32_t now_ms = esp_timer_get_time() / 1000;
+  for (uint32_t pos = start; pos != end; pos++) {
+    const tk_model_sample_t *sample = &samples[pos & TK_MODEL_SAMPLES_MASK];
+    tk_metric_observe(&age_metric, now_ms - sample->time_ms);
+    tk_model_apply(sample);
+  }
+  __atomic_store_n(&tail, end, __ATOMIC_RELEASE);
+
+  tk_model_derive();
+  tk_refresh_request();
+
+  tk_metric_add(&samples_metric, count);
+  tk_metric_observe(&batch_metric, count);
+  return count;
+}
+
+float tk_model_estimate(tk_model_sample_kind_t kind, uint32_t now_ms) {
+  return tk_estimator_get(&estimators[kind], now_ms);
+}
+
+bool tk_model_estimate_settled(tk_model_sample_kind_t kind, uint32_t now_ms) {
+  return tk_estimator_settled(&estimators[kind], now_ms);
+}
+
+uint32_t tk_model_last_change_ms(void) { return last_change_ms; }
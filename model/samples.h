@@ -0,0 +1,87 @@
+/**
+ * @file samples.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Timestamped samples from the Bluetooth host to the model.
+ * @version 0.1
+ * @date 2021-02-23
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Samples waiting at most, a power of two.
+ *
+ */
+#define TK_MODEL_SAMPLES_LEN 64
+
+typedef enum {
+  TK_MODEL_SAMPLE_ENGINE_RPM,
+  TK_MODEL_SAMPLE_ENGINE_TEMP_C,
+  TK_MODEL_SAMPLE_SPEED_KPH,
+  TK_MODEL_SAMPLE_GPS_AVAILABLE,
+  TK_MODEL_SAMPLE_KIND_COUNT
+} tk_model_sample_kind_t;
+
+typedef struct {
+  /**
+   * @brief When it was received, in milliseconds since boot.
+   *
+   */
+  uint32_t time_ms;
+  tk_model_sample_kind_t kind;
+  float value;
+} tk_model_sample_t;
+
+/**
+ * @brief Registers the sample metrics.
+ *
+ */
+void tk_model_samples_init(void);
+
+/**
+ * @brief Queues a sample, timestamped now, and wakes the GUI task to apply it.
+ * Never blocks. The Bluetooth host task is the only producer.
+ *
+ * @param kind What was received.
+ * @param value The decoded value, 0 or 1 for flags.
+ * @return true Queued.
+ * @return false The queue is full, the sample is dropped.
+ */
+bool tk_model_push(tk_model_sample_kind_t kind, float value);
+
+/**
+ * @brief Applies the queued samples to the datastore as one batch, updates
+ * what is derived from them and asks the UI for a refresh. The GUI task is the
+ * only consumer.
+ *
+ * @return uint32_t The number of samples applied.
+ */
+uint32_t tk_model_update(void);
+
+/**
+ * @brief The value of a numeric sample between samples, see
+ * model/estimator.h. GUI task only.
+ *
+ * @param kind What to estimate, not a flag.
+ * @param now_ms The time, in milliseconds since boot.
+ * @return float The estimate, 0 before the first sample.
+ */
+float tk_model_estimate(tk_model_sample_kind_t kind, uint32_t now_ms);
+
+/**
+ * @brief Whether the estimate stays the same until the next sample.
+ *
+ */
+bool tk_model_estimate_settled(tk_model_sample_kind_t kind, uint32_t now_ms);
+
+/**
+ * @brief When a sample last brought a different value, in milliseconds since
+ * boot, 0 if none has. GUI task only.
+ *
+ */
+uint32_t tk_model_last_change_ms(void);
@@ -8,6 +8,10 @@
  * 
  */
 
+#pragma once
+
+#include <stdbool.h>
+
 #include "lvgl/lvgl.h"
 
 typedef struct {
@@ -16,4 +16,8 @@ typedef struct {
   bool ap_enable;
   char ssid[32];
   char password[32];
+
+  // Network joined for downloading updates
+  char sta_ssid[32];
+  char sta_password[64];
 } tk_wifi_settings_t;
\ No newline at end of file
@@ -0,0 +1,39 @@
+/**
+ * @file check.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Assertions for the host tests: a failure is reported and counted,
+ * and the test goes on.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+static int tk_check_failures = 0;
+
+#define CHECK(condition)                                                       \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,         \
+              #condition);                                                     \
+      tk_check_failures++;                                                     \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(actual, expected)                                             \
+  do {                                                                         \
+    long long check_actual = (long long)(actual);                              \
+    long long check_expected = (long long)(expected);                          \
+    if (check_actual != check_expected) {                                      \
+      fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__,          \
+              __LINE__, #actual, check_actual, check_expected);                \
+      tk_check_failures++;                                                     \
+    }                                                                          \
+  } while (0)
+
+// The exit status of a test
+#define CHECK_RESULT() (tk_check_failures == 0 ? 0 : 1)
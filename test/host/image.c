@@ -0,0 +1,68 @@
+/**
+ * @file image.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief App images built in memory, with the layout the verifier checks.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "image.h"
+
+#include <string.h>
+
+size_t tk_test_image_len(size_t payload_len) {
+  return TK_OTA_HEADER_LEN + payload_len + TK_OTA_HASH_LEN;
+}
+
+size_t tk_test_image_build(uint8_t *out, size_t payload_len,
+                           const char *version) {
+  esp_image_header_t header = {
+      .magic = ESP_IMAGE_HEADER_MAGIC,
+      .segment_count = 1,
+      .chip_id = TK_TEST_CHIP_ID,
+      .hash_appended = 1,
+  };
+  esp_image_segment_header_t segment = {
+      .load_addr = 0x3f400020,
+      .data_len = sizeof(esp_app_desc_t) + payload_len,
+  };
+  esp_app_desc_t desc = {.magic_word = ESP_APP_DESC_MAGIC_WORD};
+  strncpy(desc.project_name, TK_TEST_PROJECT, sizeof(desc.project_name));
+  strncpy(desc.version, version, sizeof(desc.version));
+
+  uint8_t *cursor = out;
+  memcpy(cursor, &header, sizeof(header));
+  cursor += sizeof(header);
+  memcpy(cursor, &segment, sizeof(segment));
+  cursor += sizeof(segment);
+  memcpy(cursor, &desc, sizeof(desc));
+  cursor += sizeof(desc);
+
+  // Same bytes on every run
+  uint32_t state = 0x12345678;
+  for (size_t i = 0; i < payload_len; i++) {
+    state = state * 1103515245 + 12345;
+    *cursor++ = (uint8_t)(state >> 16);
+  }
+
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts_ret(&sha, 0);
+  mbedtls_sha256_update_ret(&sha, out, cursor - out);
+  mbedtls_sha256_finish_ret(&sha, cursor);
+  mbedtls_sha256_free(&sha);
+
+  return tk_test_image_len(payload_len);
+}
+
+void tk_test_expect(tk_ota_expect_t *expect, size_t capacity) {
+  memset(expect, 0, sizeof(*expect));
+  expect->chip_id = TK_TEST_CHIP_ID;
+  strncpy(expect->project_name, TK_TEST_PROJECT,
+          sizeof(expect->project_name) - 1);
+  strncpy(expect->version, TK_TEST_RUNNING_VERSION,
+          sizeof(expect->version) - 1);
+  expect->capacity = capacity;
+}
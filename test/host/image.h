@@ -0,0 +1,42 @@
+/**
+ * @file image.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief App images built in memory, with the layout the verifier checks.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "OTA/verify.h"
+
+#define TK_TEST_PROJECT "tkos"
+#define TK_TEST_RUNNING_VERSION "1.0"
+#define TK_TEST_CHIP_ID 0
+
+/**
+ * @brief Builds an image: header, one segment, app description, payload and
+ * the appended SHA-256 of everything before it.
+ *
+ * @param out The image, at least tk_test_image_len(payload_len) bytes.
+ * @param payload_len Bytes of pseudo-random payload.
+ * @param version The version in the app description.
+ * @return size_t The image length.
+ */
+size_t tk_test_image_build(uint8_t *out, size_t payload_len,
+                           const char *version);
+
+size_t tk_test_image_len(size_t payload_len);
+
+/**
+ * @brief What the running app of the tests expects.
+ *
+ * @param expect The expectations.
+ * @param capacity Room for the image.
+ */
+void tk_test_expect(tk_ota_expect_t *expect, size_t capacity);
@@ -0,0 +1,22 @@
+/**
+ * @file crc.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Host stand-in for the ROM CRC.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "esp32/rom/crc.h"
+
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *buf++;
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+
+  return ~crc;
+}
@@ -0,0 +1,16 @@
+/**
+ * @file crc.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Host stand-in for the ROM CRC.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// CRC-32 (IEEE, reflected), as the ESP32 ROM computes it
+uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
@@ -0,0 +1,16 @@
+/**
+ * @file esp_attr.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Host stand-in for the ESP-IDF placement attributes, which do nothing.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
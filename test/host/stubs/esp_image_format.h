@@ -0,0 +1,45 @@
+/**
+ * @file esp_image_format.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Host copy of the ESP-IDF 4.x app image layout.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_app_format.h"
+#include "esp_err.h"
+
+#define ESP_ERR_IMAGE_BASE 0x2000
+#define ESP_ERR_IMAGE_FLASH_FAIL (ESP_ERR_IMAGE_BASE + 1)
+#define ESP_ERR_IMAGE_INVALID (ESP_ERR_IMAGE_BASE + 2)
+
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+#define ESP_IMAGE_MAX_SEGMENTS 16
+
+typedef struct {
+  uint8_t magic;
+  uint8_t segment_count;
+  uint8_t spi_mode;
+  uint8_t spi_speed : 4;
+  uint8_t spi_size : 4;
+  uint32_t entry_addr;
+  uint8_t wp_pin;
+  uint8_t spi_pin_drv[3];
+  uint16_t chip_id;
+  uint8_t min_chip_rev;
+  uint8_t reserved[8];
+  uint8_t hash_appended;
+} __attribute__((packed)) esp_image_header_t;
+
+_Static_assert(sizeof(esp_image_header_t) == 24, "image header layout");
+
+typedef struct {
+  uint32_t load_addr;
+  uint32_t data_len;
+} esp_image_segment_header_t;
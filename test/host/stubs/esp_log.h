@@ -0,0 +1,18 @@
+/**
+ * @file esp_log.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Host stand-in for the ESP-IDF log, which drops everything.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ * The formats are written for the 32-bit target, where size_t prints with %d.
+ *
+ */
+
+#pragma once
+
+#define ESP_LOGE(tag, format, ...) ((void)(tag))
+#define ESP_LOGW(tag, format, ...) ((void)(tag))
+#define ESP_LOGI(tag, format, ...) ((void)(tag))
+#define ESP_LOGD(tag, format, ...) ((void)(tag))
+#define ESP_LOGV(tag, format, ...) ((void)(tag))
@@ -0,0 +1,22 @@
+/**
+ * @file esp_system.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Host stand-in for the ESP-IDF system calls.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+typedef void (*shutdown_handler_t)(void);
+
+// Never called on the host
+static inline esp_err_t esp_register_shutdown_handler(
+    shutdown_handler_t handler) {
+  (void)handler;
+  return ESP_OK;
+}
@@ -0,0 +1,196 @@
+/**
+ * @file freertos.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Host stand-in for FreeRTOS, on threads and a simulated clock.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos_sim.h"
+
+#define TK_SIM_TASKS 8
+
+struct tk_sim_task {
+  pthread_t thread;
+  TaskFunction_t fn;
+  void *arg;
+
+  uint32_t notified;
+
+  // Blocked, and up to date with the clock and the notifications
+  bool waiting;
+  uint64_t seen;
+};
+
+struct tk_sim_mutex {
+  pthread_mutex_t mutex;
+};
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond = PTHREAD_COND_INITIALIZER;
+
+static TickType_t sim_now = 0;
+
+// Moved by every tick and every notification
+static uint64_t sim_generation = 0;
+
+static struct tk_sim_task *sim_tasks[TK_SIM_TASKS];
+static int sim_task_count = 0;
+
+// NULL on the test thread
+static __thread struct tk_sim_task *sim_current = NULL;
+
+static bool tk_sim_settled(void) {
+  for (int i = 0; i < sim_task_count; i++) {
+    if (!sim_tasks[i]->waiting || sim_tasks[i]->seen != sim_generation)
+      return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Blocks the calling task until something happens. Holding sim_lock.
+ *
+ */
+static void tk_sim_block(void) {
+  sim_current->waiting = true;
+  sim_current->seen = sim_generation;
+  pthread_cond_broadcast(&sim_cond);
+  pthread_cond_wait(&sim_cond, &sim_lock);
+  sim_current->waiting = false;
+}
+
+void tk_sim_settle(void) {
+  pthread_mutex_lock(&sim_lock);
+  while (!tk_sim_settled())
+    pthread_cond_wait(&sim_cond, &sim_lock);
+  pthread_mutex_unlock(&sim_lock);
+}
+
+void tk_sim_advance(TickType_t ticks) {
+  pthread_mutex_lock(&sim_lock);
+  for (TickType_t i = 0; i < ticks; i++) {
+    while (!tk_sim_settled())
+      pthread_cond_wait(&sim_cond, &sim_lock);
+
+    sim_now++;
+    sim_generation++;
+    pthread_cond_broadcast(&sim_cond);
+  }
+
+  while (!tk_sim_settled())
+    pthread_cond_wait(&sim_cond, &sim_lock);
+  pthread_mutex_unlock(&sim_lock);
+}
+
+static void *tk_sim_task_main(void *arg) {
+  sim_current = (struct tk_sim_task *)arg;
+  sim_current->fn(sim_current->arg);
+  return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                       void *arg, UBaseType_t priority, TaskHandle_t *handle) {
+  struct tk_sim_task *task = calloc(1, sizeof(*task));
+  task->fn = fn;
+  task->arg = arg;
+
+  pthread_mutex_lock(&sim_lock);
+  if (sim_task_count == TK_SIM_TASKS) {
+    pthread_mutex_unlock(&sim_lock);
+    free(task);
+    return pdFAIL;
+  }
+  sim_tasks[sim_task_count++] = task;
+  pthread_mutex_unlock(&sim_lock);
+
+  if (handle != NULL)
+    *handle = task;
+
+  pthread_create(&task->thread, NULL, tk_sim_task_main, task);
+  pthread_detach(task->thread);
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  // The tasks of the tests never end
+  (void)task;
+  pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+  if (sim_current == NULL) {
+    tk_sim_advance(ticks);
+    return;
+  }
+
+  pthread_mutex_lock(&sim_lock);
+  TickType_t start = sim_now;
+  while (sim_now - start < ticks)
+    tk_sim_block();
+  pthread_mutex_unlock(&sim_lock);
+}
+
+TickType_t xTaskGetTickCount(void) {
+  pthread_mutex_lock(&sim_lock);
+  TickType_t now = sim_now;
+  pthread_mutex_unlock(&sim_lock);
+  return now;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  pthread_mutex_lock(&sim_lock);
+  task->notified++;
+  sim_generation++;
+  pthread_cond_broadcast(&sim_cond);
+  pthread_mutex_unlock(&sim_lock);
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout) {
+  uint32_t value = 0;
+
+  pthread_mutex_lock(&sim_lock);
+  TickType_t start = sim_now;
+  for (;;) {
+    if (sim_current->notified > 0) {
+      value = sim_current->notified;
+      sim_current->notified = clear ? 0 : value - 1;
+      break;
+    }
+
+    if (timeout != portMAX_DELAY && sim_now - start >= timeout)
+      break;
+
+    tk_sim_block();
+  }
+  pthread_mutex_unlock(&sim_lock);
+
+  return value;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+  struct tk_sim_mutex *mutex = calloc(1, sizeof(*mutex));
+  pthread_mutex_init(&mutex->mutex, NULL);
+  return mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t timeout) {
+  (void)timeout;
+  pthread_mutex_lock(&mutex->mutex);
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex) {
+  pthread_mutex_unlock(&mutex->mutex);
+  return pdTRUE;
+}
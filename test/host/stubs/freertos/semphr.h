@@ -0,0 +1,21 @@
+/**
+ * @file semphr.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Host stand-in for the FreeRTOS mutexes.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct tk_sim_mutex *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+
+// Waits without a timeout, whatever is asked
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t timeout);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex);
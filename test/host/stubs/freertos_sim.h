@@ -0,0 +1,29 @@
+/**
+ * @file freertos_sim.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Control of the simulated clock behind the FreeRTOS stand-in.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ * The test thread plays the GUI task. Time stands still until it advances the
+ * clock, one tick at a time, and each tick lasts until every task is blocked
+ * again: what a task does at a given time is deterministic.
+ *
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+/**
+ * @brief Waits for every task to block, then moves the clock.
+ *
+ * @param ticks Ticks to move.
+ */
+void tk_sim_advance(TickType_t ticks);
+
+/**
+ * @brief Waits for every task to block.
+ *
+ */
+void tk_sim_settle(void);
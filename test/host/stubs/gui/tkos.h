@@ -0,0 +1,15 @@
+/**
+ * @file tkos.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Host stand-in for the GUI task entry points, without the views the
+ * real header pulls in. Only on the include path of the tests that need it.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#pragma once
+
+void tk_gui_wake(void);
+void tk_gui_wake_input(void);
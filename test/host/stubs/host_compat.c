@@ -0,0 +1,22 @@
+/**
+ * @file host_compat.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief What newlib has and the host C library may not.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "host_compat.h"
+
+size_t tk_host_strlcpy(char *dst, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (size > 0) {
+    size_t copy = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, copy);
+    dst[copy] = '\0';
+  }
+
+  return len;
+}
@@ -0,0 +1,21 @@
+/**
+ * @file host_compat.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief What newlib has and the host C library may not. Included first in
+ * every host build of the sources.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__GLIBC__) &&                                                      \
+    (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+#define strlcpy tk_host_strlcpy
+size_t tk_host_strlcpy(char *dst, const char *src, size_t size);
+#endif
@@ -0,0 +1,20 @@
+/**
+ * @file lvgl.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Host stand-in for the LVGL types the model headers name.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef union {
+  uint16_t full;
+} lv_color_t;
+
+typedef struct _lv_obj_t lv_obj_t;
+typedef struct _lv_task_t lv_task_t;
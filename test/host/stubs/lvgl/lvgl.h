@@ -0,0 +1,13 @@
+/**
+ * @file lvgl.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Host stand-in for the LVGL component include path.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#pragma once
+
+#include "../lvgl.h"
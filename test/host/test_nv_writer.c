@@ -0,0 +1,297 @@
+/**
+ * @file test_nv_writer.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief The settings writer of model/nvsettings.c, on a simulated clock.
+ * @version 0.1
+ * @date 2020-11-26
+ *
+ * The test thread is the GUI task and drags the brightness slider; the writer
+ * runs on its own thread. NVS only records when blobs are committed.
+ *
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "check.h"
+#include "diag/metrics.h"
+#include "esp32/rom/crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos_sim.h"
+#include "model/datastore.h"
+#include "model/nvsettings.h"
+#include "nvs_flash.h"
+#include "ui/jobs/jobs.h"
+
+#define QUIET_MS CONFIG_TK_NV_QUIET_MS
+#define MAX_DELAY_MS CONFIG_TK_NV_MAX_DELAY_MS
+
+#define MAX_COMMITS 32
+
+// Longer than any change takes when it does not wait for the flash
+#define STALL_MS 1000
+
+// Blob header, then the brightness: automatic, then the level
+#define BLOB_LEVEL_OFFSET (12 + sizeof(bool))
+
+static struct {
+  uint8_t blob[512];
+  size_t blob_len;
+  bool blob_stored;
+
+  TickType_t commits[MAX_COMMITS];
+  int commit_count;
+
+  // A change made by the GUI task while the blob is being written
+  bool change_during_write;
+  float changed_level;
+  bool stalled;
+  sem_t changed;
+} nvs;
+
+static void *gui_change(void *arg) {
+  nv_set(TK_SETTING_BRIGHTNESS_LEVEL, &nvs.changed_level);
+  sem_post(&nvs.changed);
+  return NULL;
+}
+
+// -------------------- FAKES --------------------
+
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+esp_err_t nvs_flash_erase(void) { return ESP_OK; }
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode,
+                   nvs_handle_t *handle) {
+  *handle = 1;
+  return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value,
+                       size_t length) {
+  if (length > sizeof nvs.blob)
+    return ESP_ERR_INVALID_SIZE;
+
+  memcpy(nvs.blob, value, length);
+  nvs.blob_len = length;
+  nvs.blob_stored = true;
+
+  if (nvs.change_during_write) {
+    nvs.change_during_write = false;
+
+    // The GUI task must not wait for the flash
+    pthread_t gui;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += STALL_MS / 1000;
+
+    pthread_create(&gui, NULL, gui_change, NULL);
+    pthread_detach(gui);
+    if (sem_timedwait(&nvs.changed, &deadline) != 0)
+      nvs.stalled = true;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+  if (nvs.commit_count < MAX_COMMITS)
+    nvs.commits[nvs.commit_count] = xTaskGetTickCount();
+  nvs.commit_count++;
+  return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value,
+                       size_t *length) {
+  if (!nvs.blob_stored)
+    return ESP_ERR_NVS_NOT_FOUND;
+
+  memcpy(value, nvs.blob, nvs.blob_len);
+  *length = nvs.blob_len;
+  return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+  return ESP_OK;
+}
+
+esp_err_t nvs_get_i8(nvs_handle_t handle, const char *key, int8_t *value) {
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *value) {
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+void tk_metrics_register(tk_metric_t *metric) {}
+void tk_refresh_request(void) {}
+void switch_theme(bool light) {}
+
+// The test thread is the GUI task
+bool tk_ui_post(tk_ui_job_fn_t fn, const void *payload, size_t len) {
+  uint8_t copy[16];
+  memcpy(copy, payload, len);
+  fn(copy);
+  return true;
+}
+
+// -------------------- HELPERS --------------------
+
+static void commits_reset(void) { nvs.commit_count = 0; }
+
+static float stored_level(void) {
+  float level;
+  memcpy(&level, nvs.blob + BLOB_LEVEL_OFFSET, sizeof level);
+  return level;
+}
+
+/**
+ * @brief Drags the brightness slider from one end to the other.
+ *
+ * @param steps Changes.
+ * @param period_ms Time between two changes.
+ * @return TickType_t When the last change was made.
+ */
+static TickType_t slider_sweep(int steps, uint32_t period_ms) {
+  TickType_t last = 0;
+
+  for (int i = 0; i < steps; i++) {
+    if (i > 0)
+      tk_sim_advance(period_ms);
+
+    float level = (float)(i % 21) / 20;
+    CHECK_EQ(nv_set(TK_SETTING_BRIGHTNESS_LEVEL, &level), ESP_OK);
+    last = xTaskGetTickCount();
+  }
+
+  return last;
+}
+
+// -------------------- TESTS --------------------
+
+static void test_boot(void) {
+  nv_load_defaults();
+  nv_init();
+
+  // Nothing stored yet: the defaults are written once loaded
+  nv_load_apply_settings();
+  TickType_t loaded = xTaskGetTickCount();
+  tk_sim_advance(QUIET_MS + 100);
+
+  CHECK_EQ(nvs.commit_count, 1);
+  CHECK_EQ(nvs.commits[0], loaded + QUIET_MS);
+
+  const uint8_t *payload = nvs.blob + 12;
+  uint32_t crc;
+  memcpy(&crc, nvs.blob + 8, sizeof crc);
+  CHECK_EQ(crc, crc32_le(0, payload, nvs.blob_len - 12));
+}
+
+static void test_one_sweep(void) {
+  commits_reset();
+
+  // Two seconds of slider, a change every 50 ms
+  TickType_t last = slider_sweep(41, 50);
+  tk_sim_advance(QUIET_MS - 1);
+  CHECK_EQ(nvs.commit_count, 0);
+
+  tk_sim_advance(1);
+  CHECK_EQ(nvs.commit_count, 1);
+  CHECK_EQ(nvs.commits[0], last + QUIET_MS);
+  CHECK(stored_level() == global_datastore.brightness_settings.level);
+
+  tk_sim_advance(5 * QUIET_MS);
+  CHECK_EQ(nvs.commit_count, 1);
+}
+
+static void test_quiet_periods(void) {
+  const int steps[] = {1, 7, 30};
+  TickType_t ends[3];
+
+  commits_reset();
+
+  // Each sweep is separated from the next by more than the quiet period
+  for (int i = 0; i < 3; i++) {
+    ends[i] = slider_sweep(steps[i], 80);
+    tk_sim_advance(QUIET_MS + 250);
+  }
+
+  CHECK_EQ(nvs.commit_count, 3);
+  for (int i = 0; i < 3 && i < nvs.commit_count; i++)
+    CHECK_EQ(nvs.commits[i], ends[i] + QUIET_MS);
+}
+
+static void test_pause_shorter_than_quiet(void) {
+  commits_reset();
+
+  // A pause shorter than the quiet period does not split the batch
+  slider_sweep(10, 50);
+  tk_sim_advance(QUIET_MS - 100);
+  TickType_t last = slider_sweep(10, 50);
+  tk_sim_advance(QUIET_MS + 100);
+
+  CHECK_EQ(nvs.commit_count, 1);
+  CHECK_EQ(nvs.commits[0], last + QUIET_MS);
+}
+
+static void test_max_delay(void) {
+  commits_reset();
+
+  // A change every 100 ms for 2.5 maximum delays, never quiet
+  TickType_t first = xTaskGetTickCount();
+  TickType_t last = slider_sweep(MAX_DELAY_MS * 5 / 2 / 100 + 1, 100);
+  tk_sim_advance(QUIET_MS + 100);
+
+  CHECK_EQ(nvs.commit_count, 3);
+  CHECK(nvs.commits[0] - first <= MAX_DELAY_MS + QUIET_MS);
+  CHECK(nvs.commits[1] - nvs.commits[0] <= MAX_DELAY_MS + QUIET_MS);
+  CHECK_EQ(nvs.commits[2], last + QUIET_MS);
+  CHECK(stored_level() == global_datastore.brightness_settings.level);
+}
+
+static void test_flush(void) {
+  commits_reset();
+
+  // An explicit flush writes at once, and leaves nothing for the writer
+  slider_sweep(5, 50);
+  nv_flush();
+  CHECK_EQ(nvs.commit_count, 1);
+
+  tk_sim_advance(MAX_DELAY_MS);
+  CHECK_EQ(nvs.commit_count, 1);
+}
+
+static void test_change_during_write(void) {
+  commits_reset();
+
+  // The GUI task changes the level while the writer is in NVS
+  sem_init(&nvs.changed, 0, 0);
+  nvs.change_during_write = true;
+  nvs.changed_level = 0.25f;
+  slider_sweep(3, 50);
+  tk_sim_advance(QUIET_MS + 100);
+
+  CHECK(!nvs.stalled);
+  CHECK_EQ(nvs.commit_count, 1);
+
+  // The change is a batch of its own
+  tk_sim_advance(QUIET_MS + 100);
+  CHECK_EQ(nvs.commit_count, 2);
+  CHECK(stored_level() == 0.25f);
+  CHECK(global_datastore.brightness_settings.level == 0.25f);
+}
+
+int main(void) {
+  test_boot();
+  test_one_sweep();
+  test_quiet_periods();
+  test_pause_shorter_than_quiet();
+  test_max_delay();
+  test_flush();
+  test_change_during_write();
+
+  return CHECK_RESULT();
+}
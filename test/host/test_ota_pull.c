@@ -0,0 +1,433 @@
+/**
+ * @file test_ota_pull.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief OTA/fetch.c against tools/ota_pull_server.py, cutting every response.
+ * @version 0.1
+ * @date 2021-02-12
+ *
+ * The download runs over plain sockets into OTA/verify.c, the flash is memory
+ * and the backoff is recorded instead of waited. Arguments: the Python
+ * interpreter and the server script.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "OTA/fetch.h"
+#include "OTA/verify.h"
+#include "check.h"
+#include "image.h"
+
+#define PAYLOAD_LEN 20000
+#define DROP_AFTER 3000
+#define CAPACITY 65536
+
+static const char *python;
+static const char *server_script;
+
+typedef struct {
+  pid_t pid;
+  int port;
+} server_t;
+
+/**
+ * @brief Starts the server on a free port, cutting every response.
+ *
+ */
+static bool server_start(server_t *server, const char *image_path,
+                         int drop_after) {
+  int out[2];
+  if (pipe(out) != 0)
+    return false;
+
+  char drop[16];
+  snprintf(drop, sizeof drop, "%d", drop_after);
+
+  server->pid = fork();
+  if (server->pid == 0) {
+    dup2(out[1], STDOUT_FILENO);
+    close(out[0]);
+    close(out[1]);
+    execl(python, python, server_script, image_path, "--port", "0",
+          "--drop-after", drop, (char *)NULL);
+    _exit(127);
+  }
+
+  close(out[1]);
+  FILE *lines = fdopen(out[0], "r");
+  char line[512];
+  bool started = fgets(line, sizeof line, lines) != NULL;
+  fclose(lines);
+
+  const char *port = started ? strstr(line, "on port ") : NULL;
+  if (port == NULL) {
+    kill(server->pid, SIGTERM);
+    waitpid(server->pid, NULL, 0);
+    return false;
+  }
+
+  server->port = atoi(port + strlen("on port "));
+  return true;
+}
+
+static void server_stop(server_t *server) {
+  kill(server->pid, SIGTERM);
+  waitpid(server->pid, NULL, 0);
+}
+
+/**
+ * @brief An HTTP/1.1 client, one connection per request.
+ *
+ */
+typedef struct {
+  int port;
+  const char *path;
+  int fd;
+
+  // Body bytes still announced, negative if unknown
+  long remaining;
+  int requests;
+} http_t;
+
+static void http_close(void *ctx) {
+  http_t *http = (http_t *)ctx;
+  if (http->fd >= 0)
+    close(http->fd);
+  http->fd = -1;
+}
+
+static esp_err_t http_open(void *ctx, size_t from,
+                           tk_ota_fetch_response_t *response) {
+  http_t *http = (http_t *)ctx;
+  http->requests++;
+
+  http->fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address = {.sin_family = AF_INET,
+                                .sin_port = htons(http->port)};
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(http->fd, (struct sockaddr *)&address, sizeof address) != 0) {
+    http_close(http);
+    return ESP_FAIL;
+  }
+
+  char request[256];
+  int len = snprintf(request, sizeof request,
+                     "GET %s HTTP/1.1\r\nHost: localhost\r\n"
+                     "Connection: close\r\n",
+                     http->path);
+  if (from > 0)
+    len += snprintf(request + len, sizeof request - len,
+                    "Range: bytes=%zu-\r\n", from);
+  len += snprintf(request + len, sizeof request - len, "\r\n");
+  if (send(http->fd, request, len, 0) != len) {
+    http_close(http);
+    return ESP_FAIL;
+  }
+
+  // Headers, a byte at a time up to the empty line
+  char headers[2048];
+  size_t used = 0;
+  while (used < sizeof headers - 1) {
+    if (recv(http->fd, headers + used, 1, 0) != 1) {
+      http_close(http);
+      return ESP_FAIL;
+    }
+    used++;
+    if (used >= 4 && memcmp(headers + used - 4, "\r\n\r\n", 4) == 0)
+      break;
+  }
+  headers[used] = '\0';
+
+  response->status = 0;
+  response->content_length = -1;
+  response->range_start = -1;
+  sscanf(headers, "HTTP/1.%*d %d", &response->status);
+
+  for (char *line = strstr(headers, "\r\n"); line != NULL;
+       line = strstr(line, "\r\n")) {
+    line += 2;
+    if (strncasecmp(line, "Content-Length:", 15) == 0)
+      response->content_length = atoi(line + 15);
+    else if (strncasecmp(line, "Content-Range:", 14) == 0)
+      sscanf(line + 14, " bytes %ld-", &response->range_start);
+  }
+
+  http->remaining = response->content_length;
+  return ESP_OK;
+}
+
+static int http_read(void *ctx, uint8_t *data, size_t len) {
+  http_t *http = (http_t *)ctx;
+
+  if (http->remaining == 0)
+    return 0;
+  if (http->remaining > 0 && (long)len > http->remaining)
+    len = http->remaining;
+
+  ssize_t read_len = recv(http->fd, data, len, 0);
+  if (read_len > 0 && http->remaining > 0)
+    http->remaining -= read_len;
+
+  return (int)read_len;
+}
+
+static bool http_complete(void *ctx) {
+  return ((http_t *)ctx)->remaining == 0;
+}
+
+/**
+ * @brief The verifier, writing to memory.
+ *
+ */
+typedef struct {
+  tk_ota_verifier_t verifier;
+  bool begun;
+  esp_err_t error;
+
+  uint8_t buffer[4096];
+  uint8_t flash[CAPACITY];
+  size_t flash_len;
+  int begins;
+  int aborts;
+} memory_image_t;
+
+static esp_err_t flash_begin(void *ctx) {
+  memory_image_t *image = (memory_image_t *)ctx;
+  image->flash_len = 0;
+  return ESP_OK;
+}
+
+static esp_err_t flash_write(void *ctx, const uint8_t *data, size_t len) {
+  memory_image_t *image = (memory_image_t *)ctx;
+  if (image->flash_len + len > CAPACITY)
+    return ESP_FAIL;
+
+  memcpy(image->flash + image->flash_len, data, len);
+  image->flash_len += len;
+  return ESP_OK;
+}
+
+static esp_err_t image_begin(void *ctx, size_t total) {
+  memory_image_t *image = (memory_image_t *)ctx;
+  tk_ota_expect_t expect;
+  tk_test_expect(&expect, CAPACITY);
+  const tk_ota_sink_t sink = {
+      .begin = flash_begin, .write = flash_write, .ctx = image};
+
+  image->begins++;
+  image->error = tk_ota_verifier_begin(&image->verifier, &expect, &sink, total);
+  image->begun = image->error == ESP_OK;
+  return image->error;
+}
+
+static uint8_t *image_acquire(void *ctx, size_t *capacity) {
+  memory_image_t *image = (memory_image_t *)ctx;
+  if (image->error != ESP_OK)
+    return NULL;
+
+  *capacity = sizeof image->buffer;
+  return image->buffer;
+}
+
+static void image_submit(void *ctx, uint8_t *data, size_t len) {
+  memory_image_t *image = (memory_image_t *)ctx;
+  if (image->error == ESP_OK && len > 0)
+    image->error = tk_ota_verifier_write(&image->verifier, data, len);
+}
+
+static esp_err_t image_error(void *ctx) {
+  return ((memory_image_t *)ctx)->error;
+}
+
+static esp_err_t image_finish(void *ctx) {
+  memory_image_t *image = (memory_image_t *)ctx;
+  image->begun = false;
+  return tk_ota_verifier_finish(&image->verifier);
+}
+
+static void image_abort(void *ctx) {
+  memory_image_t *image = (memory_image_t *)ctx;
+  image->aborts++;
+  if (image->begun)
+    tk_ota_verifier_free(&image->verifier);
+  image->begun = false;
+}
+
+static uint32_t delays[16];
+static int delay_count;
+
+static void record_delay(uint32_t ms) {
+  if (delay_count < 16)
+    delays[delay_count] = ms;
+  delay_count++;
+}
+
+static uint8_t bytes[CAPACITY];
+static memory_image_t memory;
+
+/**
+ * @brief Serves an image and downloads it.
+ *
+ */
+static esp_err_t download(const uint8_t *data, size_t len, const char *path,
+                          int retries, http_t *http,
+                          tk_ota_fetch_stats_t *stats) {
+  char image_path[] = "/tmp/tk_ota_pull_XXXXXX";
+  int fd = mkstemp(image_path);
+  CHECK(fd >= 0 && write(fd, data, len) == (ssize_t)len);
+  close(fd);
+
+  server_t server;
+  bool started = server_start(&server, image_path, DROP_AFTER);
+  CHECK(started);
+  if (!started) {
+    unlink(image_path);
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  // The server serves the image under its file name
+  char request_path[64];
+  snprintf(request_path, sizeof request_path, "%s",
+           path != NULL ? path : strrchr(image_path, '/'));
+
+  *http = (http_t){.port = server.port, .path = request_path, .fd = -1};
+  memset(&memory, 0, sizeof memory);
+  delay_count = 0;
+
+  const tk_ota_fetch_t fetch = {
+      .transport = {.open = http_open,
+                    .read = http_read,
+                    .complete = http_complete,
+                    .close = http_close,
+                    .ctx = http},
+      .image = {.begin = image_begin,
+                .acquire = image_acquire,
+                .submit = image_submit,
+                .error = image_error,
+                .finish = image_finish,
+                .abort = image_abort,
+                .ctx = &memory},
+      .retries = retries,
+      .delay = record_delay,
+  };
+
+  esp_err_t err = tk_ota_fetch(&fetch, stats);
+
+  server_stop(&server);
+  unlink(image_path);
+  return err;
+}
+
+static void test_backoff(void) {
+  CHECK_EQ(tk_ota_fetch_backoff_ms(1), 1000);
+  CHECK_EQ(tk_ota_fetch_backoff_ms(2), 2000);
+  CHECK_EQ(tk_ota_fetch_backoff_ms(4), 8000);
+  CHECK_EQ(tk_ota_fetch_backoff_ms(5), 16000);
+  CHECK_EQ(tk_ota_fetch_backoff_ms(6), 16000);
+  CHECK_EQ(tk_ota_fetch_backoff_ms(40), 16000);
+}
+
+static void test_resume(void) {
+  size_t len = tk_test_image_build(bytes, PAYLOAD_LEN, "2.0");
+  size_t requests = (len + DROP_AFTER - 1) / DROP_AFTER;
+  http_t http;
+  tk_ota_fetch_stats_t stats;
+
+  esp_err_t err = download(bytes, len, NULL, 10, &http, &stats);
+  CHECK_EQ(err, ESP_OK);
+  CHECK_EQ(http.requests, requests);
+  CHECK_EQ(stats.resumes, requests - 1);
+  CHECK_EQ(stats.restarts, 0);
+  CHECK_EQ(stats.received, len);
+  CHECK_EQ(stats.total, len);
+  CHECK_EQ(memory.begins, 1);
+  CHECK_EQ(memory.aborts, 0);
+  CHECK_EQ(memory.flash_len, len);
+  CHECK(memcmp(memory.flash, bytes, len) == 0);
+
+  CHECK_EQ(delay_count, requests - 1);
+  for (int i = 0; i < delay_count && i < 16; i++)
+    CHECK_EQ(delays[i], tk_ota_fetch_backoff_ms(i + 1));
+}
+
+static void test_out_of_retries(void) {
+  size_t len = tk_test_image_build(bytes, PAYLOAD_LEN, "2.0");
+  http_t http;
+  tk_ota_fetch_stats_t stats;
+
+  esp_err_t err = download(bytes, len, NULL, 2, &http, &stats);
+  CHECK_EQ(err, ESP_FAIL);
+  CHECK_EQ(http.requests, 3);
+  CHECK_EQ(stats.received, 3 * DROP_AFTER);
+  CHECK_EQ(memory.aborts, 1);
+}
+
+static void test_bad_magic(void) {
+  size_t len = tk_test_image_build(bytes, PAYLOAD_LEN, "2.0");
+  bytes[0] = 0xE8;
+  http_t http;
+  tk_ota_fetch_stats_t stats;
+
+  // Rejected with the first block, and not retried
+  esp_err_t err = download(bytes, len, NULL, 10, &http, &stats);
+  CHECK_EQ(err, ESP_ERR_IMAGE_INVALID);
+  CHECK_EQ(http.requests, 1);
+  CHECK_EQ(delay_count, 0);
+  CHECK_EQ(memory.flash_len, 0);
+  CHECK_EQ(memory.aborts, 1);
+}
+
+static void test_corrupt(void) {
+  size_t len = tk_test_image_build(bytes, PAYLOAD_LEN, "2.0");
+  bytes[len / 2] ^= 0x01;
+  http_t http;
+  tk_ota_fetch_stats_t stats;
+
+  // Only the hash at the end can tell, after resuming across the cuts
+  esp_err_t err = download(bytes, len, NULL, 10, &http, &stats);
+  CHECK_EQ(err, ESP_ERR_IMAGE_INVALID);
+  CHECK_EQ(stats.received, len);
+  CHECK(stats.resumes > 0);
+}
+
+static void test_not_found(void) {
+  size_t len = tk_test_image_build(bytes, PAYLOAD_LEN, "2.0");
+  http_t http;
+  tk_ota_fetch_stats_t stats;
+
+  esp_err_t err = download(bytes, len, "/missing.bin", 10, &http, &stats);
+  CHECK_EQ(err, ESP_FAIL);
+  CHECK_EQ(http.requests, 1);
+  CHECK_EQ(delay_count, 0);
+  CHECK_EQ(memory.begins, 0);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <python> <ota_pull_server.py>\n", argv[0]);
+    return 2;
+  }
+
+  python = argv[1];
+  server_script = argv[2];
+  signal(SIGPIPE, SIG_IGN);
+
+  test_backoff();
+  test_resume();
+  test_out_of_retries();
+  test_bad_magic();
+  test_corrupt();
+  test_not_found();
+
+  return CHECK_RESULT();
+}
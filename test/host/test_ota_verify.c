@@ -0,0 +1,222 @@
+/**
+ * @file test_ota_verify.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief OTA/verify.c over images built in memory.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "OTA/verify.h"
+#include "check.h"
+#include "esp_ota_ops.h"
+#include "image.h"
+
+#define PAYLOAD_LEN 10000
+#define CAPACITY 65536
+
+/**
+ * @brief A flash that records what it is given.
+ *
+ */
+typedef struct {
+  int begins;
+  uint8_t data[CAPACITY];
+  size_t len;
+} memory_sink_t;
+
+static esp_err_t memory_begin(void *ctx) {
+  memory_sink_t *memory = (memory_sink_t *)ctx;
+  memory->begins++;
+  return ESP_OK;
+}
+
+static esp_err_t memory_write(void *ctx, const uint8_t *data, size_t len) {
+  memory_sink_t *memory = (memory_sink_t *)ctx;
+  if (memory->begins == 0 || memory->len + len > CAPACITY)
+    return ESP_FAIL;
+
+  memcpy(memory->data + memory->len, data, len);
+  memory->len += len;
+  return ESP_OK;
+}
+
+static uint8_t image[CAPACITY * 2];
+static memory_sink_t memory;
+
+typedef struct {
+  esp_err_t begin;
+  esp_err_t write;
+  esp_err_t finish;
+} result_t;
+
+/**
+ * @brief Streams an image through a verifier, in blocks of the given size.
+ *
+ */
+static result_t stream(const tk_ota_expect_t *expect, const uint8_t *data,
+                       size_t len, size_t announced, size_t block) {
+  const tk_ota_sink_t sink = {
+      .begin = memory_begin, .write = memory_write, .ctx = &memory};
+  tk_ota_verifier_t verifier;
+  result_t result = {ESP_OK, ESP_OK, ESP_OK};
+
+  memset(&memory, 0, sizeof(memory));
+
+  result.begin = tk_ota_verifier_begin(&verifier, expect, &sink, announced);
+  if (result.begin != ESP_OK) {
+    tk_ota_verifier_free(&verifier);
+    return result;
+  }
+
+  for (size_t offset = 0; offset < len; offset += block) {
+    size_t chunk = len - offset < block ? len - offset : block;
+    result.write = tk_ota_verifier_write(&verifier, data + offset, chunk);
+    if (result.write != ESP_OK) {
+      tk_ota_verifier_free(&verifier);
+      return result;
+    }
+  }
+
+  result.finish = tk_ota_verifier_finish(&verifier);
+  return result;
+}
+
+static void test_valid(void) {
+  tk_ota_expect_t expect;
+  tk_test_expect(&expect, CAPACITY);
+  size_t len = tk_test_image_build(image, PAYLOAD_LEN, "2.0");
+
+  // Blocks smaller than the hash, straddling the header, and whole
+  const size_t blocks[] = {1, 7, 31, 33, 300, 4096, len};
+  for (size_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++) {
+    for (int announce = 0; announce < 2; announce++) {
+      result_t result =
+          stream(&expect, image, len, announce ? len : 0, blocks[i]);
+      CHECK_EQ(result.write, ESP_OK);
+      CHECK_EQ(result.finish, ESP_OK);
+      CHECK_EQ(memory.begins, 1);
+      CHECK_EQ(memory.len, len);
+      CHECK(memcmp(memory.data, image, len) == 0);
+    }
+  }
+}
+
+static void test_bad_magic(void) {
+  tk_ota_expect_t expect;
+  tk_test_expect(&expect, CAPACITY);
+  size_t len = tk_test_image_build(image, PAYLOAD_LEN, "2.0");
+  image[0] = 0xE8;
+
+  result_t result = stream(&expect, image, len, len, 512);
+  CHECK_EQ(result.write, ESP_ERR_IMAGE_INVALID);
+
+  // Nothing is erased for an image that is not one
+  CHECK_EQ(memory.begins, 0);
+  CHECK_EQ(memory.len, 0);
+}
+
+static void test_wrong_chip(void) {
+  tk_ota_expect_t expect;
+  tk_test_expect(&expect, CAPACITY);
+  size_t len = tk_test_image_build(image, PAYLOAD_LEN, "2.0");
+  expect.chip_id = TK_TEST_CHIP_ID + 2;
+
+  result_t result = stream(&expect, image, len, len, 512);
+  CHECK_EQ(result.write, ESP_ERR_IMAGE_INVALID);
+  CHECK_EQ(memory.begins, 0);
+}
+
+static void test_versions(void) {
+  tk_ota_expect_t expect;
+  tk_test_expect(&expect, CAPACITY);
+
+  size_t len = tk_test_image_build(image, PAYLOAD_LEN, TK_TEST_RUNNING_VERSION);
+  result_t result = stream(&expect, image, len, len, 512);
+  CHECK_EQ(result.write, ESP_ERR_OTA_VALIDATE_FAILED);
+
+  expect.allow_same_version = true;
+  result = stream(&expect, image, len, len, 512);
+  CHECK_EQ(result.finish, ESP_OK);
+
+  len = tk_test_image_build(image, PAYLOAD_LEN, "2.0");
+  strcpy(expect.rejected_version, "2.0");
+  result = stream(&expect, image, len, len, 512);
+  CHECK_EQ(result.write, ESP_ERR_OTA_VALIDATE_FAILED);
+  CHECK_EQ(memory.begins, 0);
+}
+
+static void test_flipped_payload(void) {
+  tk_ota_expect_t expect;
+  tk_test_expect(&expect, CAPACITY);
+  size_t len = tk_test_image_build(image, PAYLOAD_LEN, "2.0");
+
+  const size_t offsets[] = {TK_OTA_HEADER_LEN, TK_OTA_HEADER_LEN + 4321,
+                            len - TK_OTA_HASH_LEN - 1, len - 1};
+  for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+    image[offsets[i]] ^= 0x01;
+
+    result_t result = stream(&expect, image, len, len, 1000);
+    CHECK_EQ(result.write, ESP_OK);
+    CHECK_EQ(result.finish, ESP_ERR_IMAGE_INVALID);
+
+    image[offsets[i]] ^= 0x01;
+  }
+}
+
+static void test_truncated(void) {
+  tk_ota_expect_t expect;
+  tk_test_expect(&expect, CAPACITY);
+  size_t len = tk_test_image_build(image, PAYLOAD_LEN, "2.0");
+
+  // Cut inside the appended hash: with the length announced it is short...
+  result_t result = stream(&expect, image, len - 10, len, 1000);
+  CHECK_EQ(result.finish, ESP_ERR_INVALID_SIZE);
+
+  // ...and without, the last bytes are not the hash
+  result = stream(&expect, image, len - 10, 0, 1000);
+  CHECK_EQ(result.finish, ESP_ERR_IMAGE_INVALID);
+
+  // Cut inside the header
+  result = stream(&expect, image, TK_OTA_HEADER_LEN - 1, 0, 100);
+  CHECK_EQ(result.finish, ESP_ERR_IMAGE_INVALID);
+  CHECK_EQ(memory.begins, 0);
+}
+
+static void test_oversize(void) {
+  tk_ota_expect_t expect;
+  tk_test_expect(&expect, CAPACITY);
+  size_t len = tk_test_image_build(image, CAPACITY, "2.0");
+
+  // Announced larger than the partition
+  result_t result = stream(&expect, image, len, len, 4096);
+  CHECK_EQ(result.begin, ESP_ERR_INVALID_SIZE);
+  CHECK_EQ(memory.begins, 0);
+
+  // Not announced, stopped when it overflows
+  result = stream(&expect, image, len, 0, 4096);
+  CHECK_EQ(result.write, ESP_ERR_INVALID_SIZE);
+  CHECK(memory.len <= CAPACITY);
+
+  // More than announced
+  len = tk_test_image_build(image, PAYLOAD_LEN, "2.0");
+  result = stream(&expect, image, len, len - 100, 4096);
+  CHECK_EQ(result.write, ESP_ERR_INVALID_SIZE);
+}
+
+int main(void) {
+  test_valid();
+  test_bad_magic();
+  test_wrong_chip();
+  test_versions();
+  test_flipped_payload();
+  test_truncated();
+  test_oversize();
+
+  return CHECK_RESULT();
+}
@@ -0,0 +1,164 @@
+/**
+ * @file test_ui_jobs.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Host stress test of the job queue: four producer threads post 80000
+ * jobs while the main thread, the GUI task, runs them.
+ * @version 0.1
+ * @date 2021-02-22
+ *
+ * A full queue is retried, as the brightness task does. Every job must arrive
+ * once, in order for its producer, with its payload.
+ *
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "diag/metrics.h"
+#include "ui/jobs/jobs.h"
+
+#define PRODUCERS 4
+#define JOBS_PER_PRODUCER 20000
+#define JOBS (PRODUCERS * JOBS_PER_PRODUCER)
+
+typedef struct {
+  uint32_t producer;
+  uint32_t seq;
+
+  // Derived from the two above, to catch torn copies
+  uint32_t check[2];
+} job_payload_t;
+
+_Static_assert(sizeof(job_payload_t) == TK_UI_JOB_PAYLOAD,
+               "The payload fills the slot.");
+
+static uint32_t next_seq[PRODUCERS];
+static uint32_t received = 0;
+static uint32_t out_of_order = 0;
+static uint32_t torn = 0;
+
+static uint32_t full[PRODUCERS];
+static volatile uint32_t wakes = 0;
+static volatile int started = 0;
+
+// -------------------- FAKES --------------------
+
+void tk_gui_wake(void) { __atomic_fetch_add(&wakes, 1, __ATOMIC_RELAXED); }
+void tk_gui_wake_input(void) {}
+void tk_metrics_register(tk_metric_t *metric) {}
+void tk_metric_observe(tk_metric_t *metric, int32_t value) {}
+
+// -------------------- JOBS --------------------
+
+static uint32_t payload_check(uint32_t producer, uint32_t seq, int i) {
+  return (producer * 2654435761u) ^ (seq * 40503u) ^ (i ? 0xa5a5a5a5 : 0);
+}
+
+static void job_fn(void *payload) {
+  job_payload_t job;
+  memcpy(&job, payload, sizeof job);
+
+  if (job.producer >= PRODUCERS || job.check[0] != payload_check(job.producer,
+                                                                 job.seq, 0) ||
+      job.check[1] != payload_check(job.producer, job.seq, 1)) {
+    torn++;
+    return;
+  }
+
+  if (job.seq != next_seq[job.producer])
+    out_of_order++;
+  next_seq[job.producer] = job.seq + 1;
+  received++;
+}
+
+static void *producer(void *arg) {
+  uint32_t id = (uint32_t)(uintptr_t)arg;
+
+  // Start together, for the most contention
+  __atomic_fetch_add(&started, 1, __ATOMIC_RELAXED);
+  while (__atomic_load_n(&started, __ATOMIC_RELAXED) < PRODUCERS)
+    sched_yield();
+
+  for (uint32_t seq = 0; seq < JOBS_PER_PRODUCER; seq++) {
+    job_payload_t job = {.producer = id,
+                         .seq = seq,
+                         .check = {payload_check(id, seq, 0),
+                                   payload_check(id, seq, 1)}};
+
+    while (!tk_ui_post(job_fn, &job, sizeof job)) {
+      full[id]++;
+      sched_yield();
+    }
+  }
+
+  return NULL;
+}
+
+// -------------------- TESTS --------------------
+
+static void test_limits(void) {
+  uint8_t payload[TK_UI_JOB_PAYLOAD + 1] = {0};
+
+  CHECK(!tk_ui_post(job_fn, payload, sizeof payload));
+  CHECK(!tk_ui_post(NULL, payload, 0));
+
+  // A full queue drops, and a pass runs at most one queue
+  job_payload_t job = {.producer = 0,
+                       .check = {payload_check(0, 0, 0),
+                                 payload_check(0, 0, 1)}};
+  for (int i = 0; i < TK_UI_JOBS_LEN; i++)
+    CHECK(tk_ui_post(job_fn, &job, sizeof job));
+  CHECK(!tk_ui_post(job_fn, &job, sizeof job));
+
+  CHECK_EQ(tk_ui_jobs_run(), TK_UI_JOBS_LEN);
+  CHECK_EQ(tk_ui_jobs_run(), 0);
+  CHECK_EQ(received, TK_UI_JOBS_LEN);
+
+  received = 0;
+  out_of_order = 0;
+  next_seq[0] = 0;
+}
+
+static void test_stress(void) {
+  pthread_t threads[PRODUCERS];
+  uint32_t passes = 0;
+
+  for (uintptr_t i = 0; i < PRODUCERS; i++)
+    pthread_create(&threads[i], NULL, producer, (void *)i);
+
+  while (received + torn < JOBS) {
+    if (tk_ui_jobs_run() == 0)
+      sched_yield();
+    passes++;
+  }
+
+  for (int i = 0; i < PRODUCERS; i++)
+    pthread_join(threads[i], NULL);
+
+  // Nothing left behind
+  CHECK_EQ(tk_ui_jobs_run(), 0);
+
+  CHECK_EQ(received, JOBS);
+  CHECK_EQ(torn, 0);
+  CHECK_EQ(out_of_order, 0);
+  for (int i = 0; i < PRODUCERS; i++)
+    CHECK_EQ(next_seq[i], JOBS_PER_PRODUCER);
+
+  // One wake per job posted
+  CHECK(wakes >= JOBS);
+
+  printf("%u jobs in %u passes, queue full %u/%u/%u/%u times.\n", received,
+         passes, full[0], full[1], full[2], full[3]);
+}
+
+int main(void) {
+  tk_ui_jobs_init();
+
+  test_limits();
+  test_stress();
+
+  return CHECK_RESULT();
+}
@@ -17,58 +17,239 @@
 
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 
 #include "hmi/ESP32/brightness.h"
 #include "hmi/ESP32/buttons.h"
 #include "hmi/ESP32/encoder.h"
+#include "hmi/ESP32/power.h"
 
 #include "model/datastore.h"
 #include "model/nvsettings.h"
+#include "model/samples.h"
 
 #include "BLE/ble.h"
-
+#include "OTA/wifi.h"
+
+#include "diag/boot.h"
+#include "diag/console.h"
+#include "diag/framestats.h"
+#include "diag/metrics.h"
+#include "diag/sampler.h"
+#include "diag/tk_log.h"
+#include "diag/trace.h"
+
+#include "ui/assets/assets.h"
+#include "ui/jobs/jobs.h"
 #include "ui/refresh/refresh.h"
 #include "ui/styles/tk_style.h"
 #include "ui/views.h"
+#include "ui/views/boot/splash.h"
 
 #define TAG "TKOS"
 
+static tk_metric_t frame_time_metric =
+    TK_METRIC_HISTOGRAM("tk_gui_frame_ms", "GUI frame render time.", 5, 10, 20,
+                        40, 80, 160);
+static tk_metric_t boot_first_frame_metric =
+    TK_METRIC_GAUGE("tk_boot_first_frame_ms",
+                    "Time from boot to the first frame of the main view.");
+static tk_metric_t boot_ready_metric = TK_METRIC_GAUGE(
+    "tk_boot_ready_ms", "Time from boot to settings and Bluetooth ready.");
+static tk_metric_t gui_wakeups_metric = TK_METRIC_COUNTER(
+    "tk_gui_wakeups_total", "Times the GUI task woke up to run lvgl.");
+static tk_metric_t gui_busy_metric = TK_METRIC_COUNTER(
+    "tk_gui_busy_ms_total", "Time spent running jobs and lvgl.");
+
+// Set by a job from the init task when NVS, settings and Bluetooth are up
+static bool services_ready = false;
+
+// Set once the main view has been built, the next frame is the first useful one
+static bool main_view_shown = false;
+static bool first_frame_done = false;
+
 /**
- * @brief Initializes tkos and creates the refresh task
+ * @brief Starts what depends on the loaded settings, once they are and the
+ * first frame is out.
  *
  */
-void tkos_init(void) {
-  ESP_LOGI(TAG, "Initializing TKOS.");
+static void tkos_ready(void) {
+  if (!services_ready || !first_frame_done)
+    return;
+
+  // Brightness follows the stored settings from now on, slower while idle
+  lv_task_t *brightness =
+      lv_task_create(brightness_task, 100, LV_TASK_PRIO_MID, NULL);
+  tk_power_add_task(brightness, 1000);
+  tk_boot_mark("brightness task");
+
+  tk_boot_summary();
+}
+
+/**
+ * @brief Posted by the init task when the services are up.
+ *
+ * @param payload Unused.
+ */
+static void tkos_services_ready(void *payload) {
+  (void)payload;
+
+  services_ready = true;
+  tkos_ready();
+}
+
+/**
+ * @brief Called by lvgl after every refresh of the display.
+ *
+ * @param drv The display driver.
+ * @param time The time spent refreshing, in milliseconds.
+ * @param px The number of pixels refreshed.
+ */
+static void tk_disp_monitor_cb(lv_disp_drv_t *drv, uint32_t time, uint32_t px) {
+  (void)drv;
+  (void)px;
+
+  tk_metric_observe(&frame_time_metric, time);
+  TK_TRACE_INSTANT(TK_TRACE_FRAME, time);
+  tk_power_frame();
+
+  if (main_view_shown && !first_frame_done) {
+    first_frame_done = true;
+    tk_boot_mark("first frame");
+    tk_metric_set(&boot_first_frame_metric, esp_timer_get_time() / 1000);
+    tkos_ready();
+  }
+}
+
+/**
+ * @brief Brings up the services the first frame does not need, on the other
+ * core.
+ *
+ * @param arg Unused.
+ */
+static void tkos_services_task(void *arg) {
+  (void)arg;
 
-  // Settings
+  // Settings (BLE keeps its bonds in NVS, so this comes first)
   nv_init();
+  tk_boot_mark("nvs");
   nv_load_apply_settings();
+  tk_boot_mark("settings");
 
-  // Drivers which require prior initialization
+  // BLE has a separate host task on core 0, and starts Wi-Fi on request
+  wifi_init();
   tk_ble_init();
+  tk_boot_mark("ble");
+
+  tk_console_start();
+  tk_boot_mark("console");
+
+  tk_metric_set(&boot_ready_metric, esp_timer_get_time() / 1000);
+  tk_ui_post(tkos_services_ready, NULL, 0);
+
+  vTaskDelete(NULL);
+}
+
+/**
+ * @brief Initializes tkos and creates the refresh task
+ *
+ */
+void tkos_init(void) {
+  ESP_LOGI(TAG, "Initializing TKOS.");
+
+  // Metrics
+  tk_metrics_register(&frame_time_metric);
+  tk_metrics_register(&refresh_count_metric);
+  tk_metrics_register(&boot_first_frame_metric);
+  tk_metrics_register(&boot_ready_metric);
+  tk_metrics_register(&gui_wakeups_metric);
+  tk_metrics_register(&gui_busy_metric);
+  tk_sampler_init();
+  tk_model_samples_init();
+
+  // Until the stored settings arrive, must not overwrite them
+  nv_load_defaults();
+
+  // Settings and BLE in parallel, on the other core
+  xTaskCreatePinnedToCore(tkos_services_task, "tkos_init", 4096, NULL, 5, NULL,
+                          xPortGetCoreID() == 0 ? 1 : 0);
+
+  // Backlight and theme, needed by the first frame
   hmi_brightness_init(&(global_datastore.brightness_settings));
+  tk_boot_mark("brightness");
 
-  // Tasks (BLE has a separate task on core 0)
-  lv_task_create(refresher_task, 20, LV_TASK_PRIO_MID, NULL);
-  lv_task_create(brightness_task, 100, LV_TASK_PRIO_MID, NULL);
+  // Tasks
+  tk_refresh_init();
+}
+
+// The longest the GUI task sleeps, and how long input stays at the lvgl rate
+#define TK_GUI_IDLE_MS 1000
+#define TK_GUI_INPUT_IDLE_MS 1000
+
+static TaskHandle_t gui_task_handle = NULL;
+static volatile bool input_event = false;
+static volatile int64_t input_time_us = 0;
+
+static portMUX_TYPE tick_mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t tick_last_ms = 0;
+
+/**
+ * @brief Brings the lvgl tick up to date with the system clock.
+ *
+ */
+static void tk_gui_tick_sync(void) {
+  portENTER_CRITICAL(&tick_mux);
+  int64_t now = esp_timer_get_time() / 1000;
+  uint32_t elapsed = now - tick_last_ms;
+  tick_last_ms = now;
+  if (elapsed > 0)
+    lv_tick_inc(elapsed);
+  portEXIT_CRITICAL(&tick_mux);
 }
 
 /**
- * @brief The lvgl tick task.
+ * @brief The lvgl tick task, only running while the GUI task is awake.
  *
  * @param arg Unused.
  */
 static void lv_tick_task(void *arg) {
   (void)arg;
 
-  lv_tick_inc(LV_TICK_PERIOD_MS);
+  tk_gui_tick_sync();
 }
 
-// Creates a semaphore to handle concurrent call to lvgl stuff
-// If you wish to call *any* lvgl function from other threads/tasks
-// you should lock on the very same semaphore!
-SemaphoreHandle_t xGuiSemaphore;
+void IRAM_ATTR tk_gui_wake(void) {
+  if (gui_task_handle == NULL)
+    return;
+
+  if (xPortInIsrContext()) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(gui_task_handle, &woken);
+    if (woken) {
+      portYIELD_FROM_ISR();
+    }
+  } else {
+    xTaskNotifyGive(gui_task_handle);
+  }
+}
+
+void IRAM_ATTR tk_gui_wake_input(void) {
+  // The first of a burst, for the wake latency
+  if (!input_event)
+    input_time_us = esp_timer_get_time();
+  input_event = true;
+  tk_gui_wake();
+}
+
+/**
+ * @brief Sets how often lvgl reads an input device.
+ *
+ */
+static void tk_gui_set_read_period(lv_indev_t *indev, uint32_t period) {
+  if (indev->driver.read_task->period != period)
+    lv_task_set_period(indev->driver.read_task, period);
+}
 
 /**
  * @brief The starting point for tkos. The main task for UI-related jobs.
@@ -78,12 +259,18 @@ SemaphoreHandle_t xGuiSemaphore;
 void guiTask(void *pvParameter) {
 
   (void)pvParameter;
-  xGuiSemaphore = xSemaphoreCreateMutex();
+  gui_task_handle = xTaskGetCurrentTaskHandle();
+  tk_ui_jobs_init();
+  tk_log_init();
+  tk_boot_mark("gui task");
 
   lv_init();
+  tk_assets_init();
+  tk_boot_mark("assets");
 
   /* Initialize SPI or I2C bus used by the drivers */
   lvgl_driver_init();
+  tk_boot_mark("display driver");
 
   static lv_color_t buf1[DISP_BUF_SIZE];
   static lv_disp_buf_t disp_buf;
@@ -96,11 +283,18 @@ void guiTask(void *pvParameter) {
   lv_disp_drv_t disp_drv;
   lv_disp_drv_init(&disp_drv);
   disp_drv.flush_cb = disp_driver_flush;
+  disp_drv.monitor_cb = tk_disp_monitor_cb;
 
   disp_drv.buffer = &disp_buf;
-  lv_disp_drv_register(&disp_drv);
+  lv_disp_t *disp = lv_disp_drv_register(&disp_drv);
 
-  // Show boot screen
+  // Show boot screen, straight from flash until the main view is drawn
+  tk_splash_show(disp);
+  hmi_backlight_init();
+  tk_boot_mark("splash");
+
+  // Render, flush and invalidation statistics from the first real frame
+  tk_frame_stats_init(disp);
 
   // ISR install
   ESP_ERROR_CHECK(gpio_install_isr_service(0));
@@ -123,11 +317,13 @@ void guiTask(void *pvParameter) {
 
   static const lv_point_t points_array[] = {{20, 300}, {460, 300}};
   lv_indev_set_button_points(buttons_indev, points_array);
+  tk_boot_mark("input");
 
   const esp_timer_create_args_t periodic_timer_args = {
       .callback = &lv_tick_task, .name = "periodic_gui"};
 
   esp_timer_handle_t periodic_timer;
+  tick_last_ms = esp_timer_get_time() / 1000;
   ESP_ERROR_CHECK(esp_timer_create(&periodic_timer_args, &periodic_timer));
   ESP_ERROR_CHECK(
       esp_timer_start_periodic(periodic_timer, LV_TICK_PERIOD_MS * 1000));
@@ -135,14 +331,86 @@ void guiTask(void *pvParameter) {
   // GUI Start
   tkos_init();
   view_navigate(build_main_view, true);
+  main_view_shown = true;
+  tk_boot_mark("main view");
+
+  // Refresh rate, backlight and sleep follow the activity from now on
+  tk_power_init();
+
+  // Frames and input reads are readied by the loop, these only catch misses
+  lv_task_set_period(disp->refr_task, TK_GUI_IDLE_MS);
+  uint32_t last_input = lv_tick_get();
+  uint32_t busy_us = 0;
 
   while (1) {
-    vTaskDelay(1);
-    // Try to lock the semaphore, if success, call lvgl stuff
-    if (xSemaphoreTake(xGuiSemaphore, (TickType_t)10) == pdTRUE) {
-      lv_task_handler();
-      xSemaphoreGive(xGuiSemaphore);
+    tk_gui_tick_sync();
+
+    // Input devices at the lvgl rate while in use, idle otherwise
+    if (__atomic_exchange_n(&input_event, false, __ATOMIC_ACQ_REL)) {
+      last_input = lv_tick_get();
+      tk_power_input(input_time_us);
+      tk_gui_set_read_period(encoder_indev, LV_INDEV_DEF_READ_PERIOD);
+      tk_gui_set_read_period(buttons_indev, LV_INDEV_DEF_READ_PERIOD);
+      lv_task_ready(encoder_indev->driver.read_task);
+      lv_task_ready(buttons_indev->driver.read_task);
+    } else if (lv_tick_elaps(last_input) > TK_GUI_INPUT_IDLE_MS &&
+               buttons_indev->proc.state != LV_INDEV_STATE_PR) {
+      // A held button is still read, for long presses
+      tk_gui_set_read_period(encoder_indev, TK_GUI_IDLE_MS);
+      tk_gui_set_read_period(buttons_indev, TK_GUI_IDLE_MS);
+    }
+
+    int64_t handler_start = esp_timer_get_time();
+
+    // Work from other tasks, the only way they touch lvgl
+    TK_TRACE_BEGIN(TK_TRACE_UI_JOBS, 0);
+    uint32_t jobs = tk_ui_jobs_run();
+    TK_TRACE_END(TK_TRACE_UI_JOBS, jobs);
+
+    // Bluetooth samples, in one batch and one refresh
+    tk_model_update();
+
+    uint32_t wait = tk_refresh_service();
+    uint32_t power_next = tk_power_service();
+    if (power_next < wait)
+      wait = power_next;
+
+    TK_TRACE_BEGIN(TK_TRACE_GUI_HANDLER, 0);
+    uint32_t next = lv_task_handler();
+    TK_TRACE_END(TK_TRACE_GUI_HANDLER, 0);
+    if (next < wait)
+      wait = next;
+
+    // A frame as soon as something is invalidated, at most at the lvgl rate
+    if (disp->inv_p > 0) {
+      uint32_t since = lv_tick_elaps(disp->refr_task->last_run);
+      if (since >= LV_DISP_DEF_REFR_PERIOD) {
+        lv_task_ready(disp->refr_task);
+        wait = 0;
+      } else if (LV_DISP_DEF_REFR_PERIOD - since < wait) {
+        wait = LV_DISP_DEF_REFR_PERIOD - since;
+      }
     }
+
+    busy_us += esp_timer_get_time() - handler_start;
+    tk_metric_add(&gui_busy_metric, busy_us / 1000);
+    busy_us %= 1000;
+
+    if (wait == 0)
+      continue;
+    if (wait > TK_GUI_IDLE_MS)
+      wait = TK_GUI_IDLE_MS;
+
+    // Sleeps until then or until woken, the tick catches up on wake
+    esp_timer_stop(periodic_timer);
+    tk_power_sleep(disp->inv_p > 0);
+    TK_TRACE_BEGIN(TK_TRACE_GUI_SLEEP, wait);
+    ulTaskNotifyTake(pdTRUE,
+                     (wait + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+    TK_TRACE_END(TK_TRACE_GUI_SLEEP, 0);
+    tk_power_wake();
+    tk_metric_inc(&gui_wakeups_metric);
+    esp_timer_start_periodic(periodic_timer, LV_TICK_PERIOD_MS * 1000);
   }
 
   // A task should NEVER return
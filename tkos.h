@@ -17,6 +17,21 @@ lv_indev_t *encoder_indev;
 
 // Prototypes
 
+/**
+ * @brief Wakes the GUI task, which sleeps until lvgl has work due. Call it
+ * after anything the GUI should react to. Can be called from any task or ISR.
+ * 
+ */
+void tk_gui_wake(void);
+
+/**
+ * @brief Wakes the GUI task for an input event: the input devices are read
+ * right away, then at the lvgl rate until they are idle again. Can be called
+ * from any task or ISR.
+ * 
+ */
+void tk_gui_wake_input(void);
+
 /**
  * @brief The starting point for tkos. The main task for UI-related jobs.
  * 
@@ -0,0 +1,29 @@
+/*
+ * Host build of the float case of diag/bench.c.
+ *
+ *     cc -O2 -I. tools/float_bench.c -o float_bench && ./float_bench
+ *
+ * A desktop FPU runs double as fast as float, so the host numbers only show
+ * that the kernel is the same work in both types. The saving is on the target,
+ * where double is emulated: run `bench float` on the serial console.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "diag/bench.c"
+
+int main(int argc, char **argv) {
+  const tk_bench_case_t *bench = tk_bench_find("float");
+  tk_bench_result_t result;
+
+  tk_bench_run(bench, argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000,
+               &result);
+  printf("%u %s, per run: %s %u.%u %s, %s %u.%u %s\n", result.runs,
+         bench->run_name, result.values[0].name,
+         result.values[0].value_x10 / 10, result.values[0].value_x10 % 10,
+         result.values[0].unit, result.values[1].name,
+         result.values[1].value_x10 / 10, result.values[1].value_x10 % 10,
+         result.values[1].unit);
+  return 0;
+}
@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""Boot splash generator for the commander.
+
+Renders the splash at build time, compresses it and writes a C source that
+the firmware blits before LVGL is up:
+
+    tools/gen_splash.py --output splash_image.c [--image art.ppm]
+
+Without --image the splash is drawn procedurally: a dashboard arc on the dark
+background. Every run decodes the result again and fails on any mismatch, and
+
+    tools/gen_splash.py --decode splash_image.c --ppm out.ppm
+
+decodes an already generated source, to check it or to look at it.
+
+Pixels are RGB565, row-major, little endian. The stream is a sequence of
+packets, each starting with a header byte h:
+    h < 0x80   h + 1 literal pixels follow;
+    h >= 0x80  the next pixel is repeated (h & 0x7f) + 1 times.
+Packets may cross rows. Only the standard library is used.
+"""
+
+import argparse
+import math
+import re
+import sys
+
+BACKGROUND = (8, 8, 8)          # tk_get_themed_far_background_color(false)
+ORANGE = (0xfa, 0x82, 0x31)     # TK_COLOR_ORANGE_DARK
+TRACK = (0x20, 0x20, 0x20)
+MAX_PACKET = 128
+SUPERSAMPLING = 4
+
+
+def rgb565(rgb):
+    r, g, b = rgb
+    return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3)
+
+
+def rgb888(pixel):
+    r = (pixel >> 11) & 0x1f
+    g = (pixel >> 5) & 0x3f
+    b = pixel & 0x1f
+    return (r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2)
+
+
+def mix(a, b, alpha):
+    return tuple(round(x * (1 - alpha) + y * alpha) for x, y in zip(a, b))
+
+
+def render(width, height):
+    """A 270 degree gauge arc, partially lit, centred on the panel."""
+    cx, cy = width / 2, height / 2
+    outer = min(width, height) * 0.36
+    inner = outer - min(width, height) * 0.05
+    start, sweep, lit = 135.0, 270.0, 0.7
+
+    pixels = []
+    for y in range(height):
+        for x in range(width):
+            # Most of the panel is plain background, skip the sampling there
+            d = math.hypot(x + 0.5 - cx, y + 0.5 - cy)
+            if d < inner - 2 or d > outer + 2:
+                pixels.append(rgb565(BACKGROUND))
+                continue
+
+            track = arc = 0
+            for sy in range(SUPERSAMPLING):
+                for sx in range(SUPERSAMPLING):
+                    px = x + (sx + 0.5) / SUPERSAMPLING - cx
+                    py = y + (sy + 0.5) / SUPERSAMPLING - cy
+                    if not inner <= math.hypot(px, py) <= outer:
+                        continue
+                    angle = (math.degrees(math.atan2(py, px)) - start) % 360
+                    if angle <= sweep * lit:
+                        arc += 1
+                    elif angle <= sweep:
+                        track += 1
+
+            samples = SUPERSAMPLING * SUPERSAMPLING
+            color = mix(BACKGROUND, TRACK, track / samples)
+            color = mix(color, ORANGE, arc / samples)
+            pixels.append(rgb565(color))
+    return pixels
+
+
+def load_ppm(path, width, height):
+    with open(path, "rb") as f:
+        data = f.read()
+    fields = re.match(rb"P6\s+(?:#.*\s+)*(\d+)\s+(\d+)\s+(\d+)\s", data)
+    if fields is None:
+        raise SystemExit(f"{path}: not a binary PPM")
+    w, h, maxval = (int(v) for v in fields.groups())
+    if (w, h) != (width, height) or maxval != 255:
+        raise SystemExit(f"{path}: expected {width}x{height}, 8 bit")
+    raw = data[fields.end():]
+    return [rgb565(raw[i:i + 3]) for i in range(0, w * h * 3, 3)]
+
+
+def encode(pixels):
+    out = bytearray()
+    literals = []
+
+    def flush_literals():
+        while literals:
+            chunk = literals[:MAX_PACKET]
+            del literals[:MAX_PACKET]
+            out.append(len(chunk) - 1)
+            for p in chunk:
+                out.extend(p.to_bytes(2, "little"))
+
+    i = 0
+    while i < len(pixels):
+        run = 1
+        while (i + run < len(pixels) and run < MAX_PACKET
+               and pixels[i + run] == pixels[i]):
+            run += 1
+        if run > 1:
+            flush_literals()
+            out.append(0x80 | (run - 1))
+            out += pixels[i].to_bytes(2, "little")
+        else:
+            literals.append(pixels[i])
+        i += run
+    flush_literals()
+    return bytes(out)
+
+
+def decode(data, count):
+    """Mirror of the firmware decoder, same bounds checks."""
+    pixels = []
+    i = 0
+    while len(pixels) < count:
+        if i + 3 > len(data):
+            raise ValueError(f"stream ends at pixel {len(pixels)}")
+        header = data[i]
+        i += 1
+        n = (header & 0x7f) + 1
+        if len(pixels) + n > count:
+            raise ValueError(f"packet at byte {i - 1} overflows the image")
+        if header & 0x80:
+            pixels += [int.from_bytes(data[i:i + 2], "little")] * n
+            i += 2
+        else:
+            if i + 2 * n > len(data):
+                raise ValueError(f"literal at byte {i - 1} is truncated")
+            pixels += [int.from_bytes(data[i + 2 * k:i + 2 * k + 2], "little")
+                       for k in range(n)]
+            i += 2 * n
+    if i != len(data):
+        raise ValueError(f"{len(data) - i} trailing bytes")
+    return pixels
+
+
+def emit_c(path, width, height, data):
+    with open(path, "w") as f:
+        f.write("// Generated by tools/gen_splash.py, do not edit.\n\n")
+        f.write("#include <stdint.h>\n\n")
+        f.write(f"const uint16_t tk_splash_width = {width};\n")
+        f.write(f"const uint16_t tk_splash_height = {height};\n")
+        f.write(f"const uint32_t tk_splash_rle_size = {len(data)};\n\n")
+        f.write("const uint8_t tk_splash_rle[] = {\n")
+        for i in range(0, len(data), 16):
+            row = ", ".join(f"0x{b:02x}" for b in data[i:i + 16])
+            f.write(f"    {row},\n")
+        f.write("};\n")
+
+
+def parse_c(path):
+    with open(path) as f:
+        text = f.read()
+    width = int(re.search(r"tk_splash_width = (\d+);", text).group(1))
+    height = int(re.search(r"tk_splash_height = (\d+);", text).group(1))
+    size = int(re.search(r"tk_splash_rle_size = (\d+);", text).group(1))
+    body = text[text.index("tk_splash_rle[] = {"):]
+    data = bytes(int(v, 16) for v in re.findall(r"0x([0-9a-f]{2})", body))
+    if len(data) != size:
+        raise SystemExit(f"{path}: {len(data)} bytes, header says {size}")
+    return width, height, data
+
+
+def write_ppm(path, width, height, pixels):
+    with open(path, "wb") as f:
+        f.write(f"P6\n{width} {height}\n255\n".encode())
+        f.write(bytes(c for p in pixels for c in rgb888(p)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--output", help="C source to generate")
+    parser.add_argument("--image", help="binary PPM to use instead of the "
+                        "procedural splash")
+    parser.add_argument("--width", type=int, default=480)
+    parser.add_argument("--height", type=int, default=320)
+    parser.add_argument("--decode", metavar="SOURCE",
+                        help="decode a generated source instead")
+    parser.add_argument("--ppm", help="also write the decoded image here")
+    args = parser.parse_args()
+
+    if args.decode:
+        width, height, data = parse_c(args.decode)
+        try:
+            pixels = decode(data, width * height)
+        except ValueError as e:
+            raise SystemExit(f"{args.decode}: {e}")
+        print(f"{args.decode}: {width}x{height}, {len(data)} bytes, decodes")
+    else:
+        if not args.output:
+            parser.error("--output or --decode is required")
+        width, height = args.width, args.height
+        if args.image:
+            pixels = load_ppm(args.image, width, height)
+        else:
+            pixels = render(width, height)
+        data = encode(pixels)
+        if decode(data, width * height) != pixels:
+            raise SystemExit("round trip mismatch")
+        emit_c(args.output, width, height, data)
+        print(f"splash {width}x{height}: {width * height * 2} -> "
+              f"{len(data)} bytes")
+
+    if args.ppm:
+        write_ppm(args.ppm, width, height, pixels)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Stand-in update server for the OTA download mode.
+
+Serves one image with range support, so resumed downloads can be exercised:
+
+    tools/ota_pull_server.py build/commander.bin [--port 8000] [--drop-after 300000]
+
+Then write http://<laptop address>:8000/commander.bin to the update URL
+characteristic. With --drop-after, every response is cut after that many bytes,
+forcing the device to resume with a range request. With --port 0 a free port
+is picked, and printed on the first line.
+"""
+
+import argparse
+import http.server
+import os
+import re
+
+
+def make_handler(image_path, drop_after):
+    with open(image_path, "rb") as f:
+        image = f.read()
+    name = "/" + os.path.basename(image_path)
+
+    class Handler(http.server.BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def do_GET(self):
+            if self.path != name:
+                self.send_error(404)
+                return
+
+            start = 0
+            status = 200
+            match = re.fullmatch(r"bytes=(\d+)-", self.headers.get("Range", ""))
+            if match:
+                start = int(match.group(1))
+                if start >= len(image):
+                    self.send_error(416)
+                    return
+                status = 206
+
+            body = image[start:]
+            self.send_response(status)
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Content-Length", str(len(body)))
+            if status == 206:
+                self.send_header("Content-Range",
+                                 f"bytes {start}-{len(image) - 1}/{len(image)}")
+            self.end_headers()
+
+            if drop_after and len(body) > drop_after:
+                self.wfile.write(body[:drop_after])
+                self.log_message("dropped after %d bytes", drop_after)
+                self.close_connection = True
+                return
+
+            self.wfile.write(body)
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("image")
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--drop-after", type=int, default=0,
+                        help="cut every response after this many bytes")
+    args = parser.parse_args()
+
+    handler = make_handler(args.image, args.drop_after)
+    server = http.server.ThreadingHTTPServer(("", args.port), handler)
+    print(f"serving {args.image} on port {server.server_address[1]}",
+          flush=True)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,337 @@
+#!/usr/bin/env python3
+"""Asset image packer for the commander's asset partition.
+
+Packs lv_font_conv C sources into the binary image the firmware maps from
+its asset partition (ui/assets/assets.c), so that fonts are flashed and
+updated apart from the app:
+
+    tools/pack_assets.py --output assets.bin [--version V] [--max-size N] \\
+        build/fonts/nunito_bold_36.c ui/fonts/icons.c
+
+Each font is named after its lv_font_t in the source. Without --version the
+image is versioned with the start of its hash. Every run unpacks the image
+again and fails on any mismatch, and
+
+    tools/pack_assets.py --dump assets.bin
+
+lists an existing image.
+
+Little endian throughout, every offset 4 byte aligned. The image starts with
+a 64 byte header: magic "TKAS", u16 format, u16 entries, u32 image length,
+the SHA-256 of everything after the header, and a 20 byte version string.
+32 byte entries follow: a 20 byte name, u32 type (1: font), u32 offset from
+the image start and u32 length. A font is a 36 byte header (see FONT), then
+the arrays it points to by offsets from its start: the glyph bitmaps, the
+glyph descriptors laid out as lv_font_fmt_txt_glyph_dsc_t, 20 byte character
+maps (see CMAP) with their lists, and class kerning (see KERN) with its maps
+and values. Only the standard library is used.
+"""
+
+import argparse
+import hashlib
+import re
+import struct
+import sys
+
+MAGIC = b"TKAS"
+FORMAT = 1
+TYPE_FONT = 1
+
+HEADER = struct.Struct("<4sHHI32s20s")
+ENTRY = struct.Struct("<20sIII")
+
+# line_height, base_line, subpx, bpp, bitmap_format, kern_classes,
+# kern_scale, cmap_num, glyph_count, then the offsets: bitmap (and its
+# length), glyph descriptors, character maps, kerning (0 for none)
+FONT = struct.Struct("<hhBBBBHHIIIIII")
+
+# range_start, range_length, glyph_id_start, list_length, type, then the
+# offsets of unicode_list and glyph_id_ofs_list (0 for none)
+CMAP = struct.Struct("<IHHHBxII")
+
+# left_class_cnt, right_class_cnt, then the offsets of the values, the left
+# class map and the right class map
+KERN = struct.Struct("<BBxxIII")
+
+# bitmap_index : 20, adv_w : 12, box_w, box_h, ofs_x, ofs_y
+GLYPH = struct.Struct("<IBBbb")
+
+CMAP_TYPES = {
+    "LV_FONT_FMT_TXT_CMAP_FORMAT0_FULL": 0,
+    "LV_FONT_FMT_TXT_CMAP_SPARSE_FULL": 1,
+    "LV_FONT_FMT_TXT_CMAP_FORMAT0_TINY": 2,
+    "LV_FONT_FMT_TXT_CMAP_SPARSE_TINY": 3,
+}
+SUBPX = {"LV_FONT_SUBPX_NONE": 0, "LV_FONT_SUBPX_HOR": 1,
+         "LV_FONT_SUBPX_VER": 2, "LV_FONT_SUBPX_BOTH": 3}
+
+
+def align(data):
+    return data + bytes(-len(data) % 4)
+
+
+class Font:
+    """An lv_font_conv font, as the fields the image stores."""
+
+    def __init__(self):
+        self.name = ""
+        self.line_height = self.base_line = self.subpx = 0
+        self.bpp = self.bitmap_format = self.kern_scale = 0
+        self.bitmap = b""
+        self.glyphs = []
+        self.cmaps = []
+        self.kern = None
+
+    def key(self):
+        return (self.name, self.line_height, self.base_line, self.subpx,
+                self.bpp, self.bitmap_format, self.kern_scale, self.bitmap,
+                self.glyphs, self.cmaps, self.kern)
+
+    @classmethod
+    def parse(cls, path):
+        with open(path, encoding="utf-8") as f:
+            text = f.read()
+        font = cls()
+
+        def field(name, default=None):
+            match = re.search(rf"\.{name}\s*=\s*([-&\w]+)", text)
+            if match is None:
+                if default is None:
+                    raise SystemExit(f"{path}: no .{name}")
+                return default
+            return match.group(1)
+
+        def array(name):
+            match = re.search(rf"\b{name}\[\]\s*=\s*\{{(.*?)\}};", text,
+                              re.DOTALL)
+            if match is None:
+                raise SystemExit(f"{path}: no {name}[]")
+            body = re.sub(r"/\*.*?\*/", "", match.group(1), flags=re.DOTALL)
+            return [int(n, 0) for n in re.findall(r"-?(?:0x)?[0-9a-fA-F]+",
+                                                  body)]
+
+        match = re.search(r"^lv_font_t\s+(\w+)\s*=", text, re.MULTILINE)
+        if match is None:
+            raise SystemExit(f"{path}: no public lv_font_t")
+        font.name = match.group(1)
+        if len(font.name.encode()) >= ENTRY.size - 12:
+            raise SystemExit(f"{path}: font name {font.name} is too long")
+
+        font.line_height = int(field("line_height"))
+        font.base_line = int(field("base_line"))
+        font.subpx = SUBPX[field("subpx", "LV_FONT_SUBPX_NONE")]
+        font.bpp = int(field("bpp"))
+        font.bitmap_format = int(field("bitmap_format", "0"))
+        font.kern_scale = int(field("kern_scale", "0"))
+
+        font.bitmap = bytes(array("gylph_bitmap"))
+        font.glyphs = [tuple(int(v) for v in g) for g in re.findall(
+            r"\{\.bitmap_index = (\d+), \.adv_w = (\d+), \.box_w = (\d+), "
+            r"\.box_h = (\d+), \.ofs_x = (-?\d+), \.ofs_y = (-?\d+)\}", text)]
+
+        for entry in re.findall(r"\{\s*(\.range_start.*?)\}", text,
+                                re.DOTALL):
+            values = dict(re.findall(r"\.(\w+) = (\w+)", entry))
+            unicode_list = values["unicode_list"]
+            ofs_list = values["glyph_id_ofs_list"]
+            font.cmaps.append((
+                int(values["range_start"]), int(values["range_length"]),
+                int(values["glyph_id_start"]), int(values["list_length"]),
+                CMAP_TYPES[values["type"]],
+                tuple(array(unicode_list)) if unicode_list != "NULL" else None,
+                tuple(array(ofs_list)) if ofs_list != "NULL" else None))
+        if len(font.cmaps) != int(field("cmap_num")):
+            raise SystemExit(f"{path}: character maps do not match cmap_num")
+
+        kern = field("kern_dsc")
+        if kern != "NULL":
+            if field("kern_classes") != "1":
+                raise SystemExit(f"{path}: only class kerning is supported")
+            font.kern = (int(field("left_class_cnt")),
+                         int(field("right_class_cnt")),
+                         bytes(v & 0xff for v in array("kern_class_values")),
+                         bytes(array("kern_left_class_mapping")),
+                         bytes(array("kern_right_class_mapping")))
+
+        font.check(path)
+        return font
+
+    def check(self, where):
+        """The bounds the firmware checks too, caught here first."""
+        for index, adv_w, box_w, box_h, _, _ in self.glyphs:
+            if index >= 1 << 20 or adv_w >= 1 << 12:
+                raise SystemExit(f"{where}: glyph fields out of range")
+            if box_w * box_h and index >= len(self.bitmap):
+                raise SystemExit(f"{where}: glyph bitmap out of range")
+        for start, length, first, count, kind, _, _ in self.cmaps:
+            last = first + (count if kind & 1 else length)
+            if last > len(self.glyphs):
+                raise SystemExit(f"{where}: map at U+{start:04X} points "
+                                 "past the glyphs")
+        if self.kern:
+            left, right, values, left_map, right_map = self.kern
+            if (len(values) != left * right or
+                    len(left_map) != len(self.glyphs) or
+                    len(right_map) != len(self.glyphs)):
+                raise SystemExit(f"{where}: kerning class sizes")
+
+    def pack(self):
+        blob = bytearray(FONT.size)
+
+        def put(data):
+            nonlocal blob
+            offset = len(blob)
+            blob += align(data)
+            return offset
+
+        bitmap = put(self.bitmap)
+        glyphs = put(b"".join(GLYPH.pack(i | a << 20, w, h, x, y)
+                              for i, a, w, h, x, y in self.glyphs))
+
+        records = []
+        for start, length, first, count, kind, unicode_list, ofs_list in \
+                self.cmaps:
+            lists = []
+            for values, wide in ((unicode_list, True), (ofs_list, kind == 1)):
+                if values is None:
+                    lists.append(0)
+                else:
+                    fmt = "<%dH" if wide else "<%dB"
+                    lists.append(put(struct.pack(fmt % len(values), *values)))
+            records.append(CMAP.pack(start, length, first, count, kind,
+                                     *lists))
+        cmaps = put(b"".join(records))
+
+        kern = 0
+        if self.kern:
+            left, right, values, left_map, right_map = self.kern
+            offsets = [put(values), put(left_map), put(right_map)]
+            kern = put(KERN.pack(left, right, *offsets))
+
+        FONT.pack_into(blob, 0, self.line_height, self.base_line, self.subpx,
+                       self.bpp, self.bitmap_format, int(self.kern is not None),
+                       self.kern_scale, len(self.cmaps), len(self.glyphs),
+                       bitmap, len(self.bitmap), glyphs, cmaps, kern)
+        return bytes(blob)
+
+    @classmethod
+    def unpack(cls, name, blob):
+        font = cls()
+        font.name = name
+        (font.line_height, font.base_line, font.subpx, font.bpp,
+         font.bitmap_format, kerned, font.kern_scale, cmap_num, glyph_count,
+         bitmap, bitmap_len, glyphs, cmaps, kern) = FONT.unpack_from(blob)
+
+        font.bitmap = blob[bitmap:bitmap + bitmap_len]
+        for i in range(glyph_count):
+            word, w, h, x, y = GLYPH.unpack_from(blob, glyphs + i * GLYPH.size)
+            font.glyphs.append((word & 0xfffff, word >> 20, w, h, x, y))
+
+        for i in range(cmap_num):
+            (start, length, first, count, kind, unicode_list,
+             ofs_list) = CMAP.unpack_from(blob, cmaps + i * CMAP.size)
+            lists = []
+            for offset, fmt, n in (
+                    (unicode_list, "<%dH", count),
+                    (ofs_list, "<%dH" if kind == 1 else "<%dB",
+                     count if kind == 1 else length)):
+                lists.append(struct.unpack_from(fmt % n, blob, offset)
+                             if offset else None)
+            font.cmaps.append((start, length, first, count, kind, *lists))
+
+        if kerned:
+            left, right, values, left_map, right_map = KERN.unpack_from(blob,
+                                                                        kern)
+            font.kern = (left, right, blob[values:values + left * right],
+                         blob[left_map:left_map + glyph_count],
+                         blob[right_map:right_map + glyph_count])
+        return font
+
+
+def pack(fonts, version):
+    body = bytearray(HEADER.size + ENTRY.size * len(fonts))
+    for i, font in enumerate(fonts):
+        offset = len(body)
+        blob = font.pack()
+        body += blob
+        ENTRY.pack_into(body, HEADER.size + i * ENTRY.size,
+                        font.name.encode(), TYPE_FONT, offset, len(blob))
+
+    digest = hashlib.sha256(body[HEADER.size:]).digest()
+    if version is None:
+        version = digest.hex()[:8]
+    if len(version.encode()) >= 20:
+        raise SystemExit(f"version {version} is too long")
+    HEADER.pack_into(body, 0, MAGIC, FORMAT, len(fonts), len(body), digest,
+                     version.encode())
+    return bytes(body)
+
+
+def unpack(image):
+    magic, fmt, count, length, digest, version = HEADER.unpack_from(image)
+    if magic != MAGIC or fmt != FORMAT:
+        raise SystemExit(f"not a format {FORMAT} asset image")
+    if length != len(image):
+        raise SystemExit(f"image is {len(image)} bytes, header says {length}")
+    if hashlib.sha256(image[HEADER.size:]).digest() != digest:
+        raise SystemExit("image hash mismatch")
+
+    fonts = []
+    for i in range(count):
+        name, kind, offset, size = ENTRY.unpack_from(
+            image, HEADER.size + i * ENTRY.size)
+        if kind != TYPE_FONT:
+            raise SystemExit(f"entry {i} has unknown type {kind}")
+        fonts.append(Font.unpack(name.rstrip(b"\0").decode(),
+                                 image[offset:offset + size]))
+    return version.rstrip(b"\0").decode(), fonts
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--output", help="image to write")
+    parser.add_argument("--version", help="version string, 19 bytes at most")
+    parser.add_argument("--max-size", type=lambda s: int(s, 0),
+                        help="size of the asset partition")
+    parser.add_argument("--dump", metavar="IMAGE",
+                        help="list an existing image instead")
+    parser.add_argument("fonts", nargs="*", help="lv_font_conv C sources")
+    args = parser.parse_args()
+
+    if args.dump:
+        with open(args.dump, "rb") as f:
+            version, fonts = unpack(f.read())
+        print(f"version {version}")
+        for font in fonts:
+            print(f"{font.name}: {len(font.glyphs) - 1} glyphs, "
+                  f"{len(font.bitmap)} bitmap bytes")
+        return 0
+
+    if not args.output or not args.fonts:
+        parser.error("--output and at least one font are required")
+
+    fonts = [Font.parse(path) for path in args.fonts]
+    names = [font.name for font in fonts]
+    if len(set(names)) != len(names):
+        raise SystemExit("two fonts have the same name")
+
+    image = pack(fonts, args.version)
+    if args.max_size is not None and len(image) > args.max_size:
+        raise SystemExit(f"image is {len(image)} bytes, the partition "
+                         f"{args.max_size}")
+
+    # The check runs on the bytes, not on what was meant to be packed
+    version, unpacked = unpack(image)
+    for font, back in zip(fonts, unpacked):
+        if font.key() != back.key():
+            raise SystemExit(f"{font.name} does not survive the round trip")
+
+    with open(args.output, "wb") as f:
+        f.write(image)
+    print(f"{args.output}: {len(fonts)} fonts, {len(image)} bytes, "
+          f"version {version}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
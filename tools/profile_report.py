@@ -0,0 +1,238 @@
+#!/usr/bin/env python3
+"""Symbolizes a commander profiler dump into a flat profile and a flame graph.
+
+Profile a screen with one of:
+
+    prof start [hz]  ...  prof dump                  (serial console)
+    curl 'http://192.168.1.1/profile?action=start&hz=500'
+    curl -o profile.bin http://192.168.1.1/profile   (soft AP on)
+
+then run
+
+    tools/profile_report.py profile.bin build/commander.elf --task GUI \\
+        --collapsed gui.folded
+
+The flat profile is printed. The collapsed stacks go to flamegraph.pl, or
+can be opened as they are in https://www.speedscope.app. Serial logs are
+accepted as they are, the base64 between the markers is extracted.
+Symbols come from nm, or from addr2line with --lines. The toolchain is
+found in PATH, or set with --prefix.
+
+Dump format, little endian:
+    header    u32 magic "TKPF", u16 version, u16 sample size, u8 cores,
+              u8 frames per sample, u8 tasks, u8 task name length,
+              u32 rate (per core), u32 samples in the dump,
+              u32 samples taken, u64 time of the dump (us since boot)
+    tasks     per task: u32 handle, name (task name length, NUL padded)
+    samples   oldest first: u32 task handle, u8 core, u8 frames used,
+              u16 reserved, then the frames: the interrupted PC and the
+              return addresses of its callers, outermost last
+Only the standard library is used.
+"""
+
+import argparse
+import base64
+import bisect
+import collections
+import re
+import struct
+import subprocess
+import sys
+
+MAGIC = 0x46504B54
+HEADER = struct.Struct("<IHHBBBBIIIQ")
+SAMPLE = struct.Struct("<IBBH")
+EM_XTENSA = 94
+
+
+def extract(data):
+    """Returns the binary dump, from a raw dump or a serial log."""
+    if data[:4] == struct.pack("<I", MAGIC):
+        return data
+
+    text = data.decode(errors="replace")
+    blocks = re.findall(
+        r"---- tk profile begin ----(.*?)---- tk profile end ----", text, re.S)
+    if not blocks:
+        raise SystemExit("no profile dump found")
+
+    # The last dump of the log, without the log prefixes on each line
+    lines = re.findall(r"([A-Za-z0-9+/=]+)\s*$", blocks[-1], re.M)
+    return base64.b64decode("".join(lines))
+
+
+def parse(dump):
+    (magic, version, sample_size, cores, depth, tasks, name_len, hz, count,
+     total, now_us) = HEADER.unpack_from(dump)
+    if (magic != MAGIC or version != 1
+            or sample_size != SAMPLE.size + 4 * depth):
+        raise SystemExit(f"unsupported dump (version {version})")
+    pos = HEADER.size
+
+    task_names = {}
+    for _ in range(tasks):
+        (handle,) = struct.unpack_from("<I", dump, pos)
+        name = dump[pos + 4:pos + 4 + name_len].split(b"\0")[0].decode()
+        task_names[handle] = name
+        pos += 4 + name_len
+
+    samples = []
+    for _ in range(count):
+        task, core, used, _ = SAMPLE.unpack_from(dump, pos)
+        frames = struct.unpack_from(f"<{depth}I", dump, pos + SAMPLE.size)
+        samples.append((task, core, frames[:used]))
+        pos += sample_size
+
+    return task_names, samples, hz, total
+
+
+def is_xtensa(elf):
+    with open(elf, "rb") as f:
+        header = f.read(20)
+    if header[:4] != b"\x7fELF":
+        raise SystemExit(f"{elf} is not an ELF file")
+    return struct.unpack_from("<H", header, 18)[0] == EM_XTENSA
+
+
+def return_address(addr, xtensa):
+    """The call instruction of a return address found on the stack."""
+    if xtensa:
+        # The top two bits hold the window increment of the call
+        addr = (addr & 0x3FFFFFFF) | 0x40000000
+        return addr - 3
+    return addr - 1
+
+
+class Symbols:
+    """Function names by address, from nm or addr2line."""
+
+    def __init__(self, elf, prefix, lines):
+        self.elf = elf
+        self.prefix = prefix
+        self.lines = lines
+        self.cache = {}
+
+        out = self.run("nm", ["-n", "-S", "-C", "--defined-only", elf])
+        self.starts, self.ends, self.names = [], [], []
+        for line in out.splitlines():
+            parts = line.split(None, 3)
+            if len(parts) != 4 or parts[2] not in "tTwW":
+                continue
+            start, size = int(parts[0], 16), int(parts[1], 16)
+            self.starts.append(start)
+            self.ends.append(start + size)
+            self.names.append(parts[3])
+
+    def run(self, tool, args):
+        command = [self.prefix + tool] + args
+        try:
+            return subprocess.run(command, check=True, capture_output=True,
+                                  text=True).stdout
+        except FileNotFoundError:
+            raise SystemExit(f"{command[0]} not found, set --prefix")
+
+    def resolve(self, addrs):
+        """Fills the cache for a set of addresses."""
+        missing = sorted(set(addrs) - self.cache.keys())
+        if self.lines and missing:
+            out = self.run("addr2line", ["-f", "-C", "-e", self.elf] +
+                           [hex(a) for a in missing])
+            rows = out.splitlines()
+            for i, addr in enumerate(missing):
+                function, where = rows[2 * i], rows[2 * i + 1]
+                where = where.rsplit("/", 1)[-1].split(" ")[0]
+                self.cache[addr] = (f"{function} ({where})"
+                                    if function != "??" else f"{addr:#x}")
+            return
+
+        for addr in missing:
+            i = bisect.bisect_right(self.starts, addr) - 1
+            if i >= 0 and addr < self.ends[i]:
+                self.cache[addr] = self.names[i]
+            else:
+                self.cache[addr] = f"{addr:#x}"
+
+    def __getitem__(self, addr):
+        return self.cache[addr]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", help="binary dump or serial log, - for stdin")
+    parser.add_argument("elf", help="the firmware ELF of the dumped build")
+    parser.add_argument("--prefix", default="xtensa-esp32-elf-",
+                        help="toolchain prefix, empty for the host tools")
+    parser.add_argument("--lines", action="store_true",
+                        help="symbolize with addr2line, with file and line")
+    parser.add_argument("--task", action="append",
+                        help="only these tasks, by name")
+    parser.add_argument("--core", type=int, help="only this core")
+    parser.add_argument("--top", type=int, default=30,
+                        help="functions in the flat profile")
+    parser.add_argument("--collapsed",
+                        help="write collapsed stacks here, - for stdout")
+    args = parser.parse_args()
+
+    if args.dump == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.dump, "rb") as f:
+            data = f.read()
+
+    task_names, samples, hz, total = parse(extract(data))
+    xtensa = is_xtensa(args.elf)
+
+    def task_name(handle):
+        return task_names.get(handle, f"task {handle:#x}")
+
+    samples = [s for s in samples
+               if (args.core is None or s[1] == args.core)
+               and (not args.task or task_name(s[0]) in args.task)]
+    if not samples:
+        raise SystemExit("no samples left after filtering")
+
+    # The interrupted PC as it is, the callers at their call instruction
+    stacks = [(task_name(task), [frames[0]] +
+               [return_address(a, xtensa) for a in frames[1:]])
+              for task, _, frames in samples]
+
+    symbols = Symbols(args.elf, args.prefix, args.lines)
+    symbols.resolve(a for _, frames in stacks for a in frames)
+
+    self_count = collections.Counter()
+    total_count = collections.Counter()
+    task_count = collections.Counter()
+    folded = collections.Counter()
+
+    for task, frames in stacks:
+        names = [symbols[a] for a in frames]
+        task_count[task] += 1
+        self_count[names[0]] += 1
+        for name in set(names):
+            total_count[name] += 1
+        folded[";".join([task] + names[::-1])] += 1
+
+    n = len(stacks)
+    print(f"{n} samples at {hz} Hz per core, {total} taken since the start\n")
+
+    print(f"{'Task':<16} {'Samples':>8} {'Share':>7}")
+    for task, count in task_count.most_common():
+        print(f"{task:<16} {count:>8} {100 * count / n:>6.1f}%")
+
+    print(f"\n{'Self':>7} {'Total':>7} {'Samples':>8}  Function")
+    for name, count in self_count.most_common(args.top):
+        print(f"{100 * count / n:>6.1f}% {100 * total_count[name] / n:>6.1f}% "
+              f"{count:>8}  {name}")
+
+    if args.collapsed:
+        out = (sys.stdout if args.collapsed == "-"
+               else open(args.collapsed, "w"))
+        for stack, count in sorted(folded.items()):
+            out.write(f"{stack} {count}\n")
+        if out is not sys.stdout:
+            out.close()
+            print(f"\nCollapsed stacks -> {args.collapsed}")
+
+
+if __name__ == "__main__":
+    main()
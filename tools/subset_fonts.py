@@ -0,0 +1,355 @@
+#!/usr/bin/env python3
+"""Font subsetter for the commander's generated LVGL fonts.
+
+Scans the component sources for the characters the UI can show and writes a
+copy of each lv_font_conv font with only those glyphs:
+
+    tools/subset_fonts.py --sources . --output-dir build/fonts \\
+        [--symbols lvgl/src/lv_font/lv_symbol_def.h] ui/fonts/nunito_bold_36.c
+
+Kept: printable ASCII, for text made at runtime (numbers, names, versions);
+every character in a string literal of a .c or .h file; the LV_SYMBOL_*
+glyphs the sources name, resolved with --symbols. Without --symbols every
+private use glyph is kept. Private use characters written as literals belong
+to the icon fonts and are not looked for here.
+
+Fails if a character the sources use is missing from a font, naming where it
+is used, and checks every subset it writes against the characters required.
+The glyph bitmaps are compressed one by one, so they are copied as they are;
+only the glyph ids, character maps and kerning class maps are rebuilt. Only
+the standard library is used.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+ASCII = set(range(0x20, 0x7f))
+PRIVATE_USE = range(0xe000, 0xf900)
+
+# A sparse map holds offsets from its start in 16 bits
+SPARSE_SPAN = 0x10000
+
+# Runs shorter than this go to the sparse map
+MIN_RANGE = 3
+
+TOKENS = re.compile(r'//[^\n]*|/\*.*?\*/|"(?:\\.|[^"\\\n])*"'
+                    r"|'(?:\\.|[^'\\\n])*'|\bLV_SYMBOL_[A-Z0-9_]+\b",
+                    re.DOTALL)
+ESCAPE = re.compile(rb'\\(x[0-9a-fA-F]+|[0-7]{1,3}|.)', re.DOTALL)
+SIMPLE_ESCAPES = {b"n": 10, b"t": 9, b"r": 13, b"a": 7, b"b": 8, b"f": 12,
+                  b"v": 11, b"e": 27}
+
+SKIPPED_DIRS = {"tools", "test", "build"}
+FONT_SOURCE = re.compile(r"nunito_bold_\d+\.c$")
+
+
+def unescape(literal):
+    """Bytes of a C string literal body."""
+    def replace(match):
+        esc = match.group(1)
+        if esc[:1] == b"x":
+            return bytes([int(esc[1:], 16) & 0xff])
+        if esc[0] in b"01234567":
+            return bytes([int(esc, 8) & 0xff])
+        return bytes([SIMPLE_ESCAPES.get(esc, esc[0])])
+    return ESCAPE.sub(replace, literal)
+
+
+def scan_sources(root):
+    """Characters in string literals and LV_SYMBOL names, with a place each."""
+    chars, symbols = {}, {}
+    for dirpath, dirnames, filenames in os.walk(root):
+        dirnames[:] = [d for d in dirnames
+                       if d not in SKIPPED_DIRS and not d.startswith(".")]
+        for name in sorted(filenames):
+            if not name.endswith((".c", ".h")) or FONT_SOURCE.search(name):
+                continue
+            path = os.path.join(dirpath, name)
+            with open(path, encoding="utf-8", errors="replace") as f:
+                text = f.read()
+            rel = os.path.relpath(path, root)
+            for match in TOKENS.finditer(text):
+                token = match.group(0)
+                where = f"{rel}:{text.count(chr(10), 0, match.start()) + 1}"
+                if token.startswith("LV_SYMBOL_"):
+                    symbols.setdefault(token, where)
+                elif token.startswith('"'):
+                    body = unescape(token[1:-1].encode("utf-8"))
+                    for ch in body.decode("utf-8", errors="ignore"):
+                        chars.setdefault(ord(ch), where)
+    return chars, symbols
+
+
+def read_symbols(path):
+    """LV_SYMBOL_* name to code point, from lv_symbol_def.h."""
+    symbols = {}
+    with open(path, encoding="utf-8") as f:
+        for match in re.finditer(r'#define\s+(LV_SYMBOL_\w+)\s+"([^"]*)"',
+                                 f.read()):
+            text = unescape(match.group(2).encode()).decode("utf-8", "ignore")
+            if len(text) == 1:
+                symbols[match.group(1)] = ord(text)
+    return symbols
+
+
+class Font:
+    """The parts of an lv_font_conv source that depend on glyph ids."""
+
+    def __init__(self, path):
+        self.path = path
+        with open(path, encoding="utf-8") as f:
+            self.text = f.read()
+
+        body = self.section(r"gylph_bitmap\[\] = \{")
+        marks = list(re.finditer(r'/\* U\+([0-9A-F]+) .*?\*/', body))
+        self.codepoints = [int(m.group(1), 16) for m in marks]
+        self.bitmaps = []
+        for i, mark in enumerate(marks):
+            end = marks[i + 1].start() if i + 1 < len(marks) else len(body)
+            self.bitmaps.append([int(b, 16) for b in
+                                 re.findall(r"0x[0-9a-f]+",
+                                            body[mark.end():end])])
+
+        self.glyphs = [dict((k, int(v)) for k, v in
+                            re.findall(r"\.(\w+) = (-?\d+)", entry))
+                       for entry in re.findall(r"\{(\.bitmap_index.*?)\}",
+                                               self.section(
+                                                   r"glyph_dsc\[\] = \{"))]
+        self.left = self.numbers(r"kern_left_class_mapping\[\] =\s*\{")
+        self.right = self.numbers(r"kern_right_class_mapping\[\] =\s*\{")
+
+        if "kern_classes = 1" not in self.text:
+            raise ValueError("only class kerning is supported")
+        if len(self.glyphs) != len(self.codepoints) + 1:
+            raise ValueError(f"{len(self.codepoints)} bitmaps for "
+                             f"{len(self.glyphs) - 1} glyphs")
+        offset = 0
+        for glyph, bitmap in zip(self.glyphs[1:], self.bitmaps):
+            if glyph["bitmap_index"] != offset and bitmap:
+                raise ValueError("bitmaps are not in glyph order")
+            offset += len(bitmap)
+        for mapping in (self.left, self.right):
+            if len(mapping) != len(self.glyphs):
+                raise ValueError("kerning class map length")
+
+        self.ids = {cp: i + 1 for i, cp in enumerate(self.codepoints)}
+
+    def cmaps(self):
+        """(start, length, first glyph id, offsets, type) per character map."""
+        lists = {name: [int(o, 16) for o in re.findall(r"0x[0-9a-f]+", body)]
+                 for name, body in re.findall(
+                     r"static const uint16_t (unicode_list_\d+)\[\] = "
+                     r"\{(.*?)\};", self.text, re.DOTALL)}
+        return [(int(m.group(1)), int(m.group(2)), int(m.group(3)),
+                 lists.get(m.group(4)), m.group(5)) for m in re.finditer(
+                     r"\.range_start = (\d+), \.range_length = (\d+), "
+                     r"\.glyph_id_start = (\d+),\s*\.unicode_list = (\w+),"
+                     r".*?\.type = (\w+)", self.text, re.DOTALL)]
+
+    def lookup(self, cp):
+        """The glyph id lvgl finds for a code point, 0 if none."""
+        for start, length, first, offsets, kind in self.cmaps():
+            # As lvgl: unsigned, and compared with > rather than >=
+            rcp = cp - start
+            if rcp < 0 or rcp > length:
+                continue
+            if kind == "LV_FONT_FMT_TXT_CMAP_FORMAT0_TINY":
+                return first + rcp
+            if kind == "LV_FONT_FMT_TXT_CMAP_SPARSE_TINY":
+                return first + offsets.index(rcp) if rcp in offsets else 0
+            raise ValueError(f"unsupported character map {kind}")
+        return 0
+
+    def same_glyph(self, glyph_id, other, other_id):
+        """Whether a glyph draws and kerns the same in another font."""
+        def fields(font, gid):
+            dsc = dict(font.glyphs[gid], bitmap_index=None)
+            return (dsc, font.bitmaps[gid - 1], font.left[gid],
+                    font.right[gid])
+        return fields(self, glyph_id) == fields(other, other_id)
+
+    def section(self, start):
+        """The body of the array opening with start."""
+        match = re.search(start, self.text)
+        if match is None:
+            raise ValueError(f"no {start}")
+        return self.text[match.end():self.text.index("};", match.end())]
+
+    def numbers(self, start):
+        return [int(n) for n in re.findall(r"-?\d+", self.section(start))]
+
+    def replace(self, text, start, body):
+        match = re.search(start, text)
+        end = text.index("};", match.end())
+        return text[:match.end()] + body + text[end:]
+
+    def subset(self, keep):
+        """The source text with only the code points in keep."""
+        cps = sorted(cp for cp in self.codepoints if cp in keep)
+
+        # Runs become ranges, the rest one sparse map per 64k span
+        runs, run = [], []
+        for cp in cps:
+            if run and cp != run[-1] + 1:
+                runs.append(run)
+                run = []
+            run.append(cp)
+        if run:
+            runs.append(run)
+        ranges = [r for r in runs if len(r) >= MIN_RANGE]
+        singles = [cp for r in runs if len(r) < MIN_RANGE for cp in r]
+        sparse = []
+        for cp in singles:
+            if not sparse or cp - sparse[-1][0] >= SPARSE_SPAN:
+                sparse.append([])
+            sparse[-1].append(cp)
+
+        order = [cp for r in ranges for cp in r] + singles
+        text = self.text
+
+        lines, offset, glyph_lines = [], 0, [
+            "    {.bitmap_index = 0, .adv_w = 0, .box_w = 0, .box_h = 0, "
+            ".ofs_x = 0, .ofs_y = 0} /* id = 0 reserved */"]
+        for cp in order:
+            old = self.ids[cp]
+            bitmap = self.bitmaps[old - 1]
+            ch = chr(cp) if cp >= 0x20 and cp not in (0x22, 0x5c) else ""
+            lines.append(f'    /* U+{cp:X} "{ch}" */')
+            for i in range(0, len(bitmap), 8):
+                lines.append("    " + ", ".join(f"0x{b:x}" for b in
+                                                bitmap[i:i + 8]) + ",")
+            lines.append("")
+            glyph = dict(self.glyphs[old], bitmap_index=offset)
+            glyph_lines.append("    {" + ", ".join(
+                f".{k} = {glyph[k]}" for k in
+                ("bitmap_index", "adv_w", "box_w", "box_h", "ofs_x",
+                 "ofs_y")) + "}")
+            offset += len(bitmap)
+        text = self.replace(text, r"gylph_bitmap\[\] = \{",
+                            "\n" + "\n".join(lines) + "\n")
+        text = self.replace(text, r"glyph_dsc\[\] = \{",
+                            "\n" + ",\n".join(glyph_lines) + "\n")
+
+        # Ranges come first: lvgl takes the first map whose span has the
+        # letter, and a sparse span can overlap them
+        maps, lists, next_id = [], [], 1
+        for r in ranges:
+            maps.append(f"        .range_start = {r[0]}, .range_length = "
+                        f"{len(r)}, .glyph_id_start = {next_id},\n        "
+                        ".unicode_list = NULL, .glyph_id_ofs_list = NULL, "
+                        ".list_length = 0, .type = "
+                        "LV_FONT_FMT_TXT_CMAP_FORMAT0_TINY")
+            next_id += len(r)
+        for group in sparse:
+            name = f"unicode_list_{len(maps)}"
+            offsets = [cp - group[0] for cp in group]
+            lists.append(f"static const uint16_t {name}[] = {{\n" + ",\n".join(
+                "    " + ", ".join(f"0x{o:x}" for o in offsets[i:i + 8])
+                for i in range(0, len(offsets), 8)) + "\n};\n")
+            maps.append(f"        .range_start = {group[0]}, .range_length = "
+                        f"{group[-1] - group[0] + 1}, .glyph_id_start = "
+                        f"{next_id},\n        .unicode_list = {name}, "
+                        ".glyph_id_ofs_list = NULL, .list_length = "
+                        f"{len(group)}, .type = "
+                        "LV_FONT_FMT_TXT_CMAP_SPARSE_TINY")
+            next_id += len(group)
+        start = text.index("*/\n", text.index("CHARACTER MAPPING")) + 4
+        end = text.index("};", text.index("cmaps[] =")) + 2
+        text = (text[:start] + "\n".join(lists) + ("\n" if lists else "") +
+                "/*Collect the unicode lists and glyph_id offsets*/\n"
+                "static const lv_font_fmt_txt_cmap_t cmaps[] =\n{\n" +
+                ",\n".join("    {\n" + m + "\n    }" for m in maps) +
+                "\n};" + text[end:])
+        text = re.sub(r"\.cmap_num = \d+", f".cmap_num = {len(maps)}", text)
+
+        for start, mapping in ((r"kern_left_class_mapping\[\] =\s*\{",
+                                self.left),
+                               (r"kern_right_class_mapping\[\] =\s*\{",
+                                self.right)):
+            values = [0] + [mapping[self.ids[cp]] for cp in order]
+            text = self.replace(text, start, "\n" + ",\n".join(
+                "    " + ", ".join(str(v) for v in values[i:i + 8])
+                for i in range(0, len(values), 8)) + "\n")
+
+        text = text.replace(
+            " * Opts: ",
+            f" * Subset: {len(order)} of {len(self.codepoints)} glyphs, by "
+            "tools/subset_fonts.py\n * Opts: ", 1)
+        return text, len(order), offset
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--sources", required=True,
+                        help="component directory to scan")
+    parser.add_argument("--output-dir", required=True)
+    parser.add_argument("--symbols", help="lvgl's lv_symbol_def.h")
+    parser.add_argument("--keep", default="",
+                        help="more characters to keep in every font")
+    parser.add_argument("fonts", nargs="+", help="lv_font_conv C sources")
+    args = parser.parse_args()
+
+    chars, used_symbols = scan_sources(args.sources)
+    required = {cp: where for cp, where in chars.items()
+                if cp >= 0x20 and cp not in PRIVATE_USE}
+    for cp in ASCII:
+        required.setdefault(cp, "printable ASCII")
+    for ch in args.keep:
+        required.setdefault(ord(ch), "--keep")
+
+    keep_private_use = args.symbols is None
+    if args.symbols:
+        known = read_symbols(args.symbols)
+        for name, where in used_symbols.items():
+            if name not in known:
+                raise SystemExit(f"{where}: {name} is not in {args.symbols}")
+            required.setdefault(known[name], f"{where} ({name})")
+
+    os.makedirs(args.output_dir, exist_ok=True)
+    failed = False
+    for path in args.fonts:
+        try:
+            font = Font(path)
+        except ValueError as e:
+            raise SystemExit(f"{path}: {e}")
+
+        for cp in font.ids:
+            if font.lookup(cp) != font.ids[cp]:
+                raise SystemExit(f"{path}: the character maps and the bitmap "
+                                 f"comments disagree on U+{cp:04X}")
+
+        missing = sorted(cp for cp in required if cp not in font.ids)
+        for cp in missing:
+            print(f"{required[cp]}: U+{cp:04X} {chr(cp)!r} is not in "
+                  f"{os.path.basename(path)}", file=sys.stderr)
+            failed = True
+
+        keep = set(required)
+        if keep_private_use:
+            keep |= {cp for cp in font.codepoints if cp in PRIVATE_USE}
+        text, glyphs, size = font.subset(keep)
+
+        out = os.path.join(args.output_dir, os.path.basename(path))
+        with open(out, "w", encoding="utf-8") as f:
+            f.write(text)
+        # The check looks glyphs up in what was written, as lvgl will
+        check = Font(out)
+        for cp in sorted(keep & font.ids.keys()):
+            glyph_id = check.lookup(cp)
+            if not glyph_id or not check.same_glyph(glyph_id, font,
+                                                    font.ids[cp]):
+                raise SystemExit(f"{out}: U+{cp:04X} is wrong in the subset")
+
+        print(f"{os.path.basename(path)}: {glyphs} of "
+              f"{len(font.codepoints)} glyphs, "
+              f"{sum(map(len, font.bitmaps))} -> {size} bitmap bytes")
+
+    if failed:
+        raise SystemExit("characters used by the sources are missing from "
+                         "the fonts")
+
+
+if __name__ == "__main__":
+    sys.exit(main())
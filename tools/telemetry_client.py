@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Live telemetry client for the commander.
+
+Connect the laptop to the commander soft AP, then run:
+
+    tools/telemetry_client.py [--host 192.168.1.1] [--csv out.csv]
+
+Frames are deltas; they are merged into the current state and printed as one
+line per frame. Only the standard library is used.
+"""
+
+import argparse
+import base64
+import csv
+import json
+import os
+import socket
+import struct
+import sys
+
+
+def handshake(sock, host, path):
+    key = base64.b64encode(os.urandom(16)).decode()
+    request = (
+        f"GET {path} HTTP/1.1\r\n"
+        f"Host: {host}\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        f"Sec-WebSocket-Key: {key}\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n"
+    )
+    sock.sendall(request.encode())
+
+    response = b""
+    while b"\r\n\r\n" not in response:
+        chunk = sock.recv(1024)
+        if not chunk:
+            raise ConnectionError("connection closed during handshake")
+        response += chunk
+
+    status = response.split(b"\r\n", 1)[0]
+    if b" 101 " not in status:
+        raise ConnectionError(f"handshake refused: {status.decode()}")
+
+
+def recv_exact(sock, n):
+    data = b""
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise ConnectionError("connection closed")
+        data += chunk
+    return data
+
+
+def recv_frame(sock):
+    b0, b1 = recv_exact(sock, 2)
+    opcode = b0 & 0x0F
+    length = b1 & 0x7F
+    if length == 126:
+        (length,) = struct.unpack(">H", recv_exact(sock, 2))
+    elif length == 127:
+        (length,) = struct.unpack(">Q", recv_exact(sock, 8))
+    return opcode, recv_exact(sock, length)
+
+
+def send_text(sock, text):
+    # Client frames must be masked
+    payload = text.encode()
+    mask = os.urandom(4)
+    masked = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+    sock.sendall(bytes([0x81, 0x80 | len(payload)]) + mask + masked)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="192.168.1.1")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--csv", help="also append every state to this file")
+    args = parser.parse_args()
+
+    sock = socket.create_connection((args.host, args.port), timeout=10)
+    handshake(sock, args.host, "/telemetry")
+    sock.settimeout(None)
+
+    state = {}
+    last_seq = None
+    writer = None
+    out = None
+
+    try:
+        while True:
+            opcode, payload = recv_frame(sock)
+            if opcode == 0x8:
+                print("closed by the commander")
+                return
+            if opcode != 0x1:
+                continue
+
+            frame = json.loads(payload)
+            if frame["full"]:
+                state = {}
+            elif last_seq is not None and frame["seq"] != last_seq + 1:
+                # Should not happen, the commander resyncs skipped clients
+                print(f"gap before seq {frame['seq']}, asking for a full frame",
+                      file=sys.stderr)
+                send_text(sock, "full")
+            last_seq = frame["seq"]
+            state.update(frame["d"])
+
+            print(f"{frame['t']:>10} ms  " +
+                  "  ".join(f"{k}={v}" for k, v in sorted(state.items())))
+
+            if args.csv:
+                if writer is None:
+                    out = open(args.csv, "a", newline="")
+                    writer = csv.writer(out)
+                    keys = sorted(state)
+                    writer.writerow(["t_ms"] + keys)
+                writer.writerow([frame["t"]] + [state.get(k) for k in keys])
+                out.flush()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if out is not None:
+            out.close()
+        sock.close()
+
+
+if __name__ == "__main__":
+    main()
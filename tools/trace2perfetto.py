@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""Converts a commander trace dump into a Chrome trace for Perfetto.
+
+Get a dump with one of:
+
+    curl -o trace.bin http://192.168.1.1/trace      (soft AP on)
+    the `trace` console command, saved in a serial log
+    the BLE diagnostics service: write a little endian u32 offset to the trace
+    characteristic, read a chunk, repeat from offset + chunk until it is empty
+
+then run
+
+    tools/trace2perfetto.py trace.bin -o trace.json
+
+and open trace.json in https://ui.perfetto.dev or chrome://tracing. Serial logs
+are accepted as they are, the base64 between the markers is extracted.
+
+Dump format, little endian:
+    header    u32 magic "TKTR", u16 version, u16 record size, u8 cores,
+              u8 events, u8 tasks, u8 task name length, u32 ring size,
+              u64 time of the dump (us since boot)
+    events    per event id: u8 length, name
+    tasks     per task: u32 handle, name (task name length, NUL padded)
+    rings     per core: u32 count, then count records oldest first:
+              u32 time (low 32 bits of the us since boot), u16 event,
+              u8 type (begin, end, instant, counter), u8 flags (1: ISR),
+              u32 task handle, u32 argument
+Only the standard library is used.
+"""
+
+import argparse
+import base64
+import json
+import re
+import struct
+import sys
+
+MAGIC = 0x52544B54
+HEADER = struct.Struct("<IHHBBBBIQ")
+RECORD = struct.Struct("<IHBBII")
+BEGIN, END, INSTANT, COUNTER = range(4)
+FLAG_ISR = 0x01
+
+
+def extract(data):
+    """Returns the binary dump, from a raw dump or a serial log."""
+    if data[:4] == struct.pack("<I", MAGIC):
+        return data
+
+    text = data.decode(errors="replace")
+    blocks = re.findall(r"---- tk trace begin ----(.*?)---- tk trace end ----",
+                        text, re.S)
+    if not blocks:
+        raise SystemExit("no trace dump found")
+
+    # The last dump of the log, without the log prefixes on each line
+    lines = re.findall(r"([A-Za-z0-9+/=]+)\s*$", blocks[-1], re.M)
+    return base64.b64decode("".join(lines))
+
+
+def parse(dump):
+    (magic, version, record_size, cores, events, tasks, name_len, ring_size,
+     now_us) = HEADER.unpack_from(dump)
+    if magic != MAGIC or version != 1 or record_size != RECORD.size:
+        raise SystemExit(f"unsupported dump (version {version})")
+    pos = HEADER.size
+
+    event_names = []
+    for _ in range(events):
+        n = dump[pos]
+        event_names.append(dump[pos + 1:pos + 1 + n].decode())
+        pos += 1 + n
+
+    task_names = {}
+    for _ in range(tasks):
+        (handle,) = struct.unpack_from("<I", dump, pos)
+        name = dump[pos + 4:pos + 4 + name_len].split(b"\0")[0].decode()
+        task_names[handle] = name
+        pos += 4 + name_len
+
+    # Records carry the low 32 bits, counted back from the dump time
+    now_low = now_us & 0xFFFFFFFF
+    records = []
+    for core in range(cores):
+        (count,) = struct.unpack_from("<I", dump, pos)
+        pos += 4
+        for _ in range(count):
+            time, event, kind, flags, task, arg = RECORD.unpack_from(dump, pos)
+            pos += RECORD.size
+            ts = now_us - ((now_low - time) & 0xFFFFFFFF)
+            records.append((ts, core, event, kind, flags, task, arg))
+
+    records.sort(key=lambda r: r[0])
+    return event_names, task_names, records, ring_size
+
+
+def to_chrome(event_names, task_names, records):
+    trace = []
+    threads = {}
+
+    def tid_for(core, flags, task):
+        key = ("isr", core) if flags & FLAG_ISR else ("task", task)
+        if key not in threads:
+            tid = len(threads) + 1
+            if flags & FLAG_ISR:
+                name = f"ISR core {core}"
+            else:
+                name = task_names.get(task, f"task {task:#x}")
+            threads[key] = tid
+            trace.append({"ph": "M", "pid": 1, "tid": tid,
+                          "name": "thread_name", "args": {"name": name}})
+        return threads[key]
+
+    for ts, core, event, kind, flags, task, arg in records:
+        name = (event_names[event] if event < len(event_names)
+                else f"event {event}")
+        tid = tid_for(core, flags, task)
+        base = {"pid": 1, "tid": tid, "ts": ts, "name": name}
+
+        if kind == BEGIN:
+            trace.append(dict(base, ph="B", args={"arg": arg, "core": core}))
+        elif kind == END:
+            trace.append(dict(base, ph="E", args={"result": arg}))
+        elif kind == INSTANT:
+            trace.append(dict(base, ph="i", s="t",
+                              args={"arg": arg, "core": core}))
+        elif kind == COUNTER:
+            trace.append(dict(base, ph="C", args={name: arg}))
+
+    trace.insert(0, {"ph": "M", "pid": 1, "name": "process_name",
+                     "args": {"name": "commander"}})
+    return {"traceEvents": trace, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", help="binary dump or serial log, - for stdin")
+    parser.add_argument("-o", "--output", default="trace.json")
+    args = parser.parse_args()
+
+    if args.dump == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.dump, "rb") as f:
+            data = f.read()
+
+    event_names, task_names, records, ring_size = parse(extract(data))
+    with open(args.output, "w") as f:
+        json.dump(to_chrome(event_names, task_names, records), f)
+
+    span = (records[-1][0] - records[0][0]) / 1000 if records else 0
+    print(f"{len(records)} records over {span:.1f} ms "
+          f"({ring_size} per core) -> {args.output}")
+
+
+if __name__ == "__main__":
+    main()
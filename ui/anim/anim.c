@@ -0,0 +1,104 @@
+/**
+ * @file anim.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Gauges that follow the model estimates frame by frame.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "ui/anim/anim.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "Animator"
+
+typedef struct {
+  lv_obj_t *gauge;
+  tk_model_sample_kind_t kind;
+  const bool *available;
+  float threshold;
+  float scale;
+} tk_anim_gauge_t;
+
+static tk_anim_gauge_t gauges[TK_ANIM_GAUGES];
+static lv_task_t *anim_task = NULL;
+
+/**
+ * @brief One animation frame: gauge values from the estimates at this time.
+ *
+ */
+static void tk_anim_update(lv_task_t *task) {
+  // Samples are stamped with the same clock
+  uint32_t now_ms = esp_timer_get_time() / 1000;
+  bool settled = true;
+
+  for (int i = 0; i < TK_ANIM_GAUGES; i++) {
+    tk_anim_gauge_t *binding = &gauges[i];
+    if (binding->gauge == NULL)
+      continue;
+
+    int16_t min = tk_gauge_get_min_value(binding->gauge);
+    int16_t max = tk_gauge_get_max_value(binding->gauge);
+    int32_t value = min;
+
+    if (*binding->available) {
+      float estimate = tk_model_estimate(binding->kind, now_ms);
+      if (estimate >= binding->threshold)
+        value = (int32_t)(estimate * binding->scale);
+
+      settled &= tk_model_estimate_settled(binding->kind, now_ms);
+    }
+
+    if (value < min)
+      value = min;
+    else if (value > max)
+      value = max;
+
+    // Same value, no invalidation
+    tk_gauge_set_value(binding->gauge, value);
+  }
+
+  if (settled)
+    lv_task_set_prio(task, LV_TASK_PRIO_OFF);
+}
+
+bool tk_anim_bind_gauge(lv_obj_t *gauge, tk_model_sample_kind_t kind,
+                        const bool *available, float threshold, float scale) {
+  if (anim_task == NULL)
+    anim_task = lv_task_create(tk_anim_update, TK_ANIM_PERIOD_MS,
+                               LV_TASK_PRIO_OFF, NULL);
+
+  for (int i = 0; i < TK_ANIM_GAUGES; i++) {
+    if (gauges[i].gauge == NULL) {
+      gauges[i] = (tk_anim_gauge_t){.gauge = gauge,
+                                    .kind = kind,
+                                    .available = available,
+                                    .threshold = threshold,
+                                    .scale = scale};
+      tk_anim_wake();
+      return true;
+    }
+  }
+
+  ESP_LOGW(TAG, "No free binding for a gauge, it will not move.");
+  return false;
+}
+
+void tk_anim_unbind_gauge(lv_obj_t *gauge) {
+  for (int i = 0; i < TK_ANIM_GAUGES; i++) {
+    if (gauges[i].gauge == gauge)
+      gauges[i].gauge = NULL;
+  }
+}
+
+void tk_anim_wake(void) {
+  if (anim_task == NULL)
+    return;
+
+  // The first frame now, with the sample that woke it
+  lv_task_set_prio(anim_task, LV_TASK_PRIO_MID);
+  lv_task_ready(anim_task);
+}
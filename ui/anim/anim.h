@@ -0,0 +1,60 @@
+/**
+ * @file anim.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Gauges that follow the model estimates frame by frame.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ * One lvgl task moves every bound gauge at TK_ANIM_PERIOD_MS while an estimate
+ * is moving, and turns itself off when they are all settled, so an idle
+ * dashboard still lets the GUI task sleep. The global refresh wakes it.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "lvgl/lvgl.h"
+#include "model/samples.h"
+#include "ui/widgets/tk_gauge.h"
+
+/**
+ * @brief Animation frame period, 50 Hz.
+ *
+ */
+#define TK_ANIM_PERIOD_MS 20
+
+/**
+ * @brief Gauges bound at most, over all the views alive. Navigation builds the
+ * new view before deleting the old one.
+ *
+ */
+#define TK_ANIM_GAUGES 4
+
+/**
+ * @brief Makes a gauge show an estimate, as value * scale, or its minimum when
+ * not available or below a threshold. GUI task only.
+ *
+ * @param gauge The gauge, unbound by its view when deleted.
+ * @param kind The estimated sample.
+ * @param available Whether the value is valid, read every frame.
+ * @param threshold Values below this are shown as the minimum.
+ * @param scale Arc units per sample unit.
+ * @return true Bound.
+ * @return false No free binding.
+ */
+bool tk_anim_bind_gauge(lv_obj_t *gauge, tk_model_sample_kind_t kind,
+                        const bool *available, float threshold, float scale);
+
+/**
+ * @brief Forgets a gauge. Call on LV_EVENT_DELETE.
+ *
+ */
+void tk_anim_unbind_gauge(lv_obj_t *gauge);
+
+/**
+ * @brief Resumes the animation task after new samples, call on refresh.
+ *
+ */
+void tk_anim_wake(void);
@@ -0,0 +1,508 @@
+/**
+ * @file assets.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Fonts, from the asset partition or linked into the app.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "ui/assets/assets.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ui/fonts/glyph_cache.h"
+#include "ui/jobs/jobs.h"
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mbedtls/sha256.h"
+#include "sdkconfig.h"
+
+#define TAG "Assets"
+
+#if CONFIG_TK_ASSETS_PARTITION
+
+#if LV_FONT_FMT_TXT_LARGE
+#error "Asset images hold the small glyph descriptors, LV_FONT_FMT_TXT_LARGE 0"
+#endif
+
+_Static_assert(sizeof(tk_assets_header_t) == 64, "Asset image header layout");
+_Static_assert(sizeof(tk_assets_entry_t) == 32, "Asset entry layout");
+_Static_assert(sizeof(lv_font_fmt_txt_glyph_dsc_t) == 8,
+               "Glyph descriptors are used in place from the image");
+
+/**
+ * @brief A font in the image, the offsets are from its start.
+ *
+ */
+typedef struct {
+  int16_t line_height;
+  int16_t base_line;
+  uint8_t subpx;
+  uint8_t bpp;
+  uint8_t bitmap_format;
+  uint8_t kern_classes;
+  uint16_t kern_scale;
+  uint16_t cmap_num;
+  uint32_t glyph_count;
+  uint32_t bitmap_offset;
+  uint32_t bitmap_length;
+  uint32_t glyph_dsc_offset;
+  uint32_t cmaps_offset;
+  uint32_t kern_offset;
+} tk_asset_font_t;
+
+typedef struct {
+  uint32_t range_start;
+  uint16_t range_length;
+  uint16_t glyph_id_start;
+  uint16_t list_length;
+  uint8_t type;
+  uint8_t reserved;
+  uint32_t unicode_list_offset;
+  uint32_t glyph_id_ofs_list_offset;
+} tk_asset_cmap_t;
+
+typedef struct {
+  uint8_t left_class_cnt;
+  uint8_t right_class_cnt;
+  uint16_t reserved;
+  uint32_t values_offset;
+  uint32_t left_map_offset;
+  uint32_t right_map_offset;
+} tk_asset_kern_t;
+
+_Static_assert(sizeof(tk_asset_font_t) == 36, "Asset font layout");
+_Static_assert(sizeof(tk_asset_cmap_t) == 20, "Asset character map layout");
+_Static_assert(sizeof(tk_asset_kern_t) == 16, "Asset kerning layout");
+
+/**
+ * @brief What lvgl writes to or needs pointers in, the rest stays in flash.
+ *
+ */
+typedef struct {
+  lv_font_t font;
+  lv_font_fmt_txt_dsc_t dsc;
+  lv_font_fmt_txt_kern_classes_t kern;
+  lv_font_fmt_txt_cmap_t *cmaps;
+} tk_asset_font_slot_t;
+
+static const char *const font_names[TK_FONT_COUNT] = {
+    [TK_FONT_SMALL] = "nunito_bold_12",
+    [TK_FONT_NORMAL] = "nunito_bold_16",
+    [TK_FONT_SUBTITLE] = "nunito_bold_24",
+    [TK_FONT_TITLE] = "nunito_bold_36",
+    [TK_FONT_ICONS] = "icons_16",
+};
+
+static tk_asset_font_slot_t fonts[TK_FONT_COUNT];
+
+static spi_flash_mmap_handle_t map_handle;
+static bool mapped = false;
+static char version[TK_ASSETS_VERSION_LEN + 1];
+
+static SemaphoreHandle_t released;
+
+static bool tk_assets_within(uint32_t offset, uint64_t size, uint32_t length) {
+  return offset % 4 == 0 && offset <= length && size <= length - offset;
+}
+
+/*
+ * The fallbacks are lvgl's own Montserrat sizes, whichever lv_conf.h enables,
+ * or its default font: never the Nunito fonts, which are not linked in.
+ */
+#if LV_FONT_MONTSERRAT_12
+#define TK_FALLBACK_SMALL &lv_font_montserrat_12
+#else
+#define TK_FALLBACK_SMALL LV_FONT_DEFAULT
+#endif
+
+#if LV_FONT_MONTSERRAT_16
+#define TK_FALLBACK_NORMAL &lv_font_montserrat_16
+#else
+#define TK_FALLBACK_NORMAL LV_FONT_DEFAULT
+#endif
+
+#if LV_FONT_MONTSERRAT_24
+#define TK_FALLBACK_SUBTITLE &lv_font_montserrat_24
+#else
+#define TK_FALLBACK_SUBTITLE LV_FONT_DEFAULT
+#endif
+
+#if LV_FONT_MONTSERRAT_36
+#define TK_FALLBACK_TITLE &lv_font_montserrat_36
+#else
+#define TK_FALLBACK_TITLE LV_FONT_DEFAULT
+#endif
+
+static const lv_font_t *tk_assets_fallback(tk_font_id_t id) {
+  switch (id) {
+  case TK_FONT_SMALL:
+    return TK_FALLBACK_SMALL;
+  case TK_FONT_NORMAL:
+    return TK_FALLBACK_NORMAL;
+  case TK_FONT_SUBTITLE:
+    return TK_FALLBACK_SUBTITLE;
+  case TK_FONT_TITLE:
+    return TK_FALLBACK_TITLE;
+  default:
+    // No icons there, they are left blank
+    return LV_FONT_DEFAULT;
+  }
+}
+
+/**
+ * @brief Points a font at its fallback, in place: styles keep the pointer.
+ *
+ */
+static void tk_assets_use_fallback(tk_font_id_t id) {
+  fonts[id].font = *tk_assets_fallback(id);
+
+  free(fonts[id].cmaps);
+  fonts[id].cmaps = NULL;
+}
+
+/**
+ * @brief Checks the character maps and builds their descriptors.
+ *
+ */
+static bool tk_assets_load_cmaps(tk_asset_font_slot_t *slot,
+                                 const uint8_t *blob, uint32_t length) {
+  const tk_asset_font_t *header = (const tk_asset_font_t *)blob;
+  const tk_asset_cmap_t *records =
+      (const tk_asset_cmap_t *)(blob + header->cmaps_offset);
+
+  slot->cmaps = calloc(header->cmap_num, sizeof(lv_font_fmt_txt_cmap_t));
+  if (slot->cmaps == NULL)
+    return false;
+
+  for (uint32_t i = 0; i < header->cmap_num; i++) {
+    const tk_asset_cmap_t *record = &records[i];
+    lv_font_fmt_txt_cmap_t *cmap = &slot->cmaps[i];
+    bool sparse = record->type == LV_FONT_FMT_TXT_CMAP_SPARSE_FULL ||
+                  record->type == LV_FONT_FMT_TXT_CMAP_SPARSE_TINY;
+    bool full = record->type == LV_FONT_FMT_TXT_CMAP_FORMAT0_FULL ||
+                record->type == LV_FONT_FMT_TXT_CMAP_SPARSE_FULL;
+
+    if (record->type > LV_FONT_FMT_TXT_CMAP_SPARSE_TINY)
+      return false;
+
+    uint32_t ids = sparse ? record->list_length : record->range_length;
+    if (record->glyph_id_start + ids > header->glyph_count)
+      return false;
+
+    if (sparse != (record->unicode_list_offset != 0) ||
+        full != (record->glyph_id_ofs_list_offset != 0))
+      return false;
+
+    if (sparse &&
+        !tk_assets_within(record->unicode_list_offset,
+                          (uint64_t)record->list_length * 2, length))
+      return false;
+
+    // Full maps list glyph id offsets, bytes for ranges, words for lists
+    uint32_t ofs_size = record->type == LV_FONT_FMT_TXT_CMAP_SPARSE_FULL
+                            ? record->list_length * 2
+                            : record->range_length;
+    if (full &&
+        !tk_assets_within(record->glyph_id_ofs_list_offset, ofs_size, length))
+      return false;
+
+    cmap->range_start = record->range_start;
+    cmap->range_length = record->range_length;
+    cmap->glyph_id_start = record->glyph_id_start;
+    cmap->list_length = record->list_length;
+    cmap->type = record->type;
+    cmap->unicode_list =
+        sparse ? (const uint16_t *)(blob + record->unicode_list_offset) : NULL;
+    cmap->glyph_id_ofs_list =
+        full ? blob + record->glyph_id_ofs_list_offset : NULL;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Checks the kerning classes and builds their descriptor.
+ *
+ */
+static bool tk_assets_load_kern(tk_asset_font_slot_t *slot,
+                                const uint8_t *blob, uint32_t length) {
+  const tk_asset_font_t *header = (const tk_asset_font_t *)blob;
+
+  if (!tk_assets_within(header->kern_offset, sizeof(tk_asset_kern_t), length))
+    return false;
+
+  const tk_asset_kern_t *kern =
+      (const tk_asset_kern_t *)(blob + header->kern_offset);
+  if (!tk_assets_within(kern->values_offset,
+                        (uint32_t)kern->left_class_cnt * kern->right_class_cnt,
+                        length) ||
+      !tk_assets_within(kern->left_map_offset, header->glyph_count, length) ||
+      !tk_assets_within(kern->right_map_offset, header->glyph_count, length))
+    return false;
+
+  const uint8_t *left = blob + kern->left_map_offset;
+  const uint8_t *right = blob + kern->right_map_offset;
+  for (uint32_t i = 0; i < header->glyph_count; i++)
+    if (left[i] >= kern->left_class_cnt || right[i] >= kern->right_class_cnt)
+      return false;
+
+  slot->kern.class_pair_values = (const int8_t *)(blob + kern->values_offset);
+  slot->kern.left_class_mapping = left;
+  slot->kern.right_class_mapping = right;
+  slot->kern.left_class_cnt = kern->left_class_cnt;
+  slot->kern.right_class_cnt = kern->right_class_cnt;
+  return true;
+}
+
+/**
+ * @brief Checks a font of the image against its own length, so that a
+ * damaged one cannot make lvgl read outside of it, and sets up its
+ * descriptors.
+ *
+ */
+static bool tk_assets_load_font(tk_asset_font_slot_t *slot,
+                                const uint8_t *blob, uint32_t length) {
+  const tk_asset_font_t *header = (const tk_asset_font_t *)blob;
+
+  if (length < sizeof *header || header->glyph_count == 0)
+    return false;
+
+  if ((header->bpp != 1 && header->bpp != 2 && header->bpp != 4 &&
+       header->bpp != 8) ||
+      header->bitmap_format > 2 || header->subpx > LV_FONT_SUBPX_BOTH)
+    return false;
+
+  if (!tk_assets_within(header->bitmap_offset, header->bitmap_length,
+                        length) ||
+      !tk_assets_within(header->glyph_dsc_offset,
+                        (uint64_t)header->glyph_count *
+                            sizeof(lv_font_fmt_txt_glyph_dsc_t),
+                        length) ||
+      !tk_assets_within(header->cmaps_offset,
+                        (uint64_t)header->cmap_num * sizeof(tk_asset_cmap_t),
+                        length))
+    return false;
+
+  const lv_font_fmt_txt_glyph_dsc_t *glyphs =
+      (const lv_font_fmt_txt_glyph_dsc_t *)(blob + header->glyph_dsc_offset);
+  for (uint32_t i = 0; i < header->glyph_count; i++)
+    if (glyphs[i].box_w * glyphs[i].box_h > 0 &&
+        glyphs[i].bitmap_index >= header->bitmap_length)
+      return false;
+
+  memset(&slot->kern, 0, sizeof slot->kern);
+  if (header->kern_classes && !tk_assets_load_kern(slot, blob, length))
+    return false;
+
+  if (!tk_assets_load_cmaps(slot, blob, length)) {
+    free(slot->cmaps);
+    slot->cmaps = NULL;
+    return false;
+  }
+
+  memset(&slot->dsc, 0, sizeof slot->dsc);
+  slot->dsc.glyph_bitmap = blob + header->bitmap_offset;
+  slot->dsc.glyph_dsc = glyphs;
+  slot->dsc.cmaps = slot->cmaps;
+  slot->dsc.kern_dsc = header->kern_classes ? &slot->kern : NULL;
+  slot->dsc.kern_scale = header->kern_scale;
+  slot->dsc.cmap_num = header->cmap_num;
+  slot->dsc.bpp = header->bpp;
+  slot->dsc.kern_classes = header->kern_classes;
+  slot->dsc.bitmap_format = header->bitmap_format;
+
+  memset(&slot->font, 0, sizeof slot->font);
+  slot->font.get_glyph_dsc = lv_font_get_glyph_dsc_fmt_txt;
+  slot->font.get_glyph_bitmap = lv_font_get_bitmap_fmt_txt;
+  slot->font.line_height = header->line_height;
+  slot->font.base_line = header->base_line;
+  slot->font.subpx = header->subpx;
+  slot->font.dsc = &slot->dsc;
+  return true;
+}
+
+/**
+ * @brief Maps the image, after checking its header and directory.
+ *
+ * @return const uint8_t* The image, or NULL if there is no valid one.
+ */
+static const uint8_t *tk_assets_map(void) {
+  const esp_partition_t *partition =
+      esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                               CONFIG_TK_ASSETS_PARTITION_LABEL);
+  if (partition == NULL) {
+    ESP_LOGE(TAG, "No \"%s\" partition.", CONFIG_TK_ASSETS_PARTITION_LABEL);
+    return NULL;
+  }
+
+  tk_assets_header_t header;
+  if (esp_partition_read(partition, 0, &header, sizeof header) != ESP_OK ||
+      memcmp(header.magic, TK_ASSETS_MAGIC, sizeof header.magic) != 0 ||
+      header.format != TK_ASSETS_FORMAT) {
+    ESP_LOGE(TAG, "No format %d image in the partition.", TK_ASSETS_FORMAT);
+    return NULL;
+  }
+
+  uint64_t directory =
+      sizeof header + (uint64_t)header.count * sizeof(tk_assets_entry_t);
+  if (header.length < directory || header.length > partition->size) {
+    ESP_LOGE(TAG, "Image length %u does not fit.", header.length);
+    return NULL;
+  }
+
+  const void *image;
+  esp_err_t err = esp_partition_mmap(partition, 0, header.length,
+                                     SPI_FLASH_MMAP_DATA, &image, &map_handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Mapping failed: %s.", esp_err_to_name(err));
+    return NULL;
+  }
+
+  const tk_assets_entry_t *entries =
+      (const tk_assets_entry_t *)((const uint8_t *)image + sizeof header);
+  bool valid = true;
+  for (uint32_t i = 0; i < header.count; i++)
+    valid &= tk_assets_within(entries[i].offset, entries[i].length,
+                              header.length);
+
+#if CONFIG_TK_ASSETS_VERIFY
+  uint8_t digest[32];
+  mbedtls_sha256_ret((const uint8_t *)image + sizeof header,
+                     header.length - sizeof header, digest, 0);
+  valid &= memcmp(digest, header.sha256, sizeof digest) == 0;
+#endif
+
+  if (!valid) {
+    ESP_LOGE(TAG, "Image %.*s is damaged.", TK_ASSETS_VERSION_LEN,
+             header.version);
+    spi_flash_munmap(map_handle);
+    return NULL;
+  }
+
+  mapped = true;
+  memcpy(version, header.version, TK_ASSETS_VERSION_LEN);
+  return image;
+}
+
+static const tk_assets_entry_t *tk_assets_find(const uint8_t *image,
+                                               const char *name,
+                                               uint32_t type) {
+  const tk_assets_header_t *header = (const tk_assets_header_t *)image;
+  const tk_assets_entry_t *entries =
+      (const tk_assets_entry_t *)(image + sizeof *header);
+
+  for (uint32_t i = 0; i < header->count; i++)
+    if (entries[i].type == type &&
+        strncmp(entries[i].name, name, sizeof entries[i].name) == 0)
+      return &entries[i];
+
+  return NULL;
+}
+
+void tk_assets_init(void) {
+  released = xSemaphoreCreateBinary();
+
+  for (int id = 0; id < TK_FONT_COUNT; id++)
+    tk_assets_use_fallback(id);
+
+  const uint8_t *image = tk_assets_map();
+  if (image == NULL) {
+    ESP_LOGW(TAG, "Drawing with the fallback fonts.");
+    return;
+  }
+
+  int loaded = 0;
+  for (int id = 0; id < TK_FONT_COUNT; id++) {
+    const tk_assets_entry_t *entry =
+        tk_assets_find(image, font_names[id], TK_ASSET_TYPE_FONT);
+
+    if (entry == NULL ||
+        !tk_assets_load_font(&fonts[id], image + entry->offset, entry->length)) {
+      ESP_LOGE(TAG, "Font %s is missing or damaged, using its fallback.",
+               font_names[id]);
+      tk_assets_use_fallback(id);
+      continue;
+    }
+
+    loaded++;
+  }
+
+  ESP_LOGI(TAG, "Image %s mapped, %d of %d fonts from it.", version, loaded,
+           TK_FONT_COUNT);
+}
+
+const lv_font_t *tk_font(tk_font_id_t id) { return &fonts[id].font; }
+
+const char *tk_assets_version(void) {
+  return version[0] != '\0' ? version : NULL;
+}
+
+static void tk_assets_release_job(void *payload) {
+  for (int id = 0; id < TK_FONT_COUNT; id++)
+    tk_assets_use_fallback(id);
+
+  // The cached bitmaps and the wrappers' copies are of the old fonts
+  tk_glyph_cache_flush();
+
+  // Line heights and text sizes change along
+  lv_obj_report_style_mod(NULL);
+  lv_obj_invalidate(lv_layer_top());
+  lv_obj_invalidate(lv_layer_sys());
+
+  if (mapped) {
+    spi_flash_munmap(map_handle);
+    mapped = false;
+  }
+  version[0] = '\0';
+
+  ESP_LOGI(TAG, "Image released.");
+  xSemaphoreGive(released);
+}
+
+esp_err_t tk_assets_release(uint32_t timeout_ms) {
+  // A late give, from a release that timed out before
+  xSemaphoreTake(released, 0);
+
+  if (!tk_ui_post(tk_assets_release_job, NULL, 0))
+    return ESP_ERR_TIMEOUT;
+
+  return xSemaphoreTake(released, pdMS_TO_TICKS(timeout_ms)) == pdTRUE
+             ? ESP_OK
+             : ESP_ERR_TIMEOUT;
+}
+
+#else
+
+LV_FONT_DECLARE(nunito_bold_12);
+LV_FONT_DECLARE(nunito_bold_16);
+LV_FONT_DECLARE(nunito_bold_24);
+LV_FONT_DECLARE(nunito_bold_36);
+LV_FONT_DECLARE(icons_16);
+
+static const lv_font_t *const fonts[TK_FONT_COUNT] = {
+    [TK_FONT_SMALL] = &nunito_bold_12,
+    [TK_FONT_NORMAL] = &nunito_bold_16,
+    [TK_FONT_SUBTITLE] = &nunito_bold_24,
+    [TK_FONT_TITLE] = &nunito_bold_36,
+    [TK_FONT_ICONS] = &icons_16,
+};
+
+void tk_assets_init(void) { ESP_LOGI(TAG, "Fonts linked into the app."); }
+
+const lv_font_t *tk_font(tk_font_id_t id) { return fonts[id]; }
+
+const char *tk_assets_version(void) { return NULL; }
+
+esp_err_t tk_assets_release(uint32_t timeout_ms) {
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * @file assets.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Fonts, from the asset partition or linked into the app.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ * With CONFIG_TK_ASSETS_PARTITION the fonts are not part of the app: they are
+ * packed by tools/pack_assets.py into an image of their own, flashed to a data
+ * partition, and mapped at boot. The glyph data is used in place from flash,
+ * only the descriptors lvgl writes to are built in RAM. If the image is
+ * missing or damaged, the fonts fall back to lvgl's built-in Montserrat fonts,
+ * so the device stays usable and can take a new image.
+ *
+ * The image layout is described in tools/pack_assets.py. The descriptors
+ * returned by tk_font stay the same for the whole run, whatever they draw.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "lvgl/lvgl.h"
+
+#define TK_ASSETS_MAGIC "TKAS"
+#define TK_ASSETS_FORMAT 1
+#define TK_ASSETS_VERSION_LEN 20
+
+#define TK_ASSET_TYPE_FONT 1
+
+/**
+ * @brief The start of an asset image. The hash covers everything after it.
+ *
+ */
+typedef struct {
+  char magic[4];
+  uint16_t format;
+  uint16_t count;
+  uint32_t length;
+  uint8_t sha256[32];
+  char version[TK_ASSETS_VERSION_LEN];
+} tk_assets_header_t;
+
+/**
+ * @brief A directory entry, count of them follow the header.
+ *
+ */
+typedef struct {
+  char name[20];
+  uint32_t type;
+  uint32_t offset;
+  uint32_t length;
+} tk_assets_entry_t;
+
+typedef enum {
+  TK_FONT_SMALL,
+  TK_FONT_NORMAL,
+  TK_FONT_SUBTITLE,
+  TK_FONT_TITLE,
+  TK_FONT_ICONS,
+  TK_FONT_COUNT
+} tk_font_id_t;
+
+/**
+ * @brief Maps the asset image and sets up the fonts. GUI task only, right
+ * after lv_init and before any font is used.
+ *
+ */
+void tk_assets_init(void);
+
+/**
+ * @brief A font to draw with. GUI task only.
+ *
+ * @param id Which one.
+ * @return const lv_font_t* The font, never NULL.
+ */
+const lv_font_t *tk_font(tk_font_id_t id);
+
+/**
+ * @brief The version of the mapped image.
+ *
+ * @return const char* The version, or NULL if the fonts are linked into the
+ * app or fell back.
+ */
+const char *tk_assets_version(void);
+
+/**
+ * @brief Makes every font draw with its fallback and unmaps the image, so that
+ * the partition can be rewritten. Runs on the GUI task and waits for it: not
+ * to be called from there. The image is mapped again only at the next boot.
+ *
+ * @param timeout_ms How long to wait for the GUI task.
+ * @return esp_err_t ESP_OK once nothing reads the partition any more,
+ * ESP_ERR_NOT_SUPPORTED if the fonts are linked into the app, or
+ * ESP_ERR_TIMEOUT.
+ */
+esp_err_t tk_assets_release(uint32_t timeout_ms);
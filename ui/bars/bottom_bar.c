@@ -12,17 +12,19 @@
 
 #include "ui/bars/bars.h"
 #include "ui/fonts/icons.h"
+#include "ui/overlay/dev_overlay.h"
 #include "ui/styles/tk_style.h"
 #include "ui/views.h"
 
 #include "model/datastore.h"
 
-#include "esp_log.h"
+#include "diag/tk_log.h"
 
 #include <stdio.h>
 #include <time.h>
 
 #define TAG "Bottom bar"
+#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_UI
 
 static lv_obj_t *bar;
 
@@ -40,6 +42,9 @@ bool menu_open;
 bool menu_flag;
 bool click_passthrough_flag;
 
+// Set once a hold has toggled the developer overlay, until release
+static bool overlay_hold_done;
+
 lv_obj_t *menu;
 lv_group_t *menu_group;
 lv_group_t *group_bak;
@@ -117,7 +122,7 @@ static void refresh_cb(lv_obj_t *obj, lv_event_t event) {
  */
 void hide_menu(lv_obj_t *menu) {
 
-  ESP_LOGI(TAG, "Hiding menu.");
+  TK_LOGD(TAG, "Hiding menu.");
 
   // Hide the menu
   lv_obj_del(menu);
@@ -155,8 +160,8 @@ void show_menu(tk_bottom_bar_configuration_t current_bb_conf, bool left) {
   tk_bar_menu_item_t *menu_items = left ? current_bb_conf.left_button.menu
                                         : current_bb_conf.right_button.menu;
 
-  ESP_LOGI(TAG, "Building %s menu with %d items.", left ? "left" : "right",
-           items);
+  TK_LOGD(TAG, "Building %s menu with %d items.", left ? "left" : "right",
+          items);
 
   // Menu generation
   // TODO: Automatic resize
@@ -216,7 +221,7 @@ static void left_button_event_callback(lv_obj_t *obj, lv_event_t event) {
   switch (event) {
   case LV_EVENT_SHORT_CLICKED:
 
-    ESP_LOGD(TAG, "Left button short clicked.");
+    TK_LOGD(TAG, "Left button short clicked.");
 
     // Clicked: execute callback when menus closed, close menu when open
     if (menu_open) {
@@ -224,7 +229,7 @@ static void left_button_event_callback(lv_obj_t *obj, lv_event_t event) {
       hide_menu(menu);
     } else {
       if (original_configuration.left_button.click_callback != NULL) {
-        ESP_LOGD(TAG, "Calling callback function.");
+        TK_LOGD(TAG, "Calling callback function.");
         (original_configuration.left_button.click_callback)();
       } else {
         ESP_LOGW(TAG, "No callback function available. This could be an "
@@ -236,11 +241,11 @@ static void left_button_event_callback(lv_obj_t *obj, lv_event_t event) {
 
   case LV_EVENT_LONG_PRESSED:
 
-    ESP_LOGD(TAG, "Left button long pressed.");
+    TK_LOGD(TAG, "Left button long pressed.");
 
     // Long press: show menu when both are closed and a menu is available
     if (!menu_open && original_configuration.left_button.items_count > 0) {
-      ESP_LOGD(TAG, "Flagging menu for opening.");
+      TK_LOGD(TAG, "Flagging menu for opening.");
 
       // Using a flag in order to delay the appearance of the menu on button
       // release
@@ -253,9 +258,26 @@ static void left_button_event_callback(lv_obj_t *obj, lv_event_t event) {
 
     break;
 
+  case LV_EVENT_LONG_PRESSED_REPEAT:
+
+    // A longer hold toggles the developer overlay, instead of the menu or the
+    // click on release
+    if (!overlay_hold_done &&
+        lv_tick_elaps(lv_indev_get_act()->proc.pr_timestamp) >=
+            TK_DEV_OVERLAY_HOLD_MS) {
+      TK_LOGD(TAG, "Left button held, toggling the developer overlay.");
+      overlay_hold_done = true;
+      menu_flag = false;
+      click_passthrough_flag = false;
+      tk_dev_overlay_toggle();
+    }
+
+    break;
+
   case LV_EVENT_RELEASED:
 
-    ESP_LOGD(TAG, "Left button released.");
+    TK_LOGD(TAG, "Left button released.");
+    overlay_hold_done = false;
 
     // No continued pressure
     lv_obj_set_state(obj, LV_STATE_DEFAULT);
@@ -268,7 +290,7 @@ static void left_button_event_callback(lv_obj_t *obj, lv_event_t event) {
 
     // Show menu
     if (menu_flag) {
-      ESP_LOGD(TAG, "Triggering menu opening.");
+      TK_LOGD(TAG, "Triggering menu opening.");
       show_menu(original_configuration, true);
       menu_flag = false;
     }
@@ -287,12 +309,12 @@ static void right_button_event_callback(lv_obj_t *obj, lv_event_t event) {
   switch (event) {
   case LV_EVENT_SHORT_CLICKED:
 
-    ESP_LOGD(TAG, "Right button short clicked.");
+    TK_LOGD(TAG, "Right button short clicked.");
 
     // Clicked: execute callback when menus closed, select item when open
     if (menu_open) {
 
-      ESP_LOGD(TAG, "Menu is open, calling button specific callback.");
+      TK_LOGD(TAG, "Menu is open, calling button specific callback.");
 
       // Select item (execute function pointed by user data of the focused
       // button)
@@ -309,7 +331,7 @@ static void right_button_event_callback(lv_obj_t *obj, lv_event_t event) {
       hide_menu(menu);
     } else {
       if (original_configuration.right_button.click_callback != NULL) {
-        ESP_LOGD(TAG, "Calling callback function.");
+        TK_LOGD(TAG, "Calling callback function.");
         (original_configuration.right_button.click_callback)();
       } else {
         ESP_LOGW(TAG, "No callback function available. This could be an "
@@ -321,12 +343,12 @@ static void right_button_event_callback(lv_obj_t *obj, lv_event_t event) {
 
   case LV_EVENT_LONG_PRESSED:
 
-    ESP_LOGD(TAG, "Right button long pressed.");
+    TK_LOGD(TAG, "Right button long pressed.");
 
     // Long press: show menu when both are closed and a menu is available
     if (!menu_open && original_configuration.right_button.items_count > 0) {
 
-      ESP_LOGD(TAG, "Flagging menu for opening.");
+      TK_LOGD(TAG, "Flagging menu for opening.");
 
       // Using a flag in order to delay the appearance of the menu on button
       // release
@@ -341,7 +363,7 @@ static void right_button_event_callback(lv_obj_t *obj, lv_event_t event) {
 
   case LV_EVENT_RELEASED:
 
-    ESP_LOGD(TAG, "Right button released.");
+    TK_LOGD(TAG, "Right button released.");
 
     // No continued pressure
     lv_obj_set_state(obj, LV_STATE_DEFAULT);
@@ -354,7 +376,7 @@ static void right_button_event_callback(lv_obj_t *obj, lv_event_t event) {
 
     // Show menu
     if (menu_flag) {
-      ESP_LOGD(TAG, "Triggering menu opening.");
+      TK_LOGD(TAG, "Triggering menu opening.");
       show_menu(original_configuration, false);
       menu_flag = false;
     }
@@ -373,7 +395,7 @@ static void right_button_event_callback(lv_obj_t *obj, lv_event_t event) {
 lv_obj_t *build_bottom_bar(tk_bottom_bar_configuration_t configuration,
                            bool original) {
 
-  ESP_LOGD(TAG, "Building bottom bar.");
+  TK_LOGD(TAG, "Building bottom bar.");
 
   current_configuration = configuration;
 
@@ -425,8 +447,8 @@ lv_obj_t *build_bottom_bar(tk_bottom_bar_configuration_t configuration,
   if (original)
     original_configuration = current_configuration;
 
-  ESP_LOGD(TAG, "Bottom bar built successfully%s.",
-           original ? " and saved" : "");
+  TK_LOGD(TAG, "Bottom bar built successfully%s.",
+          original ? " and saved" : "");
 
   return bar;
 }
\ No newline at end of file
@@ -17,12 +17,14 @@
 
 #include "model/datastore.h"
 
-#include "esp_log.h"
+#include "diag/tk_log.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 
 #define TAG "Top bar"
+#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_UI
 
 static lv_obj_t *bar;
 
@@ -50,7 +52,7 @@ static void refresh_cb(lv_obj_t *obj, lv_event_t event) {
 
   // Clock label
   if (obj == clock_label) {
-    ESP_LOGV(TAG, "Received a refresh event for the clock label.");
+    TK_LOGV(TAG, "Received a refresh event for the clock label.");
     time_t time_raw;
     time(&time_raw);
     struct tm *timeinfo;
@@ -77,16 +79,19 @@ static void refresh_cb(lv_obj_t *obj, lv_event_t event) {
   else if (obj == temperature_label) {
     char temperature_text[10] = "---";
     if (global_datastore.engine_data.temp_c_available) {
-      double temperature = global_datastore.engine_data.temp_c;
+      float temperature = global_datastore.engine_data.temp_c;
       char unit[5] = {};
       if (!global_datastore.unit_settings.celsius) {
-        temperature = (temperature * (9.0 / 5.0)) + 32.0;
+        temperature = (temperature * (9.0f / 5.0f)) + 32.0f;
         strcpy(unit, "°F");
       } else {
         strcpy(unit, "°C");
       }
 
-      sprintf(temperature_text, "%.1f%s", temperature, unit);
+      // Printed from integer tenths, %f would promote to double
+      int tenths = temperature * 10.0f + (temperature < 0 ? -0.5f : 0.5f);
+      sprintf(temperature_text, "%s%d.%d%s", tenths < 0 ? "-" : "",
+              abs(tenths) / 10, abs(tenths) % 10, unit);
     }
 
     lv_label_set_text(temperature_label, temperature_text);
@@ -246,7 +251,7 @@ static void refresh_cb(lv_obj_t *obj, lv_event_t event) {
  * @return lv_obj_t* The generated top bar.
  */
 lv_obj_t *build_top_bar(tk_top_bar_configuration_t configuration) {
-  ESP_LOGD(TAG, "Building bar");
+  TK_LOGD(TAG, "Building bar");
 
   current_configuration = configuration;
 
@@ -315,7 +320,7 @@ lv_obj_t *build_top_bar(tk_top_bar_configuration_t configuration) {
   lv_obj_set_event_cb(tool_icon, refresh_cb);
   lv_obj_set_event_cb(title_label, refresh_cb);
 
-  ESP_LOGD(TAG, "Bar built successfully.");
+  TK_LOGD(TAG, "Bar built successfully.");
 
   return bar;
 }
\ No newline at end of file
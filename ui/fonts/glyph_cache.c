@@ -0,0 +1,243 @@
+/**
+ * @file glyph_cache.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Decompressed glyph bitmaps kept in RAM for the compressed fonts.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "ui/fonts/glyph_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag/metrics.h"
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#define TAG "Glyph cache"
+
+_Static_assert((TK_GLYPH_CACHE_ENTRIES & (TK_GLYPH_CACHE_ENTRIES - 1)) == 0,
+               "TK_GLYPH_CACHE_ENTRIES must be a power of two.");
+
+typedef struct {
+  // First, lvgl only passes this to the callbacks
+  lv_font_t font;
+  const lv_font_t *source;
+} tk_glyph_font_t;
+
+typedef struct {
+  const tk_glyph_font_t *font;
+  uint32_t letter;
+  const uint8_t *bitmap;
+} tk_glyph_entry_t;
+
+static tk_metric_t hits_metric = TK_METRIC_COUNTER(
+    "tk_glyph_cache_hits_total", "Glyphs drawn from a cached bitmap.");
+
+static tk_metric_t misses_metric =
+    TK_METRIC_COUNTER("tk_glyph_cache_misses_total",
+                      "Glyphs of a wrapped font decompressed to draw them.");
+
+static tk_metric_t bytes_metric = TK_METRIC_GAUGE(
+    "tk_glyph_cache_bytes", "Arena bytes taken by cached glyph bitmaps.");
+
+static tk_glyph_font_t fonts[TK_GLYPH_CACHE_FONTS];
+static tk_glyph_entry_t entries[TK_GLYPH_CACHE_ENTRIES];
+static uint32_t entries_used = 0;
+
+// Bump allocated, glyphs are never evicted
+static uint8_t *arena = NULL;
+static uint32_t arena_used = 0;
+
+static tk_glyph_cache_stats_t stats;
+
+static uint32_t tk_glyph_hash(const tk_glyph_font_t *font, uint32_t letter) {
+  return ((letter * 2654435761u) ^ ((uintptr_t)font >> 4)) &
+         (TK_GLYPH_CACHE_ENTRIES - 1);
+}
+
+/**
+ * @brief The entry of a glyph, or the empty one where it would go.
+ *
+ */
+static tk_glyph_entry_t *tk_glyph_find(const tk_glyph_font_t *font,
+                                       uint32_t letter) {
+  uint32_t i = tk_glyph_hash(font, letter);
+
+  // Linear probing, the table is never full: see tk_glyph_store
+  while (entries[i].font != NULL &&
+         (entries[i].font != font || entries[i].letter != letter))
+    i = (i + 1) & (TK_GLYPH_CACHE_ENTRIES - 1);
+
+  return &entries[i];
+}
+
+/**
+ * @brief Copies a decompressed bitmap into the arena, if there is room.
+ *
+ * @return const uint8_t* The copy, or the bitmap given if not cached.
+ */
+static const uint8_t *tk_glyph_store(tk_glyph_entry_t *entry,
+                                     const tk_glyph_font_t *font,
+                                     uint32_t letter, const uint8_t *bitmap,
+                                     uint32_t size) {
+  // One entry always stays empty to end the probes
+  if (arena_used + size > CONFIG_TK_GLYPH_CACHE_BYTES ||
+      entries_used + 1 >= TK_GLYPH_CACHE_ENTRIES)
+    return bitmap;
+
+  uint8_t *copy = arena + arena_used;
+  memcpy(copy, bitmap, size);
+  arena_used += (size + 3) & ~3u;
+  entries_used++;
+
+  entry->font = font;
+  entry->letter = letter;
+  entry->bitmap = copy;
+
+  stats.glyphs = entries_used;
+  stats.bytes = arena_used;
+  tk_metric_set(&bytes_metric, arena_used);
+  return copy;
+}
+
+/**
+ * @brief Decompresses a glyph with the source font.
+ *
+ * @param size The bitmap size in bytes, 0 for an empty or missing glyph.
+ */
+static const uint8_t *tk_glyph_decompress(const tk_glyph_font_t *font,
+                                          uint32_t letter, uint32_t *size) {
+  // Into a buffer lvgl reuses for the next glyph
+  const uint8_t *bitmap = font->source->get_glyph_bitmap(font->source, letter);
+  lv_font_glyph_dsc_t dsc;
+
+  *size = 0;
+  if (bitmap != NULL &&
+      font->source->get_glyph_dsc(font->source, &dsc, letter, 0))
+    *size = ((uint32_t)dsc.box_w * dsc.box_h * dsc.bpp + 7) / 8;
+
+  return bitmap;
+}
+
+static const uint8_t *tk_glyph_cache_bitmap(const lv_font_t *font,
+                                            uint32_t letter) {
+  const tk_glyph_font_t *cached = (const tk_glyph_font_t *)font;
+  tk_glyph_entry_t *entry = tk_glyph_find(cached, letter);
+
+  if (entry->font != NULL) {
+    stats.hits++;
+    tk_metric_inc(&hits_metric);
+    return entry->bitmap;
+  }
+
+  uint32_t size;
+  const uint8_t *bitmap = tk_glyph_decompress(cached, letter, &size);
+  if (size == 0)
+    return bitmap;
+
+  stats.misses++;
+  tk_metric_inc(&misses_metric);
+  return tk_glyph_store(entry, cached, letter, bitmap, size);
+}
+
+/**
+ * @brief Caches glyphs ahead of drawing, not counted as misses.
+ *
+ */
+static void tk_glyph_preload(const tk_glyph_font_t *font, const char *text) {
+  uint32_t i = 0;
+
+  while (text[i] != '\0') {
+    uint32_t letter = _lv_txt_encoded_next(text, &i);
+    tk_glyph_entry_t *entry = tk_glyph_find(font, letter);
+    if (entry->font != NULL)
+      continue;
+
+    uint32_t size;
+    const uint8_t *bitmap = tk_glyph_decompress(font, letter, &size);
+    if (size > 0)
+      tk_glyph_store(entry, font, letter, bitmap, size);
+  }
+}
+
+/**
+ * @brief Whether lvgl decompresses the glyphs of a font.
+ *
+ */
+static bool tk_glyph_font_compressed(const lv_font_t *font) {
+  if (font->get_glyph_bitmap != lv_font_get_bitmap_fmt_txt)
+    return false;
+
+  const lv_font_fmt_txt_dsc_t *dsc = font->dsc;
+  return dsc->bitmap_format != LV_FONT_FMT_TXT_PLAIN;
+}
+
+const lv_font_t *tk_glyph_cache_wrap(const lv_font_t *source,
+                                     const char *preload) {
+  if (CONFIG_TK_GLYPH_CACHE_BYTES == 0 || !tk_glyph_font_compressed(source))
+    return source;
+
+  if (arena == NULL) {
+    arena = malloc(CONFIG_TK_GLYPH_CACHE_BYTES);
+    if (arena == NULL) {
+      ESP_LOGE(TAG, "No memory for %d bytes of glyphs.",
+               CONFIG_TK_GLYPH_CACHE_BYTES);
+      return source;
+    }
+
+    tk_metrics_register(&hits_metric);
+    tk_metrics_register(&misses_metric);
+    tk_metrics_register(&bytes_metric);
+  }
+
+  // Filled in order and never emptied, the first free slot ends the search
+  tk_glyph_font_t *cached = NULL;
+  for (int i = 0; i < TK_GLYPH_CACHE_FONTS; i++) {
+    if (fonts[i].source == source)
+      return &fonts[i].font;
+
+    if (fonts[i].source == NULL) {
+      cached = &fonts[i];
+      break;
+    }
+  }
+
+  if (cached == NULL) {
+    ESP_LOGW(TAG, "All %d fonts are wrapped already.", TK_GLYPH_CACHE_FONTS);
+    return source;
+  }
+
+  // The source's metrics and descriptor, the cache's bitmaps
+  cached->font = *source;
+  cached->font.get_glyph_bitmap = tk_glyph_cache_bitmap;
+  cached->source = source;
+
+  if (preload != NULL)
+    tk_glyph_preload(cached, preload);
+
+  ESP_LOGI(TAG, "Font wrapped, %u glyphs in %u bytes cached so far.",
+           entries_used, arena_used);
+  return &cached->font;
+}
+
+void tk_glyph_cache_flush(void) {
+  memset(entries, 0, sizeof entries);
+  entries_used = 0;
+  arena_used = 0;
+
+  for (int i = 0; i < TK_GLYPH_CACHE_FONTS && fonts[i].source != NULL; i++) {
+    fonts[i].font = *fonts[i].source;
+    fonts[i].font.get_glyph_bitmap = tk_glyph_cache_bitmap;
+  }
+
+  stats.glyphs = 0;
+  stats.bytes = 0;
+  tk_metric_set(&bytes_metric, 0);
+}
+
+void tk_glyph_cache_get_stats(tk_glyph_cache_stats_t *out) { *out = stats; }
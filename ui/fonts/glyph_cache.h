@@ -0,0 +1,71 @@
+/**
+ * @file glyph_cache.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Decompressed glyph bitmaps kept in RAM for the compressed fonts.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ * The Nunito fonts are compressed, so lvgl decompresses a glyph every time it
+ * draws it, and the readouts redraw the same few digits many times a second.
+ * A wrapped font keeps each bitmap it decompresses in one arena of
+ * CONFIG_TK_GLYPH_CACHE_BYTES, shared by all wrapped fonts. Nothing is
+ * evicted: the glyphs preloaded at wrap time come first, then the others as
+ * they are drawn, until the arena is full.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+/**
+ * @brief Glyphs cached at most, over all the fonts, a power of two.
+ *
+ */
+#define TK_GLYPH_CACHE_ENTRIES 128
+
+/**
+ * @brief Fonts wrapped at most.
+ *
+ */
+#define TK_GLYPH_CACHE_FONTS 4
+
+/**
+ * @brief Digits, separators and the units on the dashboard.
+ *
+ */
+#define TK_GLYPH_CACHE_NUMERIC "0123456789.,:-/% kmhrpKMHRP°C"
+
+typedef struct {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t glyphs;
+  uint32_t bytes;
+} tk_glyph_cache_stats_t;
+
+/**
+ * @brief A font drawing like the source, from cached bitmaps. The same
+ * wrapper every time for the same source. GUI task only.
+ *
+ * @param source A font, returned as it is if not compressed or if caching is
+ * off.
+ * @param preload UTF-8 characters to decompress now, can be NULL.
+ * @return const lv_font_t* The font to use.
+ */
+const lv_font_t *tk_glyph_cache_wrap(const lv_font_t *source,
+                                     const char *preload);
+
+/**
+ * @brief Drops every cached bitmap and takes the wrapped fonts' metrics from
+ * their sources again, for sources changed in place. GUI task only.
+ *
+ */
+void tk_glyph_cache_flush(void);
+
+/**
+ * @brief Counts since boot.
+ *
+ */
+void tk_glyph_cache_get_stats(tk_glyph_cache_stats_t *stats);
@@ -0,0 +1,133 @@
+/**
+ * @file jobs.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Jobs posted to the GUI task by other tasks and ISRs.
+ * @version 0.1
+ * @date 2021-02-22
+ *
+ *
+ */
+
+#include "ui/jobs/jobs.h"
+
+#include <string.h>
+
+#include "diag/metrics.h"
+#include "tkos.h"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "UI jobs"
+
+_Static_assert((TK_UI_JOBS_LEN & (TK_UI_JOBS_LEN - 1)) == 0,
+               "TK_UI_JOBS_LEN must be a power of two.");
+
+#define TK_UI_JOBS_MASK (TK_UI_JOBS_LEN - 1)
+
+static tk_metric_t jobs_metric =
+    TK_METRIC_COUNTER("tk_ui_jobs_total", "Jobs run by the GUI task.");
+
+static tk_metric_t dropped_metric = TK_METRIC_COUNTER(
+    "tk_ui_jobs_dropped_total", "Jobs dropped, the queue was full.");
+
+static tk_metric_t latency_metric =
+    TK_METRIC_HISTOGRAM("tk_ui_job_latency_us",
+                        "Time from posting a job to running it.", 100, 1000,
+                        10000, 100000);
+
+typedef struct {
+  // Equal to the position when free, one past it when filled
+  volatile uint32_t seq;
+  tk_ui_job_fn_t fn;
+  uint32_t posted_us;
+  uint8_t payload[TK_UI_JOB_PAYLOAD] __attribute__((aligned(4)));
+} tk_ui_job_t;
+
+// Bounded queue after Vyukov: producers claim a position with a compare and
+// swap, then publish the slot through its sequence number
+static DRAM_ATTR tk_ui_job_t jobs[TK_UI_JOBS_LEN];
+static volatile uint32_t enqueue_pos = 0;
+static uint32_t dequeue_pos = 0;
+static bool jobs_ready = false;
+
+void tk_ui_jobs_init(void) {
+  for (uint32_t i = 0; i < TK_UI_JOBS_LEN; i++)
+    jobs[i].seq = i;
+
+  tk_metrics_register(&jobs_metric);
+  tk_metrics_register(&dropped_metric);
+  tk_metrics_register(&latency_metric);
+
+  jobs_ready = true;
+}
+
+bool IRAM_ATTR tk_ui_post(tk_ui_job_fn_t fn, const void *payload, size_t len) {
+  if (!jobs_ready || fn == NULL || len > TK_UI_JOB_PAYLOAD) {
+    tk_metric_inc(&dropped_metric);
+    return false;
+  }
+
+  uint32_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+  tk_ui_job_t *job;
+
+  while (1) {
+    job = &jobs[pos & TK_UI_JOBS_MASK];
+    int32_t diff =
+        (int32_t)(__atomic_load_n(&job->seq, __ATOMIC_ACQUIRE) - pos);
+
+    if (diff == 0) {
+      // On failure pos is reloaded, another producer got there first
+      if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      // Still holds a job from a lap ago
+      tk_metric_inc(&dropped_metric);
+      return false;
+    } else {
+      pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  job->fn = fn;
+  job->posted_us = esp_timer_get_time();
+  if (len > 0)
+    memcpy(job->payload, payload, len);
+  __atomic_store_n(&job->seq, pos + 1, __ATOMIC_RELEASE);
+
+  tk_gui_wake();
+  return true;
+}
+
+uint32_t tk_ui_jobs_run(void) {
+  uint32_t run = 0;
+
+  // Bounded, jobs that post jobs get the next pass
+  while (run < TK_UI_JOBS_LEN) {
+    tk_ui_job_t *job = &jobs[dequeue_pos & TK_UI_JOBS_MASK];
+    if (__atomic_load_n(&job->seq, __ATOMIC_ACQUIRE) != dequeue_pos + 1)
+      break;
+
+    tk_ui_job_fn_t fn = job->fn;
+    uint32_t posted_us = job->posted_us;
+    uint8_t payload[TK_UI_JOB_PAYLOAD] __attribute__((aligned(4)));
+    memcpy(payload, job->payload, sizeof payload);
+
+    // Free for the producers, one lap ahead
+    __atomic_store_n(&job->seq, dequeue_pos + TK_UI_JOBS_LEN, __ATOMIC_RELEASE);
+    dequeue_pos++;
+
+    tk_metric_observe(&latency_metric,
+                      (uint32_t)esp_timer_get_time() - posted_us);
+    fn(payload);
+    run++;
+  }
+
+  if (run == TK_UI_JOBS_LEN)
+    tk_gui_wake();
+
+  tk_metric_add(&jobs_metric, run);
+  return run;
+}
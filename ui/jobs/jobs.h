@@ -0,0 +1,60 @@
+/**
+ * @file jobs.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Jobs posted to the GUI task by other tasks and ISRs.
+ * @version 0.1
+ * @date 2021-02-22
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Jobs waiting at most, a power of two.
+ *
+ */
+#define TK_UI_JOBS_LEN 32
+
+/**
+ * @brief Payload bytes copied along with each job.
+ *
+ */
+#define TK_UI_JOB_PAYLOAD 16
+
+/**
+ * @brief A job, run by the GUI task with its copy of the payload, aligned to 4
+ * bytes.
+ *
+ */
+typedef void (*tk_ui_job_fn_t)(void *payload);
+
+/**
+ * @brief Registers the job metrics. GUI task only, before anything is posted.
+ *
+ */
+void tk_ui_jobs_init(void);
+
+/**
+ * @brief Queues a job for the GUI task and wakes it. Never blocks and takes no
+ * lock, so it can be called from any task or ISR. lvgl must only be touched
+ * from the GUI task, through here.
+ *
+ * @param fn The job.
+ * @param payload Copied into the queue, can be NULL.
+ * @param len Up to TK_UI_JOB_PAYLOAD bytes.
+ * @return true Queued.
+ * @return false The queue is full or the payload too long, the job is dropped.
+ */
+bool tk_ui_post(tk_ui_job_fn_t fn, const void *payload, size_t len);
+
+/**
+ * @brief Runs the jobs queued so far, in order. GUI task only.
+ *
+ * @return uint32_t The number of jobs run.
+ */
+uint32_t tk_ui_jobs_run(void);
@@ -13,9 +13,10 @@
 #include "menu.h"
 #include "ui/views.h"
 
-#include "esp_log.h"
+#include "diag/tk_log.h"
 
 #define TAG "Menu"
+#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_UI
 
 // The page widget
 static lv_obj_t *menu_widget;
@@ -74,8 +75,8 @@ LV_EVENT_CB_DECLARE(item_control_event_cb) {
         ;
 
       int raw = lv_slider_get_value(item->control);
-      double perc = (double)raw / item->binding_steps;
-      double out =
+      float perc = (float)raw / item->binding_steps;
+      float out =
           perc * (item->binding_max - item->binding_min) + item->binding_min;
 
       switch (item->binding_type) {
@@ -85,8 +86,8 @@ LV_EVENT_CB_DECLARE(item_control_event_cb) {
       case TK_MENU_BINDING_UINT:
         (*(unsigned int *)item->binding) = (unsigned int)out > 0 ? out : 0;
         break;
-      case TK_MENU_BINDING_DOUBLE:
-        (*(double *)item->binding) = out;
+      case TK_MENU_BINDING_FLOAT:
+        (*(float *)item->binding) = out;
         break;
       }
 
@@ -104,7 +105,7 @@ LV_EVENT_CB_DECLARE(item_control_event_cb) {
 
     // Value change callback
     if (item->value_change_cb != NULL) {
-      ESP_LOGI(TAG, "Calling value change callback for %s.", item->desc);
+      TK_LOGD(TAG, "Calling value change callback for %s.", item->desc);
       (item->value_change_cb)(item);
     }
   }
@@ -128,16 +129,16 @@ LV_EVENT_CB_DECLARE(item_control_event_cb) {
 
         ;
 
-      double perc = 0;
+      float perc = 0;
       switch (item->binding_type) {
       case TK_MENU_BINDING_INT:
-        perc = (double)*(int *)item->binding;
+        perc = (float)*(int *)item->binding;
         break;
       case TK_MENU_BINDING_UINT:
-        perc = (double)*(unsigned int *)item->binding;
+        perc = (float)*(unsigned int *)item->binding;
         break;
-      case TK_MENU_BINDING_DOUBLE:
-        perc = *(double *)item->binding;
+      case TK_MENU_BINDING_FLOAT:
+        perc = *(float *)item->binding;
         break;
       }
 
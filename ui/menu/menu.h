@@ -26,7 +26,7 @@ typedef enum {
 typedef enum {
   TK_MENU_BINDING_INT,
   TK_MENU_BINDING_UINT,
-  TK_MENU_BINDING_DOUBLE
+  TK_MENU_BINDING_FLOAT
 } tk_menu_binding_type_t;
 
 typedef struct tk_menu_item {
@@ -58,13 +58,13 @@ typedef struct tk_menu_item {
    * @brief The minimum value.
    *
    */
-  double binding_min;
+  float binding_min;
 
   /**
    * @brief The maximum value.
    *
    */
-  double binding_max;
+  float binding_max;
 
   /**
    * @brief The number of steps in a slider.
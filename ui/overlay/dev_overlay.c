@@ -0,0 +1,96 @@
+/**
+ * @file dev_overlay.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Developer overlay with the frame statistics, above every view.
+ * @version 0.1
+ * @date 2021-02-21
+ *
+ *
+ */
+
+#include "ui/overlay/dev_overlay.h"
+
+#include <stdio.h>
+
+#include "diag/framestats.h"
+#include "ui/assets/assets.h"
+#include "lvgl/lvgl.h"
+
+#include "esp_log.h"
+
+#define TAG "Developer overlay"
+
+static lv_obj_t *overlay_label = NULL;
+static lv_task_t *overlay_task = NULL;
+static uint32_t shown_seq = 0;
+
+/**
+ * @brief Prints the last window, when there is a new one.
+ *
+ */
+static void tk_dev_overlay_update(lv_task_t *task) {
+  (void)task;
+
+  tk_frame_stats_t stats;
+  tk_frame_stats_get(&stats);
+  if (stats.seq == shown_seq)
+    return;
+  shown_seq = stats.seq;
+
+  // Redrawing the overlay is part of what it measures, once per window
+  uint32_t screen_px = stats.screen_px > 0 ? stats.screen_px : 1;
+  lv_label_set_text_fmt(
+      overlay_label,
+      "%u.%u fps\n"
+      "render %u.%u / %u.%u ms\n"
+      "flush %u.%u / %u.%u ms\n"
+      "aree %u.%u / %u\n"
+      "invalidato %u%%, inviato %u%%",
+      stats.fps_x10 / 10, stats.fps_x10 % 10, stats.render_avg_us / 1000,
+      stats.render_avg_us / 100 % 10, stats.render_max_us / 1000,
+      stats.render_max_us / 100 % 10, stats.flush_avg_us / 1000,
+      stats.flush_avg_us / 100 % 10, stats.flush_max_us / 1000,
+      stats.flush_max_us / 100 % 10, stats.areas_avg_x10 / 10,
+      stats.areas_avg_x10 % 10, stats.areas_max,
+      stats.invalidated_px_avg * 100 / screen_px,
+      stats.flushed_px_avg * 100 / screen_px);
+}
+
+void tk_dev_overlay_toggle(void) {
+  if (overlay_label != NULL) {
+    lv_task_del(overlay_task);
+    lv_obj_del(overlay_label);
+    overlay_task = NULL;
+    overlay_label = NULL;
+
+    ESP_LOGI(TAG, "Hidden.");
+    return;
+  }
+
+  // On the system layer, so it stays through view changes
+  overlay_label = lv_label_create(lv_layer_sys(), NULL);
+  lv_obj_set_style_local_text_font(overlay_label, LV_LABEL_PART_MAIN,
+                                   LV_STATE_DEFAULT,
+                                   tk_font(TK_FONT_SMALL));
+  lv_obj_set_style_local_text_color(overlay_label, LV_LABEL_PART_MAIN,
+                                    LV_STATE_DEFAULT, LV_COLOR_WHITE);
+  lv_obj_set_style_local_bg_color(overlay_label, LV_LABEL_PART_MAIN,
+                                  LV_STATE_DEFAULT, LV_COLOR_BLACK);
+  lv_obj_set_style_local_bg_opa(overlay_label, LV_LABEL_PART_MAIN,
+                                LV_STATE_DEFAULT, LV_OPA_70);
+  lv_obj_set_style_local_pad_all(overlay_label, LV_LABEL_PART_MAIN,
+                                 LV_STATE_DEFAULT, 4);
+  lv_label_set_text(overlay_label, "In attesa dei dati...");
+  lv_obj_align(overlay_label, NULL, LV_ALIGN_IN_TOP_RIGHT, -4, 40);
+
+  // Keeps its top right corner as the text changes width
+  lv_obj_set_auto_realign(overlay_label, true);
+
+  shown_seq = 0;
+  overlay_task =
+      lv_task_create(tk_dev_overlay_update, 250, LV_TASK_PRIO_LOW, NULL);
+
+  ESP_LOGI(TAG, "Shown.");
+}
+
+bool tk_dev_overlay_shown(void) { return overlay_label != NULL; }
@@ -0,0 +1,31 @@
+/**
+ * @file dev_overlay.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Developer overlay with the frame statistics, above every view.
+ * @version 0.1
+ * @date 2021-02-21
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * @brief How long the left bar button is held to toggle the overlay.
+ *
+ */
+#define TK_DEV_OVERLAY_HOLD_MS 3000
+
+/**
+ * @brief Shows the overlay if hidden, hides it otherwise. GUI task only.
+ *
+ */
+void tk_dev_overlay_toggle(void);
+
+/**
+ * @brief Whether the overlay is shown.
+ *
+ */
+bool tk_dev_overlay_shown(void);
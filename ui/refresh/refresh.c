@@ -16,12 +16,22 @@
 
 #include "model/datastore.h"
 
+#include "diag/metrics.h"
+#include "diag/trace.h"
+
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 
 #define TAG "Refresher"
 
-int mem_free_last = 0;
+tk_metric_t refresh_count_metric =
+    TK_METRIC_COUNTER("tk_gui_refresh_total", "Global refresh signals sent.");
+
+static lv_task_t *refresher = NULL;
+static uint32_t last_refresh = 0;
+static volatile bool refresh_requested = false;
+static uint32_t refresh_min_ms = TK_REFRESH_MIN_MS;
 
 /**
  * @brief This is an lvgl task which is the source of the global refresh signal.
@@ -32,11 +42,40 @@ void refresher_task(lv_task_t *task)
 {
 
     // Refresh screen
+    TK_TRACE_BEGIN(TK_TRACE_REFRESH, 0);
     lv_event_send_refresh_recursive(NULL);
+    TK_TRACE_END(TK_TRACE_REFRESH, 0);
+    tk_metric_inc(&refresh_count_metric);
+    last_refresh = lv_tick_get();
+}
+
+void tk_refresh_init(void)
+{
+    refresher = lv_task_create(refresher_task, TK_REFRESH_IDLE_MS, LV_TASK_PRIO_MID, NULL);
+}
+
+void IRAM_ATTR tk_refresh_request(void)
+{
+    refresh_requested = true;
+    tk_gui_wake();
+}
+
+void tk_refresh_set_min_ms(uint32_t min_ms)
+{
+    refresh_min_ms = min_ms < TK_REFRESH_MIN_MS ? TK_REFRESH_MIN_MS : min_ms;
+}
+
+uint32_t tk_refresh_service(void)
+{
+    if (!refresh_requested || refresher == NULL)
+        return LV_NO_TASK_READY;
+
+    uint32_t elapsed = lv_tick_elaps(last_refresh);
+    if (elapsed < refresh_min_ms)
+        return refresh_min_ms - elapsed;
 
-    if (esp_get_free_heap_size() != mem_free_last)
-    {
-        mem_free_last = esp_get_free_heap_size();
-        ESP_LOGI(TAG, "Mem free: %d", mem_free_last);
-    }
+    // Cleared first, a change while refreshing asks again
+    refresh_requested = false;
+    lv_task_ready(refresher);
+    return LV_NO_TASK_READY;
 }
\ No newline at end of file
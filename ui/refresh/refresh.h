@@ -12,9 +12,25 @@
 
 #include "lvgl.h"
 
+#include "diag/metrics.h"
+
 // TODO: NOOOOOHHHHHH HHHH H h
 lv_obj_t *tk_top_bar;
 
+/**
+ * @brief Refreshes at most this often, however often the data changes, unless
+ * the power governor slows it down.
+ * 
+ */
+#define TK_REFRESH_MIN_MS 20
+
+/**
+ * @brief Refreshes at least this often, for the clock and anything not
+ * signalled.
+ * 
+ */
+#define TK_REFRESH_IDLE_MS 1000
+
 /**
  * @brief This is an lvgl task which is the source of the global refresh signal.
  * 
@@ -22,3 +38,34 @@ lv_obj_t *tk_top_bar;
  */
 void refresher_task(lv_task_t *task);
 
+/**
+ * @brief Creates the refresher task. GUI task only.
+ * 
+ */
+void tk_refresh_init(void);
+
+/**
+ * @brief Asks for a refresh after the datastore changed, and wakes the GUI
+ * task. Can be called from any task or ISR.
+ * 
+ */
+void tk_refresh_request(void);
+
+/**
+ * @brief Readies the refresher if a refresh was asked for and the last one is
+ * old enough. GUI task only, before the lvgl handler.
+ * 
+ * @return uint32_t Milliseconds until a pending refresh can run, 
+ * LV_NO_TASK_READY if none is pending.
+ */
+uint32_t tk_refresh_service(void);
+
+/**
+ * @brief Sets the shortest time between two refreshes. GUI task only.
+ * 
+ * @param min_ms TK_REFRESH_MIN_MS or more.
+ */
+void tk_refresh_set_min_ms(uint32_t min_ms);
+
+extern tk_metric_t refresh_count_metric;
+
@@ -9,12 +9,29 @@
  */
 
 #include "tk_style.h"
+#include "ui/assets/assets.h"
 #include <stdlib.h>
 
 #include "esp_log.h"
 
 #define TAG "Styles"
 
+lv_style_t *const tk_styles[] = {
+    &tk_style_menu_button,
+    &tk_style_menu,
+    &tk_style_menu_fullscreen,
+    &tk_style_bar,
+    &tk_style_far_background,
+    &tk_style_top_bar_icon,
+    &tk_style_top_bar_icon_warn,
+    &tk_style_top_bar_icon_error,
+    &tk_style_no_background_borders,
+    &tk_style_no_outline,
+    &tk_style_invisible_when_disabled,
+};
+
+const int tk_styles_count = sizeof(tk_styles) / sizeof(tk_styles[0]);
+
 // TODO: Implement accent changing
 /**
  * @brief Gets the primary color based on the current theme and color settings.
@@ -84,9 +101,9 @@ lv_color_t tk_get_themed_near_background_color(bool light)
     return lv_color_mix(color, LV_COLOR_WHITE, mix);
 }
 
-// TODO: Call on theme change
 /**
  * @brief Initializes all the TractorKit styles. This function should be called before drawing any UI.
+ * Called once per mode by tk_theme, which keeps the results.
  * 
  */
 void tk_styles_init(bool light)
@@ -147,17 +164,17 @@ void tk_styles_init(bool light)
 
     // ICON (NORMAL)
     lv_style_init(&tk_style_top_bar_icon);
-    lv_style_set_text_font(&tk_style_top_bar_icon, LV_STATE_DEFAULT, &icons_16);
+    lv_style_set_text_font(&tk_style_top_bar_icon, LV_STATE_DEFAULT, tk_font(TK_FONT_ICONS));
     lv_style_set_text_color(&tk_style_top_bar_icon, LV_STATE_DEFAULT, light ? LV_COLOR_BLACK : LV_COLOR_WHITE);
 
     // ICON (WARNING)
     lv_style_init(&tk_style_top_bar_icon_warn);
-    lv_style_set_text_font(&tk_style_top_bar_icon_warn, LV_STATE_DEFAULT, &icons_16);
+    lv_style_set_text_font(&tk_style_top_bar_icon_warn, LV_STATE_DEFAULT, tk_font(TK_FONT_ICONS));
     lv_style_set_text_color(&tk_style_top_bar_icon_warn, LV_STATE_DEFAULT, light ? TK_COLOR_YELLOW_LIGHT : TK_COLOR_YELLOW_DARK);
 
     // ICON (ERROR)
     lv_style_init(&tk_style_top_bar_icon_error);
-    lv_style_set_text_font(&tk_style_top_bar_icon_error, LV_STATE_DEFAULT, &icons_16);
+    lv_style_set_text_font(&tk_style_top_bar_icon_error, LV_STATE_DEFAULT, tk_font(TK_FONT_ICONS));
     lv_style_set_text_color(&tk_style_top_bar_icon_error, LV_STATE_DEFAULT, light ? TK_COLOR_RED_LIGHT : TK_COLOR_RED_DARK);
 
     // NO BACKGROUND AND BORDERS
@@ -67,4 +67,11 @@ lv_style_t tk_style_no_background_borders;
 lv_style_t tk_style_no_outline;
 lv_style_t tk_style_invisible_when_disabled;
 
+/**
+ * @brief Every style above, for the theme switch.
+ * 
+ */
+extern lv_style_t *const tk_styles[];
+extern const int tk_styles_count;
+
 
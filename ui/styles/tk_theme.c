@@ -0,0 +1,204 @@
+/**
+ * @file tk_theme.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Light and dark themes, prebuilt and swapped in place.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "ui/styles/tk_theme.h"
+
+#include "lvgl/lvgl.h"
+#include "lvgl/src/lv_themes/lv_theme_material.h"
+
+#include "diag/metrics.h"
+#include "ui/assets/assets.h"
+#include "ui/fonts/glyph_cache.h"
+#include "ui/styles/tk_style.h"
+#include "ui/widgets/tk_gauge.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "Theme"
+
+enum { TK_THEME_DARK, TK_THEME_LIGHT, TK_THEME_MODES };
+
+static tk_metric_t switch_metric = TK_METRIC_GAUGE(
+    "tk_theme_switch_us", "Time the last theme switch took, drawing aside.");
+
+// The handles objects point to, and each mode's maps for them
+static lv_style_t *live[TK_THEME_STYLES];
+static lv_style_t maps[TK_THEME_MODES][TK_THEME_STYLES];
+static int live_count = 0;
+
+static bool built = false;
+static bool swappable = false;
+static bool restyle = false;
+static bool light_shown = false;
+
+/**
+ * @brief What used to run on every switch: both theme layers built anew.
+ *
+ */
+static void tk_theme_build(bool light) {
+  // The readout fonts, from cached glyphs (wrapped once, the same after)
+  const lv_font_t *subtitle =
+      tk_glyph_cache_wrap(tk_font(TK_FONT_SUBTITLE), TK_GLYPH_CACHE_NUMERIC);
+  const lv_font_t *title =
+      tk_glyph_cache_wrap(tk_font(TK_FONT_TITLE), TK_GLYPH_CACHE_NUMERIC);
+
+  lv_theme_material_init(
+      tk_get_primary_color(light), tk_get_secondary_color(light),
+      light ? LV_THEME_MATERIAL_FLAG_LIGHT : LV_THEME_MATERIAL_FLAG_DARK,
+      tk_font(TK_FONT_SMALL), tk_font(TK_FONT_NORMAL), subtitle, title);
+
+  tk_styles_init(light);
+}
+
+static void tk_theme_add(lv_style_t *style) {
+  for (int i = 0; i < live_count; i++)
+    if (live[i] == style)
+      return;
+
+  if (live_count == TK_THEME_STYLES) {
+    swappable = false;
+    return;
+  }
+
+  live[live_count++] = style;
+}
+
+/**
+ * @brief Adds the theme styles of an object and its children, every part.
+ *
+ */
+static void tk_theme_collect(lv_obj_t *obj) {
+  for (uint16_t part = 0; part < LV_OBJ_PART_ALL; part++) {
+    lv_style_list_t *list = lv_obj_get_style_list(obj, part);
+    if (list == NULL)
+      continue;
+
+    lv_style_t *local = lv_style_list_get_local_style(list);
+    for (int i = 0; i < list->style_cnt; i++) {
+      lv_style_t *style = lv_style_list_get_style(list, i);
+
+      // The transition style comes first, if any
+      if (style == local || (list->has_trans && i == 0))
+        continue;
+
+      tk_theme_add(style);
+    }
+  }
+
+  lv_obj_t *child = NULL;
+  while ((child = lv_obj_get_child(obj, child)) != NULL)
+    tk_theme_collect(child);
+}
+
+/**
+ * @brief Finds the material styles, applied to one of each widget the UI
+ * creates. A widget kind missing here keeps the colors of the last mode
+ * built, light, whatever the mode shown.
+ *
+ */
+static void tk_theme_probe(void) {
+  lv_obj_t *screen = lv_obj_create(NULL, NULL);
+
+  lv_obj_create(screen, NULL);
+  lv_cont_create(screen, NULL);
+  lv_label_create(screen, NULL);
+  lv_label_create(lv_btn_create(screen, NULL), NULL);
+  lv_list_add_btn(lv_list_create(screen, NULL), NULL, "-");
+  lv_page_create(screen, NULL);
+  lv_slider_create(screen, NULL);
+  lv_switch_create(screen, NULL);
+  lv_table_create(screen, NULL);
+  lv_arc_create(screen, NULL);
+  tk_gauge_create(screen);
+
+  tk_theme_collect(screen);
+  lv_obj_del(screen);
+}
+
+/**
+ * @brief Builds both modes and keeps their maps, the handles are left empty.
+ *
+ */
+static void tk_theme_prepare(void) {
+  int64_t start = esp_timer_get_time();
+  swappable = true;
+
+  for (int mode = 0; mode < TK_THEME_MODES; mode++) {
+    tk_theme_build(mode == TK_THEME_LIGHT);
+
+    // The handles are the same for both modes, only their maps change
+    if (mode == 0) {
+      tk_theme_probe();
+      for (int i = 0; i < tk_styles_count; i++)
+        tk_theme_add(tk_styles[i]);
+    }
+
+    if (!swappable)
+      break;
+
+    for (int i = 0; i < live_count; i++) {
+      lv_style_init(&maps[mode][i]);
+      lv_style_copy(&maps[mode][i], live[i]);
+      lv_style_reset(live[i]);
+    }
+  }
+
+  if (!swappable) {
+    ESP_LOGW(TAG, "More than %d styles, every switch rebuilds them.",
+             TK_THEME_STYLES);
+    return;
+  }
+
+  // Same size, same properties: only values differ, caches stay valid
+  for (int i = 0; i < live_count; i++) {
+    if (_lv_style_get_mem_size(&maps[TK_THEME_DARK][i]) !=
+        _lv_style_get_mem_size(&maps[TK_THEME_LIGHT][i])) {
+      ESP_LOGW(TAG, "Style %d differs between the modes, switches restyle.",
+               i);
+      restyle = true;
+    }
+  }
+
+  ESP_LOGI(TAG, "%d styles prebuilt for both modes in %lld us.", live_count,
+           esp_timer_get_time() - start);
+}
+
+void tk_theme_set(bool light) {
+  if (!built) {
+    tk_metrics_register(&switch_metric);
+    tk_theme_prepare();
+    built = true;
+  }
+
+  int64_t start = esp_timer_get_time();
+  light_shown = light;
+
+  if (!swappable) {
+    tk_theme_build(light);
+  } else {
+    int mode = light ? TK_THEME_LIGHT : TK_THEME_DARK;
+    for (int i = 0; i < live_count; i++)
+      live[i]->map = maps[mode][i].map;
+
+    if (restyle)
+      lv_obj_report_style_mod(NULL);
+
+    // Colors only: nothing moves, the layers are redrawn with the screen
+    lv_obj_invalidate(lv_scr_act());
+  }
+
+  tk_metric_set(&switch_metric, esp_timer_get_time() - start);
+  ESP_LOGD(TAG, "Switched to %s.", light ? "light" : "dark");
+}
+
+bool tk_theme_is_light(void) { return light_shown; }
+
+bool tk_theme_restyles(void) { return !swappable || restyle; }
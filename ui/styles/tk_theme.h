@@ -0,0 +1,52 @@
+/**
+ * @file tk_theme.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Light and dark themes, prebuilt and swapped in place.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ * An lv_style_t is a handle to a property map, and objects keep pointers to
+ * the handles. The first switch builds the material theme and the TractorKit
+ * styles once per mode, keeps a copy of every map, and finds the material
+ * styles by creating one widget of each kind the UI uses on a scratch screen.
+ * Every switch after that only points the handles at the other mode's maps
+ * and invalidates the screen: no style is rebuilt and no object restyled.
+ *
+ * This holds as long as the modes differ in colors and opacities only,
+ * which keeps lvgl's per-object style caches valid; a style whose map differs
+ * in size between the modes makes each switch restyle everything instead.
+ * After the first switch the styles are read only, and the material theme
+ * must not be initialized again.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Styles swapped at most, material and TractorKit ones together.
+ *
+ */
+#define TK_THEME_STYLES 96
+
+/**
+ * @brief Shows a mode, building both on the first call. GUI task only.
+ *
+ * @param light true for light, false for dark.
+ */
+void tk_theme_set(bool light);
+
+/**
+ * @brief The mode shown.
+ *
+ */
+bool tk_theme_is_light(void);
+
+/**
+ * @brief Whether a switch restyles every object rather than swapping maps,
+ * see above. Valid after the first switch.
+ *
+ */
+bool tk_theme_restyles(void);
@@ -9,10 +9,11 @@
  */
 
 #include "views.h"
-#include "esp_log.h"
+#include "diag/tk_log.h"
 
 
 #define TAG "View navigator"
+#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_UI
 
 int stack_depth = 0;
 
@@ -37,7 +38,7 @@ static tk_view_stack_item *view_stack_last = NULL;
 void view_navigate(tk_view_generator generator, bool record_stack)
 {
 
-    ESP_LOGD(TAG, "Navigating %srecording stack.", record_stack ? "" : "without ");
+    TK_LOGD(TAG, "Navigating %srecording stack.", record_stack ? "" : "without ");
 
     // Generate tk view
     tk_view_t view = (generator)();
@@ -70,7 +71,7 @@ void view_navigate(tk_view_generator generator, bool record_stack)
     lv_obj_t *top_bar = build_top_bar(view.top_bar_configuration);
     lv_obj_align(top_bar, lv_scr_act(), LV_ALIGN_IN_TOP_MID, 0, 0);
 
-    ESP_LOGI(TAG, "Navigation complete, stack depth is %d.", stack_depth);
+    TK_LOGD(TAG, "Navigation complete, stack depth is %d.", stack_depth);
 }
 
 /**
@@ -79,7 +80,7 @@ void view_navigate(tk_view_generator generator, bool record_stack)
  */
 void view_navigate_back()
 {
-    ESP_LOGD(TAG, "Popping view stack.");
+    TK_LOGD(TAG, "Popping view stack.");
     
     // Pop from the stack
     tk_view_stack_item *popped_item = view_stack_last;
@@ -19,6 +19,7 @@
 #include "ui/views/main/main_view.h"
 #include "ui/views/driveshaft/driveshaft_view.h"
 #include "ui/views/brightness/brightness_view.h"
+#include "ui/views/metrics/metrics_view.h"
 
 // Last: override colors
 #include "ui/styles/tk_style.h"
@@ -0,0 +1,134 @@
+/**
+ * @file splash.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Boot splash, pre-rendered at build time.
+ * @version 0.1
+ * @date 2021-02-16
+ *
+ *
+ */
+
+#include "ui/views/boot/splash.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_log.h"
+
+#define TAG "Splash"
+
+// Generated by tools/gen_splash.py, see the stream format there
+extern const uint16_t tk_splash_width;
+extern const uint16_t tk_splash_height;
+extern const uint32_t tk_splash_rle_size;
+extern const uint8_t tk_splash_rle[];
+
+/**
+ * @brief Decoder state, kept across bands since packets may cross them.
+ *
+ */
+typedef struct {
+  const uint8_t *src;
+  const uint8_t *end;
+  uint32_t left;
+  bool repeat;
+  lv_color_t color;
+} tk_splash_decoder_t;
+
+static lv_color_t tk_splash_color(const uint8_t *src) {
+  uint16_t pixel = src[0] | src[1] << 8;
+  uint8_t r = (pixel >> 11) & 0x1f;
+  uint8_t g = (pixel >> 5) & 0x3f;
+  uint8_t b = pixel & 0x1f;
+
+  return lv_color_make(r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2);
+}
+
+/**
+ * @brief Decodes the next pixels of the stream.
+ *
+ * @param decoder The decoder state.
+ * @param out Where to write the pixels.
+ * @param count How many pixels to decode.
+ * @return false if the stream is truncated.
+ */
+static bool tk_splash_decode(tk_splash_decoder_t *decoder, lv_color_t *out,
+                             uint32_t count) {
+  while (count > 0) {
+    if (decoder->left == 0) {
+      if (decoder->end - decoder->src < 3)
+        return false;
+
+      uint8_t header = *decoder->src++;
+      decoder->left = (header & 0x7f) + 1;
+      decoder->repeat = header & 0x80;
+
+      if (decoder->repeat) {
+        decoder->color = tk_splash_color(decoder->src);
+        decoder->src += 2;
+      } else if (decoder->end - decoder->src < 2 * decoder->left) {
+        return false;
+      }
+    }
+
+    uint32_t n = decoder->left < count ? decoder->left : count;
+    decoder->left -= n;
+    count -= n;
+
+    if (decoder->repeat) {
+      while (n--)
+        *out++ = decoder->color;
+    } else {
+      while (n--) {
+        *out++ = tk_splash_color(decoder->src);
+        decoder->src += 2;
+      }
+    }
+  }
+
+  return true;
+}
+
+void tk_splash_show(lv_disp_t *disp) {
+  lv_disp_drv_t *drv = &disp->driver;
+  lv_disp_buf_t *buf = drv->buffer;
+  uint32_t band_rows = buf->size / tk_splash_width;
+
+  if (tk_splash_width != lv_disp_get_hor_res(disp) ||
+      tk_splash_height != lv_disp_get_ver_res(disp) || band_rows == 0) {
+    ESP_LOGW(TAG, "Splash is %dx%d, display is %dx%d, skipping.",
+             tk_splash_width, tk_splash_height, lv_disp_get_hor_res(disp),
+             lv_disp_get_ver_res(disp));
+    return;
+  }
+
+  tk_splash_decoder_t decoder = {.src = tk_splash_rle,
+                                 .end = tk_splash_rle + tk_splash_rle_size};
+
+  // The SPI drivers report the end of a transfer to the display being
+  // refreshed, which is none until the first LVGL refresh
+  _lv_refr_set_disp_refreshing(disp);
+
+  for (uint32_t y = 0; y < tk_splash_height; y += band_rows) {
+    uint32_t rows = tk_splash_height - y < band_rows ? tk_splash_height - y
+                                                     : band_rows;
+
+    if (!tk_splash_decode(&decoder, buf->buf1, rows * tk_splash_width)) {
+      ESP_LOGE(TAG, "Splash stream is truncated at row %u.", y);
+      break;
+    }
+
+    lv_area_t area = {.x1 = 0,
+                      .y1 = y,
+                      .x2 = tk_splash_width - 1,
+                      .y2 = y + rows - 1};
+
+    // Same handshake as LVGL: the driver clears the flag when done
+    buf->flushing = 1;
+    drv->flush_cb(drv, &area, buf->buf1);
+    while (buf->flushing)
+      ;
+  }
+
+  _lv_refr_set_disp_refreshing(NULL);
+}
@@ -0,0 +1,23 @@
+/**
+ * @file splash.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Boot splash, pre-rendered at build time.
+ * @version 0.1
+ * @date 2021-02-16
+ *
+ *
+ */
+
+#pragma once
+
+#include "lvgl/lvgl.h"
+
+/**
+ * @brief Decodes the splash into the display's draw buffer and sends it to the
+ * panel through the flush callback, band by band. Call right after the display
+ * is registered, before anything is drawn: the draw buffer is reused and the
+ * first LVGL refresh replaces the splash.
+ *
+ * @param disp The registered display.
+ */
+void tk_splash_show(lv_disp_t *disp);
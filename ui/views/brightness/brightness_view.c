@@ -8,7 +8,7 @@
  *
  */
 
-#include "esp_log.h"
+#include "diag/tk_log.h"
 #include "model/datastore.h"
 #include "model/nvsettings.h"
 #include "ui/menu/menu.h"
@@ -17,6 +17,7 @@
 #include <stdio.h>
 
 #define TAG "Brightness view"
+#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_UI
 
 static lv_group_t *group;
 static tk_menu_item_t menu_current_item;
@@ -48,7 +49,7 @@ static tk_menu_item_t brightness_slider = {
     .desc = "Luminosità",
     .button_string = "Modifica   " LV_SYMBOL_EDIT,
     .editing_button_string = "Fine   " LV_SYMBOL_OK,
-    .binding_type = TK_MENU_BINDING_DOUBLE,
+    .binding_type = TK_MENU_BINDING_FLOAT,
     .binding_min = 0,
     .binding_max = 1,
     .binding_steps = 400,
@@ -62,19 +63,19 @@ static tk_menu_t menu_conf = {
 
 // Callbacks
 TK_MENU_VALUE_CHANGE_CB_DECLARE(brightness_level_cb) {
-  double val = *(double *)sender->binding;
-  ESP_LOGI(TAG, "Level setting changed to %.2f.", val);
+  float val = *(float *)sender->binding;
+  TK_LOGD(TAG, "Level setting changed to %.2f.", val);
 
-  nv_set_brightness_man_level(val);
+  nv_setting_changed(TK_SETTING_BRIGHTNESS_LEVEL);
 }
 
 TK_MENU_VALUE_CHANGE_CB_DECLARE(auto_brightness_cb) {
   bool val = *(bool *)sender->binding;
-  ESP_LOGI(TAG, "Automatic setting changed to %d.", val);
+  TK_LOGD(TAG, "Automatic setting changed to %d.", val);
   brightness_slider.disabled = val;
   brightness_slider.binding_steps = val ? 400 : 16;
 
-  nv_set_brightness_auto(val);
+  nv_setting_changed(TK_SETTING_BRIGHTNESS_AUTO);
 }
 
 static void right_button_update(tk_menu_item_t *focused) {
@@ -165,7 +166,7 @@ tk_view_t build_brightness_view() {
                          .bottom_bar_configuration = bb_conf,
                          .top_bar_configuration = tb_conf};
 
-  ESP_LOGD(TAG, "View built successfully.");
+  TK_LOGD(TAG, "View built successfully.");
 
   return main_view;
 }
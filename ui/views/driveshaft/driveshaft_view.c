@@ -8,12 +8,16 @@
  *
  */
 
-#include "esp_log.h"
+#include "diag/tk_log.h"
+#include "ui/assets/assets.h"
+#include "ui/fonts/glyph_cache.h"
 #include "ui/views.h"
+#include "ui/widgets/tk_gauge.h"
 
 #include <stdio.h>
 
 #define TAG "Driveshaft view"
+#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_UI
 
 /**
  * @brief Pushes new data to the widgets when they receive a refresh event.
@@ -28,26 +32,29 @@ static void refresh_cb(lv_obj_t *obj, lv_event_t event) {
   // Left arc
   if (obj == arc_l) {
     if (global_datastore.location_data.speed_available &&
-        global_datastore.location_data.speed > 2.5) {
-      ESP_LOGV(TAG,
-               "Received a refresh event for left arc, value is %.2f km/h.",
-               global_datastore.location_data.speed);
-      lv_arc_set_value(obj, (int)(global_datastore.location_data.speed * 10));
+        global_datastore.location_data.speed > 2.5f) {
+      TK_LOGV(TAG,
+              "Received a refresh event for left arc, value is %.2f km/h.",
+              global_datastore.location_data.speed);
+      tk_gauge_set_value(obj,
+                         (int)(global_datastore.location_data.speed * 10.0f));
     } else {
-      lv_arc_set_value(obj, 0);
+      tk_gauge_set_value(obj, 0);
     }
   }
   // Left arc's value label
   else if (obj == arc_l_big_label) {
     if (global_datastore.location_data.speed_available &&
-        global_datastore.location_data.speed > 2.5) {
+        global_datastore.location_data.speed > 2.5f) {
+      // Integer tenths, as on the main view
+      int speed_x10 = global_datastore.location_data.speed * 10.0f + 0.5f;
       char val[10];
-      snprintf(val, 10, "%.1f", global_datastore.location_data.speed);
+      snprintf(val, 10, "%d.%d", speed_x10 / 10, speed_x10 % 10);
       lv_label_set_text(obj, val);
 
-      ESP_LOGV(TAG,
-               "Received a refresh event for right arc label, content is %s.",
-               val);
+      TK_LOGV(TAG,
+              "Received a refresh event for right arc label, content is %s.",
+              val);
     } else {
       lv_label_set_text(obj, "---");
     }
@@ -85,6 +92,12 @@ tk_view_t build_driveshaft_view() {
   lv_obj_t *view_content = lv_cont_create(NULL, NULL);
   lv_obj_add_style(view_content, LV_CONT_PART_MAIN, &tk_style_far_background);
 
+  // The readouts draw from cached glyphs, the same wrappers as the theme's
+  const lv_font_t *readout_title =
+      tk_glyph_cache_wrap(tk_font(TK_FONT_TITLE), TK_GLYPH_CACHE_NUMERIC);
+  const lv_font_t *readout_subtitle =
+      tk_glyph_cache_wrap(tk_font(TK_FONT_SUBTITLE), TK_GLYPH_CACHE_NUMERIC);
+
   // Arcs
   lv_obj_t *dashboard_container = lv_cont_create(view_content, NULL);
   lv_obj_add_style(dashboard_container, LV_CONT_PART_MAIN,
@@ -97,16 +110,14 @@ tk_view_t build_driveshaft_view() {
                                  LV_STATE_DEFAULT, 0);
 
   // Left arc
-  arc_l = lv_arc_create(dashboard_container, NULL);
-  lv_obj_add_style(arc_l, LV_CONT_PART_MAIN, &tk_style_no_background_borders);
-  lv_arc_set_bg_angles(arc_l, 60, 300);
-  lv_arc_set_angles(arc_l, 60, 300);
-  lv_arc_set_range(arc_l, 0, 2500);
-  lv_arc_set_rotation(arc_l, 90);
-  lv_arc_set_value(arc_l, 0);
-  lv_arc_set_adjustable(arc_l, false);
+  arc_l = tk_gauge_create(dashboard_container);
+  lv_obj_add_style(arc_l, TK_GAUGE_PART_BG, &tk_style_no_background_borders);
+  tk_gauge_set_range(arc_l, 0, 2500);
+  tk_gauge_set_angles(arc_l, 150, 240);
+  tk_gauge_set_value(arc_l, 0);
   lv_obj_set_size(arc_l, 200, 200);
-  lv_obj_set_style_local_pad_all(arc_l, LV_ARC_PART_BG, LV_STATE_DEFAULT, 0);
+  lv_obj_set_style_local_pad_all(arc_l, TK_GAUGE_PART_BG, LV_STATE_DEFAULT,
+                                 0);
   lv_obj_set_event_cb(arc_l, refresh_cb);
 
   // Container
@@ -120,7 +131,7 @@ tk_view_t build_driveshaft_view() {
   arc_l_big_label = lv_label_create(arc_l_inner_cont, NULL);
   lv_obj_set_style_local_text_font(arc_l_big_label, LV_LABEL_PART_MAIN,
                                    LV_STATE_DEFAULT,
-                                   LV_THEME_DEFAULT_FONT_TITLE);
+                                   readout_title);
   lv_label_set_text(arc_l_big_label, "---");
   lv_obj_align(arc_l_big_label, arc_l_inner_cont, LV_ALIGN_IN_TOP_MID, 0, 8);
   lv_obj_set_event_cb(arc_l_big_label, refresh_cb);
@@ -128,7 +139,7 @@ tk_view_t build_driveshaft_view() {
   lv_obj_t *arc_l_small_label = lv_label_create(arc_l_inner_cont, NULL);
   lv_obj_set_style_local_text_font(arc_l_small_label, LV_LABEL_PART_MAIN,
                                    LV_STATE_DEFAULT,
-                                   LV_THEME_DEFAULT_FONT_SUBTITLE);
+                                   readout_subtitle);
   lv_obj_set_style_local_text_color(arc_l_small_label, LV_LABEL_PART_MAIN,
                                     LV_STATE_DEFAULT, TK_COLOR_GREY_DARK);
   lv_label_set_text(arc_l_small_label, "rpm");
@@ -154,7 +165,7 @@ tk_view_t build_driveshaft_view() {
                          .bottom_bar_configuration = bb_conf,
                          .top_bar_configuration = tb_conf};
 
-  ESP_LOGD(TAG, "View built successfully.");
+  TK_LOGD(TAG, "View built successfully.");
 
   return main_view;
 }
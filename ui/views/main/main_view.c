@@ -9,14 +9,19 @@
  */
 
 #include "model/datastore.h"
+#include "ui/anim/anim.h"
+#include "ui/assets/assets.h"
+#include "ui/fonts/glyph_cache.h"
 #include "ui/views.h"
+#include "ui/widgets/tk_gauge.h"
 
-#include "esp_log.h"
+#include "diag/tk_log.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 
 #define TAG "Main view"
+#define TK_LOG_LEVEL CONFIG_TK_LOG_LEVEL_UI
 
 // Updatable widgets:
 static lv_obj_t *arc_l;
@@ -35,35 +40,36 @@ static lv_obj_t *arc_r_big_label;
  * @param event The event that the widget received.
  */
 static void refresh_cb(lv_obj_t *obj, lv_event_t event) {
+  // Not compared to arc_l and arc_r: a new main view is built before the old
+  // one is deleted
+  if (event == LV_EVENT_DELETE)
+    tk_anim_unbind_gauge(obj);
+
   if (event != LV_EVENT_REFRESH)
     return;
 
-  // TODO: Variable arc maximum stored in nvs
   // TODO: Implement kph/mph in nvs
 
-  // Left arc
+  // Left arc, moved by the animator between samples
   if (obj == arc_l) {
-    if (global_datastore.location_data.speed_available &&
-        global_datastore.location_data.speed > 2.5) {
-      ESP_LOGV(TAG,
-               "Received a refresh event for left arc, value is %.2f km/h.",
-               global_datastore.location_data.speed);
-      lv_arc_set_value(obj, (int)(global_datastore.location_data.speed * 10));
-    } else {
-      lv_arc_set_value(obj, 0);
-    }
+    // The maximum may change once the settings are loaded
+    tk_gauge_set_range(obj, 0,
+                       global_datastore.dashboard_settings.speed_max * 10);
+    tk_anim_wake();
   }
   // Left arc's value label
   else if (obj == arc_l_big_label) {
     if (global_datastore.location_data.speed_available &&
-        global_datastore.location_data.speed > 2.5) {
+        global_datastore.location_data.speed > 2.5f) {
+      // Tenths in integers, printf would convert to double
+      int speed_x10 = global_datastore.location_data.speed * 10.0f + 0.5f;
       char val[10];
-      snprintf(val, 10, "%.1f", global_datastore.location_data.speed);
+      snprintf(val, 10, "%d.%d", speed_x10 / 10, speed_x10 % 10);
       lv_label_set_text(obj, val);
 
-      ESP_LOGV(TAG,
-               "Received a refresh event for right arc label, content is %s.",
-               val);
+      TK_LOGV(TAG,
+              "Received a refresh event for right arc label, content is %s.",
+              val);
     } else {
       lv_label_set_text(obj, "---");
     }
@@ -71,19 +77,13 @@ static void refresh_cb(lv_obj_t *obj, lv_event_t event) {
   }
   // Left arc's unit label
   else if (obj == arc_l_small_label) {
-    // ESP_LOGV(TAG, "Received a refresh event for left unit label, unit is "
-    //              "[km/h - MPH].");
+    // TK_LOGV(TAG, "Received a refresh event for left unit label, unit is "
+    //             "[km/h - MPH].");
   }
   // Right arc
   else if (obj == arc_r) {
-    if (global_datastore.engine_data.rpm_available) {
-      ESP_LOGV(TAG,
-               "Received a refresh event for right arc, value is %.2f RPM.",
-               global_datastore.engine_data.rpm);
-      lv_arc_set_value(obj, (int)global_datastore.engine_data.rpm);
-    } else {
-      lv_arc_set_value(obj, 0);
-    }
+    tk_gauge_set_range(obj, 0, global_datastore.dashboard_settings.rpm_max);
+    tk_anim_wake();
   }
   // Right arc's value label
   else if (obj == arc_r_big_label) {
@@ -91,9 +91,9 @@ static void refresh_cb(lv_obj_t *obj, lv_event_t event) {
       char val[5];
       itoa((int)global_datastore.engine_data.rpm, val, 10);
       lv_label_set_text(obj, val);
-      ESP_LOGV(TAG,
-               "Received a refresh event for right arc label, content is %s.",
-               val);
+      TK_LOGV(TAG,
+              "Received a refresh event for right arc label, content is %s.",
+              val);
     } else {
 
       lv_label_set_text(obj, "---");
@@ -111,6 +111,15 @@ static void right_button_click_callback() {
   view_navigate(build_driveshaft_view, true);
 }
 
+/**
+ * @brief The diagnostics button click callback.
+ *
+ */
+static void diagnostics_button_click_callback() {
+  TK_LOGD(TAG, "Diagnostics button clicked. Navigating to metrics view.");
+  view_navigate(build_metrics_view, true);
+}
+
 /**
  * @brief The bottom bar's left button click callback.
  *
@@ -136,6 +145,12 @@ tk_view_t build_main_view() {
   // Compass
   // TODO: Compass builder.
 
+  // The readouts draw from cached glyphs, the same wrappers as the theme's
+  const lv_font_t *readout_title =
+      tk_glyph_cache_wrap(tk_font(TK_FONT_TITLE), TK_GLYPH_CACHE_NUMERIC);
+  const lv_font_t *readout_subtitle =
+      tk_glyph_cache_wrap(tk_font(TK_FONT_SUBTITLE), TK_GLYPH_CACHE_NUMERIC);
+
   // Arcs
   lv_obj_t *dashboard_container = lv_cont_create(view_content, NULL);
   lv_obj_add_style(dashboard_container, LV_CONT_PART_MAIN,
@@ -148,17 +163,20 @@ tk_view_t build_main_view() {
                                  LV_STATE_DEFAULT, 0);
 
   // Left arc
-  arc_l = lv_arc_create(dashboard_container, NULL);
-  lv_obj_add_style(arc_l, LV_CONT_PART_MAIN, &tk_style_no_background_borders);
-  lv_arc_set_bg_angles(arc_l, 60, 300);
-  lv_arc_set_angles(arc_l, 60, 300);
-  lv_arc_set_range(arc_l, 0, 1000); // km/h * 10
-  lv_arc_set_rotation(arc_l, 90);
-  lv_arc_set_value(arc_l, 0);
-  lv_arc_set_adjustable(arc_l, false);
+  arc_l = tk_gauge_create(dashboard_container);
+  lv_obj_add_style(arc_l, TK_GAUGE_PART_BG, &tk_style_no_background_borders);
+  tk_gauge_set_range(arc_l, 0,
+                     global_datastore.dashboard_settings.speed_max *
+                         10); // km/h * 10
+  tk_gauge_set_angles(arc_l, 150, 240);
+  tk_gauge_set_value(arc_l, 0);
   lv_obj_set_size(arc_l, 200, 200);
-  lv_obj_set_style_local_pad_all(arc_l, LV_ARC_PART_BG, LV_STATE_DEFAULT, 0);
+  lv_obj_set_style_local_pad_all(arc_l, TK_GAUGE_PART_BG, LV_STATE_DEFAULT,
+                                 0);
   lv_obj_set_event_cb(arc_l, refresh_cb);
+  tk_anim_bind_gauge(arc_l, TK_MODEL_SAMPLE_SPEED_KPH,
+                     &global_datastore.location_data.speed_available, 2.5f,
+                     10.0f);
 
   // Container
   lv_obj_t *arc_l_inner_cont = lv_cont_create(arc_l, NULL);
@@ -171,7 +189,7 @@ tk_view_t build_main_view() {
   arc_l_big_label = lv_label_create(arc_l_inner_cont, NULL);
   lv_obj_set_style_local_text_font(arc_l_big_label, LV_LABEL_PART_MAIN,
                                    LV_STATE_DEFAULT,
-                                   LV_THEME_DEFAULT_FONT_TITLE);
+                                   readout_title);
   lv_label_set_text(arc_l_big_label, "---");
   lv_obj_align(arc_l_big_label, arc_l_inner_cont, LV_ALIGN_IN_TOP_MID, 0, 8);
   lv_obj_set_event_cb(arc_l_big_label, refresh_cb);
@@ -179,7 +197,7 @@ tk_view_t build_main_view() {
   arc_l_small_label = lv_label_create(arc_l_inner_cont, NULL);
   lv_obj_set_style_local_text_font(arc_l_small_label, LV_LABEL_PART_MAIN,
                                    LV_STATE_DEFAULT,
-                                   LV_THEME_DEFAULT_FONT_SUBTITLE);
+                                   readout_subtitle);
   lv_obj_set_style_local_text_color(arc_l_small_label, LV_LABEL_PART_MAIN,
                                     LV_STATE_DEFAULT, TK_COLOR_GREY_DARK);
   lv_label_set_text(arc_l_small_label, "km/h");
@@ -188,17 +206,17 @@ tk_view_t build_main_view() {
   lv_obj_set_event_cb(arc_l_small_label, refresh_cb);
 
   // Right arc
-  arc_r = lv_arc_create(dashboard_container, NULL);
-  lv_obj_add_style(arc_r, LV_CONT_PART_MAIN, &tk_style_no_background_borders);
-  lv_arc_set_bg_angles(arc_r, 60, 300);
-  lv_arc_set_angles(arc_r, 60, 300);
-  lv_arc_set_range(arc_r, 0, 2500);
-  lv_arc_set_rotation(arc_r, 90);
-  lv_arc_set_value(arc_r, 0);
-  lv_arc_set_adjustable(arc_l, false);
+  arc_r = tk_gauge_create(dashboard_container);
+  lv_obj_add_style(arc_r, TK_GAUGE_PART_BG, &tk_style_no_background_borders);
+  tk_gauge_set_range(arc_r, 0, global_datastore.dashboard_settings.rpm_max);
+  tk_gauge_set_angles(arc_r, 150, 240);
+  tk_gauge_set_value(arc_r, 0);
   lv_obj_set_size(arc_r, 200, 200);
-  lv_obj_set_style_local_pad_all(arc_r, LV_ARC_PART_BG, LV_STATE_DEFAULT, 0);
+  lv_obj_set_style_local_pad_all(arc_r, TK_GAUGE_PART_BG, LV_STATE_DEFAULT,
+                                 0);
   lv_obj_set_event_cb(arc_r, refresh_cb);
+  tk_anim_bind_gauge(arc_r, TK_MODEL_SAMPLE_ENGINE_RPM,
+                     &global_datastore.engine_data.rpm_available, 0.0f, 1.0f);
 
   // Container
   lv_obj_t *arc_r_inner_cont = lv_cont_create(arc_r, NULL);
@@ -211,7 +229,7 @@ tk_view_t build_main_view() {
   arc_r_big_label = lv_label_create(arc_r_inner_cont, NULL);
   lv_obj_set_style_local_text_font(arc_r_big_label, LV_LABEL_PART_MAIN,
                                    LV_STATE_DEFAULT,
-                                   LV_THEME_DEFAULT_FONT_TITLE);
+                                   readout_title);
   lv_label_set_text(arc_r_big_label, "---");
   lv_obj_align(arc_r_big_label, arc_r_inner_cont, LV_ALIGN_IN_TOP_MID, 0, 8);
   lv_obj_set_event_cb(arc_r_big_label, refresh_cb);
@@ -219,7 +237,7 @@ tk_view_t build_main_view() {
   lv_obj_t *arc_r_small_label = lv_label_create(arc_r_inner_cont, NULL);
   lv_obj_set_style_local_text_font(arc_r_small_label, LV_LABEL_PART_MAIN,
                                    LV_STATE_DEFAULT,
-                                   LV_THEME_DEFAULT_FONT_SUBTITLE);
+                                   readout_subtitle);
   lv_obj_set_style_local_text_color(arc_r_small_label, LV_LABEL_PART_MAIN,
                                     LV_STATE_DEFAULT, TK_COLOR_GREY_DARK);
   lv_label_set_text(arc_r_small_label, "rpm");
@@ -235,13 +253,18 @@ tk_view_t build_main_view() {
   tk_bottom_bar_button_t left_bar_button = {
       .text = "Luminosità", .click_callback = left_button_click_callback};
 
-  tk_bottom_bar_configuration_t bb_conf = {.left_button = left_bar_button};
+  tk_bottom_bar_button_t diagnostics_bar_button = {
+      .text = "Diagnostica",
+      .click_callback = diagnostics_button_click_callback};
+
+  tk_bottom_bar_configuration_t bb_conf = {
+      .left_button = left_bar_button, .right_button = diagnostics_bar_button};
 
   // Return struct
   tk_view_t main_view = {.content = view_content,
                          .bottom_bar_configuration = bb_conf};
 
-  ESP_LOGD(TAG, "View built successfully.");
+  TK_LOGD(TAG, "View built successfully.");
 
   return main_view;
 }
@@ -0,0 +1,173 @@
+/**
+ * @file metrics_view.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief The diagnostics view builder.
+ * @version 0.1
+ * @date 2021-02-17
+ *
+ *
+ */
+
+#include "diag/sampler.h"
+#include "ui/assets/assets.h"
+#include "ui/views.h"
+
+#include "esp_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "Metrics view"
+
+// Updatable widgets
+static lv_obj_t *summary_label;
+static lv_obj_t *task_table;
+
+static tk_top_bar_configuration_t tb_conf;
+
+// Last sample shown, the refresh signal is much faster than the sampler
+static uint32_t shown_seq;
+
+/**
+ * @brief Fills the widgets from a sample.
+ *
+ * @param sample The sample.
+ */
+static void show_sample(const tk_sample_t *sample) {
+  char text[32];
+
+  lv_label_set_text_fmt(summary_label,
+                        "Heap: %u kB liberi, minimo %u kB, blocco %u kB\n"
+                        "LVGL: %u/%u kB liberi, max %u kB, fram. %u%%",
+                        sample->heap_free / 1024, sample->heap_min_free / 1024,
+                        sample->heap_largest_block / 1024,
+                        sample->lv_mem_free / 1024, sample->lv_mem_total / 1024,
+                        sample->lv_mem_max_used / 1024,
+                        sample->lv_mem_frag_pct);
+
+  lv_table_set_row_cnt(task_table, sample->tasks_count + 1);
+
+  for (int i = 0; i < sample->tasks_count; i++) {
+    const tk_sampler_task_t *task = &sample->tasks[i];
+    uint16_t row = i + 1;
+
+    lv_table_set_cell_value(task_table, row, 0, task->name);
+
+    if (task->core >= 0)
+      snprintf(text, sizeof text, "%d", task->core);
+    else
+      strcpy(text, "-");
+    lv_table_set_cell_value(task_table, row, 1, text);
+
+    if (task->cpu_permille >= 0)
+      snprintf(text, sizeof text, "%d.%d%%", task->cpu_permille / 10,
+               task->cpu_permille % 10);
+    else
+      strcpy(text, "-");
+    lv_table_set_cell_value(task_table, row, 2, text);
+
+    snprintf(text, sizeof text, "%u", task->stack_free_min);
+    lv_table_set_cell_value(task_table, row, 3, text);
+  }
+}
+
+/**
+ * @brief Pushes new data to the widgets when they receive a refresh event.
+ *
+ * @param obj The widget that called this callback function.
+ * @param event The event that the widget received.
+ */
+static void refresh_cb(lv_obj_t *obj, lv_event_t event) {
+  if (event != LV_EVENT_REFRESH || obj != task_table)
+    return;
+
+  tk_sample_t *sample = malloc(sizeof *sample);
+  if (sample == NULL)
+    return;
+
+  tk_sampler_get(sample);
+  if (sample->seq != 0 && sample->seq != shown_seq) {
+    shown_seq = sample->seq;
+    show_sample(sample);
+  }
+
+  free(sample);
+}
+
+/**
+ * @brief The bottom bar's left button click callback.
+ *
+ */
+static void left_button_click_callback() {
+  ESP_LOGI(TAG, "Left button pressed.");
+  view_navigate_back();
+}
+
+/**
+ * @brief The diagnostics view generator.
+ *
+ * @return tk_view_t The generated view.
+ */
+tk_view_t build_metrics_view() {
+
+  ESP_LOGI(TAG, "Building view.");
+
+  shown_seq = 0;
+
+  // Content
+  lv_obj_t *view_content = lv_cont_create(NULL, NULL);
+  lv_obj_add_style(view_content, LV_CONT_PART_MAIN, &tk_style_far_background);
+
+  // Scrolled with the encoder
+  lv_obj_t *page = lv_page_create(view_content, NULL);
+  lv_obj_add_style(page, LV_PAGE_PART_BG, &tk_style_far_background);
+  lv_obj_set_size(page, 480, 320 - 2 * 36);
+  lv_obj_align(page, NULL, LV_ALIGN_CENTER, 0, 0);
+  lv_page_set_scrl_layout(page, LV_LAYOUT_COLUMN_LEFT);
+
+  summary_label = lv_label_create(page, NULL);
+  lv_label_set_text(summary_label, "In attesa del primo campione...");
+
+  task_table = lv_table_create(page, NULL);
+  lv_obj_set_style_local_text_font(task_table, LV_TABLE_PART_BG,
+                                   LV_STATE_DEFAULT,
+                                   tk_font(TK_FONT_SMALL));
+  lv_obj_set_style_local_pad_ver(task_table, LV_TABLE_PART_CELL1,
+                                 LV_STATE_DEFAULT, 4);
+  lv_table_set_col_cnt(task_table, 4);
+  lv_table_set_row_cnt(task_table, 1);
+  lv_table_set_col_width(task_table, 0, 180);
+  lv_table_set_col_width(task_table, 1, 70);
+  lv_table_set_col_width(task_table, 2, 90);
+  lv_table_set_col_width(task_table, 3, 100);
+  lv_table_set_cell_value(task_table, 0, 0, "Task");
+  lv_table_set_cell_value(task_table, 0, 1, "Core");
+  lv_table_set_cell_value(task_table, 0, 2, "CPU");
+  lv_table_set_cell_value(task_table, 0, 3, "Stack");
+  lv_obj_set_event_cb(task_table, refresh_cb);
+
+  // Group (for encoder)
+  lv_group_t *group = lv_group_create();
+  lv_group_add_obj(group, page);
+  lv_group_set_editing(group, true);
+  lv_indev_set_group(encoder_indev, group);
+
+  // Bottom bar configuration
+  tk_bottom_bar_button_t left_bar_button = {
+      .text = LV_SYMBOL_LEFT "   Indietro",
+      .click_callback = left_button_click_callback};
+
+  tk_bottom_bar_configuration_t bb_conf = {.left_button = left_bar_button};
+
+  tb_conf.title = "Diagnostica";
+
+  // Return struct
+  tk_view_t main_view = {.content = view_content,
+                         .bottom_bar_configuration = bb_conf,
+                         .top_bar_configuration = tb_conf};
+
+  ESP_LOGD(TAG, "View built successfully.");
+
+  return main_view;
+}
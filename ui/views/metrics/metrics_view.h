@@ -0,0 +1,21 @@
+/**
+ * @file metrics_view.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief The diagnostics view generator.
+ * @version 0.1
+ * @date 2021-02-17
+ * 
+ * 
+ */
+
+#pragma once
+
+#include "ui/tk_view.h"
+
+/**
+ * @brief The diagnostics view generator: tasks, heap and LVGL memory from the
+ * last system sample.
+ * 
+ * @return tk_view_t The generated view.
+ */
+tk_view_t build_metrics_view();
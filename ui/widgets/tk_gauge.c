@@ -0,0 +1,564 @@
+/**
+ * @file tk_gauge.c
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Arc gauge drawn from a cached ring mask.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ *
+ */
+
+#include "ui/widgets/tk_gauge.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "diag/metrics.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "Gauge"
+
+#define TK_GAUGE_DEG_TO_RAD 0.0174532925f
+
+typedef struct {
+  uint16_t refs;
+
+  // Key
+  lv_coord_t diameter;
+  lv_coord_t width;
+  int16_t start;
+  int16_t sweep;
+
+  lv_img_dsc_t img;
+} tk_gauge_mask_t;
+
+typedef struct {
+  // The base object has no extended data, nothing to include first
+  int16_t min;
+  int16_t max;
+  int16_t value;
+  int16_t start;
+  int16_t sweep;
+
+  lv_style_list_t style_indic;
+  lv_style_list_t style_knob;
+
+  tk_gauge_mask_t *bg_mask;
+  tk_gauge_mask_t *indic_mask;
+} tk_gauge_ext_t;
+
+static tk_metric_t mask_renders_metric = TK_METRIC_COUNTER(
+    "tk_gauge_mask_renders_total", "Gauge ring masks rasterized.");
+
+static tk_metric_t mask_render_metric =
+    TK_METRIC_HISTOGRAM("tk_gauge_mask_render_ms",
+                        "Time to rasterize a gauge ring mask.", 5, 10, 20, 50,
+                        100, 200);
+
+static tk_gauge_mask_t masks[TK_GAUGE_MASKS];
+
+static lv_signal_cb_t ancestor_signal = NULL;
+static lv_design_cb_t ancestor_design = NULL;
+
+static inline float tk_gauge_clamp01(float x) {
+  return x < 0 ? 0 : (x > 1 ? 1 : x);
+}
+
+/**
+ * @brief Coverage of a pixel center by the ring, with rounded ends.
+ *
+ */
+static float tk_gauge_coverage(const tk_gauge_mask_t *mask, float dx,
+                               float dy) {
+  float outer = mask->diameter / 2.0f;
+  float half_width = mask->width / 2.0f;
+  float r = sqrtf(dx * dx + dy * dy);
+
+  float coverage = fminf(tk_gauge_clamp01(outer - r + 0.5f),
+                         tk_gauge_clamp01(r - (outer - mask->width) + 0.5f));
+  if (coverage <= 0 || mask->sweep >= 360)
+    return coverage;
+
+  // Angular distance to the ends, in pixels along the circle
+  float angle = atan2f(dy, dx) / TK_GAUGE_DEG_TO_RAD;
+  float rel = fmodf(angle - mask->start + 720.0f, 360.0f);
+  float to_edge;
+  if (rel <= mask->sweep)
+    to_edge = fminf(rel, mask->sweep - rel);
+  else
+    to_edge = -fminf(rel - mask->sweep, 360.0f - rel);
+  coverage = fminf(coverage, tk_gauge_clamp01(to_edge * TK_GAUGE_DEG_TO_RAD *
+                                                  r +
+                                              0.5f));
+
+  // Round ends, as lvgl draws them
+  float middle = outer - half_width;
+  for (int end = 0; end < 2; end++) {
+    float end_angle =
+        (mask->start + (end ? mask->sweep : 0)) * TK_GAUGE_DEG_TO_RAD;
+    float ex = dx - middle * cosf(end_angle);
+    float ey = dy - middle * sinf(end_angle);
+    coverage = fmaxf(coverage, tk_gauge_clamp01(half_width -
+                                                sqrtf(ex * ex + ey * ey) +
+                                                0.5f));
+  }
+
+  return coverage;
+}
+
+/**
+ * @brief Rasterizes the ring into the mask image, once per geometry.
+ *
+ */
+static bool tk_gauge_mask_render(tk_gauge_mask_t *mask) {
+  int64_t start = esp_timer_get_time();
+
+  uint32_t size = lv_img_buf_get_img_size(mask->diameter, mask->diameter,
+                                          LV_IMG_CF_ALPHA_4BIT);
+  uint8_t *data = calloc(1, size);
+  if (data == NULL) {
+    ESP_LOGE(TAG, "No memory for a %d px ring mask.", mask->diameter);
+    return false;
+  }
+
+  mask->img.header.always_zero = 0;
+  mask->img.header.cf = LV_IMG_CF_ALPHA_4BIT;
+  mask->img.header.w = mask->diameter;
+  mask->img.header.h = mask->diameter;
+  mask->img.data_size = size;
+  mask->img.data = data;
+
+  float center = mask->diameter / 2.0f;
+  float inner = center - mask->width - 1;
+  for (lv_coord_t y = 0; y < mask->diameter; y++) {
+    float dy = y + 0.5f - center;
+    for (lv_coord_t x = 0; x < mask->diameter; x++) {
+      float dx = x + 0.5f - center;
+
+      // Most of the square is the hole, skipped before any trigonometry
+      if (inner > 0 && dx * dx + dy * dy < inner * inner)
+        continue;
+
+      float coverage = tk_gauge_coverage(mask, dx, dy);
+      if (coverage > 0)
+        lv_img_buf_set_px_alpha(&mask->img, x, y,
+                                (lv_opa_t)(coverage * LV_OPA_COVER));
+    }
+  }
+
+  int32_t elapsed_ms = (esp_timer_get_time() - start) / 1000;
+  tk_metric_inc(&mask_renders_metric);
+  tk_metric_observe(&mask_render_metric, elapsed_ms);
+  ESP_LOGD(TAG, "Rendered a %d px ring mask in %d ms.", mask->diameter,
+           elapsed_ms);
+  return true;
+}
+
+/**
+ * @brief A shared mask for a geometry, rendered if no gauge has it.
+ *
+ * @return tk_gauge_mask_t* The mask, NULL if all are in use or without memory.
+ */
+static tk_gauge_mask_t *tk_gauge_mask_acquire(lv_coord_t diameter,
+                                              lv_coord_t width, int16_t start,
+                                              int16_t sweep) {
+  tk_gauge_mask_t *slot = NULL;
+
+  for (int i = 0; i < TK_GAUGE_MASKS; i++) {
+    tk_gauge_mask_t *mask = &masks[i];
+    if (mask->img.data != NULL && mask->diameter == diameter &&
+        mask->width == width && mask->start == start &&
+        mask->sweep == sweep) {
+      mask->refs++;
+      return mask;
+    }
+
+    // Unused renders are kept for as long as there are empty slots
+    if (mask->refs == 0 && (slot == NULL || slot->img.data != NULL))
+      slot = mask;
+  }
+
+  if (slot == NULL) {
+    ESP_LOGW(TAG, "All %d ring masks are in use.", TK_GAUGE_MASKS);
+    return NULL;
+  }
+
+  free((void *)slot->img.data);
+  slot->img.data = NULL;
+  slot->diameter = diameter;
+  slot->width = width;
+  slot->start = start;
+  slot->sweep = sweep;
+  if (!tk_gauge_mask_render(slot))
+    return NULL;
+
+  slot->refs = 1;
+  return slot;
+}
+
+static void tk_gauge_mask_release(tk_gauge_mask_t *mask) {
+  if (mask != NULL && mask->refs > 0)
+    mask->refs--;
+}
+
+/**
+ * @brief The square the ring is drawn in, centered in the gauge.
+ *
+ */
+static void tk_gauge_ring_area(const lv_obj_t *gauge, lv_area_t *area) {
+  lv_coord_t w = lv_obj_get_width(gauge);
+  lv_coord_t h = lv_obj_get_height(gauge);
+  lv_coord_t pad = lv_obj_get_style_pad_left(gauge, TK_GAUGE_PART_BG);
+  lv_coord_t diameter = LV_MATH_MIN(w, h) - 2 * pad;
+
+  area->x1 = gauge->coords.x1 + (w - diameter) / 2;
+  area->y1 = gauge->coords.y1 + (h - diameter) / 2;
+  area->x2 = area->x1 + diameter - 1;
+  area->y2 = area->y1 + diameter - 1;
+}
+
+/**
+ * @brief The ring the gauge needs now, line widths clamped to the radius.
+ *
+ */
+static void tk_gauge_geometry(const lv_obj_t *gauge, lv_coord_t *diameter,
+                              lv_coord_t *bg_width, lv_coord_t *indic_width) {
+  lv_area_t ring;
+  tk_gauge_ring_area(gauge, &ring);
+  *diameter = lv_area_get_width(&ring);
+
+  lv_coord_t bg = lv_obj_get_style_line_width(gauge, TK_GAUGE_PART_BG);
+  lv_coord_t indic = lv_obj_get_style_line_width(gauge, TK_GAUGE_PART_INDIC);
+  *bg_width = LV_MATH_MIN(bg, *diameter / 2);
+  *indic_width = LV_MATH_MIN(indic, *diameter / 2);
+}
+
+static bool tk_gauge_mask_fits(const tk_gauge_mask_t *mask,
+                               const tk_gauge_ext_t *ext, lv_coord_t diameter,
+                               lv_coord_t width) {
+  return mask != NULL && mask->diameter == diameter && mask->width == width &&
+         mask->start == ext->start && mask->sweep == ext->sweep;
+}
+
+/**
+ * @brief Lets go of the masks if the size, line widths or angles changed.
+ * New ones are taken when drawing, so the steps of building a gauge do not
+ * each render one.
+ *
+ */
+static void tk_gauge_check_masks(lv_obj_t *gauge) {
+  tk_gauge_ext_t *ext = lv_obj_get_ext_attr(gauge);
+  lv_coord_t diameter, bg_width, indic_width;
+  tk_gauge_geometry(gauge, &diameter, &bg_width, &indic_width);
+
+  // Moved, or restyled with the same geometry
+  if (tk_gauge_mask_fits(ext->bg_mask, ext, diameter, bg_width) &&
+      tk_gauge_mask_fits(ext->indic_mask, ext, diameter, indic_width))
+    return;
+
+  // Released renders stay cached until their slot is needed
+  tk_gauge_mask_release(ext->bg_mask);
+  tk_gauge_mask_release(ext->indic_mask);
+  ext->bg_mask = NULL;
+  ext->indic_mask = NULL;
+  lv_obj_invalidate(gauge);
+}
+
+/**
+ * @brief Takes the masks for drawing, if not held already.
+ *
+ */
+static void tk_gauge_take_masks(lv_obj_t *gauge) {
+  tk_gauge_ext_t *ext = lv_obj_get_ext_attr(gauge);
+  lv_coord_t diameter, bg_width, indic_width;
+  tk_gauge_geometry(gauge, &diameter, &bg_width, &indic_width);
+
+  if (diameter <= 0)
+    return;
+  if (ext->bg_mask == NULL && bg_width > 0)
+    ext->bg_mask =
+        tk_gauge_mask_acquire(diameter, bg_width, ext->start, ext->sweep);
+  if (ext->indic_mask == NULL && indic_width > 0)
+    ext->indic_mask =
+        tk_gauge_mask_acquire(diameter, indic_width, ext->start, ext->sweep);
+}
+
+static float tk_gauge_value_angle(const tk_gauge_ext_t *ext, int16_t value) {
+  if (ext->max <= ext->min)
+    return ext->start;
+
+  return ext->start +
+         (float)ext->sweep * (value - ext->min) / (ext->max - ext->min);
+}
+
+/**
+ * @brief Invalidates the bounding box of the ring between two angles.
+ *
+ */
+static void tk_gauge_invalidate_sector(lv_obj_t *gauge, float from,
+                                       float to) {
+  tk_gauge_ext_t *ext = lv_obj_get_ext_attr(gauge);
+  if (ext->indic_mask == NULL) {
+    lv_obj_invalidate(gauge);
+    return;
+  }
+
+  if (from > to) {
+    float swap = from;
+    from = to;
+    to = swap;
+  }
+
+  lv_area_t ring;
+  tk_gauge_ring_area(gauge, &ring);
+  float cx = ring.x1 + ext->indic_mask->diameter / 2.0f;
+  float cy = ring.y1 + ext->indic_mask->diameter / 2.0f;
+  float outer = ext->indic_mask->diameter / 2.0f;
+  float inner = outer - ext->indic_mask->width;
+
+  float x_min = cx, x_max = cx, y_min = cy, y_max = cy;
+  bool first = true;
+
+#define TK_GAUGE_EXTEND(angle, radius)                                         \
+  do {                                                                         \
+    float px = cx + (radius)*cosf((angle)*TK_GAUGE_DEG_TO_RAD);                \
+    float py = cy + (radius)*sinf((angle)*TK_GAUGE_DEG_TO_RAD);                \
+    x_min = first || px < x_min ? px : x_min;                                  \
+    x_max = first || px > x_max ? px : x_max;                                  \
+    y_min = first || py < y_min ? py : y_min;                                  \
+    y_max = first || py > y_max ? py : y_max;                                  \
+    first = false;                                                             \
+  } while (0)
+
+  TK_GAUGE_EXTEND(from, outer);
+  TK_GAUGE_EXTEND(from, inner);
+  TK_GAUGE_EXTEND(to, outer);
+  TK_GAUGE_EXTEND(to, inner);
+
+  // The sector bulges out where it crosses an axis
+  for (int axis = ((int)ceilf(from / 90.0f)) * 90; axis < to; axis += 90)
+    TK_GAUGE_EXTEND(axis, outer);
+
+#undef TK_GAUGE_EXTEND
+
+  // The round end and antialiasing
+  lv_coord_t margin = ext->indic_mask->width / 2 + 2;
+  lv_area_t area = {.x1 = (lv_coord_t)floorf(x_min) - margin,
+                    .y1 = (lv_coord_t)floorf(y_min) - margin,
+                    .x2 = (lv_coord_t)ceilf(x_max) + margin,
+                    .y2 = (lv_coord_t)ceilf(y_max) + margin};
+  lv_obj_invalidate_area(gauge, &area);
+}
+
+/**
+ * @brief Draws the track, then the indicator up to the value.
+ *
+ */
+static void tk_gauge_draw(lv_obj_t *gauge, const lv_area_t *clip_area) {
+  tk_gauge_ext_t *ext = lv_obj_get_ext_attr(gauge);
+  tk_gauge_take_masks(gauge);
+
+  lv_area_t ring;
+  tk_gauge_ring_area(gauge, &ring);
+
+  lv_draw_img_dsc_t img_dsc;
+  lv_draw_img_dsc_init(&img_dsc);
+
+  // Alpha only images take their color from recolor
+  if (ext->bg_mask != NULL) {
+    img_dsc.recolor = lv_obj_get_style_line_color(gauge, TK_GAUGE_PART_BG);
+    img_dsc.opa = lv_obj_get_style_line_opa(gauge, TK_GAUGE_PART_BG);
+    if (img_dsc.opa > LV_OPA_MIN)
+      lv_draw_img(&ring, clip_area, &ext->bg_mask->img, &img_dsc);
+  }
+
+  if (ext->indic_mask == NULL || ext->value <= ext->min)
+    return;
+
+  img_dsc.recolor = lv_obj_get_style_line_color(gauge, TK_GAUGE_PART_INDIC);
+  img_dsc.opa = lv_obj_get_style_line_opa(gauge, TK_GAUGE_PART_INDIC);
+  if (img_dsc.opa <= LV_OPA_MIN)
+    return;
+
+  float end = tk_gauge_value_angle(ext, ext->value);
+  float outer = ext->indic_mask->diameter / 2.0f;
+  float half_width = ext->indic_mask->width / 2.0f;
+  float cx = ring.x1 + outer;
+  float cy = ring.y1 + outer;
+
+  // The mask starts before the ring does, to keep its round start, by at most
+  // half the gap so the far end stays out
+  int16_t lead = LV_MATH_MIN(90, (360 - ext->sweep) / 2);
+  int16_t mask_start = ((ext->start - lead) % 360 + 360) % 360;
+  int16_t mask_end = ((int16_t)ceilf(end) % 360 + 360) % 360;
+
+  lv_draw_mask_angle_param_t angle_param;
+  lv_draw_mask_angle_init(&angle_param, (lv_coord_t)cx, (lv_coord_t)cy,
+                          mask_start, mask_end);
+  int16_t mask_id = lv_draw_mask_add(&angle_param, NULL);
+  lv_draw_img(&ring, clip_area, &ext->indic_mask->img, &img_dsc);
+  lv_draw_mask_remove_id(mask_id);
+
+  // The round end at the value, the angle mask cuts it square
+  float middle = outer - half_width;
+  float ex = cx + middle * cosf(end * TK_GAUGE_DEG_TO_RAD);
+  float ey = cy + middle * sinf(end * TK_GAUGE_DEG_TO_RAD);
+  lv_area_t cap = {.x1 = (lv_coord_t)(ex - half_width + 0.5f),
+                   .y1 = (lv_coord_t)(ey - half_width + 0.5f)};
+  cap.x2 = cap.x1 + ext->indic_mask->width - 1;
+  cap.y2 = cap.y1 + ext->indic_mask->width - 1;
+
+  lv_draw_rect_dsc_t cap_dsc;
+  lv_draw_rect_dsc_init(&cap_dsc);
+  cap_dsc.radius = LV_RADIUS_CIRCLE;
+  cap_dsc.bg_color = img_dsc.recolor;
+  cap_dsc.bg_opa = img_dsc.opa;
+  lv_draw_rect(&cap, clip_area, &cap_dsc);
+}
+
+static lv_design_res_t tk_gauge_design(lv_obj_t *gauge,
+                                       const lv_area_t *clip_area,
+                                       lv_design_mode_t mode) {
+  if (mode == LV_DESIGN_COVER_CHK)
+    return LV_DESIGN_RES_NOT_COVER;
+
+  if (mode == LV_DESIGN_DRAW_MAIN) {
+    ancestor_design(gauge, clip_area, mode);
+    tk_gauge_draw(gauge, clip_area);
+  } else if (mode == LV_DESIGN_DRAW_POST) {
+    ancestor_design(gauge, clip_area, mode);
+  }
+
+  return LV_DESIGN_RES_OK;
+}
+
+static lv_style_list_t *tk_gauge_get_style(lv_obj_t *gauge, uint8_t part) {
+  tk_gauge_ext_t *ext = lv_obj_get_ext_attr(gauge);
+
+  switch (part) {
+  case TK_GAUGE_PART_BG:
+    return &gauge->style_list;
+  case TK_GAUGE_PART_INDIC:
+    return &ext->style_indic;
+  case TK_GAUGE_PART_KNOB:
+    // Never drawn, only there for the arc theme
+    return &ext->style_knob;
+  default:
+    return NULL;
+  }
+}
+
+static lv_res_t tk_gauge_signal(lv_obj_t *gauge, lv_signal_t sign,
+                                void *param) {
+  if (sign == LV_SIGNAL_GET_STYLE) {
+    lv_get_style_info_t *info = param;
+    info->result = tk_gauge_get_style(gauge, info->part);
+    if (info->result != NULL)
+      return LV_RES_OK;
+    return ancestor_signal(gauge, sign, param);
+  }
+
+  lv_res_t res = ancestor_signal(gauge, sign, param);
+  if (res != LV_RES_OK)
+    return res;
+
+  if (sign == LV_SIGNAL_GET_TYPE)
+    return lv_obj_handle_get_type_signal(param, "tk_gauge");
+
+  tk_gauge_ext_t *ext = lv_obj_get_ext_attr(gauge);
+  if (sign == LV_SIGNAL_CLEANUP) {
+    tk_gauge_mask_release(ext->bg_mask);
+    tk_gauge_mask_release(ext->indic_mask);
+    ext->bg_mask = NULL;
+    ext->indic_mask = NULL;
+    lv_obj_clean_style_list(gauge, TK_GAUGE_PART_INDIC);
+    lv_obj_clean_style_list(gauge, TK_GAUGE_PART_KNOB);
+  } else if (sign == LV_SIGNAL_COORD_CHG || sign == LV_SIGNAL_STYLE_CHG) {
+    tk_gauge_check_masks(gauge);
+  }
+
+  return res;
+}
+
+lv_obj_t *tk_gauge_create(lv_obj_t *parent) {
+  tk_metrics_register(&mask_renders_metric);
+  tk_metrics_register(&mask_render_metric);
+
+  lv_obj_t *gauge = lv_obj_create(parent, NULL);
+  if (gauge == NULL)
+    return NULL;
+
+  if (ancestor_signal == NULL)
+    ancestor_signal = lv_obj_get_signal_cb(gauge);
+  if (ancestor_design == NULL)
+    ancestor_design = lv_obj_get_design_cb(gauge);
+
+  tk_gauge_ext_t *ext = lv_obj_allocate_ext_attr(gauge, sizeof *ext);
+  if (ext == NULL) {
+    lv_obj_del(gauge);
+    return NULL;
+  }
+
+  ext->min = 0;
+  ext->max = 100;
+  ext->value = 0;
+  ext->start = 135;
+  ext->sweep = 270;
+  ext->bg_mask = NULL;
+  ext->indic_mask = NULL;
+  lv_style_list_init(&ext->style_indic);
+  lv_style_list_init(&ext->style_knob);
+
+  lv_obj_set_signal_cb(gauge, tk_gauge_signal);
+  lv_obj_set_design_cb(gauge, tk_gauge_design);
+  lv_obj_set_click(gauge, false);
+  lv_obj_set_size(gauge, LV_DPI * 2, LV_DPI * 2);
+  lv_theme_apply(gauge, LV_THEME_ARC);
+
+  return gauge;
+}
+
+void tk_gauge_set_angles(lv_obj_t *gauge, int16_t start, int16_t sweep) {
+  tk_gauge_ext_t *ext = lv_obj_get_ext_attr(gauge);
+
+  ext->start = (start % 360 + 360) % 360;
+  ext->sweep = LV_MATH_MIN(LV_MATH_MAX(sweep, 1), 360);
+  tk_gauge_check_masks(gauge);
+}
+
+void tk_gauge_set_range(lv_obj_t *gauge, int16_t min, int16_t max) {
+  tk_gauge_ext_t *ext = lv_obj_get_ext_attr(gauge);
+  if (ext->min == min && ext->max == max)
+    return;
+
+  ext->min = min;
+  ext->max = max;
+  ext->value = LV_MATH_MIN(LV_MATH_MAX(ext->value, min), max);
+  lv_obj_invalidate(gauge);
+}
+
+void tk_gauge_set_value(lv_obj_t *gauge, int16_t value) {
+  tk_gauge_ext_t *ext = lv_obj_get_ext_attr(gauge);
+
+  value = LV_MATH_MIN(LV_MATH_MAX(value, ext->min), ext->max);
+  if (value == ext->value)
+    return;
+
+  float from = tk_gauge_value_angle(ext, ext->value);
+  ext->value = value;
+  tk_gauge_invalidate_sector(gauge, from, tk_gauge_value_angle(ext, value));
+}
+
+int16_t tk_gauge_get_value(const lv_obj_t *gauge) {
+  return ((tk_gauge_ext_t *)lv_obj_get_ext_attr(gauge))->value;
+}
+
+int16_t tk_gauge_get_min_value(const lv_obj_t *gauge) {
+  return ((tk_gauge_ext_t *)lv_obj_get_ext_attr(gauge))->min;
+}
+
+int16_t tk_gauge_get_max_value(const lv_obj_t *gauge) {
+  return ((tk_gauge_ext_t *)lv_obj_get_ext_attr(gauge))->max;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file tk_gauge.h
+ * @author Riccardo Persello (riccardo.persello@icloud.com)
+ * @brief Arc gauge drawn from a cached ring mask.
+ * @version 0.1
+ * @date 2021-02-25
+ *
+ * Looks like an lv_arc with rounded ends, and takes the arc theme. The ring
+ * is rasterized once per size, line width and angles into a 4 bit alpha mask
+ * shared by every gauge with the same geometry, and colored at draw time, so
+ * a theme change costs nothing. Drawing is a blit of the mask for the track
+ * and a blit under an angle mask for the indicator, instead of the
+ * antialiased arc lvgl computes pixel by pixel. A new value invalidates only
+ * the bounding box of the sector between the old and the new angle.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "lvgl/lvgl.h"
+
+/**
+ * @brief Ring masks kept at most. Navigation holds the old and the new view.
+ *
+ */
+#define TK_GAUGE_MASKS 4
+
+/**
+ * @brief Parts, the same as lv_arc so the arc theme applies.
+ *
+ */
+enum {
+  TK_GAUGE_PART_BG = LV_OBJ_PART_MAIN,
+  TK_GAUGE_PART_INDIC,
+  TK_GAUGE_PART_KNOB,
+};
+
+/**
+ * @brief Creates a gauge, 0 to 100 over 270 degrees from the bottom left.
+ *
+ * @param parent The parent.
+ * @return lv_obj_t* The gauge, NULL without memory.
+ */
+lv_obj_t *tk_gauge_create(lv_obj_t *parent);
+
+/**
+ * @brief Sets where the ring starts and how far it goes.
+ *
+ * @param gauge The gauge.
+ * @param start Degrees clockwise from the right, as lvgl.
+ * @param sweep Degrees clockwise from start, up to 360.
+ */
+void tk_gauge_set_angles(lv_obj_t *gauge, int16_t start, int16_t sweep);
+
+/**
+ * @brief Sets the range, the value is clamped into it.
+ *
+ */
+void tk_gauge_set_range(lv_obj_t *gauge, int16_t min, int16_t max);
+
+/**
+ * @brief Sets the value, redrawing only the sector that changed.
+ *
+ */
+void tk_gauge_set_value(lv_obj_t *gauge, int16_t value);
+
+int16_t tk_gauge_get_value(const lv_obj_t *gauge);
+int16_t tk_gauge_get_min_value(const lv_obj_t *gauge);
+int16_t tk_gauge_get_max_value(const lv_obj_t *gauge);